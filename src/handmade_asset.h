@@ -0,0 +1,1188 @@
+#if !defined(HANDMADE_ASSET_H)
+
+/* NOTE: Assets from every .hha pack (see handmade_file_formats.h), loaded on
+   demand into a cache with a fixed budget. Needs handmade_memory.h first.
+
+   AllocateGameAssets opens the packs and merges their indexes: all the assets
+   of one type, from whichever pack, end up one contiguous range of asset
+   indices. The cache is one block carved out of the arena it is given,
+   normally the TransientStorage one, and never grows.
+
+     - LoadAsset queues the asset's read on Queue (LowPriorityQueue) and
+       returns immediately; the read lands straight in the cache.
+     - GetBitmap/GetSound/GetAssetData return 0 until the asset is in, and
+       mark it as just used.
+     - When a load doesn't fit, the least recently used assets are evicted
+       until it does. An asset last used in a generation that is still in
+       flight is never evicted: BeginGeneration/EndGeneration bracket work
+       (a frame's rendering, say) whose asset pointers have to stay good
+       until it is done. Assets fetched with generation 0 have no such
+       protection beyond the current call.
+     - PrefetchAsset says an asset will be wanted FramesUntilNeeded frames
+       from now, so its load can start before anything asks for it. See
+       RunAssetPrefetch for how the requests become reads.
+*/
+
+#define ASSET_MEMORY_ALIGNMENT HHA_DATA_ALIGNMENT
+#define MAX_IN_FLIGHT_GENERATIONS 16
+
+#define MAX_PREFETCH_REQUESTS 256
+// NOTE: How many of the most urgent requests are looked at each frame, and
+// how many coalesced reads can be in flight at once. The reads also bound
+// what the scheduler can have reserved on Queue.
+#define MAX_PREFETCH_BATCH 64
+#define MAX_PREFETCH_READS 32
+// NOTE: Assets closer together than this in a pack are read in one go, the
+// gap read and thrown away; no coalesced read spans more than the span.
+#define PREFETCH_MAX_GAP Kilobytes(16)
+#define PREFETCH_MAX_SPAN Megabytes(4)
+
+struct loaded_bitmap
+{
+    void *Memory;
+    s32 Width;
+    s32 Height;
+    s32 Pitch;
+    r32 AlignPercentage[2];
+};
+
+struct loaded_sound
+{
+    s16 *Samples;
+    u32 SampleCount;
+    u32 ChannelCount;
+};
+
+struct asset_vector
+{
+    r32 E[HHA_TAG_ID_COUNT];
+};
+
+enum asset_state
+{
+    AssetState_Unloaded,
+    AssetState_Queued,
+    AssetState_Loaded,
+};
+
+// NOTE: The cache is partitioned into blocks, in address order, each either
+// free or holding one asset: an asset_memory_block, an asset_memory_header,
+// then the asset's data, each starting on ASSET_MEMORY_ALIGNMENT.
+enum asset_memory_block_flags
+{
+    AssetMemory_Used = 0x1,
+};
+
+struct asset_memory_block
+{
+    asset_memory_block *Prev;
+    asset_memory_block *Next;
+    u32 Flags;
+    memory_index Size;
+};
+
+struct asset_memory_header
+{
+    // NOTE: The loaded-asset list, most recently used first.
+    asset_memory_header *Next;
+    asset_memory_header *Prev;
+
+    u32 AssetIndex;
+    u32 GenerationID;
+    memory_index DataSize;
+};
+
+struct asset_file
+{
+    platform_file_handle Handle;
+    hha_header Header;
+    hha_asset_type *AssetTypeArray;
+    u32 TagBase;
+};
+
+struct asset
+{
+    u32 volatile State;
+    asset_memory_header *Header;
+
+    hha_asset HHA;
+    asset_file *File;
+};
+
+struct asset_type
+{
+    u32 FirstAssetIndex;
+    u32 OnePastLastAssetIndex;
+};
+
+struct asset_prefetch_request
+{
+    u32 AssetIndex;
+    u32 Priority;
+    u32 NeededByFrame;
+};
+
+struct game_assets;
+struct asset_prefetch_read
+{
+    game_assets *Assets;
+    asset_file *File;
+
+    u32 AssetCount;
+    u32 AssetIndices[PLATFORM_MAX_READ_SEGMENTS];
+    u32 NeededByFrame[PLATFORM_MAX_READ_SEGMENTS];
+
+    asset_prefetch_read *NextFree;
+};
+
+struct game_assets
+{
+    platform_api *Platform;
+    platform_work_queue *Queue;
+
+    // NOTE: Guards the blocks, the loaded-asset list and the generations.
+    u32 volatile Lock;
+
+    memory_index Budget;
+    memory_index BytesInUse;
+    asset_memory_block MemorySentinel;
+    asset_memory_header LoadedAssetSentinel;
+
+    u32 NextGenerationID;
+    u32 InFlightGenerationCount;
+    u32 InFlightGenerations[MAX_IN_FLIGHT_GENERATIONS];
+
+    u32 FileCount;
+    asset_file *Files;
+
+    u32 TagCount;
+    hha_tag *Tags;
+
+    u32 AssetCount;
+    asset *Assets;
+
+    asset_type AssetTypes[HHA_TYPE_ID_COUNT];
+
+    u32 LoadCount;
+    u32 EvictionCount;
+    u32 NoRoomCount;
+
+    // NOTE: The prefetch requests are only touched by the game's own thread;
+    // the free reads are under Lock, since reads come back on Queue.
+    // FrameIndex is the frame whose RunAssetPrefetch ran last, advanced at
+    // the start of the run.
+    u32 volatile FrameIndex;
+    u32 PrefetchRequestCount;
+    asset_prefetch_request PrefetchRequests[MAX_PREFETCH_REQUESTS];
+    asset_prefetch_read *FirstFreePrefetchRead;
+    asset_prefetch_read PrefetchReads[MAX_PREFETCH_READS];
+
+    // NOTE: Hits and misses are GetAsset finding the asset in or not. A late
+    // load is a prefetch that landed after the frame it was needed by.
+    u32 HitCount;
+    u32 MissCount;
+    u32 PrefetchCount;
+    u32 PrefetchCancelCount;
+    u32 PrefetchReadCount;
+    u32 OnTimeLoadCount;
+    u32 LateLoadCount;
+};
+
+inline memory_index
+GetAssetBlockHeaderSize(void)
+{
+    memory_index Result = AlignPow2(sizeof(asset_memory_block), (memory_index)ASSET_MEMORY_ALIGNMENT);
+    return(Result);
+}
+
+inline memory_index
+GetAssetHeaderSize(void)
+{
+    memory_index Result = AlignPow2(sizeof(asset_memory_header), (memory_index)ASSET_MEMORY_ALIGNMENT);
+    return(Result);
+}
+
+inline void *
+GetAssetMemory(asset_memory_header *Header)
+{
+    void *Result = (u8 *)Header + GetAssetHeaderSize();
+    return(Result);
+}
+
+inline void
+BeginAssetLock(game_assets *Assets)
+{
+    while(AtomicCompareExchangeUInt32(&Assets->Lock, 1, 0) != 0)
+    {
+        _mm_pause();
+    }
+}
+
+inline void
+EndAssetLock(game_assets *Assets)
+{
+    CompletePreviousWritesBeforeFutureWrites;
+    Assets->Lock = 0;
+}
+
+inline void
+InsertAssetHeaderAtFront(game_assets *Assets, asset_memory_header *Header)
+{
+    asset_memory_header *Sentinel = &Assets->LoadedAssetSentinel;
+
+    Header->Prev = Sentinel;
+    Header->Next = Sentinel->Next;
+
+    Header->Next->Prev = Header;
+    Header->Prev->Next = Header;
+}
+
+inline void
+RemoveAssetHeaderFromList(asset_memory_header *Header)
+{
+    Header->Prev->Next = Header->Next;
+    Header->Next->Prev = Header->Prev;
+
+    Header->Next = Header->Prev = 0;
+}
+
+inline b32
+GenerationHasCompleted(game_assets *Assets, u32 CheckID)
+{
+    b32 Result = true;
+
+    for(u32 Index = 0;
+        Index < Assets->InFlightGenerationCount;
+        ++Index)
+    {
+        if(Assets->InFlightGenerations[Index] == CheckID)
+        {
+            Result = false;
+            break;
+        }
+    }
+
+    return(Result);
+}
+
+inline u32
+BeginGeneration(game_assets *Assets)
+{
+    // NOTE: Returns 0, which protects nothing, if too many are in flight.
+    u32 Result = 0;
+
+    BeginAssetLock(Assets);
+    Assert(Assets->InFlightGenerationCount < ArrayCount(Assets->InFlightGenerations));
+    if(Assets->InFlightGenerationCount < ArrayCount(Assets->InFlightGenerations))
+    {
+        Result = Assets->NextGenerationID++;
+        if(!Assets->NextGenerationID)
+        {
+            Assets->NextGenerationID = 1;
+        }
+        Assets->InFlightGenerations[Assets->InFlightGenerationCount++] = Result;
+    }
+    EndAssetLock(Assets);
+
+    return(Result);
+}
+
+inline void
+EndGeneration(game_assets *Assets, u32 GenerationID)
+{
+    BeginAssetLock(Assets);
+    for(u32 Index = 0;
+        Index < Assets->InFlightGenerationCount;
+        ++Index)
+    {
+        if(Assets->InFlightGenerations[Index] == GenerationID)
+        {
+            Assets->InFlightGenerations[Index] =
+                Assets->InFlightGenerations[--Assets->InFlightGenerationCount];
+            break;
+        }
+    }
+    EndAssetLock(Assets);
+}
+
+inline asset_memory_block *
+InsertAssetBlock(asset_memory_block *Prev, memory_index Size, void *Memory)
+{
+    Assert(Size > GetAssetBlockHeaderSize());
+
+    asset_memory_block *Block = (asset_memory_block *)Memory;
+    Block->Flags = 0;
+    Block->Size = Size - GetAssetBlockHeaderSize();
+    Block->Prev = Prev;
+    Block->Next = Prev->Next;
+    Block->Prev->Next = Block;
+    Block->Next->Prev = Block;
+
+    return(Block);
+}
+
+inline b32
+MergeIfPossible(game_assets *Assets, asset_memory_block *First, asset_memory_block *Second)
+{
+    b32 Result = false;
+
+    if((First != &Assets->MemorySentinel) &&
+       (Second != &Assets->MemorySentinel) &&
+       !(First->Flags & AssetMemory_Used) &&
+       !(Second->Flags & AssetMemory_Used))
+    {
+        Assert(((u8 *)First + GetAssetBlockHeaderSize() + First->Size) == (u8 *)Second);
+
+        Second->Next->Prev = Second->Prev;
+        Second->Prev->Next = Second->Next;
+
+        First->Size += GetAssetBlockHeaderSize() + Second->Size;
+
+        Result = true;
+    }
+
+    return(Result);
+}
+
+static asset_memory_block *
+FindBlockForSize(game_assets *Assets, memory_index Size)
+{
+    // TODO: Best match block!
+    asset_memory_block *Result = 0;
+
+    for(asset_memory_block *Block = Assets->MemorySentinel.Next;
+        Block != &Assets->MemorySentinel;
+        Block = Block->Next)
+    {
+        if(!(Block->Flags & AssetMemory_Used) &&
+           (Block->Size >= Size))
+        {
+            Result = Block;
+            break;
+        }
+    }
+
+    return(Result);
+}
+
+static asset_memory_block *
+ReleaseAssetMemory(game_assets *Assets, asset_memory_header *Header)
+{
+    // NOTE: Assets->Lock must be held. Returns the free block the asset's
+    // memory ended up in, merged with any free neighbours.
+    asset_memory_block *Block = (asset_memory_block *)((u8 *)Header - GetAssetBlockHeaderSize());
+    Block->Flags &= ~AssetMemory_Used;
+    Assets->BytesInUse -= GetAssetBlockHeaderSize() + Block->Size;
+
+    if(MergeIfPossible(Assets, Block->Prev, Block))
+    {
+        Block = Block->Prev;
+    }
+    MergeIfPossible(Assets, Block, Block->Next);
+
+    return(Block);
+}
+
+static asset_memory_header *
+AcquireAssetMemory(game_assets *Assets, memory_index DataSize, u32 AssetIndex)
+{
+    // NOTE: Evicts least recently used assets until a free block is big
+    // enough. Returns 0 if even evicting everything that can go wouldn't
+    // make room.
+    asset_memory_header *Result = 0;
+
+    memory_index Size = AlignPow2(GetAssetHeaderSize() + DataSize, (memory_index)ASSET_MEMORY_ALIGNMENT);
+
+    BeginAssetLock(Assets);
+
+    asset_memory_block *Block = FindBlockForSize(Assets, Size);
+    for(asset_memory_header *Header = Assets->LoadedAssetSentinel.Prev;
+        !Block && (Header != &Assets->LoadedAssetSentinel);
+        )
+    {
+        asset_memory_header *Prev = Header->Prev;
+
+        asset *Asset = Assets->Assets + Header->AssetIndex;
+        if((Asset->State == AssetState_Loaded) &&
+           GenerationHasCompleted(Assets, Header->GenerationID))
+        {
+            RemoveAssetHeaderFromList(Header);
+            Asset->Header = 0;
+            Asset->State = AssetState_Unloaded;
+            ++Assets->EvictionCount;
+
+            asset_memory_block *Freed = ReleaseAssetMemory(Assets, Header);
+            if(Freed->Size >= Size)
+            {
+                Block = Freed;
+            }
+        }
+
+        Header = Prev;
+    }
+
+    if(Block)
+    {
+        Block->Flags |= AssetMemory_Used;
+
+        // NOTE: Split off what's left, if it's big enough to hold anything.
+        memory_index Remaining = Block->Size - Size;
+        if(Remaining > (GetAssetBlockHeaderSize() + GetAssetHeaderSize()))
+        {
+            Block->Size = Size;
+            InsertAssetBlock(Block, Remaining, (u8 *)Block + GetAssetBlockHeaderSize() + Size);
+        }
+        Assets->BytesInUse += GetAssetBlockHeaderSize() + Block->Size;
+
+        Result = (asset_memory_header *)((u8 *)Block + GetAssetBlockHeaderSize());
+        Result->AssetIndex = AssetIndex;
+        Result->GenerationID = 0;
+        Result->DataSize = DataSize;
+        InsertAssetHeaderAtFront(Assets, Result);
+    }
+    else
+    {
+        ++Assets->NoRoomCount;
+    }
+
+    EndAssetLock(Assets);
+
+    return(Result);
+}
+
+static PLATFORM_WORK_QUEUE_CALLBACK(LoadAssetWorkComplete)
+{
+    asset *Asset = (asset *)Data;
+
+    // NOTE: A failed read leaves the asset loaded as all zeroes, rather than
+    // retried every frame.
+    if(!PlatformNoFileErrors(&Asset->File->Handle))
+    {
+        ZeroSize(Asset->Header->DataSize, GetAssetMemory(Asset->Header));
+    }
+
+    CompletePreviousWritesBeforeFutureWrites;
+    Asset->State = AssetState_Loaded;
+}
+
+static void
+LoadAsset(game_assets *Assets, u32 AssetIndex)
+{
+    if(AssetIndex && (AssetIndex < Assets->AssetCount))
+    {
+        asset *Asset = Assets->Assets + AssetIndex;
+        if(AtomicCompareExchangeUInt32(&Asset->State, AssetState_Queued, AssetState_Unloaded) ==
+           AssetState_Unloaded)
+        {
+            asset_memory_header *Header = AcquireAssetMemory(Assets, Asset->HHA.DataSize, AssetIndex);
+            if(Header)
+            {
+                Asset->Header = Header;
+                ++Assets->LoadCount;
+                Assets->Platform->ReadDataFromFileAsync(Assets->Queue, &Asset->File->Handle,
+                                                        Asset->HHA.DataOffset, Asset->HHA.DataSize,
+                                                        GetAssetMemory(Header),
+                                                        LoadAssetWorkComplete, Asset);
+            }
+            else
+            {
+                // NOTE: Doesn't fit right now; the next request tries again.
+                Asset->State = AssetState_Unloaded;
+            }
+        }
+    }
+}
+
+inline void
+PrefetchAsset(game_assets *Assets, u32 AssetIndex, u32 Priority, u32 FramesUntilNeeded)
+{
+    // NOTE: FramesUntilNeeded is 0 for an asset wanted this frame, the one
+    // whose RunAssetPrefetch is still to come. Asking again for the same asset
+    // keeps the earlier deadline and the higher priority. Requests that don't
+    // fit are dropped.
+    if(AssetIndex && (AssetIndex < Assets->AssetCount) &&
+       (Assets->Assets[AssetIndex].State == AssetState_Unloaded))
+    {
+        u32 NeededByFrame = Assets->FrameIndex + 1 + FramesUntilNeeded;
+
+        asset_prefetch_request *Request = 0;
+        for(u32 RequestIndex = 0;
+            RequestIndex < Assets->PrefetchRequestCount;
+            ++RequestIndex)
+        {
+            if(Assets->PrefetchRequests[RequestIndex].AssetIndex == AssetIndex)
+            {
+                Request = Assets->PrefetchRequests + RequestIndex;
+                break;
+            }
+        }
+
+        if(Request)
+        {
+            if(Request->NeededByFrame > NeededByFrame)
+            {
+                Request->NeededByFrame = NeededByFrame;
+            }
+            if(Request->Priority < Priority)
+            {
+                Request->Priority = Priority;
+            }
+        }
+        else if(Assets->PrefetchRequestCount < ArrayCount(Assets->PrefetchRequests))
+        {
+            Request = Assets->PrefetchRequests + Assets->PrefetchRequestCount++;
+            Request->AssetIndex = AssetIndex;
+            Request->Priority = Priority;
+            Request->NeededByFrame = NeededByFrame;
+            ++Assets->PrefetchCount;
+        }
+        else
+        {
+            ++Assets->PrefetchCancelCount;
+        }
+    }
+}
+
+inline void
+CancelPrefetch(game_assets *Assets, u32 AssetIndex)
+{
+    // NOTE: Only a request whose read hasn't gone out yet can be cancelled.
+    for(u32 RequestIndex = 0;
+        RequestIndex < Assets->PrefetchRequestCount;
+        ++RequestIndex)
+    {
+        if(Assets->PrefetchRequests[RequestIndex].AssetIndex == AssetIndex)
+        {
+            Assets->PrefetchRequests[RequestIndex] =
+                Assets->PrefetchRequests[--Assets->PrefetchRequestCount];
+            ++Assets->PrefetchCancelCount;
+            break;
+        }
+    }
+}
+
+static PLATFORM_WORK_QUEUE_CALLBACK(PrefetchReadWorkComplete)
+{
+    asset_prefetch_read *Read = (asset_prefetch_read *)Data;
+    game_assets *Assets = Read->Assets;
+
+    u32 FrameIndex = Assets->FrameIndex;
+    u32 LateCount = 0;
+    for(u32 Index = 0;
+        Index < Read->AssetCount;
+        ++Index)
+    {
+        asset *Asset = Assets->Assets + Read->AssetIndices[Index];
+
+        // NOTE: As in LoadAssetWorkComplete, a failed read loads as zeroes.
+        if(!PlatformNoFileErrors(&Read->File->Handle))
+        {
+            ZeroSize(Asset->Header->DataSize, GetAssetMemory(Asset->Header));
+        }
+        // NOTE: Late once the run of the frame after the one it was needed
+        // by has started, by which time that frame has been drawn without it.
+        if((s32)(FrameIndex - Read->NeededByFrame[Index]) > 0)
+        {
+            ++LateCount;
+        }
+
+        CompletePreviousWritesBeforeFutureWrites;
+        Asset->State = AssetState_Loaded;
+    }
+
+    BeginAssetLock(Assets);
+    Assets->LateLoadCount += LateCount;
+    Assets->OnTimeLoadCount += Read->AssetCount - LateCount;
+    Read->NextFree = Assets->FirstFreePrefetchRead;
+    Assets->FirstFreePrefetchRead = Read;
+    EndAssetLock(Assets);
+}
+
+inline b32
+PrefetchRequestIsBefore(asset_prefetch_request *A, asset_prefetch_request *B)
+{
+    b32 Result = ((s32)(A->NeededByFrame - B->NeededByFrame) < 0);
+    if(A->NeededByFrame == B->NeededByFrame)
+    {
+        Result = (A->Priority > B->Priority);
+    }
+
+    return(Result);
+}
+
+inline b32
+PrefetchRequestIsBeforeInFile(game_assets *Assets, asset_prefetch_request *A, asset_prefetch_request *B)
+{
+    asset *AssetA = Assets->Assets + A->AssetIndex;
+    asset *AssetB = Assets->Assets + B->AssetIndex;
+
+    b32 Result = (AssetA->File < AssetB->File);
+    if(AssetA->File == AssetB->File)
+    {
+        Result = (AssetA->HHA.DataOffset < AssetB->HHA.DataOffset);
+    }
+
+    return(Result);
+}
+
+static void
+RunAssetPrefetch(game_assets *Assets)
+{
+    /* NOTE: Called once a frame by the game, after it has made its requests
+       for the frame, to turn them into reads:
+
+         - Requests whose deadline has passed, or whose asset got loaded some
+           other way, are dropped.
+         - The rest are ordered by deadline, then priority, and the first
+           MAX_PREFETCH_BATCH are taken.
+         - Those are put in file and offset order, and runs of them lying
+           close together in a pack become one read each.
+
+       What can't be started this frame (out of reads, or no room in the
+       cache) waits for the next one.
+    */
+    TIMED_FUNCTION();
+
+    // NOTE: Not ++ on the volatile; only this thread writes it.
+    Assets->FrameIndex = Assets->FrameIndex + 1;
+    u32 FrameIndex = Assets->FrameIndex;
+
+    u32 RequestCount = 0;
+    for(u32 RequestIndex = 0;
+        RequestIndex < Assets->PrefetchRequestCount;
+        ++RequestIndex)
+    {
+        asset_prefetch_request Request = Assets->PrefetchRequests[RequestIndex];
+        if(((s32)(FrameIndex - Request.NeededByFrame) > 0) ||
+           (Assets->Assets[Request.AssetIndex].State != AssetState_Unloaded))
+        {
+            ++Assets->PrefetchCancelCount;
+        }
+        else
+        {
+            // NOTE: Insertion sort; there are never many and they are mostly
+            // in order from last frame already.
+            u32 InsertIndex = RequestCount++;
+            while(InsertIndex &&
+                  PrefetchRequestIsBefore(&Request, Assets->PrefetchRequests + InsertIndex - 1))
+            {
+                Assets->PrefetchRequests[InsertIndex] = Assets->PrefetchRequests[InsertIndex - 1];
+                --InsertIndex;
+            }
+            Assets->PrefetchRequests[InsertIndex] = Request;
+        }
+    }
+    Assets->PrefetchRequestCount = RequestCount;
+
+    u32 BatchCount = (RequestCount < MAX_PREFETCH_BATCH) ? RequestCount : MAX_PREFETCH_BATCH;
+    asset_prefetch_request *Batch = Assets->PrefetchRequests;
+    for(u32 BatchIndex = 1;
+        BatchIndex < BatchCount;
+        ++BatchIndex)
+    {
+        asset_prefetch_request Request = Batch[BatchIndex];
+        u32 InsertIndex = BatchIndex;
+        while(InsertIndex &&
+              PrefetchRequestIsBeforeInFile(Assets, &Request, Batch + InsertIndex - 1))
+        {
+            Batch[InsertIndex] = Batch[InsertIndex - 1];
+            --InsertIndex;
+        }
+        Batch[InsertIndex] = Request;
+    }
+
+    for(u32 BatchIndex = 0;
+        BatchIndex < BatchCount;
+        )
+    {
+        BeginAssetLock(Assets);
+        asset_prefetch_read *Read = Assets->FirstFreePrefetchRead;
+        if(Read)
+        {
+            Assets->FirstFreePrefetchRead = Read->NextFree;
+        }
+        EndAssetLock(Assets);
+
+        if(!Read)
+        {
+            break;
+        }
+
+        u32 SegmentCount = 0;
+        platform_read_segment Segments[PLATFORM_MAX_READ_SEGMENTS];
+        u64 ReadOffset = 0;
+        u64 ReadEnd = 0;
+
+        Read->AssetCount = 0;
+        while(BatchIndex < BatchCount)
+        {
+            asset_prefetch_request *Request = Batch + BatchIndex;
+            asset *Asset = Assets->Assets + Request->AssetIndex;
+            u64 Offset = Asset->HHA.DataOffset;
+            u64 Size = Asset->HHA.DataSize;
+
+            if(Read->AssetCount)
+            {
+                // NOTE: Only assets that start after the end of the read so
+                // far can join it.
+                u32 SegmentsNeeded = (Offset != ReadEnd) ? 2 : 1;
+                if((Asset->File != Read->File) ||
+                   (Offset < ReadEnd) ||
+                   ((Offset - ReadEnd) > PREFETCH_MAX_GAP) ||
+                   ((Offset + Size - ReadOffset) > PREFETCH_MAX_SPAN) ||
+                   ((SegmentCount + SegmentsNeeded) > ArrayCount(Segments)))
+                {
+                    break;
+                }
+            }
+
+            ++BatchIndex;
+            if(AtomicCompareExchangeUInt32(&Asset->State, AssetState_Queued, AssetState_Unloaded) ==
+               AssetState_Unloaded)
+            {
+                asset_memory_header *Header = AcquireAssetMemory(Assets, Size, Request->AssetIndex);
+                if(Header)
+                {
+                    Asset->Header = Header;
+                    ++Assets->LoadCount;
+
+                    if(!Read->AssetCount)
+                    {
+                        Read->File = Asset->File;
+                        ReadOffset = ReadEnd = Offset;
+                    }
+                    else if(Offset != ReadEnd)
+                    {
+                        platform_read_segment *Gap = Segments + SegmentCount++;
+                        Gap->Size = Offset - ReadEnd;
+                        Gap->Dest = 0;
+                    }
+
+                    platform_read_segment *Segment = Segments + SegmentCount++;
+                    Segment->Size = Size;
+                    Segment->Dest = GetAssetMemory(Header);
+                    ReadEnd = Offset + Size;
+
+                    Read->AssetIndices[Read->AssetCount] = Request->AssetIndex;
+                    Read->NeededByFrame[Read->AssetCount] = Request->NeededByFrame;
+                    ++Read->AssetCount;
+
+                    // NOTE: Marked as started, for the compaction below.
+                    Request->AssetIndex = 0;
+                }
+                else
+                {
+                    Asset->State = AssetState_Unloaded;
+                }
+            }
+        }
+
+        if(Read->AssetCount)
+        {
+            ++Assets->PrefetchReadCount;
+            Assets->Platform->ReadSegmentsFromFileAsync(Assets->Queue, &Read->File->Handle,
+                                                        ReadOffset, SegmentCount, Segments,
+                                                        PrefetchReadWorkComplete, Read);
+        }
+        else
+        {
+            BeginAssetLock(Assets);
+            Read->NextFree = Assets->FirstFreePrefetchRead;
+            Assets->FirstFreePrefetchRead = Read;
+            EndAssetLock(Assets);
+        }
+    }
+
+    u32 RemainingCount = 0;
+    for(u32 RequestIndex = 0;
+        RequestIndex < Assets->PrefetchRequestCount;
+        ++RequestIndex)
+    {
+        if(Assets->PrefetchRequests[RequestIndex].AssetIndex)
+        {
+            Assets->PrefetchRequests[RemainingCount++] = Assets->PrefetchRequests[RequestIndex];
+        }
+    }
+    Assets->PrefetchRequestCount = RemainingCount;
+}
+
+static asset_memory_header *
+GetAsset(game_assets *Assets, u32 AssetIndex, u32 GenerationID)
+{
+    asset_memory_header *Result = 0;
+
+    if(AssetIndex && (AssetIndex < Assets->AssetCount))
+    {
+        asset *Asset = Assets->Assets + AssetIndex;
+
+        // NOTE: Checked under the lock, so the asset can't be evicted
+        // between the check and the touch.
+        BeginAssetLock(Assets);
+        if(Asset->State == AssetState_Loaded)
+        {
+            CompletePreviousReadsBeforeFutureReads;
+            Result = Asset->Header;
+            RemoveAssetHeaderFromList(Result);
+            InsertAssetHeaderAtFront(Assets, Result);
+
+            if(GenerationID)
+            {
+                Result->GenerationID = GenerationID;
+            }
+            ++Assets->HitCount;
+        }
+        else
+        {
+            ++Assets->MissCount;
+        }
+        EndAssetLock(Assets);
+    }
+
+    return(Result);
+}
+
+inline loaded_bitmap *
+GetBitmap(game_assets *Assets, u32 AssetIndex, u32 GenerationID, loaded_bitmap *Result)
+{
+    asset_memory_header *Header = GetAsset(Assets, AssetIndex, GenerationID);
+    if(Header && (Assets->Assets[AssetIndex].HHA.Kind == HHAAsset_Bitmap))
+    {
+        hha_bitmap *Info = &Assets->Assets[AssetIndex].HHA.Bitmap;
+        Result->Memory = GetAssetMemory(Header);
+        Result->Width = Info->Dim[0];
+        Result->Height = Info->Dim[1];
+        Result->Pitch = Info->Dim[0]*4;
+        Result->AlignPercentage[0] = Info->AlignPercentage[0];
+        Result->AlignPercentage[1] = Info->AlignPercentage[1];
+    }
+    else
+    {
+        Result = 0;
+    }
+
+    return(Result);
+}
+
+inline loaded_sound *
+GetSound(game_assets *Assets, u32 AssetIndex, u32 GenerationID, loaded_sound *Result)
+{
+    asset_memory_header *Header = GetAsset(Assets, AssetIndex, GenerationID);
+    if(Header && (Assets->Assets[AssetIndex].HHA.Kind == HHAAsset_Sound))
+    {
+        hha_sound *Info = &Assets->Assets[AssetIndex].HHA.Sound;
+        Result->Samples = (s16 *)GetAssetMemory(Header);
+        Result->SampleCount = Info->SampleCount;
+        Result->ChannelCount = Info->ChannelCount;
+    }
+    else
+    {
+        Result = 0;
+    }
+
+    return(Result);
+}
+
+inline void *
+GetAssetData(game_assets *Assets, u32 AssetIndex, u32 GenerationID, u64 *DataSize)
+{
+    void *Result = 0;
+
+    asset_memory_header *Header = GetAsset(Assets, AssetIndex, GenerationID);
+    if(Header)
+    {
+        Result = GetAssetMemory(Header);
+        *DataSize = Header->DataSize;
+    }
+
+    return(Result);
+}
+
+inline u32
+GetFirstAssetFrom(game_assets *Assets, u32 TypeID)
+{
+    u32 Result = 0;
+
+    if(TypeID < HHA_TYPE_ID_COUNT)
+    {
+        asset_type *Type = Assets->AssetTypes + TypeID;
+        if(Type->FirstAssetIndex != Type->OnePastLastAssetIndex)
+        {
+            Result = Type->FirstAssetIndex;
+        }
+    }
+
+    return(Result);
+}
+
+static u32
+GetBestMatchAssetFrom(game_assets *Assets, u32 TypeID,
+                      asset_vector *MatchVector, asset_vector *WeightVector)
+{
+    // NOTE: The asset whose tags are closest to MatchVector, each tag's
+    // distance scaled by its weight.
+    u32 Result = 0;
+
+    if(TypeID < HHA_TYPE_ID_COUNT)
+    {
+        r32 BestDiff = 3.402823466e+38f;
+        asset_type *Type = Assets->AssetTypes + TypeID;
+        for(u32 AssetIndex = Type->FirstAssetIndex;
+            AssetIndex < Type->OnePastLastAssetIndex;
+            ++AssetIndex)
+        {
+            asset *Asset = Assets->Assets + AssetIndex;
+
+            r32 TotalWeightedDiff = 0.0f;
+            for(u32 TagIndex = Asset->HHA.FirstTagIndex;
+                TagIndex < Asset->HHA.OnePastLastTagIndex;
+                ++TagIndex)
+            {
+                hha_tag *Tag = Assets->Tags + TagIndex;
+
+                r32 Diff = MatchVector->E[Tag->ID] - Tag->Value;
+                if(Diff < 0.0f)
+                {
+                    Diff = -Diff;
+                }
+                TotalWeightedDiff += WeightVector->E[Tag->ID]*Diff;
+            }
+
+            if(BestDiff > TotalWeightedDiff)
+            {
+                BestDiff = TotalWeightedDiff;
+                Result = AssetIndex;
+            }
+        }
+    }
+
+    return(Result);
+}
+
+inline b32
+FitsInFile(u64 FileSize, u64 Offset, u32 Count, u64 ElementSize)
+{
+    b32 Result = ((Offset <= FileSize) &&
+                  (Count <= ((FileSize - Offset) / ElementSize)));
+    return(Result);
+}
+
+static b32
+ReadAssetFileIndex(platform_api *Platform, memory_arena *Arena, asset_file *File)
+{
+    b32 Result = false;
+
+    Platform->ReadDataFromFile(&File->Handle, 0, sizeof(File->Header), &File->Header);
+    hha_header *Header = &File->Header;
+    u64 FileSize = File->Handle.Size;
+    if(PlatformNoFileErrors(&File->Handle) &&
+       (Header->MagicValue == HHA_MAGIC_VALUE) &&
+       (Header->Version == HHA_VERSION) &&
+       (Header->AssetCount >= 1) &&
+       (Header->AssetTypeCount <= HHA_TYPE_ID_COUNT) &&
+       FitsInFile(FileSize, Header->Tags, Header->TagCount, sizeof(hha_tag)) &&
+       FitsInFile(FileSize, Header->AssetTypes, Header->AssetTypeCount, sizeof(hha_asset_type)) &&
+       FitsInFile(FileSize, Header->Assets, Header->AssetCount, sizeof(hha_asset)))
+    {
+        File->AssetTypeArray = PushArray(Arena, Header->AssetTypeCount, hha_asset_type);
+        Platform->ReadDataFromFile(&File->Handle, Header->AssetTypes,
+                                   Header->AssetTypeCount*sizeof(hha_asset_type),
+                                   File->AssetTypeArray);
+        Result = PlatformNoFileErrors(&File->Handle);
+
+        // NOTE: AllocateGameAssets sizes its array from AssetCount and copies
+        // every type's whole range, so the ranges have to be what the format
+        // promises: sorted by TypeID, one per TypeID, and not overlapping.
+        // That also keeps them to AssetCount - 1 assets in all.
+        u32 MinTypeID = 0;
+        u32 MinAssetIndex = 1;
+        for(u32 TypeIndex = 0;
+            Result && (TypeIndex < Header->AssetTypeCount);
+            ++TypeIndex)
+        {
+            hha_asset_type *Type = File->AssetTypeArray + TypeIndex;
+            Result = ((Type->TypeID >= MinTypeID) &&
+                      (Type->TypeID < HHA_TYPE_ID_COUNT) &&
+                      (Type->FirstAssetIndex >= MinAssetIndex) &&
+                      (Type->FirstAssetIndex <= Type->OnePastLastAssetIndex) &&
+                      (Type->OnePastLastAssetIndex <= Header->AssetCount));
+            MinTypeID = Type->TypeID + 1;
+            MinAssetIndex = Type->OnePastLastAssetIndex;
+        }
+    }
+
+    if(!Result)
+    {
+        Platform->FileError(&File->Handle, (char *)"Asset file is not a valid .hha of this version.");
+        File->Header.TagCount = 0;
+        File->Header.AssetTypeCount = 0;
+        File->Header.AssetCount = 0;
+    }
+
+    return(Result);
+}
+
+static game_assets *
+AllocateGameAssets(memory_arena *Arena, memory_index CacheSize,
+                   platform_api *Platform, platform_work_queue *Queue)
+{
+    game_assets *Assets = PushStruct(Arena, game_assets);
+    ZeroStruct(*Assets);
+
+    Assets->Platform = Platform;
+    Assets->Queue = Queue;
+    Assets->NextGenerationID = 1;
+
+    for(u32 ReadIndex = 0;
+        ReadIndex < ArrayCount(Assets->PrefetchReads);
+        ++ReadIndex)
+    {
+        asset_prefetch_read *Read = Assets->PrefetchReads + ReadIndex;
+        Read->Assets = Assets;
+        Read->NextFree = Assets->FirstFreePrefetchRead;
+        Assets->FirstFreePrefetchRead = Read;
+    }
+
+    Assets->MemorySentinel.Next = &Assets->MemorySentinel;
+    Assets->MemorySentinel.Prev = &Assets->MemorySentinel;
+    Assets->LoadedAssetSentinel.Next = &Assets->LoadedAssetSentinel;
+    Assets->LoadedAssetSentinel.Prev = &Assets->LoadedAssetSentinel;
+
+    Assets->Budget = AlignPow2(CacheSize, (memory_index)ASSET_MEMORY_ALIGNMENT);
+    InsertAssetBlock(&Assets->MemorySentinel, Assets->Budget,
+                     PushSize(Arena, Assets->Budget, ASSET_MEMORY_ALIGNMENT));
+
+    // NOTE: Tag and asset indices are global across packs; asset 0 is the
+    // null asset.
+    Assets->TagCount = 0;
+    Assets->AssetCount = 1;
+
+    platform_file_group FileGroup = Platform->GetAllFilesOfTypeBegin(PlatformFileType_AssetFile);
+    Assets->FileCount = FileGroup.FileCount;
+    Assets->Files = PushArray(Arena, Assets->FileCount, asset_file);
+    for(u32 FileIndex = 0;
+        FileIndex < Assets->FileCount;
+        ++FileIndex)
+    {
+        asset_file *File = Assets->Files + FileIndex;
+        ZeroStruct(*File);
+
+        File->Handle = Platform->OpenNextFile(&FileGroup);
+        // NOTE: The index totals are u32s, so a pack that would overflow
+        // them is left out like a bad one.
+        if(ReadAssetFileIndex(Platform, Arena, File) &&
+           (File->Header.TagCount <= (0xFFFFFFFF - Assets->TagCount)) &&
+           ((File->Header.AssetCount - 1) <= (0xFFFFFFFF - Assets->AssetCount)))
+        {
+            File->TagBase = Assets->TagCount;
+            Assets->TagCount += File->Header.TagCount;
+            Assets->AssetCount += File->Header.AssetCount - 1;
+        }
+        else
+        {
+            // NOTE: Nothing is ever read from a bad pack again. Good packs
+            // stay open for as long as the assets do.
+            Platform->CloseFile(&File->Handle);
+        }
+    }
+    Platform->GetAllFilesOfTypeEnd(&FileGroup);
+
+    Assets->Tags = PushArray(Arena, Assets->TagCount, hha_tag);
+    Assets->Assets = PushArray(Arena, Assets->AssetCount, asset);
+    ZeroStruct(Assets->Assets[0]);
+
+    for(u32 FileIndex = 0;
+        FileIndex < Assets->FileCount;
+        ++FileIndex)
+    {
+        asset_file *File = Assets->Files + FileIndex;
+        if(PlatformNoFileErrors(&File->Handle))
+        {
+            Platform->ReadDataFromFile(&File->Handle, File->Header.Tags,
+                                       File->Header.TagCount*sizeof(hha_tag),
+                                       Assets->Tags + File->TagBase);
+        }
+    }
+
+    // NOTE: Merged a type at a time, so each type's assets from every pack
+    // end up next to each other.
+    u32 AssetCount = 1;
+    for(u32 TypeID = 0;
+        TypeID < HHA_TYPE_ID_COUNT;
+        ++TypeID)
+    {
+        asset_type *Type = Assets->AssetTypes + TypeID;
+        Type->FirstAssetIndex = AssetCount;
+
+        for(u32 FileIndex = 0;
+            FileIndex < Assets->FileCount;
+            ++FileIndex)
+        {
+            asset_file *File = Assets->Files + FileIndex;
+            for(u32 SourceIndex = 0;
+                PlatformNoFileErrors(&File->Handle) && (SourceIndex < File->Header.AssetTypeCount);
+                ++SourceIndex)
+            {
+                hha_asset_type *SourceType = File->AssetTypeArray + SourceIndex;
+                if(SourceType->TypeID == TypeID)
+                {
+                    u32 AssetCountForType = (SourceType->OnePastLastAssetIndex -
+                                             SourceType->FirstAssetIndex);
+                    if(AssetCountForType > (Assets->AssetCount - AssetCount))
+                    {
+                        InvalidCodePath;
+                        AssetCountForType = Assets->AssetCount - AssetCount;
+                    }
+
+                    temporary_memory TempMem = BeginTemporaryMemory(Arena);
+                    hha_asset *HHAAssetArray = PushArray(Arena, AssetCountForType, hha_asset);
+                    Platform->ReadDataFromFile(&File->Handle,
+                                               File->Header.Assets +
+                                               SourceType->FirstAssetIndex*sizeof(hha_asset),
+                                               AssetCountForType*sizeof(hha_asset),
+                                               HHAAssetArray);
+                    for(u32 AssetIndex = 0;
+                        PlatformNoFileErrors(&File->Handle) && (AssetIndex < AssetCountForType);
+                        ++AssetIndex)
+                    {
+                        hha_asset *HHAAsset = HHAAssetArray + AssetIndex;
+                        asset *Asset = Assets->Assets + AssetCount++;
+                        ZeroStruct(*Asset);
+
+                        Asset->File = File;
+                        Asset->HHA = *HHAAsset;
+                        if((Asset->HHA.FirstTagIndex > Asset->HHA.OnePastLastTagIndex) ||
+                           (Asset->HHA.OnePastLastTagIndex > File->Header.TagCount))
+                        {
+                            Asset->HHA.FirstTagIndex = Asset->HHA.OnePastLastTagIndex = 0;
+                        }
+                        Asset->HHA.FirstTagIndex += File->TagBase;
+                        Asset->HHA.OnePastLastTagIndex += File->TagBase;
+                    }
+                    EndTemporaryMemory(TempMem);
+                }
+            }
+        }
+
+        Type->OnePastLastAssetIndex = AssetCount;
+    }
+
+    // NOTE: Fewer if a pack went bad after its header was read.
+    Assert(AssetCount <= Assets->AssetCount);
+    Assets->AssetCount = AssetCount;
+
+    for(u32 TagIndex = 0;
+        TagIndex < Assets->TagCount;
+        ++TagIndex)
+    {
+        if(Assets->Tags[TagIndex].ID >= HHA_TAG_ID_COUNT)
+        {
+            Assets->Tags[TagIndex].ID = 0;
+            Assets->Tags[TagIndex].Value = 0.0f;
+        }
+    }
+
+    return(Assets);
+}
+
+#define HANDMADE_ASSET_H
+#endif
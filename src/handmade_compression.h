@@ -0,0 +1,293 @@
+#if !defined(HANDMADE_COMPRESSION_H)
+
+/* NOTE: A small LZ77 codec in the LZ4 mould: greedy matching through one
+   hash table, no entropy coding, so both directions run at memory speed
+   rather than at disk speed.
+
+   The compressed stream is a series of sequences:
+
+     token      high nibble = literal count, low nibble = match length - 4
+                (a nibble of 15 is followed by bytes that are added to it,
+                up to and including the first one that isn't 255)
+     literals
+     offset     2 bytes, little endian, how far back the match starts
+
+   The last sequence stops after its literals. Matches never reach further
+   back than 65535 bytes, so nothing but the block itself is needed to
+   decompress it.
+
+   CompressLZ returns 0 if the result would not fit in DestSize - store the
+   data raw then. DecompressLZ checks every length and offset against both
+   buffers and returns 0 for a corrupt stream.
+*/
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+
+inline u32
+LZLoad32(u8 *At)
+{
+    u32 Result = ((u32)At[0] |
+                  ((u32)At[1] << 8) |
+                  ((u32)At[2] << 16) |
+                  ((u32)At[3] << 24));
+    return(Result);
+}
+
+inline u32
+LZHash(u32 Value)
+{
+    u32 Result = (Value*2654435761U) >> (32 - LZ_HASH_BITS);
+    return(Result);
+}
+
+inline u8 *
+LZWriteLength(u8 *Out, u8 *OutEnd, memory_index Length)
+{
+    // NOTE: The remainder after the token's 15.
+    while(Out && (Length >= 255))
+    {
+        if(Out < OutEnd)
+        {
+            *Out++ = 255;
+            Length -= 255;
+        }
+        else
+        {
+            Out = 0;
+        }
+    }
+
+    if(Out)
+    {
+        if(Out < OutEnd)
+        {
+            *Out++ = (u8)Length;
+        }
+        else
+        {
+            Out = 0;
+        }
+    }
+
+    return(Out);
+}
+
+inline u8 *
+LZWriteSequence(u8 *Out, u8 *OutEnd, u8 *Literals, memory_index LiteralCount,
+                memory_index Offset, memory_index MatchLength)
+{
+    // NOTE: Returns 0 if the sequence doesn't fit.
+    if(Out < OutEnd)
+    {
+        memory_index MatchCode = MatchLength ? (MatchLength - LZ_MIN_MATCH) : 0;
+        u8 *Token = Out++;
+        *Token = (u8)(((LiteralCount < 15 ? LiteralCount : 15) << 4) |
+                      (MatchCode < 15 ? MatchCode : 15));
+
+        if(LiteralCount >= 15)
+        {
+            Out = LZWriteLength(Out, OutEnd, LiteralCount - 15);
+        }
+
+        if(Out && ((memory_index)(OutEnd - Out) >= LiteralCount))
+        {
+            for(memory_index Index = 0;
+                Index < LiteralCount;
+                ++Index)
+            {
+                *Out++ = Literals[Index];
+            }
+        }
+        else
+        {
+            Out = 0;
+        }
+
+        if(Out && MatchLength)
+        {
+            if((OutEnd - Out) >= 2)
+            {
+                *Out++ = (u8)(Offset & 0xFF);
+                *Out++ = (u8)(Offset >> 8);
+                if(MatchCode >= 15)
+                {
+                    Out = LZWriteLength(Out, OutEnd, MatchCode - 15);
+                }
+            }
+            else
+            {
+                Out = 0;
+            }
+        }
+    }
+    else
+    {
+        Out = 0;
+    }
+
+    return(Out);
+}
+
+inline memory_index
+CompressLZ(memory_index SourceSize, void *SourceInit, memory_index DestSize, void *DestInit)
+{
+    u8 *Source = (u8 *)SourceInit;
+    u8 *Dest = (u8 *)DestInit;
+
+    // NOTE: Positions + 1, so that 0 means empty.
+    u32 Table[1 << LZ_HASH_BITS] = {};
+
+    u8 *Out = Dest;
+    u8 *OutEnd = Dest + DestSize;
+    memory_index LiteralStart = 0;
+    memory_index At = 0;
+    memory_index Misses = 0;
+    while(Out && ((At + LZ_MIN_MATCH) <= SourceSize))
+    {
+        u32 Value = LZLoad32(Source + At);
+        u32 Hash = LZHash(Value);
+        memory_index Candidate = Table[Hash];
+        Table[Hash] = (u32)(At + 1);
+
+        if(Candidate &&
+           ((At - (Candidate - 1)) <= LZ_MAX_OFFSET) &&
+           (LZLoad32(Source + Candidate - 1) == Value))
+        {
+            --Candidate;
+            memory_index MatchLength = LZ_MIN_MATCH;
+            while(((At + MatchLength) < SourceSize) &&
+                  (Source[Candidate + MatchLength] == Source[At + MatchLength]))
+            {
+                ++MatchLength;
+            }
+
+            Out = LZWriteSequence(Out, OutEnd, Source + LiteralStart, At - LiteralStart,
+                                  At - Candidate, MatchLength);
+            At += MatchLength;
+            LiteralStart = At;
+            Misses = 0;
+        }
+        else
+        {
+            // NOTE: Step faster through data that isn't compressing.
+            At += 1 + (Misses++ >> 5);
+        }
+    }
+
+    if(Out)
+    {
+        Out = LZWriteSequence(Out, OutEnd, Source + LiteralStart, SourceSize - LiteralStart, 0, 0);
+    }
+
+    memory_index Result = Out ? (Out - Dest) : 0;
+    return(Result);
+}
+
+inline b32
+LZReadLength(u8 **InAt, u8 *InEnd, memory_index *Length)
+{
+    b32 Result = true;
+
+    u8 *In = *InAt;
+    for(;;)
+    {
+        if(In >= InEnd)
+        {
+            Result = false;
+            break;
+        }
+
+        u8 Byte = *In++;
+        *Length += Byte;
+        if(Byte != 255)
+        {
+            break;
+        }
+    }
+    *InAt = In;
+
+    return(Result);
+}
+
+inline memory_index
+DecompressLZ(memory_index SourceSize, void *SourceInit, memory_index DestSize, void *DestInit)
+{
+    u8 *In = (u8 *)SourceInit;
+    u8 *InEnd = In + SourceSize;
+    u8 *Dest = (u8 *)DestInit;
+    u8 *Out = Dest;
+    u8 *OutEnd = Dest + DestSize;
+
+    b32 Valid = true;
+    while(Valid && (In < InEnd))
+    {
+        u8 Token = *In++;
+
+        memory_index LiteralCount = Token >> 4;
+        if(LiteralCount == 15)
+        {
+            Valid = LZReadLength(&In, InEnd, &LiteralCount);
+        }
+
+        if(Valid &&
+           ((memory_index)(InEnd - In) >= LiteralCount) &&
+           ((memory_index)(OutEnd - Out) >= LiteralCount))
+        {
+            for(memory_index Index = 0;
+                Index < LiteralCount;
+                ++Index)
+            {
+                *Out++ = *In++;
+            }
+        }
+        else
+        {
+            Valid = false;
+        }
+
+        if(Valid && (In < InEnd))
+        {
+            memory_index Offset = 0;
+            if((InEnd - In) >= 2)
+            {
+                Offset = (memory_index)In[0] | ((memory_index)In[1] << 8);
+                In += 2;
+            }
+
+            memory_index MatchLength = (Token & 0xF);
+            if(MatchLength == 15)
+            {
+                Valid = LZReadLength(&In, InEnd, &MatchLength);
+            }
+            MatchLength += LZ_MIN_MATCH;
+
+            if(Valid &&
+               Offset &&
+               (Offset <= (memory_index)(Out - Dest)) &&
+               ((memory_index)(OutEnd - Out) >= MatchLength))
+            {
+                // NOTE: Byte at a time, because a match may overlap the bytes
+                // it is producing (a run).
+                u8 *From = Out - Offset;
+                for(memory_index Index = 0;
+                    Index < MatchLength;
+                    ++Index)
+                {
+                    *Out++ = *From++;
+                }
+            }
+            else
+            {
+                Valid = false;
+            }
+        }
+    }
+
+    memory_index Result = Valid ? (Out - Dest) : 0;
+    return(Result);
+}
+
+#define HANDMADE_COMPRESSION_H
+#endif
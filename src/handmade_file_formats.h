@@ -0,0 +1,99 @@
+#if !defined(HANDMADE_FILE_FORMATS_H)
+
+/* NOTE: The asset pack (.hha) format, written by test_asset_builder and read
+   by handmade_asset.h.
+
+     hha_header
+     hha_tag[TagCount]              at Tags
+     hha_asset_type[AssetTypeCount] at AssetTypes, sorted by TypeID
+     hha_asset[AssetCount]          at Assets, grouped by type
+     payloads                       each at its asset's DataOffset
+
+   Asset 0 is a null asset that every pack starts with, so an asset index of
+   0 can mean "none". Each asset's tags are the hha_tags from FirstTagIndex
+   to OnePastLastTagIndex. Type and tag IDs are the game's business; the pack
+   only requires them to be below HHA_TYPE_ID_COUNT and HHA_TAG_ID_COUNT.
+
+   Payloads start on HHA_DATA_ALIGNMENT, so a pack can be mapped and used in
+   place. Bitmaps are 32-bit BB GG RR AA, bottom row first, with a pitch of
+   Width*4. Sounds are 16-bit samples, channels interleaved.
+
+   Offsets and sizes are 64-bit; a pack may be larger than 4GB.
+*/
+
+#define HHA_CODE(a, b, c, d) (((uint32)(a) << 0) | ((uint32)(b) << 8) | ((uint32)(c) << 16) | ((uint32)(d) << 24))
+
+#define HHA_MAGIC_VALUE HHA_CODE('h','h','a','f')
+#define HHA_VERSION 1
+#define HHA_TYPE_ID_COUNT 256
+#define HHA_TAG_ID_COUNT 32
+#define HHA_DATA_ALIGNMENT 64
+
+#pragma pack(push, 1)
+
+struct hha_header
+{
+    u32 MagicValue;
+    u32 Version;
+
+    u32 TagCount;
+    u32 AssetTypeCount;
+    u32 AssetCount;
+    u32 Reserved;
+
+    u64 Tags;
+    u64 AssetTypes;
+    u64 Assets;
+};
+
+struct hha_tag
+{
+    u32 ID;
+    r32 Value;
+};
+
+struct hha_asset_type
+{
+    u32 TypeID;
+    u32 FirstAssetIndex;
+    u32 OnePastLastAssetIndex;
+};
+
+enum hha_asset_kind
+{
+    HHAAsset_None,
+    HHAAsset_Bitmap,
+    HHAAsset_Sound,
+    HHAAsset_Data,
+};
+
+struct hha_bitmap
+{
+    u32 Dim[2];
+    r32 AlignPercentage[2];
+};
+
+struct hha_sound
+{
+    u32 SampleCount;
+    u32 ChannelCount;
+};
+
+struct hha_asset
+{
+    u64 DataOffset;
+    u64 DataSize;
+    u32 FirstTagIndex;
+    u32 OnePastLastTagIndex;
+    u32 Kind;
+    union
+    {
+        hha_bitmap Bitmap;
+        hha_sound Sound;
+    };
+};
+
+#pragma pack(pop)
+
+#define HANDMADE_FILE_FORMATS_H
+#endif
@@ -0,0 +1,188 @@
+#if !defined(HANDMADE_MEMORY_H)
+
+/* NOTE: Bump allocation over the blocks the platform hands us.
+
+   The game carves PermanentStorage, TransientStorage and CacheStorage into
+   memory_arenas.
+   Nothing here ever calls the heap: a push is an add and a compare.
+
+     - PushStruct/PushArray/PushSize take an optional alignment (default 4).
+     - SubArena carves a child arena out of a parent, e.g. one per subsystem.
+     - BeginTemporaryMemory/EndTemporaryMemory roll an arena back to where it
+       was, for scratch memory that only lives for a frame or a function.
+
+   Every arena tracks its high-water mark (MaxUsed). In internal builds,
+   DEBUGRegisterArena puts an arena in game_memory's list so the platform
+   layer can report how close each one came to its size.
+*/
+
+struct memory_arena
+{
+    memory_index Size;
+    uint8 *Base;
+    memory_index Used;
+    memory_index MaxUsed;
+
+    int32 TempCount;
+};
+
+struct temporary_memory
+{
+    memory_arena *Arena;
+    memory_index Used;
+};
+
+inline void
+InitializeArena(memory_arena *Arena, memory_index Size, void *Base)
+{
+    Arena->Size = Size;
+    Arena->Base = (uint8 *)Base;
+    Arena->Used = 0;
+    Arena->MaxUsed = 0;
+    Arena->TempCount = 0;
+}
+
+inline memory_index
+GetAlignmentOffset(memory_arena *Arena, memory_index Alignment)
+{
+    Assert(Alignment && !(Alignment & (Alignment - 1)));
+
+    memory_index AlignmentOffset = 0;
+
+    memory_index ResultPointer = (memory_index)Arena->Base + Arena->Used;
+    memory_index AlignmentMask = Alignment - 1;
+    if(ResultPointer & AlignmentMask)
+    {
+        AlignmentOffset = Alignment - (ResultPointer & AlignmentMask);
+    }
+
+    return(AlignmentOffset);
+}
+
+inline memory_index
+GetArenaSizeRemaining(memory_arena *Arena, memory_index Alignment = 4)
+{
+    memory_index Result = 0;
+
+    memory_index AlignmentOffset = GetAlignmentOffset(Arena, Alignment);
+    if((Arena->Used + AlignmentOffset) < Arena->Size)
+    {
+        Result = Arena->Size - (Arena->Used + AlignmentOffset);
+    }
+
+    return(Result);
+}
+
+// TODO: Optional "clear" parameter!!!!
+#define PushStruct(Arena, type, ...) (type *)PushSize_(Arena, sizeof(type), ## __VA_ARGS__)
+#define PushArray(Arena, Count, type, ...) (type *)PushSize_(Arena, (Count)*sizeof(type), ## __VA_ARGS__)
+#define PushSize(Arena, Size, ...) PushSize_(Arena, Size, ## __VA_ARGS__)
+inline void *
+PushSize_(memory_arena *Arena, memory_index SizeInit, memory_index Alignment = 4)
+{
+    memory_index Size = SizeInit;
+
+    memory_index AlignmentOffset = GetAlignmentOffset(Arena, Alignment);
+    Size += AlignmentOffset;
+
+    // NOTE: Overflow check. In shipping builds an overrun is not caught, so
+    // every arena must be sized from its measured high-water mark.
+    Assert((Arena->Used + Size) <= Arena->Size);
+    void *Result = Arena->Base + Arena->Used + AlignmentOffset;
+    Arena->Used += Size;
+
+    if(Arena->MaxUsed < Arena->Used)
+    {
+        Arena->MaxUsed = Arena->Used;
+    }
+
+    Assert(Size >= SizeInit);
+
+    return(Result);
+}
+
+inline void
+SubArena(memory_arena *Result, memory_arena *Arena, memory_index Size, memory_index Alignment = 16)
+{
+    Result->Size = Size;
+    Result->Base = (uint8 *)PushSize_(Arena, Size, Alignment);
+    Result->Used = 0;
+    Result->MaxUsed = 0;
+    Result->TempCount = 0;
+}
+
+inline temporary_memory
+BeginTemporaryMemory(memory_arena *Arena)
+{
+    temporary_memory Result;
+
+    Result.Arena = Arena;
+    Result.Used = Arena->Used;
+
+    ++Arena->TempCount;
+
+    return(Result);
+}
+
+inline void
+EndTemporaryMemory(temporary_memory TempMem)
+{
+    memory_arena *Arena = TempMem.Arena;
+    Assert(Arena->Used >= TempMem.Used);
+    Arena->Used = TempMem.Used;
+    Assert(Arena->TempCount > 0);
+    --Arena->TempCount;
+}
+
+inline void
+CheckArena(memory_arena *Arena)
+{
+    // NOTE: Every BeginTemporaryMemory must have been matched by an
+    // EndTemporaryMemory by the time this is called (e.g. end of frame).
+    Assert(Arena->TempCount == 0);
+}
+
+#define ZeroStruct(Instance) ZeroSize(sizeof(Instance), &(Instance))
+inline void
+ZeroSize(memory_index Size, void *Ptr)
+{
+    // TODO: Check this guy for performance
+    uint8 *Byte = (uint8 *)Ptr;
+    while(Size--)
+    {
+        *Byte++ = 0;
+    }
+}
+
+#if HANDMADE_INTERNAL
+// NOTE: The platform reads the arena through these pointers at any time, so
+// the arena itself must live in game memory, not on the stack.
+inline void
+DEBUGRegisterArena(game_memory *Memory, memory_arena *Arena, char *Name)
+{
+    Assert(Memory->DebugArenaCount < ArrayCount(Memory->DebugArenas));
+    if(Memory->DebugArenaCount < ArrayCount(Memory->DebugArenas))
+    {
+        debug_arena_info *Info = Memory->DebugArenas + Memory->DebugArenaCount++;
+
+        // NOTE: Copied, because a literal would live in the game code, which
+        // the platform unloads on every reload.
+        uint32 NameIndex = 0;
+        while(Name[NameIndex] && (NameIndex < (ArrayCount(Info->Name) - 1)))
+        {
+            Info->Name[NameIndex] = Name[NameIndex];
+            ++NameIndex;
+        }
+        Info->Name[NameIndex] = 0;
+
+        Info->Size = &Arena->Size;
+        Info->Used = &Arena->Used;
+        Info->MaxUsed = &Arena->MaxUsed;
+    }
+}
+#else
+#define DEBUGRegisterArena(...)
+#endif
+
+#define HANDMADE_MEMORY_H
+#endif
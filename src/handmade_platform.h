@@ -11,7 +11,38 @@
 extern "C" {
 #endif
     
+//
+// NOTE(casey): Compilers
+//
+#if !defined(COMPILER_MSVC)
+#define COMPILER_MSVC 0
+#endif
+
+#if !defined(COMPILER_LLVM)
+#define COMPILER_LLVM 0
+#endif
+
+#if !COMPILER_MSVC && !COMPILER_LLVM
+#if _MSC_VER
+#undef COMPILER_MSVC
+#define COMPILER_MSVC 1
+#else
+// TODO: Moar compilerz!!!
+#undef COMPILER_LLVM
+#define COMPILER_LLVM 1
+#endif
+#endif
+
+#if COMPILER_MSVC
+#include <intrin.h>
+#elif COMPILER_LLVM
+#include <x86intrin.h>
+#else
+#error SSE/NEON optimizations are not available for this compiler yet!!!!
+#endif
+
 #include <stdint.h>
+#include <stddef.h>
 
 typedef int8_t int8;
 typedef int16_t int16;
@@ -24,13 +55,141 @@ typedef uint16_t uint16;
 typedef uint32_t uint32;
 typedef uint64_t uint64;
 
+typedef size_t memory_index;
+
 typedef float real32;
 typedef double real64;
 
-typedef struct thread_context
+typedef int8 s8;
+typedef int16 s16;
+typedef int32 s32;
+typedef int64 s64;
+typedef bool32 b32;
+
+typedef uint8 u8;
+typedef uint16 u16;
+typedef uint32 u32;
+typedef uint64 u64;
+
+typedef real32 r32;
+typedef real64 r64;
+
+#if HANDMADE_SLOW
+// TODO: Complete assertion macro - don't worry everyone!
+#define Assert(Expression) if(!(Expression)) {*(volatile int *)0 = 0;}
+#else
+#define Assert(Expression)
+#endif
+
+#define InvalidCodePath Assert(!"InvalidCodePath")
+#define InvalidDefaultCase default: {InvalidCodePath;} break
+
+#define Kilobytes(Value) ((Value)*1024LL)
+#define Megabytes(Value) (Kilobytes(Value)*1024LL)
+#define Gigabytes(Value) (Megabytes(Value)*1024LL)
+#define Terabytes(Value) (Gigabytes(Value)*1024LL)
+
+#define ArrayCount(Array) (sizeof(Array) / sizeof((Array)[0]))
+// TODO: swap, min, max ... macros???
+
+#define AlignPow2(Value, Alignment) ((Value + ((Alignment) - 1)) & ~((Alignment) - 1))
+#define Align4(Value) ((Value + 3) & ~3)
+#define Align8(Value) ((Value + 7) & ~7)
+#define Align16(Value) ((Value + 15) & ~15)
+
+inline uint32
+SafeTruncateUInt64(uint64 Value)
 {
-    int Placeholder;
-} thread_context;
+    // TODO: Defines for maximum values
+    Assert(Value <= 0xFFFFFFFF);
+    uint32 Result = (uint32)Value;
+    return(Result);
+}
+
+#if COMPILER_MSVC
+#define CompletePreviousReadsBeforeFutureReads _ReadBarrier()
+#define CompletePreviousWritesBeforeFutureWrites _WriteBarrier()
+inline uint32 AtomicCompareExchangeUInt32(uint32 volatile *Value, uint32 New, uint32 Expected)
+{
+    uint32 Result = _InterlockedCompareExchange((long volatile *)Value, New, Expected);
+
+    return(Result);
+}
+inline u32 AtomicAddU32(u32 volatile *Value, u32 Addend)
+{
+    // NOTE(casey): Returns the original value _prior_ to adding
+    u32 Result = _InterlockedExchangeAdd((long volatile *)Value, Addend);
+
+    return(Result);
+}
+inline u64 AtomicAddU64(u64 volatile *Value, u64 Addend)
+{
+    // NOTE(casey): Returns the original value _prior_ to adding
+    u64 Result = _InterlockedExchangeAdd64((__int64 volatile *)Value, Addend);
+
+    return(Result);
+}
+inline u64 AtomicExchangeU64(u64 volatile *Value, u64 New)
+{
+    u64 Result = _InterlockedExchange64((__int64 volatile *)Value, New);
+
+    return(Result);
+}
+inline u32 GetThreadID(void)
+{
+    u8 *ThreadLocalStorage = (u8 *)__readgsqword(0x30);
+    u32 ThreadID = *(u32 *)(ThreadLocalStorage + 0x48);
+
+    return(ThreadID);
+}
+#elif COMPILER_LLVM
+// TODO: Does LLVM have real read-specific barriers yet?
+#define CompletePreviousReadsBeforeFutureReads asm volatile("" ::: "memory")
+#define CompletePreviousWritesBeforeFutureWrites asm volatile("" ::: "memory")
+inline uint32 AtomicCompareExchangeUInt32(uint32 volatile *Value, uint32 New, uint32 Expected)
+{
+    uint32 Result = __sync_val_compare_and_swap(Value, Expected, New);
+
+    return(Result);
+}
+inline u32 AtomicAddU32(u32 volatile *Value, u32 Addend)
+{
+    // NOTE(casey): Returns the original value _prior_ to adding
+    u32 Result = __sync_fetch_and_add(Value, Addend);
+
+    return(Result);
+}
+inline u64 AtomicAddU64(u64 volatile *Value, u64 Addend)
+{
+    // NOTE(casey): Returns the original value _prior_ to adding
+    u64 Result = __sync_fetch_and_add(Value, Addend);
+
+    return(Result);
+}
+inline u64 AtomicExchangeU64(u64 volatile *Value, u64 New)
+{
+    u64 Result = __sync_lock_test_and_set(Value, New);
+
+    return(Result);
+}
+inline u32 GetThreadID(void)
+{
+    // NOTE: The thread's own control block address, which is the same in
+    // every module loaded into the process.
+    u32 ThreadID;
+#if defined(__x86_64__)
+    asm("mov %%fs:0x10,%0" : "=r"(ThreadID));
+#elif defined(__i386__)
+    asm("mov %%gs:0x08,%0" : "=r"(ThreadID));
+#else
+#error Unsupported architecture
+#endif
+
+    return(ThreadID);
+}
+#else
+// TODO: Need GCC/LLVM equivalents!
+#endif
 
 /*
   NOTE(casey): Services that the platform layer provides to the game
@@ -43,21 +202,274 @@ typedef struct thread_context
 */
 typedef struct debug_read_file_result
 {
-    uint32 ContentsSize;
+    uint64 ContentsSize;
     void *Contents;
 } debug_read_file_result;
 
-#define DEBUG_PLATFORM_FREE_FILE_MEMORY(name) void name(thread_context *Thread, void *Memory)
+#define DEBUG_PLATFORM_FREE_FILE_MEMORY(name) void name(void *Memory)
 typedef DEBUG_PLATFORM_FREE_FILE_MEMORY(debug_platform_free_file_memory);
 
-#define DEBUG_PLATFORM_READ_ENTIRE_FILE(name) debug_read_file_result name(thread_context *Thread, char *Filename)
+#define DEBUG_PLATFORM_READ_ENTIRE_FILE(name) debug_read_file_result name(char *Filename)
 typedef DEBUG_PLATFORM_READ_ENTIRE_FILE(debug_platform_read_entire_file);
 
-#define DEBUG_PLATFORM_WRITE_ENTIRE_FILE(name) bool32 name(thread_context *Thread, char *Filename, uint32 MemorySize, void *Memory)
+#define DEBUG_PLATFORM_WRITE_ENTIRE_FILE(name) bool32 name(char *Filename, uint64 MemorySize, void *Memory)
 typedef DEBUG_PLATFORM_WRITE_ENTIRE_FILE(debug_platform_write_entire_file);
 
+/* NOTE: TIMED_BLOCK events. Each thread that records one claims its own
+   debug_thread_events, so recording never contends with other threads. A
+   thread writes into one of its two arrays, picked by the high half of
+   ArrayIndex_EventIndex, at the index in the low half. Once a frame the
+   platform swaps every thread over to its other array with one atomic
+   exchange and collates what was in the old one. Events past
+   MAX_DEBUG_EVENT_COUNT in a frame are dropped (and counted).
+
+   The game sets GlobalDebugTable from game_memory's DebugTable each frame,
+   and defines it in its own module the way the platform layer does.
+*/
+#define MAX_DEBUG_THREAD_COUNT 32
+#define MAX_DEBUG_EVENT_COUNT 16384
+
+enum debug_event_type
+{
+    DebugEvent_BeginBlock,
+    DebugEvent_EndBlock,
+};
+typedef struct debug_event
+{
+    u64 Clock;
+    char *FileName;
+    char *BlockName;
+    u32 LineNumber;
+    u32 Type;
+} debug_event;
+
+typedef struct debug_thread_events
+{
+    u32 volatile ThreadID;
+    u64 volatile ArrayIndex_EventIndex;
+    debug_event Events[2][MAX_DEBUG_EVENT_COUNT];
+} debug_thread_events;
+
+typedef struct debug_table
+{
+    u32 volatile ThreadCount;
+    debug_thread_events Threads[MAX_DEBUG_THREAD_COUNT];
+} debug_table;
+
+extern debug_table *GlobalDebugTable;
+
+// NOTE: Filled in by DEBUGRegisterArena (handmade_memory.h) so the platform
+// layer can report arena high-water marks without knowing memory_arena.
+typedef struct debug_arena_info
+{
+    char Name[32];
+    memory_index *Size;
+    memory_index *Used;
+    memory_index *MaxUsed;
+} debug_arena_info;
+
 #endif
 
+// NOTE: Size and LastWriteTime (in nanoseconds) come from the platform's
+// listing of the file's directory, as of the GetAllFilesOfTypeBegin the file
+// was opened from.
+typedef struct platform_file_handle
+{
+    b32 NoErrors;
+    void *Platform;
+
+    u64 Size;
+    u64 LastWriteTime;
+} platform_file_handle;
+
+typedef struct platform_file_group
+{
+    u32 FileCount;
+    void *Platform;
+} platform_file_group;
+
+typedef enum platform_file_type
+{
+    PlatformFileType_AssetFile,
+    PlatformFileType_SavedGameFile,
+
+    PlatformFileType_Count,
+} platform_file_type;
+
+#define PLATFORM_GET_ALL_FILE_OF_TYPE_BEGIN(name) platform_file_group name(platform_file_type Type)
+typedef PLATFORM_GET_ALL_FILE_OF_TYPE_BEGIN(platform_get_all_files_of_type_begin);
+
+#define PLATFORM_GET_ALL_FILE_OF_TYPE_END(name) void name(platform_file_group *FileGroup)
+typedef PLATFORM_GET_ALL_FILE_OF_TYPE_END(platform_get_all_files_of_type_end);
+
+#define PLATFORM_OPEN_FILE(name) platform_file_handle name(platform_file_group *FileGroup)
+typedef PLATFORM_OPEN_FILE(platform_open_next_file);
+
+// NOTE: Handles outlive the group they were opened from, and stay open until
+// CloseFile. Nothing may still be reading from the handle (including async
+// reads and streams on it) when it is closed. Pointers from MapFileRange on
+// it are no longer good after CloseFile or GetAllFilesOfTypeEnd on its
+// group, whichever comes first.
+#define PLATFORM_CLOSE_FILE(name) void name(platform_file_handle *Handle)
+typedef PLATFORM_CLOSE_FILE(platform_close_file);
+
+#define PLATFORM_READ_DATA_FROM_FILE(name) void name(platform_file_handle *Source, u64 Offset, u64 Size, void *Dest)
+typedef PLATFORM_READ_DATA_FROM_FILE(platform_read_data_from_file);
+
+typedef enum platform_file_access
+{
+    PlatformFileAccess_Normal,
+    PlatformFileAccess_WillNeed,
+    PlatformFileAccess_Sequential,
+    PlatformFileAccess_Random,
+} platform_file_access;
+
+// NOTE: Returns a read-only pointer to Size bytes at Offset in the file itself,
+// or 0 if the range isn't in the file. The whole file is mapped on first use,
+// so there is no copy and the pages are the page cache's, shared with any
+// other process reading the same file. Access tells the OS how the range is
+// about to be read. Pointers are no longer good after CloseFile on Source or
+// GetAllFilesOfTypeEnd on the group it came from, whichever comes first.
+#define PLATFORM_MAP_FILE_RANGE(name) void *name(platform_file_handle *Source, u64 Offset, u64 Size, platform_file_access Access)
+typedef PLATFORM_MAP_FILE_RANGE(platform_map_file_range);
+
+// NOTE: Reads Size bytes of Source from Offset a window at a time, for files
+// too big to read whole. Each ReadNextFileWindow fills Window with the next
+// WindowSize bytes (fewer at the end) and returns how many, or 0 once the
+// range is done or a read has failed.
+typedef struct platform_file_stream
+{
+    platform_file_handle *Source;
+    u64 Offset;
+    u64 OnePastLastOffset;
+    u64 WindowSize;
+    void *Window;
+} platform_file_stream;
+
+inline platform_file_stream
+BeginFileStream(platform_file_handle *Source, u64 Offset, u64 Size, u64 WindowSize, void *Window)
+{
+    platform_file_stream Result = {};
+    Result.Source = Source;
+    Result.Offset = Offset;
+    Result.OnePastLastOffset = Offset + Size;
+    Result.WindowSize = WindowSize;
+    Result.Window = Window;
+    return(Result);
+}
+
+#define PLATFORM_READ_NEXT_FILE_WINDOW(name) u64 name(platform_file_stream *Stream)
+typedef PLATFORM_READ_NEXT_FILE_WINDOW(platform_read_next_file_window);
+
+#define PLATFORM_FILE_ERROR(name) void name(platform_file_handle *Handle, char *Message)
+typedef PLATFORM_FILE_ERROR(platform_file_error);
+
+#define PlatformNoFileErrors(Handle) ((Handle)->NoErrors)
+
+struct platform_work_queue;
+#define PLATFORM_WORK_QUEUE_CALLBACK(name) void name(platform_work_queue *Queue, void *Data)
+typedef PLATFORM_WORK_QUEUE_CALLBACK(platform_work_queue_callback);
+
+// NOTE: Queues the read and returns immediately. When the read is done,
+// Callback(Queue, Data) is added to Queue as a regular entry; Source->NoErrors
+// tells it whether the read succeeded. The read counts as outstanding work on
+// Queue, so CompleteAllWork(Queue) also waits for it. Source and Dest must stay
+// valid until the callback runs.
+#define PLATFORM_READ_DATA_FROM_FILE_ASYNC(name) void name(platform_work_queue *Queue, platform_file_handle *Source, u64 Offset, u64 Size, void *Dest, platform_work_queue_callback *Callback, void *Data)
+typedef PLATFORM_READ_DATA_FROM_FILE_ASYNC(platform_read_data_from_file_async);
+
+// NOTE: One read of consecutive bytes from Offset, scattered over Segments in
+// order, so reads of things stored next to each other can be coalesced into
+// a single request. A segment with Dest 0 skips its Size bytes, which can be
+// at most PLATFORM_MAX_READ_SKIP. Otherwise like ReadDataFromFileAsync; the
+// Segments array itself is copied and needn't outlive the call.
+#define PLATFORM_MAX_READ_SEGMENTS 16
+#define PLATFORM_MAX_READ_SKIP Kilobytes(64)
+typedef struct platform_read_segment
+{
+    u64 Size;
+    void *Dest;
+} platform_read_segment;
+
+#define PLATFORM_READ_SEGMENTS_FROM_FILE_ASYNC(name) void name(platform_work_queue *Queue, platform_file_handle *Source, u64 Offset, u32 SegmentCount, platform_read_segment *Segments, platform_work_queue_callback *Callback, void *Data)
+typedef PLATFORM_READ_SEGMENTS_FROM_FILE_ASYNC(platform_read_segments_from_file_async);
+
+// NOTE: Saved games (.hhs). SaveGame copies the regions before it returns -
+// that copy is all the caller pays - and compresses and writes them on a
+// background thread, to a temp file that is renamed over Name.hhs in the
+// executable's directory once it is complete. It returns false if the save
+// couldn't be queued (too many still being written, or out of memory); a
+// write that fails later leaves any old save of that name as it was.
+// LoadGame fills the regions from a file opened from a
+// PlatformFileType_SavedGameFile group, and fails without touching them
+// unless the file was saved with as many regions of the same sizes.
+typedef struct platform_save_region
+{
+    void *Memory;
+    u64 Size;
+} platform_save_region;
+
+#define PLATFORM_SAVE_GAME(name) b32 name(char *Name, u32 RegionCount, platform_save_region *Regions)
+typedef PLATFORM_SAVE_GAME(platform_save_game);
+
+#define PLATFORM_LOAD_GAME(name) b32 name(platform_file_handle *Source, u32 RegionCount, platform_save_region *Regions)
+typedef PLATFORM_LOAD_GAME(platform_load_game);
+
+#define PLATFORM_ALLOCATE_MEMORY(name) void *name(memory_index Size)
+typedef PLATFORM_ALLOCATE_MEMORY(platform_allocate_memory);
+
+#define PLATFORM_DEALLOCATE_MEMORY(name) void name(void *Memory)
+typedef PLATFORM_DEALLOCATE_MEMORY(platform_deallocate_memory);
+
+typedef struct platform_memory_stats
+{
+    u64 AllocationCount;
+    u64 DeallocationCount;
+    u64 LiveAllocationCount;
+
+    // NOTE: Live bytes are counted at the granularity they were handed out
+    // (size class for small blocks, whole mapping for large ones).
+    u64 LiveBytes;
+    u64 SlabBytes;
+    u64 LargeBytes;
+} platform_memory_stats;
+
+#define PLATFORM_GET_MEMORY_STATS(name) void name(platform_memory_stats *Stats)
+typedef PLATFORM_GET_MEMORY_STATS(platform_get_memory_stats);
+
+typedef void platform_add_entry(platform_work_queue *Queue, platform_work_queue_callback *Callback, void *Data);
+typedef void platform_complete_all_work(platform_work_queue *Queue);
+
+typedef struct platform_api
+{
+    platform_add_entry *AddEntry;
+    platform_complete_all_work *CompleteAllWork;
+
+    platform_get_all_files_of_type_begin *GetAllFilesOfTypeBegin;
+    platform_get_all_files_of_type_end *GetAllFilesOfTypeEnd;
+    platform_open_next_file *OpenNextFile;
+    platform_close_file *CloseFile;
+    platform_read_data_from_file *ReadDataFromFile;
+    platform_read_data_from_file_async *ReadDataFromFileAsync;
+    platform_read_segments_from_file_async *ReadSegmentsFromFileAsync;
+    platform_map_file_range *MapFileRange;
+    platform_read_next_file_window *ReadNextFileWindow;
+    platform_file_error *FileError;
+
+    platform_save_game *SaveGame;
+    platform_load_game *LoadGame;
+
+    platform_allocate_memory *AllocateMemory;
+    platform_deallocate_memory *DeallocateMemory;
+    platform_get_memory_stats *GetMemoryStats;
+
+#if HANDMADE_INTERNAL
+    debug_platform_free_file_memory *DEBUGFreeFileMemory;
+    debug_platform_read_entire_file *DEBUGReadEntireFile;
+    debug_platform_write_entire_file *DEBUGWriteEntireFile;
+#endif
+} platform_api;
+
 /*
   NOTE(casey): Services that the game provides to the platform layer.
   (this may expand in the future - sound on separate thread, etc.)
@@ -129,39 +541,178 @@ typedef struct game_input
     game_button_state MouseButtons[5];
     int32 MouseX, MouseY, MouseZ;
 
+    bool32 ExecutableReloaded;
     real32 dtForFrame;
 
+    // NOTE: Each call advances the simulation SimStepCount steps of
+    // dtForFrame, which may be none when rendering runs faster than the
+    // simulation, and then renders tInterpolate of the way from the state
+    // before the last step to the state after it. Without a fixed timestep
+    // the platform passes one step per frame and a tInterpolate of 1.
+    uint32 SimStepCount;
+    real32 tInterpolate;
+
     game_controller_input Controllers[5];
 } game_input;
 
-typedef struct game_memory
+inline game_controller_input *GetController(game_input *Input, int unsigned ControllerIndex)
 {
-    bool32 IsInitialized;
+    Assert(ControllerIndex < ArrayCount(Input->Controllers));
 
+    game_controller_input *Result = &Input->Controllers[ControllerIndex];
+    return(Result);
+}
+
+typedef struct game_memory
+{
     uint64 PermanentStorageSize;
     void *PermanentStorage; // NOTE(casey): REQUIRED to be cleared to zero at startup
 
     uint64 TransientStorageSize;
     void *TransientStorage; // NOTE(casey): REQUIRED to be cleared to zero at startup
 
-    debug_platform_free_file_memory *DEBUGPlatformFreeFileMemory;
-    debug_platform_read_entire_file *DEBUGPlatformReadEntireFile;
-    debug_platform_write_entire_file *DEBUGPlatformWriteEntireFile;
+    // NOTE: Memory for things that can always be rebuilt from permanent and
+    // transient storage (loaded assets, derived data). Looped input playback
+    // only saves and restores permanent + transient storage, so after a
+    // restore the platform sets CacheStorageInvalidated. The game must then
+    // throw away whatever it keeps in here and clear the flag.
+    uint64 CacheStorageSize;
+    void *CacheStorage; // NOTE: REQUIRED to be cleared to zero at startup
+    bool32 CacheStorageInvalidated;
+
+    platform_work_queue *HighPriorityQueue;
+    platform_work_queue *LowPriorityQueue;
+
+    platform_api PlatformAPI;
+
+#if HANDMADE_INTERNAL
+    debug_table *DebugTable;
+
+    uint32 DebugArenaCount;
+    debug_arena_info DebugArenas[32];
+#endif
 } game_memory;
 
-#define GAME_UPDATE_AND_RENDER(name) void name(thread_context *Thread, game_memory *Memory, game_input *Input, game_offscreen_buffer *Buffer)
+#define GAME_UPDATE_AND_RENDER(name) void name(game_memory *Memory, game_input *Input, game_offscreen_buffer *Buffer)
 typedef GAME_UPDATE_AND_RENDER(game_update_and_render);
 
 // NOTE(casey): At the moment, this has to be a very fast function, it cannot be
 // more than a millisecond or so.
 // TODO(casey): Reduce the pressure on this function's performance by measuring it
 // or asking about it, etc.
-#define GAME_GET_SOUND_SAMPLES(name) void name(thread_context *Thread, game_memory *Memory, game_sound_output_buffer *SoundBuffer)
+#define GAME_GET_SOUND_SAMPLES(name) void name(game_memory *Memory, game_sound_output_buffer *SoundBuffer)
 typedef GAME_GET_SOUND_SAMPLES(game_get_sound_samples);
 
+// NOTE: Bump HANDMADE_API_VERSION whenever game_memory, game_input or
+// platform_api change shape. The game exports GameGetAPIVersion returning the
+// value it was built with, and the platform layer won't run game code built
+// against a different one.
+#define HANDMADE_API_VERSION 5
+#define GAME_GET_API_VERSION(name) uint32 name(void)
+typedef GAME_GET_API_VERSION(game_get_api_version);
+
 #ifdef __cplusplus
 }
 #endif
 
+#if HANDMADE_INTERNAL && defined(__cplusplus)
+inline debug_thread_events *
+GetDebugThreadEvents(debug_table *Table)
+{
+    // NOTE: Each module (the platform layer, the game) has its own copy of
+    // these, so a thread finds the events it already claimed by its ID.
+    static thread_local debug_thread_events *ThreadEvents;
+    static thread_local b32 Looked;
+
+    if(!Looked)
+    {
+        Looked = true;
+
+        u32 ThreadID = GetThreadID();
+        u32 ThreadCount = Table->ThreadCount;
+        if(ThreadCount > MAX_DEBUG_THREAD_COUNT)
+        {
+            ThreadCount = MAX_DEBUG_THREAD_COUNT;
+        }
+
+        for(u32 ThreadIndex = 0;
+            ThreadIndex < ThreadCount;
+            ++ThreadIndex)
+        {
+            if(Table->Threads[ThreadIndex].ThreadID == ThreadID)
+            {
+                ThreadEvents = Table->Threads + ThreadIndex;
+                break;
+            }
+        }
+
+        if(!ThreadEvents)
+        {
+            u32 ThreadIndex = AtomicAddU32(&Table->ThreadCount, 1);
+            Assert(ThreadIndex < MAX_DEBUG_THREAD_COUNT);
+            if(ThreadIndex < MAX_DEBUG_THREAD_COUNT)
+            {
+                ThreadEvents = Table->Threads + ThreadIndex;
+                ThreadEvents->ThreadID = ThreadID;
+            }
+        }
+    }
+
+    return(ThreadEvents);
+}
+
+inline void
+RecordDebugEvent(u32 Type, char *FileName, u32 LineNumber, char *BlockName)
+{
+    debug_table *Table = GlobalDebugTable;
+    if(Table)
+    {
+        debug_thread_events *Thread = GetDebugThreadEvents(Table);
+        if(Thread)
+        {
+            u64 ArrayIndex_EventIndex = AtomicAddU64(&Thread->ArrayIndex_EventIndex, 1);
+            u32 EventIndex = (u32)(ArrayIndex_EventIndex & 0xFFFFFFFF);
+            if(EventIndex < MAX_DEBUG_EVENT_COUNT)
+            {
+                debug_event *Event = Thread->Events[ArrayIndex_EventIndex >> 32] + EventIndex;
+                Event->Clock = __rdtsc();
+                Event->FileName = FileName;
+                Event->BlockName = BlockName;
+                Event->LineNumber = LineNumber;
+                Event->Type = Type;
+            }
+        }
+    }
+}
+
+struct timed_block
+{
+    char *FileName;
+    char *BlockName;
+    u32 LineNumber;
+
+    timed_block(char *FileNameInit, u32 LineNumberInit, char *BlockNameInit)
+    {
+        FileName = FileNameInit;
+        BlockName = BlockNameInit;
+        LineNumber = LineNumberInit;
+        RecordDebugEvent(DebugEvent_BeginBlock, FileName, LineNumber, BlockName);
+    }
+
+    ~timed_block()
+    {
+        RecordDebugEvent(DebugEvent_EndBlock, FileName, LineNumber, BlockName);
+    }
+};
+
+#define TIMED_BLOCK__(BlockName, Number) timed_block TimedBlock_##Number((char *)__FILE__, __LINE__, (char *)BlockName)
+#define TIMED_BLOCK_(BlockName, Number) TIMED_BLOCK__(BlockName, Number)
+#define TIMED_BLOCK(BlockName) TIMED_BLOCK_(#BlockName, __LINE__)
+#define TIMED_FUNCTION() TIMED_BLOCK_(__FUNCTION__, __LINE__)
+#else
+#define TIMED_BLOCK(BlockName)
+#define TIMED_FUNCTION()
+#endif
+
 #define HANDMADE_PLATFORM_H
 #endif
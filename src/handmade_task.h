@@ -0,0 +1,275 @@
+#if !defined(HANDMADE_TASK_H)
+
+/* NOTE: Coroutine jobs for the platform work queues.
+
+   A plain work queue callback has to run to completion, so a job that loads
+   an asset keeps its worker blocked in the read for as long as the disk takes.
+   A task is a C++20 coroutine that runs on a platform_work_queue but can
+   suspend:
+
+     - co_await TaskReadDataFromFile(...) hands the read to the platform and
+       gives the worker back to the queue. The task is re-added to its queue
+       when the read completes.
+     - co_await SomeOtherTask(...) runs the child task and continues the parent
+       once the child is done.
+
+   Every task function takes a task_context * as its FIRST parameter, and its
+   coroutine frame is allocated out of that context's frame arena, never the
+   heap. If the arena is full the task comes back empty; StartTask returns
+   false and co_await on it returns false without running anything.
+
+   A task must either be started with StartTask or co_awaited exactly once,
+   otherwise its frame is never returned to the arena.
+*/
+
+#include <coroutine>
+
+struct task_frame_header
+{
+    struct task_frame_arena *Arena;
+    task_frame_header *NextFree;
+};
+
+struct task_frame_arena
+{
+    uint32 volatile Lock;
+
+    memory_index BlockSize;
+    u32 BlockCount;
+    u32 BlocksCarved;
+    u8 *Base;
+    task_frame_header *FirstFree;
+
+    u32 BlocksInUse;
+    u32 MaxBlocksInUse;
+};
+
+struct task_context
+{
+    platform_api *Platform;
+    platform_work_queue *Queue;
+    task_frame_arena *FrameArena;
+};
+
+inline void
+InitializeTaskFrameArena(task_frame_arena *Arena, memory_index Size, void *Base, memory_index BlockSize)
+{
+    Assert(BlockSize > sizeof(task_frame_header));
+
+    *Arena = {};
+    Arena->BlockSize = Align16(BlockSize);
+    Arena->BlockCount = (u32)(Size / Arena->BlockSize);
+    Arena->Base = (u8 *)Base;
+}
+
+inline void
+BeginTaskFrameArenaLock(task_frame_arena *Arena)
+{
+    while(AtomicCompareExchangeUInt32(&Arena->Lock, 1, 0) != 0)
+    {
+        _mm_pause();
+    }
+}
+
+inline void
+EndTaskFrameArenaLock(task_frame_arena *Arena)
+{
+    CompletePreviousWritesBeforeFutureWrites;
+    Arena->Lock = 0;
+}
+
+inline void *
+AllocateTaskFrame(task_frame_arena *Arena, memory_index Size)
+{
+    void *Result = 0;
+
+    memory_index TotalSize = Size + sizeof(task_frame_header);
+    Assert(TotalSize <= Arena->BlockSize);
+    if(TotalSize <= Arena->BlockSize)
+    {
+        BeginTaskFrameArenaLock(Arena);
+        task_frame_header *Header = Arena->FirstFree;
+        if(Header)
+        {
+            Arena->FirstFree = Header->NextFree;
+        }
+        else if(Arena->BlocksCarved < Arena->BlockCount)
+        {
+            Header = (task_frame_header *)(Arena->Base + Arena->BlocksCarved++*Arena->BlockSize);
+        }
+
+        if(Header)
+        {
+            ++Arena->BlocksInUse;
+            if(Arena->MaxBlocksInUse < Arena->BlocksInUse)
+            {
+                Arena->MaxBlocksInUse = Arena->BlocksInUse;
+            }
+        }
+        EndTaskFrameArenaLock(Arena);
+
+        if(Header)
+        {
+            Header->Arena = Arena;
+            Result = Header + 1;
+        }
+    }
+
+    return(Result);
+}
+
+inline void
+FreeTaskFrame(void *Memory)
+{
+    if(Memory)
+    {
+        task_frame_header *Header = (task_frame_header *)Memory - 1;
+        task_frame_arena *Arena = Header->Arena;
+
+        BeginTaskFrameArenaLock(Arena);
+        Header->NextFree = Arena->FirstFree;
+        Arena->FirstFree = Header;
+        --Arena->BlocksInUse;
+        EndTaskFrameArenaLock(Arena);
+    }
+}
+
+static PLATFORM_WORK_QUEUE_CALLBACK(DoTaskWork)
+{
+    std::coroutine_handle<>::from_address(Data).resume();
+}
+
+struct task;
+
+struct task_final_awaiter
+{
+    bool await_ready() noexcept {return(false);}
+    void await_resume() noexcept {}
+
+    template<typename promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<promise> Handle) noexcept
+    {
+        // NOTE: An awaited task continues its parent, which destroys it. A
+        // started task has nobody waiting on it, so it frees itself.
+        std::coroutine_handle<> Result = Handle.promise().Continuation;
+        if(!Result)
+        {
+            Handle.destroy();
+            Result = std::noop_coroutine();
+        }
+
+        return(Result);
+    }
+};
+
+struct task_promise
+{
+    std::coroutine_handle<> Continuation;
+
+    template<typename... arguments>
+    void *operator new(memory_index Size, task_context *Context, arguments &...) noexcept
+    {
+        void *Result = AllocateTaskFrame(Context->FrameArena, Size);
+        return(Result);
+    }
+
+    void operator delete(void *Memory)
+    {
+        FreeTaskFrame(Memory);
+    }
+
+    static task get_return_object_on_allocation_failure();
+    task get_return_object();
+
+    std::suspend_always initial_suspend() noexcept {return(std::suspend_always());}
+    task_final_awaiter final_suspend() noexcept {return(task_final_awaiter());}
+    void return_void() {}
+    void unhandled_exception() {InvalidCodePath;}
+};
+
+struct task
+{
+    typedef task_promise promise_type;
+
+    std::coroutine_handle<task_promise> Handle;
+
+    // NOTE: co_await on a task runs it and resumes the awaiting coroutine
+    // when it finishes. Returns false if the task never got a frame.
+    bool await_ready() {return(!Handle);}
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> Awaiter)
+    {
+        Handle.promise().Continuation = Awaiter;
+        return(Handle);
+    }
+
+    b32 await_resume()
+    {
+        b32 Result = (Handle != 0);
+        if(Handle)
+        {
+            Handle.destroy();
+            Handle = 0;
+        }
+
+        return(Result);
+    }
+};
+
+inline task
+task_promise::get_return_object_on_allocation_failure()
+{
+    task Result = {};
+    return(Result);
+}
+
+inline task
+task_promise::get_return_object()
+{
+    task Result = {};
+    Result.Handle = std::coroutine_handle<task_promise>::from_promise(*this);
+    return(Result);
+}
+
+inline b32
+StartTask(task_context *Context, task Task)
+{
+    b32 Result = (Task.Handle != 0);
+    if(Result)
+    {
+        Context->Platform->AddEntry(Context->Queue, DoTaskWork, Task.Handle.address());
+    }
+
+    return(Result);
+}
+
+struct task_file_read
+{
+    task_context *Context;
+    platform_file_handle *Source;
+    u64 Offset;
+    u64 Size;
+    void *Dest;
+
+    bool await_ready() {return(!PlatformNoFileErrors(Source));}
+
+    void await_suspend(std::coroutine_handle<> Awaiter)
+    {
+        // NOTE: The read may complete and resume the task on another worker
+        // before this returns, so nothing here may touch *this afterwards.
+        Context->Platform->ReadDataFromFileAsync(Context->Queue, Source, Offset, Size, Dest,
+                                                 DoTaskWork, Awaiter.address());
+    }
+
+    b32 await_resume() {return(PlatformNoFileErrors(Source));}
+};
+
+inline task_file_read
+TaskReadDataFromFile(task_context *Context, platform_file_handle *Source, u64 Offset, u64 Size, void *Dest)
+{
+    task_file_read Result = {Context, Source, Offset, Size, Dest};
+    return(Result);
+}
+
+#define HANDMADE_TASK_H
+#endif
@@ -1,23 +1,36 @@
-#include "sdl_handmade.h"
+#include "handmade_platform.h"
+#include "handmade_compression.h"
+#include "handmade_memory.h"
 
 #include <cstring>
 
-#include "handmade_platform.h"
-
 #include <SDL.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <glob.h>
+#include <errno.h>
+#include <dirent.h>
 #include <dlfcn.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <sys/inotify.h>
+#include <sys/uio.h>
+#include <sys/prctl.h>
+#include <time.h>
+#include <linux/io_uring.h>
+#include <linux/perf_event.h>
+#include <linux/userfaultfd.h>
 #include <x86intrin.h>
 
 #include "SDL_haptic.h"
 #include "SDL_oldnames.h"
 
+#include "sdl_handmade.h"
+
 // NOTE: MAP_ANONYMOUS is not defined on Mac OS X and some other UNIX systems.
 // On the vast majority of those systems, one can use MAP_ANON instead.
 // Huge thanks to Adam Rosenfield for investigating this, and suggesting this
@@ -26,12 +39,29 @@
 #define MAP_ANONYMOUS MAP_ANON
 #endif
 
+// NOTE: Older glibc headers only have these in <linux/mman.h>.
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
 // TODO(casey): This is a global for now.
 static bool32 GlobalRunning;
 static bool32 GlobalPause;
+#if HANDMADE_INTERNAL
+debug_table *GlobalDebugTable;
+static sdl_debug_state GlobalDebugState;
+#endif
+static sdl_frame_stats GlobalFrameStats;
 static sdl_offscreen_buffer GlobalBackbuffer;
 static uint64 GlobalPerfCountFrequency;
 static bool32 DEBUGGlobalShowCursor;
+static sdl_huge_page_mode GlobalHugePageMode;
 
 #define MAX_CONTROLLERS 4
 #define CONTROLLER_AXIS_LEFT_DEADZONE 7849
@@ -110,6 +140,38 @@ DEBUG_PLATFORM_FREE_FILE_MEMORY(DEBUGPlatformFreeFileMemory)
     }
 }
 
+// NOTE: One pread moves at most a little under 2GB and may stop short of
+// what it was asked for, so SDLReadAt goes a chunk at a time until all of Size
+// is read, the file ends or a read fails, and returns how much it got.
+#define SDL_MAX_READ_CHUNK_SIZE Gigabytes(1)
+
+static u64
+SDLReadAt(int FileHandle, u64 Offset, u64 Size, void *Dest)
+{
+    u64 BytesRead = 0;
+    uint8 *DestLocation = (uint8 *)Dest;
+    while(BytesRead < Size)
+    {
+        u64 ChunkSize = Size - BytesRead;
+        if(ChunkSize > SDL_MAX_READ_CHUNK_SIZE)
+        {
+            ChunkSize = SDL_MAX_READ_CHUNK_SIZE;
+        }
+
+        ssize_t ChunkRead = pread(FileHandle, DestLocation + BytesRead, ChunkSize, Offset + BytesRead);
+        if(ChunkRead > 0)
+        {
+            BytesRead += ChunkRead;
+        }
+        else if(!((ChunkRead == -1) && (errno == EINTR)))
+        {
+            break;
+        }
+    }
+
+    return(BytesRead);
+}
+
 DEBUG_PLATFORM_READ_ENTIRE_FILE(DEBUGPlatformReadEntireFile)
 {
     debug_read_file_result Result = {};
@@ -126,7 +188,7 @@ DEBUG_PLATFORM_READ_ENTIRE_FILE(DEBUGPlatformReadEntireFile)
         close(FileHandle);
         return Result;
     }
-    Result.ContentsSize = SafeTruncateUInt64(FileStatus.st_size);
+    Result.ContentsSize = FileStatus.st_size;
 
     Result.Contents = malloc(Result.ContentsSize);
     if(!Result.Contents)
@@ -136,22 +198,11 @@ DEBUG_PLATFORM_READ_ENTIRE_FILE(DEBUGPlatformReadEntireFile)
         return Result;
     }
 
-
-    uint32 BytesToRead = Result.ContentsSize;
-    uint8 *NextByteLocation = (uint8*)Result.Contents;
-    while (BytesToRead)
+    if(SDLReadAt(FileHandle, 0, Result.ContentsSize, Result.Contents) != Result.ContentsSize)
     {
-        ssize_t BytesRead = read(FileHandle, NextByteLocation, BytesToRead);
-        if (BytesRead == -1)
-        {
-            free(Result.Contents);
-            Result.Contents = 0;
-            Result.ContentsSize = 0;
-            close(FileHandle);
-            return Result;
-        }
-        BytesToRead -= BytesRead;
-        NextByteLocation += BytesRead;
+        free(Result.Contents);
+        Result.Contents = 0;
+        Result.ContentsSize = 0;
     }
 
     close(FileHandle);
@@ -162,10 +213,10 @@ DEBUG_PLATFORM_WRITE_ENTIRE_FILE(DEBUGPlatformWriteEntireFile)
 {
     int FileHandle = open(Filename, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
 
-    if (!FileHandle)
+    if (FileHandle == -1)
         return false;
 
-    uint32 BytesToWrite = MemorySize;
+    uint64 BytesToWrite = MemorySize;
     uint8 *NextByteLocation = (uint8*)Memory;
     while (BytesToWrite)
     {
@@ -184,40 +235,141 @@ DEBUG_PLATFORM_WRITE_ENTIRE_FILE(DEBUGPlatformWriteEntireFile)
     return true;
 }
 
-inline time_t
+inline uint64
 SDLGetLastWriteTime(char *Filename)
 {
-    time_t LastWriteTime = 0;
+    // NOTE: In nanoseconds; whole seconds miss two builds in one second.
+    uint64 LastWriteTime = 0;
 
     struct stat FileStatus;
     if(stat(Filename, &FileStatus) == 0)
     {
-        LastWriteTime = FileStatus.st_mtime;
+        LastWriteTime = ((uint64)FileStatus.st_mtim.tv_sec*1000000000ULL +
+                         (uint64)FileStatus.st_mtim.tv_nsec);
     }
 
     return(LastWriteTime);
 }
 
+static bool32
+SDLCopyFile(char *SourceName, char *DestName)
+{
+    bool32 Result = false;
+
+    int SourceHandle = open(SourceName, O_RDONLY | O_CLOEXEC);
+    if(SourceHandle != -1)
+    {
+        int DestHandle = open(DestName, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRWXU);
+        struct stat FileStatus;
+        if((DestHandle != -1) && (fstat(SourceHandle, &FileStatus) == 0))
+        {
+            // NOTE: sendfile copies in the kernel, without bringing the
+            // library through a buffer of ours.
+            off_t Remaining = FileStatus.st_size;
+            Result = true;
+            while(Result && Remaining)
+            {
+                ssize_t Copied = sendfile(DestHandle, SourceHandle, 0, Remaining);
+                if(Copied > 0)
+                {
+                    Remaining -= Copied;
+                }
+                else if(!((Copied == -1) && (errno == EINTR)))
+                {
+                    Result = false;
+                }
+            }
+        }
+
+        if(DestHandle != -1)
+        {
+            close(DestHandle);
+        }
+        close(SourceHandle);
+    }
+
+    return(Result);
+}
+
+static sdl_game_code_symbol GlobalGameCodeSymbols[] =
+{
+    {"GameUpdateAndRender", offsetof(sdl_game_code, UpdateAndRender), true},
+    {"GameGetSoundSamples", offsetof(sdl_game_code, GetSoundSamples), true},
+    {"GameGetAPIVersion", offsetof(sdl_game_code, GetAPIVersion), true},
+};
+
+static void
+SDLUnloadGameCode(sdl_game_code *GameCode)
+{
+    if(GameCode->GameCodeDLL)
+    {
+        dlclose(GameCode->GameCodeDLL);
+        GameCode->GameCodeDLL = 0;
+    }
+
+    if(GameCode->TempDLLName[0])
+    {
+        unlink(GameCode->TempDLLName);
+        GameCode->TempDLLName[0] = 0;
+    }
+
+    GameCode->IsValid = false;
+    GameCode->UpdateAndRender = 0;
+    GameCode->GetSoundSamples = 0;
+    GameCode->GetAPIVersion = 0;
+}
+
 static sdl_game_code
-SDLLoadGameCode(char *SourceDLLName)
+SDLLoadGameCode(char *SourceDLLName, char *TempDLLName)
 {
     sdl_game_code Result = {};
+    uint64 StartCounter = SDL_GetPerformanceCounter();
 
     Result.DLLLastWriteTime = SDLGetLastWriteTime(SourceDLLName);
 
-    if(Result.DLLLastWriteTime)
+    // NOTE: The library is loaded from a copy, so the build can replace
+    // handmade.so while the game runs, and the copy has a name of its own,
+    // because dlopen hands back the library it already has for a name it
+    // has seen. RTLD_NOW binds every symbol here, rather than on the first
+    // call through each one in the middle of a frame, and fails here if any
+    // of them can't be.
+    if(Result.DLLLastWriteTime && SDLCopyFile(SourceDLLName, TempDLLName))
     {
-        Result.GameCodeDLL = dlopen(SourceDLLName, RTLD_LAZY);
+        strncpy(Result.TempDLLName, TempDLLName, sizeof(Result.TempDLLName) - 1);
+        Result.GameCodeDLL = dlopen(TempDLLName, RTLD_NOW | RTLD_LOCAL);
         if(Result.GameCodeDLL)
         {
-            Result.UpdateAndRender = (game_update_and_render *)
-                dlsym(Result.GameCodeDLL, "GameUpdateAndRender");
-
-            Result.GetSoundSamples = (game_get_sound_samples *)
-                dlsym(Result.GameCodeDLL, "GameGetSoundSamples");
+            Result.IsValid = true;
+            for(uint32 SymbolIndex = 0;
+                SymbolIndex < ArrayCount(GlobalGameCodeSymbols);
+                ++SymbolIndex)
+            {
+                sdl_game_code_symbol *Symbol = GlobalGameCodeSymbols + SymbolIndex;
+                void *Address = dlsym(Result.GameCodeDLL, Symbol->Name);
+                *(void **)((uint8 *)&Result + Symbol->Offset) = Address;
+                if(!Address && Symbol->Required)
+                {
+                    // TODO: Diagnostic
+#if HANDMADE_INTERNAL
+                    printf("%s doesn't export %s\n", SourceDLLName, Symbol->Name);
+#endif
+                    Result.IsValid = false;
+                }
+            }
 
-            Result.IsValid = (Result.UpdateAndRender &&
-                              Result.GetSoundSamples);
+            if(Result.IsValid)
+            {
+                uint32 Version = Result.GetAPIVersion();
+                if(Version != HANDMADE_API_VERSION)
+                {
+                    // TODO: Diagnostic
+#if HANDMADE_INTERNAL
+                    printf("%s was built against API version %u, not %u\n",
+                           SourceDLLName, Version, HANDMADE_API_VERSION);
+#endif
+                    Result.IsValid = false;
+                }
+            }
         }
         else
         {
@@ -227,25 +379,106 @@ SDLLoadGameCode(char *SourceDLLName)
 
     if(!Result.IsValid)
     {
-        Result.UpdateAndRender = 0;
-        Result.GetSoundSamples = 0;
+        SDLUnloadGameCode(&Result);
     }
 
+    Result.LoadCounter = SDL_GetPerformanceCounter() - StartCounter;
+
     return(Result);
 }
 
 static void
-SDLUnloadGameCode(sdl_game_code *GameCode)
+SDLInitGameCodeWatch(sdl_game_code_watch *Watch, char *DLLFullPath)
 {
-    if(GameCode->GameCodeDLL)
+    // NOTE: Watches the directory rather than the library, because builds
+    // replace the library: build.sh writes a temp file and renames it over
+    // (IN_MOVED_TO), linkers writing it in place close it (IN_CLOSE_WRITE).
+    Watch->Changed = false;
+    Watch->FileName = DLLFullPath;
+    for(char *Scan = DLLFullPath; *Scan; ++Scan)
     {
-        dlclose(GameCode->GameCodeDLL);
-        GameCode->GameCodeDLL = 0;
+        if(*Scan == '/')
+        {
+            Watch->FileName = Scan + 1;
+        }
     }
 
-    GameCode->IsValid = false;
-    GameCode->UpdateAndRender = 0;
-    GameCode->GetSoundSamples = 0;
+    char Directory[SDL_STATE_FILE_NAME_COUNT] = ".";
+    memory_index DirectoryLength = Watch->FileName - DLLFullPath;
+    if(DirectoryLength && (DirectoryLength < sizeof(Directory)))
+    {
+        memcpy(Directory, DLLFullPath, DirectoryLength);
+        Directory[DirectoryLength] = 0;
+    }
+
+    Watch->Handle = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if((Watch->Handle != -1) &&
+       (inotify_add_watch(Watch->Handle, Directory, IN_CLOSE_WRITE | IN_MOVED_TO) == -1))
+    {
+        close(Watch->Handle);
+        Watch->Handle = -1;
+    }
+
+    if(Watch->Handle == -1)
+    {
+        // TODO: Diagnostic
+#if HANDMADE_INTERNAL
+        printf("inotify unavailable, checking %s for changes every frame\n", DLLFullPath);
+#endif
+        Watch->LastWriteTime = SDLGetLastWriteTime(DLLFullPath);
+    }
+}
+
+static bool32
+SDLGameCodeChanged(sdl_game_code_watch *Watch, char *DLLFullPath)
+{
+    bool32 Result = false;
+
+    if(Watch->Handle != -1)
+    {
+        // NOTE: Non-blocking, so with nothing queued this is one read that
+        // fails with EAGAIN.
+        uint8 Events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        ssize_t BytesRead;
+        while((BytesRead = read(Watch->Handle, Events, sizeof(Events))) > 0)
+        {
+            uint8 *At = Events;
+            while(At < (Events + BytesRead))
+            {
+                struct inotify_event *Event = (struct inotify_event *)At;
+                if((Event->mask & IN_Q_OVERFLOW) ||
+                   (Event->len && (strcmp(Event->name, Watch->FileName) == 0)))
+                {
+                    Watch->Changed = true;
+                    Watch->LastEventCounter = SDL_GetPerformanceCounter();
+                }
+                At += sizeof(struct inotify_event) + Event->len;
+            }
+        }
+
+        // NOTE: A build may close the library more than once (link, then
+        // strip, say), so a change is only picked up once the file has been
+        // left alone for SDL_GAME_CODE_SETTLE_MS.
+        if(Watch->Changed)
+        {
+            uint64 SettleCounter = (GlobalPerfCountFrequency*SDL_GAME_CODE_SETTLE_MS) / 1000;
+            if((SDL_GetPerformanceCounter() - Watch->LastEventCounter) >= SettleCounter)
+            {
+                Watch->Changed = false;
+                Result = true;
+            }
+        }
+    }
+    else
+    {
+        // NOTE: Against the last time seen rather than the loaded library's,
+        // so a build that fails to load is only tried once.
+        uint64 LastWriteTime = SDLGetLastWriteTime(DLLFullPath);
+        Result = (LastWriteTime != Watch->LastWriteTime);
+        Watch->LastWriteTime = LastWriteTime;
+    }
+
+    return(Result);
 }
 
 static void
@@ -322,6 +555,221 @@ SDLGetWindowDimension(SDL_Window *Window)
     return(Result);
 }
 
+static sdl_huge_page_mode
+SDLGetHugePageModeFromEnvironment(void)
+{
+    // NOTE: HANDMADE_HUGE_PAGES=off|thp|2mb|1gb. Transparent huge pages are
+    // the default because they need no system setup; explicit ones need
+    // pages reserved in /proc/sys/vm/nr_hugepages (or hugepages= at boot).
+    sdl_huge_page_mode Result = SDLHugePages_Transparent;
+
+    char *Mode = getenv("HANDMADE_HUGE_PAGES");
+    if(Mode)
+    {
+        if(strcmp(Mode, "off") == 0)
+        {
+            Result = SDLHugePages_None;
+        }
+        else if(strcmp(Mode, "2mb") == 0)
+        {
+            Result = SDLHugePages_Explicit2MB;
+        }
+        else if(strcmp(Mode, "1gb") == 0)
+        {
+            Result = SDLHugePages_Explicit1GB;
+        }
+    }
+
+    return(Result);
+}
+
+static char *
+SDLGetHugePageModeName(sdl_huge_page_mode Mode)
+{
+    char *Result = "4kb pages";
+    switch(Mode)
+    {
+        case SDLHugePages_Transparent: {Result = "transparent huge pages";} break;
+        case SDLHugePages_Explicit2MB: {Result = "explicit 2mb pages";} break;
+        case SDLHugePages_Explicit1GB: {Result = "explicit 1gb pages";} break;
+    }
+
+    return(Result);
+}
+
+static sdl_memory_mapping
+SDLMapMemory(void *BaseAddress, memory_index Size, sdl_huge_page_mode HugePages)
+{
+    sdl_memory_mapping Result = {};
+
+    if((HugePages == SDLHugePages_Explicit1GB) ||
+       (HugePages == SDLHugePages_Explicit2MB))
+    {
+        memory_index HugePageSize = Megabytes(2);
+        int HugePageFlag = MAP_HUGE_2MB;
+        if(HugePages == SDLHugePages_Explicit1GB)
+        {
+            HugePageSize = Gigabytes(1);
+            HugePageFlag = MAP_HUGE_1GB;
+        }
+
+        memory_index MapSize = AlignPow2(Size, HugePageSize);
+        void *Base = mmap(BaseAddress, MapSize,
+                          PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | HugePageFlag,
+                          -1, 0);
+        if(Base != MAP_FAILED)
+        {
+            Result.Base = Base;
+            Result.Size = MapSize;
+            Result.HugePages = HugePages;
+            Result.PageSize = HugePageSize;
+        }
+        else if(HugePages == SDLHugePages_Explicit1GB)
+        {
+            Result = SDLMapMemory(BaseAddress, Size, SDLHugePages_Explicit2MB);
+        }
+    }
+
+    if(!Result.Base)
+    {
+        void *Base = mmap(BaseAddress, Size,
+                          PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS,
+                          -1, 0);
+        if(Base != MAP_FAILED)
+        {
+            Result.Base = Base;
+            Result.Size = Size;
+            Result.HugePages = SDLHugePages_None;
+            Result.PageSize = sysconf(_SC_PAGESIZE);
+
+            // NOTE: Either asked for, or the fallback when no explicit huge
+            // pages are reserved. Fails harmlessly if THP is disabled.
+            if((HugePages != SDLHugePages_None) &&
+               (madvise(Base, Size, MADV_HUGEPAGE) == 0))
+            {
+                Result.HugePages = SDLHugePages_Transparent;
+            }
+        }
+    }
+
+    return(Result);
+}
+
+static void
+SDLUnmapMemory(sdl_memory_mapping *Mapping)
+{
+    if(Mapping->Base)
+    {
+        munmap(Mapping->Base, Mapping->Size);
+    }
+
+    *Mapping = {};
+}
+
+static memory_index
+SDLGetTransparentHugePageBytes(void *Base)
+{
+    // NOTE: Reads AnonHugePages for the mapping starting at Base out of
+    // /proc/self/smaps, i.e. how much of it the kernel really backs with
+    // huge pages right now. Slow; only for reports.
+    memory_index Result = 0;
+
+    FILE *SMaps = fopen("/proc/self/smaps", "r");
+    if(SMaps)
+    {
+        bool32 InMapping = false;
+        char Line[512];
+        while(fgets(Line, sizeof(Line), SMaps))
+        {
+            unsigned long Start, End;
+            unsigned long KB;
+            if(sscanf(Line, "%lx-%lx ", &Start, &End) == 2)
+            {
+                InMapping = (Start == (unsigned long)Base);
+            }
+            else if(InMapping && (sscanf(Line, "AnonHugePages: %lu kB", &KB) == 1))
+            {
+                Result = (memory_index)KB*1024;
+                break;
+            }
+        }
+
+        fclose(SMaps);
+    }
+
+    return(Result);
+}
+
+static int
+SDLOpenTLBMissCounter(void)
+{
+    // NOTE: Counts data TLB load misses in user mode for this process and
+    // every thread it starts afterwards, so open it before the workers.
+    // Returns -1 when perf events are unavailable (VMs, perf_event_paranoid),
+    // and always in release builds, which never report it.
+    int Result = -1;
+#if HANDMADE_INTERNAL
+    perf_event_attr Attributes = {};
+    Attributes.type = PERF_TYPE_HW_CACHE;
+    Attributes.size = sizeof(Attributes);
+    Attributes.config = (PERF_COUNT_HW_CACHE_DTLB |
+                         (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    Attributes.inherit = 1;
+    Attributes.exclude_kernel = 1;
+    Attributes.exclude_hv = 1;
+
+    Result = (int)syscall(SYS_perf_event_open, &Attributes, 0, -1, -1, 0);
+#endif
+    return(Result);
+}
+
+static uint64
+SDLReadTLBMissCounter(int Counter)
+{
+    uint64 Result = 0;
+    if(Counter != -1)
+    {
+        if(read(Counter, &Result, sizeof(Result)) != sizeof(Result))
+        {
+            Result = 0;
+        }
+    }
+
+    return(Result);
+}
+
+static void
+SDLReportMemoryMapping(char *Name, sdl_memory_mapping *Mapping)
+{
+    printf("%s: %lu bytes, %s", Name, (uint64)Mapping->Size,
+           SDLGetHugePageModeName(Mapping->HugePages));
+    if(Mapping->HugePages == SDLHugePages_Transparent)
+    {
+        printf(" (%lu bytes currently huge)", (uint64)SDLGetTransparentHugePageBytes(Mapping->Base));
+    }
+    printf("\n");
+}
+
+static void
+SDLReportPageUsage(sdl_state *State)
+{
+#if HANDMADE_INTERNAL
+    SDLReportMemoryMapping("Game memory", &State->GameMemoryMapping);
+    SDLReportMemoryMapping("Backbuffer", &GlobalBackbuffer.Mapping);
+    if(State->TLBMissCounter != -1)
+    {
+        printf("DTLB load misses: %lu\n", SDLReadTLBMissCounter(State->TLBMissCounter));
+    }
+    else
+    {
+        printf("DTLB load misses: unavailable (perf events not permitted)\n");
+    }
+#endif
+}
+
 static void
 SDLResizeTexture(sdl_offscreen_buffer *Buffer, SDL_Renderer *Renderer, int Width, int Height)
 {
@@ -330,8 +778,7 @@ SDLResizeTexture(sdl_offscreen_buffer *Buffer, SDL_Renderer *Renderer, int Width
 
     if(Buffer->Memory)
     {
-        munmap(Buffer->Memory,
-               (Buffer->Width*Buffer->Height)*Buffer->BytesPerPixel);
+        SDLUnmapMemory(&Buffer->Mapping);
     }
 
     Buffer->Width = Width;
@@ -352,19 +799,28 @@ SDLResizeTexture(sdl_offscreen_buffer *Buffer, SDL_Renderer *Renderer, int Width
 
     Buffer->Pitch = Align16(Width*BytesPerPixel);
     int BitmapMemorySize = (Buffer->Pitch*Buffer->Height);
-    Buffer->Memory = mmap(0,
-                          BitmapMemorySize,
-                          PROT_READ | PROT_WRITE,
-                          MAP_PRIVATE | MAP_ANONYMOUS,
-                          -1,
-                          0);
+    Buffer->Mapping = SDLMapMemory(0, BitmapMemorySize, GlobalHugePageMode);
+    Buffer->Memory = Buffer->Mapping.Base;
 
     // TODO(casey): Probably clear this to black
 }
 
+inline uint64 SDLGetNanoseconds(void);
+
+inline void
+SDLMarkFramePhase(sdl_frame_stats *Stats, sdl_frame_phase Phase)
+{
+    // NOTE: Ends Phase for the current frame; the next phase starts now.
+    uint64 Now = SDLGetNanoseconds();
+    sdl_frame_timing *Frame = &Stats->Frames[Stats->FrameCount % SDL_FRAME_STATS_COUNT];
+    Frame->PhaseNanoseconds[Phase] = (uint32)(Now - Stats->PhaseStart);
+    Stats->PhaseStart = Now;
+}
+
 static void
 SDLDisplayBufferInWindow(sdl_offscreen_buffer *Buffer,
-                         SDL_Renderer *Renderer, int WindowWidth, int WindowHeight)
+                         SDL_Renderer *Renderer, int WindowWidth, int WindowHeight,
+                         sdl_frame_stats *Stats = 0)
 {
     // TODO(casey): Centering / black bars?
 
@@ -413,7 +869,17 @@ SDLDisplayBufferInWindow(sdl_offscreen_buffer *Buffer,
                        &DestRect);
     }
 
+    if(Stats)
+    {
+        SDLMarkFramePhase(Stats, SDLFramePhase_Upload);
+    }
+
     SDL_RenderPresent(Renderer);
+
+    if(Stats)
+    {
+        SDLMarkFramePhase(Stats, SDLFramePhase_Present);
+    }
 }
 
 static void
@@ -465,11 +931,12 @@ SDLProcessGameControllerAxisValue(int16 Value, int16 DeadZoneThreshold)
 }
 
 static void
-SDLGetInputFileLocation(sdl_state *State, bool32 InputStream,
+SDLGetInputFileLocation(sdl_state *State, char *Kind,
                           int SlotIndex, int DestCount, char *Dest)
 {
+    // NOTE: Kind is "input", "state" or "keys".
     char Temp[64];
-    sprintf(Temp, "loop_edit_%d_%s.hmi", SlotIndex, InputStream ? "input" : "state");
+    snprintf(Temp, sizeof(Temp), "loop_edit_%d_%s.hmi", SlotIndex, Kind);
     SDLBuildEXEPathFileName(State, Temp, DestCount, Dest);
 }
 
@@ -482,638 +949,5208 @@ SDLGetReplayBuffer(sdl_state *State, int unsigned Index)
     return(Result);
 }
 
-static void
-SDLBeginRecordingInput(sdl_state *State, int InputRecordingIndex)
+// NOTE: Kernel ABI for dirty page tracking. Spelled out here because older
+// <linux/userfaultfd.h> and <linux/fs.h> don't have the 6.7 additions yet.
+#define SDL_PAGEMAP_SOFT_DIRTY (1ULL << 55)
+#define SDL_UFFD_USER_MODE_ONLY 1
+#define SDL_UFFD_FEATURE_WP_UNPOPULATED (1 << 13)
+#define SDL_UFFD_FEATURE_WP_ASYNC (1 << 15)
+#define SDL_PAGE_IS_WRITTEN (1 << 1)
+#define SDL_PAGE_IS_FILE (1 << 2)
+#define SDL_PAGE_IS_PRESENT (1 << 3)
+#define SDL_PAGE_IS_SWAPPED (1 << 4)
+#define SDL_PM_SCAN_WP_MATCHING (1 << 0)
+#define SDL_PM_SCAN_CHECK_WPASYNC (1 << 1)
+
+struct sdl_pagemap_region
 {
-    sdl_replay_buffer *ReplayBuffer = SDLGetReplayBuffer(State, InputRecordingIndex);
-    if(ReplayBuffer->MemoryBlock)
-    {
-        State->InputRecordingIndex = InputRecordingIndex;
+    uint64 Start;
+    uint64 End;
+    uint64 Categories;
+};
 
-        char FileName[SDL_STATE_FILE_NAME_COUNT];
-        SDLGetInputFileLocation(State, true, InputRecordingIndex, sizeof(FileName), FileName);
-        State->RecordingHandle = open(FileName, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+struct sdl_pagemap_scan
+{
+    uint64 Size;
+    uint64 Flags;
+    uint64 Start;
+    uint64 End;
+    uint64 WalkEnd;
+    uint64 Vec;
+    uint64 VecLength;
+    uint64 MaxPages;
+    uint64 CategoryInverted;
+    uint64 CategoryMask;
+    uint64 CategoryAnyOfMask;
+    uint64 ReturnMask;
+};
 
-#if 0
-        lseek(State->RecordingHandle, State->TotalSize, SEEK_SET);
-#endif
+#define SDL_PAGEMAP_SCAN _IOWR('f', 16, sdl_pagemap_scan)
 
-        memcpy(ReplayBuffer->MemoryBlock, State->GameMemoryBlock, State->TotalSize);
-    }
+static void
+SDLAddPageRun(sdl_page_run *Runs, uint32 MaxRunCount, uint32 *RunCount, uint32 FirstPage, uint32 OnePastLastPage)
+{
+    sdl_page_run *LastRun = *RunCount ? (Runs + *RunCount - 1) : 0;
+    if(LastRun && (LastRun->OnePastLastPage == FirstPage))
+    {
+        LastRun->OnePastLastPage = OnePastLastPage;
+    }
+    else
+    {
+        Assert(*RunCount < MaxRunCount);
+        sdl_page_run *Run = Runs + (*RunCount)++;
+        Run->FirstPage = FirstPage;
+        Run->OnePastLastPage = OnePastLastPage;
+    }
+}
+
+static void
+SDLAddDirtyPages(sdl_dirty_page_tracker *Tracker, uint32 FirstPage, uint32 OnePastLastPage)
+{
+    SDLAddPageRun(Tracker->DirtyRuns, Tracker->MaxDirtyRunCount, &Tracker->DirtyRunCount,
+                  FirstPage, OnePastLastPage);
+}
+
+static bool32
+SDLScanWrittenPages(sdl_dirty_page_tracker *Tracker, bool32 WriteProtectAgain)
+{
+    // NOTE: One PAGEMAP_SCAN call returns at most as many runs as fit in
+    // the scratch buffer, so keep going from where the kernel stopped.
+    bool32 Result = true;
+
+    sdl_pagemap_region *Regions = (sdl_pagemap_region *)Tracker->Scratch;
+    uint64 Start = (uint64)Tracker->Base;
+    uint64 End = Start + Tracker->Size;
+    while(Start < End)
+    {
+        sdl_pagemap_scan Scan = {};
+        Scan.Size = sizeof(Scan);
+        Scan.Flags = SDL_PM_SCAN_CHECK_WPASYNC | (WriteProtectAgain ? SDL_PM_SCAN_WP_MATCHING : 0);
+        Scan.Start = Start;
+        Scan.End = End;
+        Scan.Vec = (uint64)Regions;
+        Scan.VecLength = Tracker->ScratchSize / sizeof(sdl_pagemap_region);
+        Scan.CategoryMask = SDL_PAGE_IS_WRITTEN;
+        Scan.ReturnMask = SDL_PAGE_IS_WRITTEN;
+
+        int RegionCount = ioctl(Tracker->PagemapHandle, SDL_PAGEMAP_SCAN, &Scan);
+        if(RegionCount < 0)
+        {
+            Result = false;
+            break;
+        }
+
+        if(!WriteProtectAgain)
+        {
+            for(int RegionIndex = 0;
+                RegionIndex < RegionCount;
+                ++RegionIndex)
+            {
+                sdl_pagemap_region *Region = Regions + RegionIndex;
+                SDLAddDirtyPages(Tracker,
+                                 (uint32)((Region->Start - (uint64)Tracker->Base) / Tracker->PageSize),
+                                 (uint32)((Region->End - (uint64)Tracker->Base) / Tracker->PageSize));
+            }
+        }
+
+        Start = Scan.WalkEnd;
+    }
+
+    return(Result);
+}
+
+static void
+SDLResetDirtyPages(sdl_dirty_page_tracker *Tracker)
+{
+    bool32 Succeeded = true;
+    switch(Tracker->Mode)
+    {
+        case SDLDirtyTracking_WriteProtect:
+        {
+            Succeeded = SDLScanWrittenPages(Tracker, true);
+        } break;
+
+        case SDLDirtyTracking_SoftDirty:
+        {
+            // NOTE: "4" clears the soft-dirty bit on every page of the
+            // process. Nothing else in here uses soft-dirty, so that's fine.
+            Succeeded = (pwrite(Tracker->ClearRefsHandle, "4", 1, 0) == 1);
+        } break;
+    }
+
+    if(!Succeeded)
+    {
+        Tracker->Mode = SDLDirtyTracking_None;
+    }
+}
+
+static void
+SDLCollectDirtyPages(sdl_dirty_page_tracker *Tracker)
+{
+    // NOTE: Nothing else may be writing the tracked block while this runs,
+    // or between it and the copy and reset that follow; see
+    // SDLCompleteGameWork.
+    Tracker->DirtyRunCount = 0;
+
+    bool32 Succeeded = true;
+    switch(Tracker->Mode)
+    {
+        case SDLDirtyTracking_WriteProtect:
+        {
+            Succeeded = SDLScanWrittenPages(Tracker, false);
+        } break;
+
+        case SDLDirtyTracking_SoftDirty:
+        {
+            // NOTE: Read the pagemap a chunk at a time into scratch.
+            uint64 *Entries = (uint64 *)Tracker->Scratch;
+            uint32 EntriesPerChunk = (uint32)(Tracker->ScratchSize / sizeof(uint64));
+            for(uint32 ChunkPage = 0;
+                Succeeded && (ChunkPage < Tracker->PageCount);
+                ChunkPage += EntriesPerChunk)
+            {
+                uint32 EntryCount = Tracker->PageCount - ChunkPage;
+                if(EntryCount > EntriesPerChunk)
+                {
+                    EntryCount = EntriesPerChunk;
+                }
+
+                memory_index EntriesSize = EntryCount*sizeof(uint64);
+                off_t EntriesOffset = (((memory_index)Tracker->Base / Tracker->PageSize) + ChunkPage)*sizeof(uint64);
+                Succeeded = (pread(Tracker->PagemapHandle, Entries, EntriesSize, EntriesOffset) == (ssize_t)EntriesSize);
+                for(uint32 EntryIndex = 0;
+                    Succeeded && (EntryIndex < EntryCount);
+                    ++EntryIndex)
+                {
+                    if(Entries[EntryIndex] & SDL_PAGEMAP_SOFT_DIRTY)
+                    {
+                        SDLAddDirtyPages(Tracker, ChunkPage + EntryIndex, ChunkPage + EntryIndex + 1);
+                    }
+                }
+            }
+        } break;
+    }
+
+    if(!Succeeded)
+    {
+        Tracker->Mode = SDLDirtyTracking_None;
+    }
+}
+
+static bool32
+SDLBeginWriteProtectTracking(sdl_dirty_page_tracker *Tracker)
+{
+    // NOTE: Asynchronous write-protect faults are resolved by the kernel
+    // itself - nobody reads the userfaultfd - and just leave the page marked
+    // as written. Unlike mprotect this also catches the kernel writing into
+    // the memory (read() into game memory, for example). It may split
+    // transparent huge pages that get written.
+    bool32 Result = false;
+
+    int Handle = (int)syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+    if(Handle == -1)
+    {
+        Handle = (int)syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | SDL_UFFD_USER_MODE_ONLY);
+    }
+
+    if(Handle != -1)
+    {
+        uint64 Features = SDL_UFFD_FEATURE_WP_ASYNC | SDL_UFFD_FEATURE_WP_UNPOPULATED;
+
+        uffdio_api API = {};
+        API.api = UFFD_API;
+        API.features = Features;
+
+        uffdio_register Register = {};
+        Register.range.start = (uint64)Tracker->Base;
+        Register.range.len = Tracker->Size;
+        Register.mode = UFFDIO_REGISTER_MODE_WP;
+
+        uffdio_writeprotect WriteProtect = {};
+        WriteProtect.range = Register.range;
+        WriteProtect.mode = UFFDIO_WRITEPROTECT_MODE_WP;
+
+        if((ioctl(Handle, UFFDIO_API, &API) == 0) &&
+           ((API.features & Features) == Features) &&
+           (ioctl(Handle, UFFDIO_REGISTER, &Register) == 0) &&
+           (ioctl(Handle, UFFDIO_WRITEPROTECT, &WriteProtect) == 0))
+        {
+            Tracker->UserfaultHandle = Handle;
+            Result = true;
+        }
+        else
+        {
+            close(Handle);
+        }
+    }
+
+    return(Result);
+}
+
+static bool32
+SDLProbeDirtyPageTracking(sdl_dirty_page_tracker *Tracker)
+{
+    // NOTE: Make sure a write to the tracked memory really shows up, and
+    // only where it was made.
+    SDLResetDirtyPages(Tracker);
+    volatile uint8 *Probe = Tracker->Base;
+    *Probe = *Probe;
+    SDLCollectDirtyPages(Tracker);
+
+    bool32 Result = ((Tracker->Mode != SDLDirtyTracking_None) &&
+                     (Tracker->DirtyRunCount == 1) &&
+                     (Tracker->DirtyRuns[0].FirstPage == 0));
+    return(Result);
+}
+
+static void
+SDLInitDirtyPageTracker(sdl_dirty_page_tracker *Tracker, void *Base, memory_index Size)
+{
+    *Tracker = {};
+    Tracker->Base = (uint8 *)Base;
+    Tracker->Size = Size;
+    Tracker->PageSize = sysconf(_SC_PAGESIZE);
+    Tracker->PageCount = (uint32)(Size / Tracker->PageSize);
+    Tracker->UserfaultHandle = -1;
+
+    Tracker->PagemapHandle = open("/proc/self/pagemap", O_RDONLY);
+    Tracker->ClearRefsHandle = open("/proc/self/clear_refs", O_WRONLY);
+
+    // NOTE: Worst case every other page is dirty.
+    Tracker->MaxDirtyRunCount = Tracker->PageCount / 2 + 1;
+    Tracker->ScratchSize = Kilobytes(64);
+    memory_index RunsSize = Tracker->MaxDirtyRunCount*sizeof(sdl_page_run);
+    void *Memory = mmap(0, RunsSize + Tracker->ScratchSize,
+                        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if((Tracker->PagemapHandle != -1) && (Memory != MAP_FAILED))
+    {
+        Tracker->DirtyRuns = (sdl_page_run *)Memory;
+        Tracker->Scratch = (uint8 *)Memory + RunsSize;
+
+        if(SDLBeginWriteProtectTracking(Tracker))
+        {
+            Tracker->Mode = SDLDirtyTracking_WriteProtect;
+            if(!SDLProbeDirtyPageTracking(Tracker))
+            {
+                Tracker->Mode = SDLDirtyTracking_None;
+                close(Tracker->UserfaultHandle);
+                Tracker->UserfaultHandle = -1;
+            }
+        }
+
+        if((Tracker->Mode == SDLDirtyTracking_None) && (Tracker->ClearRefsHandle != -1))
+        {
+            // NOTE: Needs CONFIG_MEM_SOFT_DIRTY.
+            Tracker->Mode = SDLDirtyTracking_SoftDirty;
+            if(!SDLProbeDirtyPageTracking(Tracker))
+            {
+                Tracker->Mode = SDLDirtyTracking_None;
+            }
+        }
+    }
+
+    if(Tracker->Mode == SDLDirtyTracking_None)
+    {
+        // TODO: Diagnostic
+#if HANDMADE_INTERNAL
+        printf("Dirty page tracking unavailable, loop snapshots will copy all game memory\n");
+#endif
+    }
+}
+
+static void
+SDLCompleteGameWork(sdl_state *State)
+{
+    // NOTE: Work the game queued, and async reads it started, can write the
+    // replayable part of game memory at any time. Finding which pages
+    // changed, copying them and resetting the tracking only agree with each
+    // other when none of that is running, so everything that does them
+    // waits for both queues to drain first.
+    game_memory *GameMemory = State->GameMemory;
+    if(GameMemory->HighPriorityQueue)
+    {
+        GameMemory->PlatformAPI.CompleteAllWork(GameMemory->HighPriorityQueue);
+    }
+    if(GameMemory->LowPriorityQueue)
+    {
+        GameMemory->PlatformAPI.CompleteAllWork(GameMemory->LowPriorityQueue);
+    }
+}
+
+// NOTE: Defined with the work queues below.
+static bool32 SDLIsQueueIdle(platform_work_queue *Queue);
+
+static bool32
+SDLGameWorkIsIdle(sdl_state *State)
+{
+    // NOTE: Whether SDLCompleteGameWork would return without waiting.
+    game_memory *GameMemory = State->GameMemory;
+    bool32 Result = ((!GameMemory->HighPriorityQueue || SDLIsQueueIdle(GameMemory->HighPriorityQueue)) &&
+                     (!GameMemory->LowPriorityQueue || SDLIsQueueIdle(GameMemory->LowPriorityQueue)));
+    return(Result);
+}
+
+static memory_index
+SDLSyncReplayBuffer(sdl_state *State, int ReplayIndex, void *Dest, void *Source)
+{
+    // NOTE: Makes Dest match Source over the replayable part of game memory.
+    // If this replay buffer was in sync with game memory at the last reset,
+    // the only pages that can differ are the ones game memory has written
+    // since, so only those are copied. Returns the number of bytes copied.
+    memory_index Result = 0;
+
+    SDLCompleteGameWork(State);
+
+    sdl_dirty_page_tracker *Tracker = &State->DirtyPageTracker;
+    SDLCollectDirtyPages(Tracker);
+    if((Tracker->Mode != SDLDirtyTracking_None) && (State->SyncedReplayIndex == ReplayIndex))
+    {
+        for(uint32 RunIndex = 0;
+            RunIndex < Tracker->DirtyRunCount;
+            ++RunIndex)
+        {
+            sdl_page_run *Run = Tracker->DirtyRuns + RunIndex;
+            memory_index Offset = (memory_index)Run->FirstPage*Tracker->PageSize;
+            memory_index Size = (memory_index)(Run->OnePastLastPage - Run->FirstPage)*Tracker->PageSize;
+            memcpy((uint8 *)Dest + Offset, (uint8 *)Source + Offset, Size);
+            Result += Size;
+        }
+    }
+    else
+    {
+        memcpy(Dest, Source, State->ReplayableSize);
+        Result = State->ReplayableSize;
+    }
+
+    // NOTE: Reset after the copy, so a restore's own writes into game memory
+    // don't count as changes next time.
+    SDLResetDirtyPages(Tracker);
+    State->SyncedReplayIndex = ReplayIndex;
+
+    return(Result);
+}
+
+static bool32
+SDLMapReplayableMemory(sdl_state *State, int Handle, bool32 Private)
+{
+    void *Base = mmap(State->GameMemoryBlock, State->ReplayableSize,
+                      PROT_READ | PROT_WRITE,
+                      (Private ? MAP_PRIVATE : MAP_SHARED) | MAP_FIXED,
+                      Handle, 0);
+    bool32 Result = (Base == State->GameMemoryBlock);
+    if(Result && (State->GameMemoryMapping.HugePages == SDLHugePages_Transparent))
+    {
+        // NOTE: Only honoured for shmem when shmem_enabled allows it.
+        madvise(Base, State->ReplayableSize, MADV_HUGEPAGE);
+    }
+
+    // TODO: Diagnostic
+    Assert(Result);
+
+    return(Result);
+}
+
+static int
+SDLCreateSnapshotHandle(sdl_state *State)
+{
+    int Result = memfd_create("handmade_game_memory", MFD_CLOEXEC);
+    if((Result != -1) && (ftruncate(Result, State->ReplayableSize) != 0))
+    {
+        close(Result);
+        Result = -1;
+    }
+
+    return(Result);
+}
+
+static void
+SDLInitCopyOnWriteSnapshots(sdl_state *State)
+{
+    // NOTE: Explicit huge pages stay anonymous. A private hugetlb mapping
+    // would need a second pool of huge pages reserved for its copies, so
+    // those keep the copying snapshots.
+    State->GameMemoryHandle = -1;
+    if((State->GameMemoryMapping.HugePages != SDLHugePages_Explicit2MB) &&
+       (State->GameMemoryMapping.HugePages != SDLHugePages_Explicit1GB))
+    {
+        int Handle = SDLCreateSnapshotHandle(State);
+        if(Handle != -1)
+        {
+            // NOTE: Worst case every other page is a run of its own.
+            State->MaxChangedRunCount = (uint32)(State->ReplayableSize / sysconf(_SC_PAGESIZE) / 2 + 1);
+            void *Runs = mmap(0, State->MaxChangedRunCount*sizeof(sdl_page_run), PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if((Runs != MAP_FAILED) && SDLMapReplayableMemory(State, Handle, false))
+            {
+                State->ChangedRuns = (sdl_page_run *)Runs;
+                State->GameMemoryHandle = Handle;
+                State->CopyOnWriteSnapshots = true;
+            }
+            else
+            {
+                close(Handle);
+            }
+        }
+    }
+}
+
+static uint32
+SDLCollectPrivatePageRuns(sdl_state *State)
+{
+    // NOTE: Finds every page of the private mapping that the game has
+    // written since it was mapped - i.e. every page that isn't the file's
+    // own page any more - and puts them in State->ChangedRuns as runs of
+    // pages. Returns the run count.
+    uint32 Result = 0;
+
+    sdl_page_run *Runs = State->ChangedRuns;
+    uint32 MaxRunCount = State->MaxChangedRunCount;
+    memory_index PageSize = sysconf(_SC_PAGESIZE);
+
+    int PagemapHandle = open("/proc/self/pagemap", O_RDONLY);
+    if(PagemapHandle != -1)
+    {
+        // NOTE: PAGEMAP_SCAN (Linux 6.7+) hands back the runs of anonymous
+        // pages directly.
+        bool32 Scanned = true;
+        sdl_pagemap_region Regions[256];
+        uint64 Start = (uint64)State->GameMemoryBlock;
+        uint64 End = Start + State->ReplayableSize;
+        while(Scanned && (Start < End))
+        {
+            sdl_pagemap_scan Scan = {};
+            Scan.Size = sizeof(Scan);
+            Scan.Start = Start;
+            Scan.End = End;
+            Scan.Vec = (uint64)Regions;
+            Scan.VecLength = ArrayCount(Regions);
+            Scan.CategoryInverted = SDL_PAGE_IS_FILE;
+            Scan.CategoryMask = SDL_PAGE_IS_FILE;
+            Scan.CategoryAnyOfMask = SDL_PAGE_IS_PRESENT | SDL_PAGE_IS_SWAPPED;
+            Scan.ReturnMask = SDL_PAGE_IS_FILE;
+
+            int RegionCount = ioctl(PagemapHandle, SDL_PAGEMAP_SCAN, &Scan);
+            Scanned = (RegionCount >= 0);
+            for(int RegionIndex = 0;
+                RegionIndex < RegionCount;
+                ++RegionIndex)
+            {
+                sdl_pagemap_region *Region = Regions + RegionIndex;
+                SDLAddPageRun(Runs, MaxRunCount, &Result,
+                              (uint32)((Region->Start - (uint64)State->GameMemoryBlock) / PageSize),
+                              (uint32)((Region->End - (uint64)State->GameMemoryBlock) / PageSize));
+            }
+
+            Start = Scan.WalkEnd;
+        }
+
+        if(!Scanned)
+        {
+            // NOTE: Older kernels: read the pagemap entries themselves. Bit
+            // 61 is set for file pages, 63 for present pages and 62 for
+            // swapped ones.
+            Result = 0;
+
+            uint32 PageCount = (uint32)(State->ReplayableSize / PageSize);
+            uint64 FirstEntry = (memory_index)State->GameMemoryBlock / PageSize;
+            uint64 Entries[512];
+            for(uint32 PageIndex = 0;
+                PageIndex < PageCount;
+                ++PageIndex)
+            {
+                uint32 EntryIndex = PageIndex % ArrayCount(Entries);
+                if(EntryIndex == 0)
+                {
+                    uint32 EntryCount = PageCount - PageIndex;
+                    if(EntryCount > ArrayCount(Entries))
+                    {
+                        EntryCount = ArrayCount(Entries);
+                    }
+
+                    ssize_t BytesRead = pread(PagemapHandle, Entries, EntryCount*sizeof(uint64),
+                                              (FirstEntry + PageIndex)*sizeof(uint64));
+                    // TODO: Diagnostic
+                    Assert(BytesRead == (ssize_t)(EntryCount*sizeof(uint64)));
+                }
+
+                uint64 Entry = Entries[EntryIndex];
+                if(((Entry & (1ULL << 63)) && !(Entry & (1ULL << 61))) ||
+                   (Entry & (1ULL << 62)))
+                {
+                    SDLAddPageRun(Runs, MaxRunCount, &Result, PageIndex, PageIndex + 1);
+                }
+            }
+        }
+
+        close(PagemapHandle);
+    }
+
+    return(Result);
+}
+
+static bool32
+SDLDropPrivatePages(sdl_state *State, int SaveHandle, memory_index *BytesCopied)
+{
+    // NOTE: Optionally writes the game's private copies into SaveHandle, and
+    // throws them away so those pages are read from the file again. Only
+    // those runs are touched: zapping the whole range would also unmap every
+    // clean page, which costs more than the copies for gigabytes of state.
+    // A run that didn't make it into SaveHandle keeps its copies, so game
+    // memory is still right, but the file is not, and false comes back.
+    bool32 Result = true;
+    *BytesCopied = 0;
+
+    memory_index PageSize = sysconf(_SC_PAGESIZE);
+    uint32 RunCount = SDLCollectPrivatePageRuns(State);
+    for(uint32 RunIndex = 0;
+        RunIndex < RunCount;
+        ++RunIndex)
+    {
+        sdl_page_run *Run = State->ChangedRuns + RunIndex;
+        memory_index Offset = (memory_index)Run->FirstPage*PageSize;
+        memory_index Size = (memory_index)(Run->OnePastLastPage - Run->FirstPage)*PageSize;
+
+        uint8 *Memory = (uint8 *)State->GameMemoryBlock + Offset;
+        bool32 Saved = true;
+        if(SaveHandle != -1)
+        {
+            memory_index BytesWritten = 0;
+            while(BytesWritten < Size)
+            {
+                ssize_t Written = pwrite(SaveHandle, Memory + BytesWritten,
+                                         Size - BytesWritten, Offset + BytesWritten);
+                if(Written <= 0)
+                {
+                    break;
+                }
+                BytesWritten += Written;
+            }
+            Saved = (BytesWritten == Size);
+            *BytesCopied += BytesWritten;
+        }
+
+        if(Saved)
+        {
+            madvise(Memory, Size, MADV_DONTNEED);
+        }
+        else
+        {
+            // TODO: Diagnostic
+            Result = false;
+        }
+    }
+
+    return(Result);
+}
+
+static bool32
+SDLTakeSnapshot(sdl_state *State, int Index, memory_index *BytesCopied)
+{
+    // NOTE: Makes the current contents of game memory slot Index's snapshot,
+    // with game memory mapped privately over it so the game's writes from
+    // here on are copies that never reach the snapshot. BytesCopied gets how
+    // many bytes had to be copied to get there; false means the snapshot
+    // file didn't get all of them and can't be used.
+    bool32 Result = false;
+    *BytesCopied = 0;
+
+    SDLCompleteGameWork(State);
+
+    sdl_replay_buffer *ReplayBuffer = SDLGetReplayBuffer(State, Index);
+    if(State->MappedSnapshotIndex == 0)
+    {
+        // NOTE: Game memory is still the shared mapping, so the file already
+        // is the state and simply becomes the snapshot.
+        Assert(ReplayBuffer->SnapshotHandle == -1);
+        ReplayBuffer->SnapshotHandle = State->GameMemoryHandle;
+        State->GameMemoryHandle = -1;
+        if(SDLMapReplayableMemory(State, ReplayBuffer->SnapshotHandle, true))
+        {
+            State->MappedSnapshotIndex = Index;
+        }
+        Result = true;
+    }
+    else if(State->MappedSnapshotIndex == Index)
+    {
+        // NOTE: The old snapshot is being replaced, so bring it up to date
+        // with just the pages the game has written since.
+        Result = SDLDropPrivatePages(State, ReplayBuffer->SnapshotHandle, BytesCopied);
+    }
+    else
+    {
+        // NOTE: Game memory sits on another slot's snapshot, which has to
+        // survive this, so this slot gets a full copy.
+        if(ReplayBuffer->SnapshotHandle == -1)
+        {
+            ReplayBuffer->SnapshotHandle = SDLCreateSnapshotHandle(State);
+        }
+
+        if(ReplayBuffer->SnapshotHandle != -1)
+        {
+            memory_index BytesWritten = 0;
+            while(BytesWritten < State->ReplayableSize)
+            {
+                ssize_t Written = pwrite(ReplayBuffer->SnapshotHandle,
+                                         (uint8 *)State->GameMemoryBlock + BytesWritten,
+                                         State->ReplayableSize - BytesWritten, BytesWritten);
+                if(Written <= 0)
+                {
+                    // TODO: Diagnostic
+                    break;
+                }
+                BytesWritten += Written;
+            }
+            *BytesCopied = BytesWritten;
+
+            // NOTE: A partial copy mapped over game memory would lose the
+            // rest of it.
+            Result = (BytesWritten == State->ReplayableSize);
+            if(Result &&
+               SDLMapReplayableMemory(State, ReplayBuffer->SnapshotHandle, true))
+            {
+                State->MappedSnapshotIndex = Index;
+            }
+        }
+    }
+
+    return(Result);
+}
+
+static void
+SDLRestoreSnapshot(sdl_state *State, int Index)
+{
+    sdl_replay_buffer *ReplayBuffer = SDLGetReplayBuffer(State, Index);
+    Assert(ReplayBuffer->SnapshotHandle != -1);
+    SDLCompleteGameWork(State);
+    if(State->MappedSnapshotIndex == Index)
+    {
+        memory_index BytesDropped;
+        SDLDropPrivatePages(State, -1, &BytesDropped);
+    }
+    else if(SDLMapReplayableMemory(State, ReplayBuffer->SnapshotHandle, true))
+    {
+        if(State->MappedSnapshotIndex == 0)
+        {
+            close(State->GameMemoryHandle);
+            State->GameMemoryHandle = -1;
+        }
+        State->MappedSnapshotIndex = Index;
+    }
+}
+
+static bool32
+SDLGetReplayStorage(sdl_state *State, int Index)
+{
+    // NOTE: A slot gets storage the first time it's used and keeps it from
+    // then on, so runs that never record a loop never pay for it. With
+    // copy-on-write snapshots the storage is the snapshot's own memfd,
+    // which the snapshot creates.
+    sdl_replay_buffer *ReplayBuffer = SDLGetReplayBuffer(State, Index);
+    if(!State->CopyOnWriteSnapshots && !ReplayBuffer->MemoryBlock)
+    {
+        uint64 StartCounter = SDL_GetPerformanceCounter();
+
+        // NOTE: Dirty tracking starts with the first slot too, since
+        // write-protect tracking costs the game a fault on the first write
+        // to every page after each reset.
+        if(!State->DirtyPageTracker.Base)
+        {
+            SDLInitDirtyPageTracker(&State->DirtyPageTracker, State->GameMemoryBlock, State->ReplayableSize);
+        }
+
+        // NOTE: Only touched pages are ever backed, and the disk only ever
+        // sees the compressed snapshot.
+        void *MemoryBlock = mmap(0, (size_t)State->ReplayableSize,
+                                 PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                                 -1, 0);
+        if(MemoryBlock != MAP_FAILED)
+        {
+            ReplayBuffer->MemoryBlock = MemoryBlock;
+        }
+        else
+        {
+            // TODO: Diagnostic
+        }
+
+        uint64 EndCounter = SDL_GetPerformanceCounter();
+#if HANDMADE_INTERNAL
+        printf("Loop slot %d storage: %.02fms\n", Index,
+               1000.0f*(real32)(EndCounter - StartCounter) / (real32)GlobalPerfCountFrequency);
+#endif
+    }
+
+    bool32 Result = (State->CopyOnWriteSnapshots || (ReplayBuffer->MemoryBlock != 0));
+    return(Result);
+}
+
+static bool32
+SDLIsZeroPage(void *Page)
+{
+    bool32 Result = true;
+
+    uint64 *Word = (uint64 *)Page;
+    for(uint32 WordIndex = 0;
+        Result && (WordIndex < (SDL_REPLAY_STATE_PAGE_SIZE / sizeof(uint64)));
+        WordIndex += 8)
+    {
+        Result = !(Word[WordIndex + 0] | Word[WordIndex + 1] | Word[WordIndex + 2] | Word[WordIndex + 3] |
+                   Word[WordIndex + 4] | Word[WordIndex + 5] | Word[WordIndex + 6] | Word[WordIndex + 7]);
+    }
+
+    return(Result);
+}
+
+static void
+SDLFinishReplayStateWrites(sdl_state *State)
+{
+    State->GameMemory->PlatformAPI.CompleteAllWork(State->ReplayWriteQueue);
+    for(int ReplayIndex = 1;
+        ReplayIndex < ArrayCount(State->ReplayBuffers);
+        ++ReplayIndex)
+    {
+        sdl_replay_buffer *ReplayBuffer = &State->ReplayBuffers[ReplayIndex];
+        ReplayBuffer->WriteQueued = false;
+        ReplayBuffer->WriteCancelled = false;
+    }
+}
+
+static void
+SDLCancelReplayStateWrite(sdl_state *State, int Index)
+{
+    sdl_replay_buffer *ReplayBuffer = SDLGetReplayBuffer(State, Index);
+    if(ReplayBuffer->WriteQueued)
+    {
+        ReplayBuffer->WriteCancelled = true;
+        SDLFinishReplayStateWrites(State);
+    }
+}
+
+struct sdl_replay_state_output
+{
+    int Handle;
+    bool32 Failed;
+    uint64 BytesWritten;
+
+    memory_index Used;
+    memory_index Size;
+    uint8 *Buffer;
+};
+
+static void
+SDLFlushReplayStateOutput(sdl_replay_state_output *Output)
+{
+    uint8 *At = Output->Buffer;
+    while(!Output->Failed && (At < (Output->Buffer + Output->Used)))
+    {
+        ssize_t BytesWritten = write(Output->Handle, At, (Output->Buffer + Output->Used) - At);
+        if(BytesWritten > 0)
+        {
+            At += BytesWritten;
+            Output->BytesWritten += BytesWritten;
+        }
+        else if(errno != EINTR)
+        {
+            Output->Failed = true;
+        }
+    }
+
+    Output->Used = 0;
+}
+
+static void
+SDLWriteReplayStateOutput(sdl_replay_state_output *Output, memory_index Size, void *Source)
+{
+    if((Output->Used + Size) > Output->Size)
+    {
+        SDLFlushReplayStateOutput(Output);
+    }
+
+    Assert(Size <= Output->Size);
+    memcpy(Output->Buffer + Output->Used, Source, Size);
+    Output->Used += Size;
+}
+
+static void
+SDLWriteStateBlock(sdl_replay_state_output *Output, uint32 BlockIndex, uint16 PageMask,
+                   uint8 *Pages, uint8 *Compressed)
+{
+    // NOTE: Pages holds the pages PageMask says are stored, packed together;
+    // Compressed has room for a whole block.
+    sdl_replay_state_block BlockHeader = {};
+    BlockHeader.BlockIndex = BlockIndex;
+    BlockHeader.PageMask = PageMask;
+    BlockHeader.DataSize = __builtin_popcount(PageMask)*SDL_REPLAY_STATE_PAGE_SIZE;
+
+    uint8 *BlockData = Pages;
+    memory_index CompressedSize = CompressLZ(BlockHeader.DataSize, Pages,
+                                             BlockHeader.DataSize - 1, Compressed);
+    if(CompressedSize)
+    {
+        BlockHeader.Flags |= SDLReplayStateBlock_Compressed;
+        BlockHeader.DataSize = (uint32)CompressedSize;
+        BlockData = Compressed;
+    }
+
+    SDLWriteReplayStateOutput(Output, sizeof(BlockHeader), &BlockHeader);
+    SDLWriteReplayStateOutput(Output, BlockHeader.DataSize, BlockData);
+}
+
+static bool32
+SDLReadSnapshotBlock(sdl_replay_buffer *ReplayBuffer, memory_index Offset, memory_index Size, void *Dest)
+{
+    bool32 Result = true;
+
+    if(ReplayBuffer->State->CopyOnWriteSnapshots)
+    {
+        // NOTE: pread rather than a mapping: holes in the memfd read back as
+        // zeroes without the kernel allocating pages for them.
+        Result = (pread(ReplayBuffer->SnapshotHandle, Dest, Size, Offset) == (ssize_t)Size);
+    }
+    else
+    {
+        memcpy(Dest, (uint8 *)ReplayBuffer->MemoryBlock + Offset, Size);
+    }
+
+    return(Result);
+}
+
+static PLATFORM_WORK_QUEUE_CALLBACK(SDLWriteReplayStateWork)
+{
+    sdl_replay_buffer *ReplayBuffer = (sdl_replay_buffer *)Data;
+    sdl_state *State = ReplayBuffer->State;
+    platform_api *PlatformAPI = &State->GameMemory->PlatformAPI;
+    uint64 StartCounter = SDL_GetPerformanceCounter();
+
+    // NOTE: Written next to the old file and renamed over it when complete,
+    // so a cancelled or failed write never leaves a half file behind.
+    char TempFileName[SDL_STATE_FILE_NAME_COUNT + 8];
+    snprintf(TempFileName, sizeof(TempFileName), "%s.tmp", ReplayBuffer->FileName);
+
+    sdl_replay_state_output Output = {};
+    Output.Handle = open(TempFileName, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    Output.Size = Megabytes(1);
+    Output.Buffer = (uint8 *)PlatformAPI->AllocateMemory(Output.Size + 3*SDL_REPLAY_STATE_BLOCK_SIZE);
+    uint8 *Block = Output.Buffer + Output.Size;
+    uint8 *Packed = Block + SDL_REPLAY_STATE_BLOCK_SIZE;
+    uint8 *Compressed = Packed + SDL_REPLAY_STATE_BLOCK_SIZE;
+    Output.Failed = ((Output.Handle == -1) || !Output.Buffer);
+
+    sdl_replay_state_header Header = {};
+    Header.MagicValue = SDL_REPLAY_STATE_MAGIC_VALUE;
+    Header.Version = SDL_REPLAY_STATE_VERSION;
+    Header.ReplayableSize = State->ReplayableSize;
+    if(!Output.Failed)
+    {
+        SDLWriteReplayStateOutput(&Output, sizeof(Header), &Header);
+    }
+
+    Assert((State->ReplayableSize % SDL_REPLAY_STATE_PAGE_SIZE) == 0);
+    uint32 BlockCount = (uint32)((State->ReplayableSize + SDL_REPLAY_STATE_BLOCK_SIZE - 1) /
+                                 SDL_REPLAY_STATE_BLOCK_SIZE);
+    for(uint32 BlockIndex = 0;
+        !Output.Failed && !ReplayBuffer->WriteCancelled && (BlockIndex < BlockCount);
+        ++BlockIndex)
+    {
+        memory_index BlockOffset = (memory_index)BlockIndex*SDL_REPLAY_STATE_BLOCK_SIZE;
+        memory_index BlockSize = State->ReplayableSize - BlockOffset;
+        if(BlockSize > SDL_REPLAY_STATE_BLOCK_SIZE)
+        {
+            BlockSize = SDL_REPLAY_STATE_BLOCK_SIZE;
+        }
+
+        Output.Failed = !SDLReadSnapshotBlock(ReplayBuffer, BlockOffset, BlockSize, Block);
+
+        uint16 PageMask = 0;
+        memory_index PackedSize = 0;
+        for(uint32 PageIndex = 0;
+            PageIndex < (BlockSize / SDL_REPLAY_STATE_PAGE_SIZE);
+            ++PageIndex)
+        {
+            uint8 *Page = Block + PageIndex*SDL_REPLAY_STATE_PAGE_SIZE;
+            if(!SDLIsZeroPage(Page))
+            {
+                PageMask |= (1 << PageIndex);
+                memcpy(Packed + PackedSize, Page, SDL_REPLAY_STATE_PAGE_SIZE);
+                PackedSize += SDL_REPLAY_STATE_PAGE_SIZE;
+            }
+        }
+
+        if(!Output.Failed && PageMask)
+        {
+            SDLWriteStateBlock(&Output, BlockIndex, PageMask, Packed, Compressed);
+        }
+    }
+
+    sdl_replay_state_block EndBlock = {};
+    EndBlock.BlockIndex = SDL_REPLAY_STATE_END;
+    bool32 Completed = (!Output.Failed && !ReplayBuffer->WriteCancelled);
+    if(Completed)
+    {
+        SDLWriteReplayStateOutput(&Output, sizeof(EndBlock), &EndBlock);
+        SDLFlushReplayStateOutput(&Output);
+        Completed = !Output.Failed;
+    }
+
+    if(Output.Handle != -1)
+    {
+        close(Output.Handle);
+        if(Completed)
+        {
+            rename(TempFileName, ReplayBuffer->FileName);
+        }
+        else
+        {
+            unlink(TempFileName);
+        }
+    }
+    PlatformAPI->DeallocateMemory(Output.Buffer);
+
+    uint64 EndCounter = SDL_GetPerformanceCounter();
+#if HANDMADE_INTERNAL
+    if(Completed)
+    {
+        printf("Loop state written: %lu bytes of %lu in %.02fms\n",
+               Output.BytesWritten, State->ReplayableSize,
+               1000.0f*(real32)(EndCounter - StartCounter) / (real32)GlobalPerfCountFrequency);
+    }
+    else if(!ReplayBuffer->WriteCancelled)
+    {
+        // TODO: Diagnostic
+        printf("Could not write loop state to %s\n", ReplayBuffer->FileName);
+    }
+#endif
+}
+
+static void
+SDLQueueReplayStateWrite(sdl_state *State, int Index)
+{
+    sdl_replay_buffer *ReplayBuffer = SDLGetReplayBuffer(State, Index);
+    Assert(!ReplayBuffer->WriteQueued);
+
+    ReplayBuffer->State = State;
+    ReplayBuffer->WriteCancelled = false;
+    ReplayBuffer->WriteQueued = true;
+    State->GameMemory->PlatformAPI.AddEntry(State->ReplayWriteQueue, SDLWriteReplayStateWork, ReplayBuffer);
+}
+
+static bool32
+SDLApplyStateBlocks(sdl_state *State, uint8 **AtInit, uint8 *End,
+                    int DestHandle, uint8 *DestMemory, uint8 *Scratch)
+{
+    // NOTE: Decodes blocks, up to and including the end block, into
+    // DestHandle if it isn't -1 and into DestMemory otherwise. Scratch holds
+    // one block. Returns false for a damaged or truncated stream, which may
+    // have been partly applied by then.
+    bool32 Result = false;
+
+    uint8 *At = *AtInit;
+    uint32 BlockCount = (uint32)((State->ReplayableSize + SDL_REPLAY_STATE_BLOCK_SIZE - 1) /
+                                 SDL_REPLAY_STATE_BLOCK_SIZE);
+    uint32 NextBlockIndex = 0;
+    bool32 Valid = true;
+    while(Valid)
+    {
+        // NOTE: Copied out, because blocks sit at any alignment.
+        sdl_replay_state_block Block;
+        Valid = ((memory_index)(End - At) >= sizeof(Block));
+        if(Valid)
+        {
+            memcpy(&Block, At, sizeof(Block));
+            At += sizeof(Block);
+            if(Block.BlockIndex == SDL_REPLAY_STATE_END)
+            {
+                Result = true;
+                break;
+            }
+        }
+
+        memory_index BlockOffset = (memory_index)Block.BlockIndex*SDL_REPLAY_STATE_BLOCK_SIZE;
+        memory_index BlockSize = State->ReplayableSize - BlockOffset;
+        if(BlockSize > SDL_REPLAY_STATE_BLOCK_SIZE)
+        {
+            BlockSize = SDL_REPLAY_STATE_BLOCK_SIZE;
+        }
+        uint32 BlockPageCount = (uint32)(BlockSize / SDL_REPLAY_STATE_PAGE_SIZE);
+
+        Valid = (Valid &&
+                 (Block.BlockIndex >= NextBlockIndex) &&
+                 (Block.BlockIndex < BlockCount) &&
+                 (Block.DataSize <= SDL_REPLAY_STATE_BLOCK_SIZE) &&
+                 (Block.DataSize <= (memory_index)(End - At)) &&
+                 !(Block.PageMask >> BlockPageCount));
+        if(Valid)
+        {
+            memory_index PackedSize = __builtin_popcount(Block.PageMask)*SDL_REPLAY_STATE_PAGE_SIZE;
+            uint8 *Pages = At;
+            if(Block.Flags & SDLReplayStateBlock_Compressed)
+            {
+                Valid = (DecompressLZ(Block.DataSize, At, PackedSize, Scratch) == PackedSize);
+                Pages = Scratch;
+            }
+            else
+            {
+                Valid = (Block.DataSize == PackedSize);
+            }
+            At += Block.DataSize;
+
+            // NOTE: Runs of stored pages go out in one write each.
+            uint32 PageIndex = 0;
+            while(Valid && (PageIndex < BlockPageCount))
+            {
+                uint32 RunPageCount = 0;
+                while(((PageIndex + RunPageCount) < BlockPageCount) &&
+                      (Block.PageMask & (1 << (PageIndex + RunPageCount))))
+                {
+                    ++RunPageCount;
+                }
+
+                if(RunPageCount)
+                {
+                    memory_index RunOffset = BlockOffset + PageIndex*SDL_REPLAY_STATE_PAGE_SIZE;
+                    memory_index RunSize = RunPageCount*SDL_REPLAY_STATE_PAGE_SIZE;
+                    if(DestHandle != -1)
+                    {
+                        Valid = (pwrite(DestHandle, Pages, RunSize, RunOffset) == (ssize_t)RunSize);
+                    }
+                    else
+                    {
+                        memcpy(DestMemory + RunOffset, Pages, RunSize);
+                    }
+                    Pages += RunSize;
+                    PageIndex += RunPageCount;
+                }
+                else
+                {
+                    ++PageIndex;
+                }
+            }
+
+            NextBlockIndex = Block.BlockIndex + 1;
+        }
+    }
+    *AtInit = At;
+
+    return(Result);
+}
+
+static bool32
+SDLLoadReplayState(sdl_state *State, int Index)
+{
+    // NOTE: Decodes the slot's state file into fresh snapshot storage for
+    // the slot - a new memfd, or the untouched replay buffer - which reads
+    // as zero wherever the file has nothing. Game memory is only touched by
+    // the restore afterwards, so a damaged file costs nothing but the time.
+    bool32 Result = false;
+
+    sdl_replay_buffer *ReplayBuffer = SDLGetReplayBuffer(State, Index);
+    platform_api *PlatformAPI = &State->GameMemory->PlatformAPI;
+    Assert(!ReplayBuffer->HasSnapshot);
+
+    int SnapshotHandle = -1;
+    bool32 HaveStorage = false;
+    if(State->CopyOnWriteSnapshots)
+    {
+        SnapshotHandle = SDLCreateSnapshotHandle(State);
+        HaveStorage = (SnapshotHandle != -1);
+    }
+    else
+    {
+        HaveStorage = SDLGetReplayStorage(State, Index);
+    }
+
+    int Handle = open(ReplayBuffer->FileName, O_RDONLY);
+    struct stat FileStatus;
+    if(HaveStorage && (Handle != -1) &&
+       (fstat(Handle, &FileStatus) == 0) &&
+       (FileStatus.st_size >= (off_t)sizeof(sdl_replay_state_header)))
+    {
+        uint8 *Scratch = (uint8 *)PlatformAPI->AllocateMemory(SDL_REPLAY_STATE_BLOCK_SIZE);
+        void *Base = mmap(0, FileStatus.st_size, PROT_READ, MAP_PRIVATE, Handle, 0);
+        if(Scratch && (Base != MAP_FAILED))
+        {
+            madvise(Base, FileStatus.st_size, MADV_SEQUENTIAL);
+
+            sdl_replay_state_header Header;
+            memcpy(&Header, Base, sizeof(Header));
+            if((Header.MagicValue == SDL_REPLAY_STATE_MAGIC_VALUE) &&
+               (Header.Version == SDL_REPLAY_STATE_VERSION) &&
+               (Header.ReplayableSize == State->ReplayableSize))
+            {
+                uint8 *At = (uint8 *)Base + sizeof(Header);
+                uint8 *End = (uint8 *)Base + FileStatus.st_size;
+                Result = SDLApplyStateBlocks(State, &At, End, SnapshotHandle,
+                                             (uint8 *)ReplayBuffer->MemoryBlock, Scratch);
+                if(!Result)
+                {
+                    // TODO: Diagnostic
+#if HANDMADE_INTERNAL
+                    printf("Loop state %s is damaged\n", ReplayBuffer->FileName);
+#endif
+                }
+            }
+        }
+
+        if(Base != MAP_FAILED)
+        {
+            munmap(Base, FileStatus.st_size);
+        }
+        PlatformAPI->DeallocateMemory(Scratch);
+    }
+
+    if(Handle != -1)
+    {
+        close(Handle);
+    }
+
+    if(State->CopyOnWriteSnapshots)
+    {
+        if(Result)
+        {
+            ReplayBuffer->SnapshotHandle = SnapshotHandle;
+        }
+        else if(SnapshotHandle != -1)
+        {
+            close(SnapshotHandle);
+        }
+    }
+    else if(HaveStorage && !Result)
+    {
+        // NOTE: Back to all zeroes for the next attempt.
+        madvise(ReplayBuffer->MemoryBlock, State->ReplayableSize, MADV_DONTNEED);
+    }
+
+    ReplayBuffer->HasSnapshot = Result;
+
+    return(Result);
+}
+
+static memory_index
+SDLSnapshotGameMemory(sdl_state *State, int Index)
+{
+    // NOTE: Returns the number of bytes that had to be copied.
+    memory_index Result = 0;
+
+    sdl_replay_buffer *ReplayBuffer = SDLGetReplayBuffer(State, Index);
+    SDLCancelReplayStateWrite(State, Index);
+    if(State->CopyOnWriteSnapshots)
+    {
+        ReplayBuffer->HasSnapshot = (SDLTakeSnapshot(State, Index, &Result) &&
+                                     (ReplayBuffer->SnapshotHandle != -1));
+    }
+    else if(SDLGetReplayStorage(State, Index))
+    {
+        Result = SDLSyncReplayBuffer(State, Index, ReplayBuffer->MemoryBlock, State->GameMemoryBlock);
+        ReplayBuffer->HasSnapshot = true;
+    }
+
+    return(Result);
+}
+
+static uint8 *
+SDLWriteVarint(uint8 *At, uint32 Value)
+{
+    while(Value >= 0x80)
+    {
+        *At++ = (uint8)(Value | 0x80);
+        Value >>= 7;
+    }
+    *At++ = (uint8)Value;
+
+    return(At);
+}
+
+static bool32
+SDLReadVarint(uint8 **AtInit, uint8 *End, uint32 *Value)
+{
+    bool32 Result = false;
+
+    uint8 *At = *AtInit;
+    uint32 Shift = 0;
+    *Value = 0;
+    while((At < End) && (Shift < 35))
+    {
+        uint8 Byte = *At++;
+        *Value |= (uint32)(Byte & 0x7F) << Shift;
+        Shift += 7;
+        if(!(Byte & 0x80))
+        {
+            Result = true;
+            break;
+        }
+    }
+    *AtInit = At;
+
+    return(Result);
+}
+
+static memory_index
+SDLEncodeInputDelta(game_input *LastInput, game_input *Input, uint8 *Dest)
+{
+    // NOTE: Returns the encoded size, at most SDL_MAX_ENCODED_INPUT_SIZE.
+    uint32 *Old = (uint32 *)LastInput;
+    uint32 *New = (uint32 *)Input;
+
+    uint32 ChangedCount = 0;
+    for(uint32 WordIndex = 0;
+        WordIndex < SDL_INPUT_STREAM_WORD_COUNT;
+        ++WordIndex)
+    {
+        ChangedCount += (Old[WordIndex] != New[WordIndex]);
+    }
+
+    uint8 *At = SDLWriteVarint(Dest, ChangedCount);
+    uint32 Skip = 0;
+    for(uint32 WordIndex = 0;
+        WordIndex < SDL_INPUT_STREAM_WORD_COUNT;
+        ++WordIndex)
+    {
+        if(Old[WordIndex] != New[WordIndex])
+        {
+            At = SDLWriteVarint(At, Skip);
+            At = SDLWriteVarint(At, Old[WordIndex] ^ New[WordIndex]);
+            Skip = 0;
+        }
+        else
+        {
+            ++Skip;
+        }
+    }
+
+    memory_index Result = At - Dest;
+    return(Result);
+}
+
+static bool32
+SDLDecodeInputDelta(uint8 **At, uint8 *End, game_input *Input)
+{
+    // NOTE: Input holds the previous frame and is updated in place.
+    uint32 *Word = (uint32 *)Input;
+
+    uint32 ChangedCount;
+    bool32 Result = SDLReadVarint(At, End, &ChangedCount);
+    uint32 WordIndex = 0;
+    for(uint32 ChangedIndex = 0;
+        Result && (ChangedIndex < ChangedCount);
+        ++ChangedIndex)
+    {
+        uint32 Skip, Delta;
+        Result = (SDLReadVarint(At, End, &Skip) &&
+                  SDLReadVarint(At, End, &Delta) &&
+                  ((WordIndex + Skip) < SDL_INPUT_STREAM_WORD_COUNT));
+        if(Result)
+        {
+            WordIndex += Skip;
+            Word[WordIndex++] ^= Delta;
+        }
+    }
+
+    return(Result);
+}
+
+static PLATFORM_WORK_QUEUE_CALLBACK(SDLWriteInputChunkWork)
+{
+    sdl_input_chunk *Chunk = (sdl_input_chunk *)Data;
+    sdl_input_recorder *Recorder = Chunk->Recorder;
+
+    uint32 Written = 0;
+    while(Written < Chunk->Used)
+    {
+        ssize_t BytesWritten = pwrite(Recorder->Handle, Chunk->Data + Written, Chunk->Used - Written,
+                                      Chunk->FileOffset + Written);
+        if(BytesWritten > 0)
+        {
+            Written += BytesWritten;
+        }
+        else if(errno != EINTR)
+        {
+            Recorder->WriteFailed = true;
+            break;
+        }
+    }
+
+    CompletePreviousWritesBeforeFutureWrites;
+    Chunk->Pending = false;
+}
+
+static void
+SDLWaitForInputChunk(sdl_input_chunk *Chunk)
+{
+    // NOTE: Only ever waits if the disk has fallen a whole ring behind.
+    while(Chunk->Pending)
+    {
+        _mm_pause();
+    }
+    CompletePreviousReadsBeforeFutureReads;
+}
+
+static void
+SDLSubmitInputChunk(sdl_state *State)
+{
+    sdl_input_recorder *Recorder = &State->InputRecorder;
+    sdl_input_chunk *Chunk = Recorder->Chunks + Recorder->ChunkIndex;
+    if(Chunk->Used)
+    {
+        Chunk->Recorder = Recorder;
+        Chunk->FileOffset = Recorder->FileOffset;
+        Recorder->FileOffset += Chunk->Used;
+        Chunk->Pending = true;
+        State->GameMemory->PlatformAPI.AddEntry(State->InputWriteQueue, SDLWriteInputChunkWork, Chunk);
+
+        Recorder->ChunkIndex = (Recorder->ChunkIndex + 1) % SDL_INPUT_CHUNK_COUNT;
+        Chunk = Recorder->Chunks + Recorder->ChunkIndex;
+        SDLWaitForInputChunk(Chunk);
+        Chunk->Used = 0;
+    }
+}
+
+static void
+SDLWaitForKeyframe(sdl_input_recorder *Recorder)
+{
+    while(Recorder->KeyframePending)
+    {
+        _mm_pause();
+    }
+    CompletePreviousReadsBeforeFutureReads;
+}
+
+static PLATFORM_WORK_QUEUE_CALLBACK(SDLWriteKeyframeWork)
+{
+    sdl_keyframe_capture *Capture = (sdl_keyframe_capture *)Data;
+    sdl_state *State = Capture->State;
+    sdl_input_recorder *Recorder = &State->InputRecorder;
+    platform_api *PlatformAPI = &State->GameMemory->PlatformAPI;
+
+    // NOTE: The header goes out with a DataSize of 0 and is only patched
+    // once the whole keyframe is on disk, so a keyframe cut short by a
+    // failed write reads back as the end of the file.
+    sdl_replay_state_output Output = {};
+    Output.Handle = Recorder->KeyframeHandle;
+    Output.Size = Megabytes(1);
+    Output.Buffer = (uint8 *)PlatformAPI->AllocateMemory(Output.Size + 2*SDL_REPLAY_STATE_BLOCK_SIZE);
+    uint8 *Compressed = Output.Buffer + Output.Size;
+    off_t RecordOffset = lseek(Output.Handle, 0, SEEK_CUR);
+    Output.Failed = (!Output.Buffer || (RecordOffset == -1));
+
+    sdl_keyframe_header Header = Capture->Header;
+    Header.DataSize = 0;
+    if(!Output.Failed)
+    {
+        SDLWriteReplayStateOutput(&Output, sizeof(Header), &Header);
+    }
+
+    // NOTE: The runs are in address order; each block's stored pages are
+    // packed together out of the shadow as they're reached.
+    uint8 *BlockPages = Compressed + SDL_REPLAY_STATE_BLOCK_SIZE;
+    uint8 *Page = BlockPages;
+    uint32 CurrentBlockIndex = SDL_REPLAY_STATE_END;
+    uint16 PageMask = 0;
+    for(uint32 RunIndex = 0;
+        !Output.Failed && (RunIndex < Capture->RunCount);
+        ++RunIndex)
+    {
+        sdl_page_run *Run = Capture->Runs + RunIndex;
+        for(uint32 PageIndex = Run->FirstPage;
+            PageIndex < Run->OnePastLastPage;
+            ++PageIndex)
+        {
+            uint32 BlockIndex = PageIndex / SDL_REPLAY_STATE_PAGES_PER_BLOCK;
+            if(BlockIndex != CurrentBlockIndex)
+            {
+                if(PageMask)
+                {
+                    SDLWriteStateBlock(&Output, CurrentBlockIndex, PageMask, BlockPages, Compressed);
+                }
+                CurrentBlockIndex = BlockIndex;
+                PageMask = 0;
+                Page = BlockPages;
+            }
+
+            PageMask |= (1 << (PageIndex % SDL_REPLAY_STATE_PAGES_PER_BLOCK));
+            memcpy(Page, Recorder->KeyframeShadow + (memory_index)PageIndex*SDL_REPLAY_STATE_PAGE_SIZE,
+                   SDL_REPLAY_STATE_PAGE_SIZE);
+            Page += SDL_REPLAY_STATE_PAGE_SIZE;
+        }
+    }
+
+    if(!Output.Failed)
+    {
+        if(PageMask)
+        {
+            SDLWriteStateBlock(&Output, CurrentBlockIndex, PageMask, BlockPages, Compressed);
+        }
+
+        sdl_replay_state_block EndBlock = {};
+        EndBlock.BlockIndex = SDL_REPLAY_STATE_END;
+        SDLWriteReplayStateOutput(&Output, sizeof(EndBlock), &EndBlock);
+        SDLFlushReplayStateOutput(&Output);
+    }
+
+    if(!Output.Failed)
+    {
+        Header.DataSize = Output.BytesWritten - sizeof(Header);
+        Output.Failed = (pwrite(Output.Handle, &Header, sizeof(Header), RecordOffset) != sizeof(Header));
+    }
+
+    if(!Output.Failed)
+    {
+        Recorder->KeyframeFileSize = RecordOffset + Output.BytesWritten;
+    }
+    else
+    {
+        if(RecordOffset != -1)
+        {
+            // NOTE: Cut back to the last good keyframe.
+            ftruncate(Output.Handle, RecordOffset);
+            lseek(Output.Handle, RecordOffset, SEEK_SET);
+        }
+        Recorder->KeyframeWriteFailed = true;
+    }
+
+    PlatformAPI->DeallocateMemory(Output.Buffer);
+
+    CompletePreviousWritesBeforeFutureWrites;
+    Recorder->KeyframePending = false;
+}
+
+static void
+SDLCaptureKeyframe(sdl_state *State)
+{
+    // NOTE: The pages that can differ from the last keyframe are among the
+    // ones that differ from the loop snapshot, and those are exactly the ones
+    // the snapshot mechanism already knows about: the private pages of a
+    // copy-on-write mapping, or the dirty pages since the snapshot's sync
+    // otherwise. Without either there are no keyframes. Each of those is
+    // compared with the shadow, and only the ones that changed are copied
+    // and written, so a keyframe's size follows what changed in its
+    // interval, not the length of the recording.
+    // NOTE: The caller tries again every frame while the last keyframe is
+    // still being written, and while the game's work queues are busy, up to
+    // SDL_MAX_KEYFRAME_WAIT frames; only then does the drain below wait.
+    // The compare stays on this thread, because the game writes memory again
+    // as soon as the frame goes on.
+    sdl_input_recorder *Recorder = &State->InputRecorder;
+    Assert(!Recorder->KeyframePending);
+    Recorder->NextKeyframeFrame = Recorder->FrameCount + SDL_KEYFRAME_INTERVAL;
+
+    if(Recorder->KeyframeWriteFailed ||
+       (Recorder->KeyframeCount >= SDL_MAX_KEYFRAME_COUNT) ||
+       (Recorder->KeyframeFileSize >= SDL_MAX_KEYFRAME_FILE_SIZE))
+    {
+#if HANDMADE_INTERNAL
+        printf("Loop keyframes stopped at frame %u (%u keyframes, %lu bytes%s)\n",
+               Recorder->FrameCount, Recorder->KeyframeCount, Recorder->KeyframeFileSize,
+               Recorder->KeyframeWriteFailed ? ", WRITE FAILED" : "");
+#endif
+        Recorder->NextKeyframeFrame = 0xFFFFFFFF;
+        return;
+    }
+
+    SDLCompleteGameWork(State);
+
+    uint32 RunCount = 0;
+    sdl_page_run *Runs = 0;
+    memory_index PageSize = sysconf(_SC_PAGESIZE);
+    if(State->CopyOnWriteSnapshots)
+    {
+        if(State->MappedSnapshotIndex == State->InputRecordingIndex)
+        {
+            RunCount = SDLCollectPrivatePageRuns(State);
+            Runs = State->ChangedRuns;
+        }
+    }
+    else
+    {
+        sdl_dirty_page_tracker *Tracker = &State->DirtyPageTracker;
+        if((Tracker->Mode != SDLDirtyTracking_None) &&
+           (State->SyncedReplayIndex == State->InputRecordingIndex))
+        {
+            // NOTE: Collecting doesn't reset, so this is everything since
+            // the snapshot.
+            SDLCollectDirtyPages(Tracker);
+            if(Tracker->Mode != SDLDirtyTracking_None)
+            {
+                RunCount = Tracker->DirtyRunCount;
+                Runs = Tracker->DirtyRuns;
+            }
+        }
+    }
+
+    if(RunCount && (Recorder->KeyframeHandle != -1) && Recorder->KeyframeShadow)
+    {
+        // NOTE: Runs are kept in state file pages from here on.
+        Assert((PageSize % SDL_REPLAY_STATE_PAGE_SIZE) == 0);
+        uint32 Scale = (uint32)(PageSize / SDL_REPLAY_STATE_PAGE_SIZE);
+
+        sdl_keyframe_capture *Capture = &Recorder->Keyframe;
+        Capture->State = State;
+        Capture->RunCount = 0;
+
+        uint32 PageCount = 0;
+        uint8 *Memory = (uint8 *)State->GameMemoryBlock;
+        for(uint32 RunIndex = 0;
+            RunIndex < RunCount;
+            ++RunIndex)
+        {
+            for(uint32 PageIndex = Runs[RunIndex].FirstPage*Scale;
+                PageIndex < Runs[RunIndex].OnePastLastPage*Scale;
+                ++PageIndex)
+            {
+                memory_index Offset = (memory_index)PageIndex*SDL_REPLAY_STATE_PAGE_SIZE;
+                uint8 *ShadowPages = Recorder->KeyframeShadowPages + PageIndex/8;
+                uint8 ShadowBit = (uint8)(1 << (PageIndex % 8));
+                if(!(*ShadowPages & ShadowBit) ||
+                   (memcmp(Recorder->KeyframeShadow + Offset, Memory + Offset, SDL_REPLAY_STATE_PAGE_SIZE) != 0))
+                {
+                    memcpy(Recorder->KeyframeShadow + Offset, Memory + Offset, SDL_REPLAY_STATE_PAGE_SIZE);
+                    *ShadowPages |= ShadowBit;
+                    SDLAddPageRun(Capture->Runs, Capture->MaxRunCount, &Capture->RunCount,
+                                  PageIndex, PageIndex + 1);
+                    ++PageCount;
+                }
+            }
+        }
+
+        sdl_input_chunk *Chunk = Recorder->Chunks + Recorder->ChunkIndex;
+        Capture->Header = {};
+        Capture->Header.FrameIndex = Recorder->FrameCount;
+        Capture->Header.PageCount = PageCount;
+        Capture->Header.InputOffset = Recorder->FileOffset + Chunk->Used;
+        Capture->Header.LastInput = Recorder->LastInput;
+
+        ++Recorder->KeyframeCount;
+        Recorder->KeyframePending = true;
+        State->GameMemory->PlatformAPI.AddEntry(State->ReplayWriteQueue, SDLWriteKeyframeWork, Capture);
+    }
+}
+
+static void
+SDLFreeKeyframeShadow(sdl_input_recorder *Recorder)
+{
+    if(Recorder->KeyframeShadow)
+    {
+        munmap(Recorder->KeyframeShadow, Recorder->KeyframeShadowSize);
+    }
+    Recorder->KeyframeShadow = 0;
+    Recorder->KeyframeShadowPages = 0;
+    Recorder->Keyframe.Runs = 0;
+}
+
+static bool32
+SDLAllocateKeyframeShadow(sdl_state *State, sdl_input_recorder *Recorder)
+{
+    // NOTE: Reserved, not committed: only the pages keyframes store are ever
+    // touched.
+    uint32 PageCount = (uint32)(State->ReplayableSize / SDL_REPLAY_STATE_PAGE_SIZE);
+    uint32 MaxRunCount = PageCount / 2 + 1;
+    memory_index ShadowPagesSize = (PageCount + 7) / 8;
+    Recorder->KeyframeShadowSize = (State->ReplayableSize + ShadowPagesSize +
+                                    MaxRunCount*sizeof(sdl_page_run));
+    void *Base = mmap(0, Recorder->KeyframeShadowSize, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    bool32 Result = (Base != MAP_FAILED);
+    if(Result)
+    {
+        Recorder->KeyframeShadow = (uint8 *)Base;
+        Recorder->KeyframeShadowPages = Recorder->KeyframeShadow + State->ReplayableSize;
+        Recorder->Keyframe.Runs = (sdl_page_run *)(Recorder->KeyframeShadowPages + ShadowPagesSize);
+        Recorder->Keyframe.MaxRunCount = MaxRunCount;
+    }
+
+    return(Result);
+}
+
+static bool32
+SDLBeginInputStream(sdl_state *State, int SlotIndex)
+{
+    sdl_input_recorder *Recorder = &State->InputRecorder;
+    Recorder->KeyframeHandle = -1;
+
+    char FileName[SDL_STATE_FILE_NAME_COUNT];
+    SDLGetInputFileLocation(State, "input", SlotIndex, sizeof(FileName), FileName);
+    Recorder->Handle = open(FileName, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+    sdl_input_stream_header Header = {};
+    Header.MagicValue = SDL_INPUT_STREAM_MAGIC_VALUE;
+    Header.Version = SDL_INPUT_STREAM_VERSION;
+    Header.InputSize = sizeof(game_input);
+
+    bool32 Result = ((Recorder->Handle != -1) &&
+                     (pwrite(Recorder->Handle, &Header, sizeof(Header), 0) == sizeof(Header)));
+    if(Result)
+    {
+        Recorder->WriteFailed = false;
+        Recorder->FrameCount = 0;
+        Recorder->FileOffset = sizeof(Header);
+        Recorder->ChunkIndex = 0;
+        Recorder->LastInput = {};
+        Recorder->NextKeyframeFrame = SDL_KEYFRAME_INTERVAL;
+
+        // NOTE: Without a keys file the loop still records; seeks just run
+        // from the start of it.
+        sdl_keyframe_file_header KeyframeFileHeader = {};
+        KeyframeFileHeader.MagicValue = SDL_KEYFRAME_MAGIC_VALUE;
+        KeyframeFileHeader.Version = SDL_KEYFRAME_VERSION;
+        KeyframeFileHeader.InputSize = sizeof(game_input);
+        KeyframeFileHeader.ReplayableSize = State->ReplayableSize;
+
+        SDLGetInputFileLocation(State, "keys", SlotIndex, sizeof(FileName), FileName);
+        Recorder->KeyframeHandle = open(FileName, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if((Recorder->KeyframeHandle != -1) &&
+           ((write(Recorder->KeyframeHandle, &KeyframeFileHeader, sizeof(KeyframeFileHeader)) !=
+             sizeof(KeyframeFileHeader)) ||
+            !SDLAllocateKeyframeShadow(State, Recorder)))
+        {
+            close(Recorder->KeyframeHandle);
+            Recorder->KeyframeHandle = -1;
+        }
+        Recorder->KeyframeCount = 0;
+        Recorder->KeyframeFileSize = sizeof(KeyframeFileHeader);
+        Recorder->KeyframeWriteFailed = false;
+
+        for(uint32 ChunkIndex = 0;
+            ChunkIndex < SDL_INPUT_CHUNK_COUNT;
+            ++ChunkIndex)
+        {
+            sdl_input_chunk *Chunk = Recorder->Chunks + ChunkIndex;
+            if(!Chunk->Data)
+            {
+                Chunk->Data = (uint8 *)State->GameMemory->PlatformAPI.AllocateMemory(SDL_INPUT_CHUNK_SIZE);
+            }
+            Chunk->Used = 0;
+            Result = Result && (Chunk->Data != 0);
+        }
+    }
+
+    if(!Result && (Recorder->Handle != -1))
+    {
+        close(Recorder->Handle);
+        Recorder->Handle = -1;
+        if(Recorder->KeyframeHandle != -1)
+        {
+            close(Recorder->KeyframeHandle);
+            Recorder->KeyframeHandle = -1;
+        }
+        SDLFreeKeyframeShadow(Recorder);
+    }
+
+    return(Result);
+}
+
+static void
+SDLEndRecordingInput(sdl_state *State)
+{
+    sdl_input_recorder *Recorder = &State->InputRecorder;
+    SDLSubmitInputChunk(State);
+    for(uint32 ChunkIndex = 0;
+        ChunkIndex < SDL_INPUT_CHUNK_COUNT;
+        ++ChunkIndex)
+    {
+        SDLWaitForInputChunk(Recorder->Chunks + ChunkIndex);
+    }
+
+    sdl_input_stream_header Header = {};
+    Header.MagicValue = SDL_INPUT_STREAM_MAGIC_VALUE;
+    Header.Version = SDL_INPUT_STREAM_VERSION;
+    Header.InputSize = sizeof(game_input);
+    Header.FrameCount = Recorder->FrameCount;
+    pwrite(Recorder->Handle, &Header, sizeof(Header), 0);
+
+    SDLWaitForKeyframe(Recorder);
+    if(Recorder->KeyframeHandle != -1)
+    {
+        close(Recorder->KeyframeHandle);
+        Recorder->KeyframeHandle = -1;
+    }
+    SDLFreeKeyframeShadow(Recorder);
+
+#if HANDMADE_INTERNAL
+    printf("Loop input: %u frames in %lu bytes%s\n", Recorder->FrameCount, Recorder->FileOffset,
+           Recorder->WriteFailed ? " (WRITE FAILED)" : "");
+#endif
+
+    close(Recorder->Handle);
+    Recorder->Handle = -1;
+    State->InputRecordingIndex = 0;
+}
+
+static void
+SDLBeginRecordingInput(sdl_state *State, int InputRecordingIndex)
+{
+    sdl_replay_buffer *ReplayBuffer = SDLGetReplayBuffer(State, InputRecordingIndex);
+    if(SDLGetReplayStorage(State, InputRecordingIndex) &&
+       SDLBeginInputStream(State, InputRecordingIndex))
+    {
+        State->InputRecordingIndex = InputRecordingIndex;
+
+        uint64 StartCounter = SDL_GetPerformanceCounter();
+        memory_index BytesCopied = SDLSnapshotGameMemory(State, InputRecordingIndex);
+        uint64 EndCounter = SDL_GetPerformanceCounter();
+#if HANDMADE_INTERNAL
+        printf("Loop snapshot: %lu bytes in %.02fms\n", (uint64)BytesCopied,
+               1000.0f*(real32)(EndCounter - StartCounter) / (real32)GlobalPerfCountFrequency);
+#endif
+
+        if(ReplayBuffer->HasSnapshot)
+        {
+            SDLQueueReplayStateWrite(State, InputRecordingIndex);
+        }
+        else
+        {
+            // TODO: Diagnostic
+            // NOTE: Input with no state to start it from can't be played.
+            SDLEndRecordingInput(State);
+        }
+    }
+}
+
+static void
+SDLRestoreLoopState(sdl_state *State, int Index)
+{
+    sdl_replay_buffer *ReplayBuffer = SDLGetReplayBuffer(State, Index);
+
+    uint64 StartCounter = SDL_GetPerformanceCounter();
+    if(State->CopyOnWriteSnapshots)
+    {
+        SDLRestoreSnapshot(State, Index);
+    }
+    else
+    {
+        SDLSyncReplayBuffer(State, Index, State->GameMemoryBlock, ReplayBuffer->MemoryBlock);
+    }
+    uint64 EndCounter = SDL_GetPerformanceCounter();
+#if HANDMADE_INTERNAL
+    printf("Loop restore: %.02fms\n",
+           1000.0f*(real32)(EndCounter - StartCounter) / (real32)GlobalPerfCountFrequency);
+#endif
+
+    // NOTE: Cache storage is not part of the snapshot, so whatever it
+    // holds now may not match the state we just went back to.
+    State->GameMemory->CacheStorageInvalidated = true;
+}
+
+static bool32
+SDLOpenInputStream(sdl_state *State, int SlotIndex)
+{
+    sdl_input_player *Player = &State->InputPlayer;
+    bool32 Result = false;
+
+    char FileName[SDL_STATE_FILE_NAME_COUNT];
+    SDLGetInputFileLocation(State, "input", SlotIndex, sizeof(FileName), FileName);
+    int Handle = open(FileName, O_RDONLY);
+    if(Handle != -1)
+    {
+        struct stat FileStatus;
+        if((fstat(Handle, &FileStatus) == 0) &&
+           (FileStatus.st_size >= (off_t)sizeof(sdl_input_stream_header)))
+        {
+            void *Base = mmap(0, FileStatus.st_size, PROT_READ, MAP_PRIVATE, Handle, 0);
+            if(Base != MAP_FAILED)
+            {
+                madvise(Base, FileStatus.st_size, MADV_SEQUENTIAL);
+
+                sdl_input_stream_header *Header = (sdl_input_stream_header *)Base;
+                if((Header->MagicValue == SDL_INPUT_STREAM_MAGIC_VALUE) &&
+                   (Header->Version == SDL_INPUT_STREAM_VERSION) &&
+                   (Header->InputSize == sizeof(game_input)))
+                {
+                    Player->Base = (uint8 *)Base;
+                    Player->Size = FileStatus.st_size;
+                    Player->FirstFrame = Player->Base + sizeof(sdl_input_stream_header);
+                    Player->At = Player->FirstFrame;
+                    Player->LastInput = {};
+                    Player->FrameIndex = 0;
+                    Player->LoopStartFrame = 0;
+                    Player->SeekRequested = false;
+
+                    // NOTE: Counted rather than taken from the header, so a
+                    // recording that was never finished, or is damaged part
+                    // way, plays as far as it goes.
+                    Player->FrameCount = 0;
+                    game_input Input = {};
+                    uint8 *At = Player->FirstFrame;
+                    while(SDLDecodeInputDelta(&At, Player->Base + Player->Size, &Input))
+                    {
+                        ++Player->FrameCount;
+                    }
+
+                    Result = true;
+                }
+                else
+                {
+                    // TODO: Diagnostic
+                    munmap(Base, FileStatus.st_size);
+                }
+            }
+        }
+
+        // NOTE: The mapping keeps the file alive.
+        close(Handle);
+    }
+
+    return(Result);
+}
+
+static bool32
+SDLReadKeyframeHeader(sdl_input_player *Player, uint8 *At, sdl_keyframe_header *Header)
+{
+    // NOTE: Checks that a whole keyframe is at At, and that it fits the
+    // input stream.
+    bool32 Result = false;
+
+    uint8 *End = Player->KeyframeBase + Player->KeyframeSize;
+    if((memory_index)(End - At) >= sizeof(*Header))
+    {
+        memcpy(Header, At, sizeof(*Header));
+        Result = (Header->DataSize &&
+                  (Header->DataSize <= (memory_index)(End - At - sizeof(*Header))) &&
+                  (Header->FrameIndex <= Player->FrameCount) &&
+                  (Header->InputOffset >= sizeof(sdl_input_stream_header)) &&
+                  (Header->InputOffset <= Player->Size));
+    }
+
+    return(Result);
+}
+
+static void
+SDLOpenKeyframes(sdl_state *State, int SlotIndex)
+{
+    // NOTE: Keyframes are optional: without them, seeks simply run the loop
+    // from its start.
+    sdl_input_player *Player = &State->InputPlayer;
+    platform_api *PlatformAPI = &State->GameMemory->PlatformAPI;
+
+    char FileName[SDL_STATE_FILE_NAME_COUNT];
+    SDLGetInputFileLocation(State, "keys", SlotIndex, sizeof(FileName), FileName);
+    int Handle = open(FileName, O_RDONLY);
+    if(Handle != -1)
+    {
+        struct stat FileStatus;
+        if((fstat(Handle, &FileStatus) == 0) &&
+           (FileStatus.st_size >= (off_t)sizeof(sdl_keyframe_file_header)))
+        {
+            void *Base = mmap(0, FileStatus.st_size, PROT_READ, MAP_PRIVATE, Handle, 0);
+            if(Base != MAP_FAILED)
+            {
+                Player->KeyframeBase = (uint8 *)Base;
+                Player->KeyframeSize = FileStatus.st_size;
+            }
+        }
+        close(Handle);
+    }
+
+    if(Player->KeyframeBase)
+    {
+        sdl_keyframe_file_header FileHeader;
+        memcpy(&FileHeader, Player->KeyframeBase, sizeof(FileHeader));
+        if((FileHeader.MagicValue == SDL_KEYFRAME_MAGIC_VALUE) &&
+           (FileHeader.Version == SDL_KEYFRAME_VERSION) &&
+           (FileHeader.InputSize == sizeof(game_input)) &&
+           (FileHeader.ReplayableSize == State->ReplayableSize))
+        {
+            // NOTE: Once to count them, once to index them. Anything after
+            // the first bad keyframe is ignored.
+            uint8 *FirstKeyframe = Player->KeyframeBase + sizeof(FileHeader);
+            for(uint32 Pass = 0;
+                Pass < 2;
+                ++Pass)
+            {
+                uint32 KeyframeCount = 0;
+                uint32 LastFrameIndex = 0;
+                uint8 *At = FirstKeyframe;
+                sdl_keyframe_header Header;
+                while(SDLReadKeyframeHeader(Player, At, &Header) &&
+                      (!KeyframeCount || (Header.FrameIndex > LastFrameIndex)))
+                {
+                    if(Player->Keyframes)
+                    {
+                        Player->Keyframes[KeyframeCount] = At;
+                    }
+                    ++KeyframeCount;
+                    LastFrameIndex = Header.FrameIndex;
+                    At += sizeof(Header) + Header.DataSize;
+                }
+
+                if(Pass == 0)
+                {
+                    Player->Keyframes = (uint8 **)PlatformAPI->AllocateMemory((KeyframeCount + 1)*sizeof(uint8 *));
+                    Player->Scratch = (uint8 *)PlatformAPI->AllocateMemory(SDL_REPLAY_STATE_BLOCK_SIZE);
+                    if(!Player->Keyframes || !Player->Scratch)
+                    {
+                        break;
+                    }
+                }
+                else
+                {
+                    Player->KeyframeCount = KeyframeCount;
+                }
+            }
+        }
+    }
+}
+
+static void
+SDLSeekPlayBack(sdl_state *State, uint32 TargetFrame,
+                sdl_game_code *Game, game_offscreen_buffer *Buffer,
+                int SamplesPerSecond, int16 *Samples)
+{
+    // NOTE: Restores the loop snapshot, lays every keyframe up to the last
+    // one at or before TargetFrame over it in order, and runs the game on the
+    // recorded input from there up to TargetFrame. The frames run through
+    // still get their sound asked for, into Samples (room for a second's
+    // worth) and thrown away, since mixing moves game state along too.
+    sdl_input_player *Player = &State->InputPlayer;
+    if(TargetFrame >= Player->FrameCount)
+    {
+        TargetFrame = Player->FrameCount ? (Player->FrameCount - 1) : 0;
+    }
+
+    uint64 StartCounter = SDL_GetPerformanceCounter();
+
+    SDLRestoreLoopState(State, State->InputPlayingIndex);
+    Player->At = Player->FirstFrame;
+    Player->LastInput = {};
+    Player->FrameIndex = 0;
+
+    uint32 KeyIndex = Player->KeyframeCount;
+    sdl_keyframe_header Header = {};
+    while(KeyIndex > 0)
+    {
+        memcpy(&Header, Player->Keyframes[KeyIndex - 1], sizeof(Header));
+        if(Header.FrameIndex <= TargetFrame)
+        {
+            break;
+        }
+        --KeyIndex;
+    }
+
+    if(KeyIndex > 0)
+    {
+        bool32 Applied = true;
+        for(uint32 ApplyIndex = 0;
+            Applied && (ApplyIndex < KeyIndex);
+            ++ApplyIndex)
+        {
+            sdl_keyframe_header ApplyHeader;
+            memcpy(&ApplyHeader, Player->Keyframes[ApplyIndex], sizeof(ApplyHeader));
+            uint8 *At = Player->Keyframes[ApplyIndex] + sizeof(ApplyHeader);
+            Applied = SDLApplyStateBlocks(State, &At, At + ApplyHeader.DataSize, -1,
+                                          (uint8 *)State->GameMemoryBlock, Player->Scratch);
+        }
+
+        if(Applied)
+        {
+            Player->At = Player->Base + Header.InputOffset;
+            Player->LastInput = Header.LastInput;
+            Player->FrameIndex = Header.FrameIndex;
+        }
+        else
+        {
+            // TODO: Diagnostic
+            // NOTE: Partly applied, so back to the snapshot and run it all.
+            SDLRestoreLoopState(State, State->InputPlayingIndex);
+        }
+    }
+
+    uint32 KeyframeFrame = Player->FrameIndex;
+    uint8 *End = Player->Base + Player->Size;
+    while((Player->FrameIndex < TargetFrame) &&
+          SDLDecodeInputDelta(&Player->At, End, &Player->LastInput))
+    {
+        ++Player->FrameIndex;
+        game_input Input = Player->LastInput;
+        if(Game->UpdateAndRender)
+        {
+            Game->UpdateAndRender(State->GameMemory, &Input, Buffer);
+        }
+
+        game_sound_output_buffer SoundBuffer = {};
+        SoundBuffer.SamplesPerSecond = SamplesPerSecond;
+        SoundBuffer.SampleCount = Align8((int)((real32)SamplesPerSecond*
+                                               Input.dtForFrame*(real32)Input.SimStepCount));
+        if(SoundBuffer.SampleCount > SamplesPerSecond)
+        {
+            SoundBuffer.SampleCount = SamplesPerSecond;
+        }
+        SoundBuffer.Samples = Samples;
+        if(Game->GetSoundSamples)
+        {
+            Game->GetSoundSamples(State->GameMemory, &SoundBuffer);
+        }
+    }
+
+    uint64 EndCounter = SDL_GetPerformanceCounter();
+#if HANDMADE_INTERNAL
+    printf("Loop seek to frame %u of %u: from frame %u, %u frames run in %.02fms\n",
+           Player->FrameIndex, Player->FrameCount, KeyframeFrame, Player->FrameIndex - KeyframeFrame,
+           1000.0f*(real32)(EndCounter - StartCounter) / (real32)GlobalPerfCountFrequency);
+#endif
+}
+
+static void
+SDLBeginInputPlayBack(sdl_state *State, int InputPlayingIndex)
+{
+    sdl_replay_buffer *ReplayBuffer = SDLGetReplayBuffer(State, InputPlayingIndex);
+    if(!ReplayBuffer->HasSnapshot)
+    {
+        // NOTE: Nothing recorded into this slot yet this run, so pick up
+        // the loop an earlier run left on disk, if there is one.
+        uint64 StartCounter = SDL_GetPerformanceCounter();
+        bool32 Loaded = SDLLoadReplayState(State, InputPlayingIndex);
+        uint64 EndCounter = SDL_GetPerformanceCounter();
+#if HANDMADE_INTERNAL
+        if(Loaded)
+        {
+            printf("Loop state loaded from disk in %.02fms\n",
+                   1000.0f*(real32)(EndCounter - StartCounter) / (real32)GlobalPerfCountFrequency);
+        }
+#endif
+    }
+
+    if(ReplayBuffer->HasSnapshot && SDLOpenInputStream(State, InputPlayingIndex))
+    {
+        SDLOpenKeyframes(State, InputPlayingIndex);
+        State->InputPlayingIndex = InputPlayingIndex;
+        SDLRestoreLoopState(State, InputPlayingIndex);
+    }
+}
+
+static void
+SDLEndInputPlayBack(sdl_state *State)
+{
+    sdl_input_player *Player = &State->InputPlayer;
+    munmap(Player->Base, Player->Size);
+    if(Player->KeyframeBase)
+    {
+        munmap(Player->KeyframeBase, Player->KeyframeSize);
+    }
+    State->GameMemory->PlatformAPI.DeallocateMemory(Player->Keyframes);
+    State->GameMemory->PlatformAPI.DeallocateMemory(Player->Scratch);
+    *Player = {};
+    State->InputPlayingIndex = 0;
+}
+
+static void
+SDLRecordInput(sdl_state *State, game_input *NewInput)
+{
+    sdl_input_recorder *Recorder = &State->InputRecorder;
+    sdl_input_chunk *Chunk = Recorder->Chunks + Recorder->ChunkIndex;
+    if((Chunk->Used + SDL_MAX_ENCODED_INPUT_SIZE) > SDL_INPUT_CHUNK_SIZE)
+    {
+        SDLSubmitInputChunk(State);
+        Chunk = Recorder->Chunks + Recorder->ChunkIndex;
+    }
+
+    if((Recorder->FrameCount >= Recorder->NextKeyframeFrame) && !Recorder->KeyframePending &&
+       (SDLGameWorkIsIdle(State) ||
+        ((Recorder->FrameCount - Recorder->NextKeyframeFrame) >= SDL_MAX_KEYFRAME_WAIT)))
+    {
+        SDLCaptureKeyframe(State);
+    }
+
+    Chunk->Used += (uint32)SDLEncodeInputDelta(&Recorder->LastInput, NewInput, Chunk->Data + Chunk->Used);
+    Recorder->LastInput = *NewInput;
+    ++Recorder->FrameCount;
+}
+
+static void
+SDLPlayBackInput(sdl_state *State, game_input *NewInput,
+                 sdl_game_code *Game, game_offscreen_buffer *Buffer,
+                 int SamplesPerSecond, int16 *Samples)
+{
+    sdl_input_player *Player = &State->InputPlayer;
+    if(Player->SeekRequested)
+    {
+        Player->SeekRequested = false;
+        SDLSeekPlayBack(State, Player->SeekFrame, Game, Buffer, SamplesPerSecond, Samples);
+    }
+
+    if(Player->FrameIndex >= Player->FrameCount)
+    {
+        // NOTE(casey): We've hit the end of the stream, go back to the beginning
+        SDLSeekPlayBack(State, Player->LoopStartFrame, Game, Buffer, SamplesPerSecond, Samples);
+    }
+
+    if(Player->FrameIndex < Player->FrameCount)
+    {
+        if(SDLDecodeInputDelta(&Player->At, Player->Base + Player->Size, &Player->LastInput))
+        {
+            *NewInput = Player->LastInput;
+            ++Player->FrameIndex;
+        }
+        else
+        {
+            // TODO: Diagnostic
+            // NOTE: Damaged from here on, so treat it as the end.
+            Player->FrameCount = Player->FrameIndex;
+        }
+    }
+}
+
+static void
+SDLRequestPlayBackSeek(sdl_state *State, uint32 TargetFrame)
+{
+    sdl_input_player *Player = &State->InputPlayer;
+    Player->SeekRequested = true;
+    Player->SeekFrame = TargetFrame;
+}
+
+static void
+SDLToggleFullscreen(SDL_Window *Window)
+{
+    uint32 Flags = SDL_GetWindowFlags(Window);
+    if(Flags & SDL_WINDOW_FULLSCREEN_DESKTOP)
+    {
+        SDL_SetWindowFullscreen(Window, 0);
+    }
+    else
+    {
+        SDL_SetWindowFullscreen(Window, SDL_WINDOW_FULLSCREEN_DESKTOP);
+    }
+}
+
+static void
+SDLProcessPendingEvents(sdl_state *State, game_controller_input *KeyboardController)
+{
+    SDL_Event Event;
+    while(SDL_PollEvent(&Event))
+    {
+        switch(Event.type)
+        {
+            case SDL_QUIT:
+            {
+                GlobalRunning = false;
+            } break;
+
+            case SDL_KEYDOWN:
+            case SDL_KEYUP:
+            {
+                SDL_Keycode KeyCode = Event.key.keysym.sym;
+                bool IsDown = (Event.key.state == SDL_PRESSED);
+
+                // NOTE: In the windows version, we used "if (IsDown != WasDown)"
+                // to detect key repeats. SDL has the 'repeat' value, though,
+                // which we'll use.
+                if (Event.key.repeat == 0)
+                {
+                    if(KeyCode == SDLK_w)
+                    {
+                        SDLProcessKeyboardEvent(&KeyboardController->MoveUp, IsDown);
+                    }
+                    else if(KeyCode == SDLK_a)
+                    {
+                        SDLProcessKeyboardEvent(&KeyboardController->MoveLeft, IsDown);
+                    }
+                    else if(KeyCode == SDLK_s)
+                    {
+                        SDLProcessKeyboardEvent(&KeyboardController->MoveDown, IsDown);
+                    }
+                    else if(KeyCode == SDLK_d)
+                    {
+                        SDLProcessKeyboardEvent(&KeyboardController->MoveRight, IsDown);
+                    }
+                    else if(KeyCode == SDLK_q)
+                    {
+                        SDLProcessKeyboardEvent(&KeyboardController->LeftShoulder, IsDown);
+                    }
+                    else if(KeyCode == SDLK_e)
+                    {
+                        SDLProcessKeyboardEvent(&KeyboardController->RightShoulder, IsDown);
+                    }
+                    else if(KeyCode == SDLK_UP)
+                    {
+                        SDLProcessKeyboardEvent(&KeyboardController->ActionUp, IsDown);
+                    }
+                    else if(KeyCode == SDLK_LEFT)
+                    {
+                        SDLProcessKeyboardEvent(&KeyboardController->ActionLeft, IsDown);
+                    }
+                    else if(KeyCode == SDLK_DOWN)
+                    {
+                        SDLProcessKeyboardEvent(&KeyboardController->ActionDown, IsDown);
+                    }
+                    else if(KeyCode == SDLK_RIGHT)
+                    {
+                        SDLProcessKeyboardEvent(&KeyboardController->ActionRight, IsDown);
+                    }
+                    else if(KeyCode == SDLK_ESCAPE)
+                    {
+                        SDLProcessKeyboardEvent(&KeyboardController->Back, IsDown);
+                    }
+                    else if(KeyCode == SDLK_SPACE)
+                    {
+                        SDLProcessKeyboardEvent(&KeyboardController->Start, IsDown);
+                    }
+#if HANDMADE_INTERNAL
+                    else if(KeyCode == SDLK_p)
+                    {
+                        if(IsDown)
+                        {
+                            GlobalPause = !GlobalPause;
+                        }
+                    }
+                    else if(KeyCode == SDLK_t)
+                    {
+                        if(IsDown)
+                        {
+                            GlobalFrameStats.ReportRequested = true;
+                        }
+                    }
+                    else if(KeyCode == SDLK_l)
+                    {
+                        if(IsDown)
+                        {
+                            if(State->InputPlayingIndex == 0)
+                            {
+                                if(State->InputRecordingIndex == 0)
+                                {
+                                    SDLBeginRecordingInput(State, 1);
+                                }
+                                else
+                                {
+                                    SDLEndRecordingInput(State);
+                                    SDLBeginInputPlayBack(State, 1);
+                                }
+                            }
+                            else
+                            {
+                                SDLEndInputPlayBack(State);
+                            }
+                        }
+                    }
+                    else if(State->InputPlayingIndex &&
+                            ((KeyCode == SDLK_LEFTBRACKET) || (KeyCode == SDLK_RIGHTBRACKET)))
+                    {
+                        if(IsDown)
+                        {
+                            uint32 FrameIndex = State->InputPlayer.FrameIndex;
+                            if(KeyCode == SDLK_RIGHTBRACKET)
+                            {
+                                FrameIndex += SDL_KEYFRAME_INTERVAL;
+                            }
+                            else
+                            {
+                                FrameIndex = (FrameIndex > SDL_KEYFRAME_INTERVAL) ?
+                                    (FrameIndex - SDL_KEYFRAME_INTERVAL) : 0;
+                            }
+                            SDLRequestPlayBackSeek(State, FrameIndex);
+                        }
+                    }
+                    else if(State->InputPlayingIndex && (KeyCode == SDLK_k))
+                    {
+                        if(IsDown)
+                        {
+                            // NOTE: Loop from here on; with shift, from the
+                            // start of the recording again.
+                            sdl_input_player *Player = &State->InputPlayer;
+                            bool ShiftKeyWasDown = (Event.key.keysym.mod & KMOD_SHIFT);
+                            Player->LoopStartFrame = ShiftKeyWasDown ? 0 : Player->FrameIndex;
+                            printf("Loop start: frame %u\n", Player->LoopStartFrame);
+                        }
+                    }
+#endif
+                    if(IsDown)
+                    {
+                        bool AltKeyWasDown = (Event.key.keysym.mod & KMOD_ALT);
+                        if (KeyCode == SDLK_F4 && AltKeyWasDown)
+                        {
+                            GlobalRunning = false;
+                        }
+                        if((KeyCode == SDLK_RETURN) && AltKeyWasDown)
+                        {
+                            SDL_Window *Window = SDL_GetWindowFromID(Event.window.windowID);
+                            if(Window)
+                            {
+                                SDLToggleFullscreen(Window);
+                            }
+                        }
+                    }
+                }
+
+            } break;
+
+            case SDL_WINDOWEVENT:
+            {
+                switch(Event.window.event)
+                {
+                    case SDL_WINDOWEVENT_SIZE_CHANGED:
+                    {
+                        SDL_Window *Window = SDL_GetWindowFromID(Event.window.windowID);
+                        SDL_Renderer *Renderer = SDL_GetRenderer(Window);
+                        printf("SDL_WINDOWEVENT_SIZE_CHANGED (%d, %d)\n", Event.window.data1, Event.window.data2);
+                    } break;
+
+                    case SDL_WINDOWEVENT_FOCUS_GAINED:
+                    {
+                        printf("SDL_WINDOWEVENT_FOCUS_GAINED\n");
+                    } break;
+
+                    case SDL_WINDOWEVENT_EXPOSED:
+                    {
+                        SDL_Window *Window = SDL_GetWindowFromID(Event.window.windowID);
+                        SDL_Renderer *Renderer = SDL_GetRenderer(Window);
+                        sdl_window_dimension Dimension = SDLGetWindowDimension(Window);
+                        SDLDisplayBufferInWindow(&GlobalBackbuffer, Renderer,
+                                                 Dimension.Width, Dimension.Height);
+
+                    } break;
+                }
+            } break;
+        }
+    }
+}
+
+inline uint64
+SDLGetWallClock(void)
+{
+    uint64 Result = SDL_GetPerformanceCounter();
+    return(Result);
+}
+
+static real32
+SDLGetSecondsElapsed(uint64 Start, uint64 End)
+{
+    real32 Result = ((real32)(End - Start) /
+                     (real32)GlobalPerfCountFrequency);
+    return(Result);
+}
+
+inline uint64
+SDLGetNanoseconds(void)
+{
+    struct timespec Now;
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    uint64 Result = (uint64)Now.tv_sec*1000000000ULL + (uint64)Now.tv_nsec;
+    return(Result);
+}
+
+static sdl_pacing_mode
+SDLGetPacingMode(int MonitorRefreshHz, real32 GameUpdateHz)
+{
+    // NOTE: HANDMADE_PACING=vsync|timer. Vsync can only pace a game that
+    // runs at the display's rate; anything else goes by the timer.
+    sdl_pacing_mode Result = ((int)GameUpdateHz == MonitorRefreshHz) ?
+        SDLPacing_VSync : SDLPacing_Timer;
+
+    char *Mode = getenv("HANDMADE_PACING");
+    if(Mode)
+    {
+        if(strcmp(Mode, "vsync") == 0)
+        {
+            Result = SDLPacing_VSync;
+        }
+        else if(strcmp(Mode, "timer") == 0)
+        {
+            Result = SDLPacing_Timer;
+        }
+    }
+
+    return(Result);
+}
+
+static void
+SDLInitFramePacer(sdl_frame_pacer *Pacer, sdl_pacing_mode Mode, real32 FramesPerSecond)
+{
+    Pacer->Mode = Mode;
+    Pacer->FrameNanoseconds = (uint64)(1000000000.0 / (real64)FramesPerSecond);
+    Pacer->SpinMargin = 1000000;
+    Pacer->LastFrameEnd = SDLGetNanoseconds();
+    Pacer->NextDeadline = Pacer->LastFrameEnd + Pacer->FrameNanoseconds;
+
+    // NOTE: The default 50us of timer slack would be wake-up jitter the spin
+    // margin has to cover.
+    prctl(PR_SET_TIMERSLACK, 1, 0, 0, 0);
+}
+
+static void
+SDLWaitForFrameDeadline(sdl_frame_pacer *Pacer)
+{
+    uint64 Now = SDLGetNanoseconds();
+    Pacer->MissedThisFrame = (Now > Pacer->NextDeadline);
+
+    if((Pacer->Mode == SDLPacing_Timer) && !Pacer->MissedThisFrame)
+    {
+        if((Pacer->NextDeadline - Now) > Pacer->SpinMargin)
+        {
+            uint64 WakeTime = Pacer->NextDeadline - Pacer->SpinMargin;
+            struct timespec Wake;
+            Wake.tv_sec = (time_t)(WakeTime / 1000000000ULL);
+            Wake.tv_nsec = (long)(WakeTime % 1000000000ULL);
+            while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &Wake, 0) == EINTR)
+            {
+            }
+
+            uint64 Woke = SDLGetNanoseconds();
+            uint64 Lateness = (Woke > WakeTime) ? (Woke - WakeTime) : 0;
+            if(Lateness > Pacer->SpinMargin)
+            {
+                Pacer->SpinMargin = 2*Lateness;
+                if(Pacer->SpinMargin > SDL_PACER_MAX_SPIN_NANOSECONDS)
+                {
+                    Pacer->SpinMargin = SDL_PACER_MAX_SPIN_NANOSECONDS;
+                }
+            }
+            else
+            {
+                Pacer->SpinMargin -= Pacer->SpinMargin / 64;
+                if(Pacer->SpinMargin < SDL_PACER_MIN_SPIN_NANOSECONDS)
+                {
+                    Pacer->SpinMargin = SDL_PACER_MIN_SPIN_NANOSECONDS;
+                }
+            }
+        }
+
+        while(SDLGetNanoseconds() < Pacer->NextDeadline)
+        {
+            _mm_pause();
+        }
+    }
+}
+
+static void
+SDLEndFrame(sdl_frame_pacer *Pacer)
+{
+    // NOTE: Called once the frame has been presented.
+    uint64 Now = SDLGetNanoseconds();
+    uint64 FrameNanoseconds = Pacer->FrameNanoseconds;
+
+    if(Pacer->Mode == SDLPacing_VSync)
+    {
+        // NOTE: The flips set the schedule; a frame that took more than one
+        // and a half refreshes missed one.
+        Pacer->MissedThisFrame = ((Now - Pacer->LastFrameEnd) > (FrameNanoseconds + FrameNanoseconds/2));
+        Pacer->NextDeadline = Now + FrameNanoseconds;
+    }
+    else if(Pacer->MissedThisFrame)
+    {
+        // NOTE: Deadlines that went by are skipped rather than raced through,
+        // and the ones after stay on the same phase.
+        uint64 LateFrames = (Now - Pacer->NextDeadline) / FrameNanoseconds + 1;
+        Pacer->NextDeadline += LateFrames*FrameNanoseconds;
+    }
+    else
+    {
+        Pacer->NextDeadline += FrameNanoseconds;
+    }
+
+    if(Pacer->MissedThisFrame)
+    {
+        ++Pacer->MissedFrameCount;
+#if HANDMADE_INTERNAL
+        printf("Missed frame %u: %.02fms (%u missed so far)\n", Pacer->FrameIndex,
+               (real64)(Now - Pacer->LastFrameEnd) / 1000000.0, Pacer->MissedFrameCount);
+#endif
+    }
+
+    Pacer->LastFrameEnd = Now;
+    ++Pacer->FrameIndex;
+}
+
+static real32
+SDLGetSimulationHzFromEnvironment(void)
+{
+    // NOTE: HANDMADE_SIMULATION_HZ=<rate> turns on the fixed timestep.
+    real32 Result = 0.0f;
+
+    char *Rate = getenv("HANDMADE_SIMULATION_HZ");
+    if(Rate)
+    {
+        Result = (real32)atof(Rate);
+        if(Result < 1.0f)
+        {
+            Result = 0.0f;
+        }
+    }
+
+    return(Result);
+}
+
+static void
+SDLInitFixedTimestep(sdl_fixed_timestep *Timestep, real32 SimulationHz,
+                     sdl_frame_pacer *Pacer)
+{
+    Timestep->Enabled = (SimulationHz > 0.0f);
+    if(Timestep->Enabled)
+    {
+        Timestep->StepNanoseconds = (uint64)(1000000000.0 / (real64)SimulationHz);
+    }
+    Timestep->FrameNanoseconds = Pacer->FrameNanoseconds;
+    Timestep->SnapNanoseconds = Pacer->FrameNanoseconds / 20;
+    Timestep->LastFrameEnd = Pacer->LastFrameEnd;
+}
+
+static void
+SDLAdvanceFixedTimestep(sdl_fixed_timestep *Timestep, sdl_frame_pacer *Pacer,
+                        game_input *Input, real32 TargetSecondsPerFrame)
+{
+    if(Timestep->Enabled)
+    {
+        uint64 FrameNanoseconds = Pacer->LastFrameEnd - Timestep->LastFrameEnd;
+        Timestep->LastFrameEnd = Pacer->LastFrameEnd;
+
+        uint64 Period = Timestep->FrameNanoseconds;
+        if((FrameNanoseconds + Timestep->SnapNanoseconds > Period) &&
+           (FrameNanoseconds < Period + Timestep->SnapNanoseconds))
+        {
+            FrameNanoseconds = Period;
+        }
+
+        Timestep->Accumulated += FrameNanoseconds;
+
+        uint64 MaxAccumulated = SDL_MAX_SIM_STEPS_PER_FRAME*Timestep->StepNanoseconds;
+        if(Timestep->Accumulated > MaxAccumulated)
+        {
+            // NOTE: Past the catch-up limit the simulation runs slow rather
+            // than spending every frame catching up.
+            uint64 Dropped = Timestep->Accumulated - MaxAccumulated;
+            Timestep->DroppedNanoseconds += Dropped;
+            Timestep->Accumulated = MaxAccumulated;
+#if HANDMADE_INTERNAL
+            printf("Simulation fell %.02fms behind, dropped (%.02fms dropped so far)\n",
+                   (real64)Dropped / 1000000.0, (real64)Timestep->DroppedNanoseconds / 1000000.0);
+#endif
+        }
+
+        uint32 StepCount = (uint32)(Timestep->Accumulated / Timestep->StepNanoseconds);
+        Timestep->Accumulated -= StepCount*Timestep->StepNanoseconds;
+
+        Input->dtForFrame = (real32)((real64)Timestep->StepNanoseconds / 1000000000.0);
+        Input->SimStepCount = StepCount;
+        Input->tInterpolate = (real32)((real64)Timestep->Accumulated /
+                                       (real64)Timestep->StepNanoseconds);
+    }
+    else
+    {
+        Input->dtForFrame = TargetSecondsPerFrame;
+        Input->SimStepCount = 1;
+        Input->tInterpolate = 1.0f;
+    }
+}
+
+static int
+SDLCompareFrameTimes(const void *A, const void *B)
+{
+    uint32 TimeA = *(uint32 *)A;
+    uint32 TimeB = *(uint32 *)B;
+    int Result = (TimeA < TimeB) ? -1 : ((TimeA > TimeB) ? 1 : 0);
+    return(Result);
+}
+
+static void
+SDLPrintFrameTimePercentiles(sdl_frame_stats *Stats, char *Name, uint32 Count)
+{
+    qsort(Stats->Sorted, Count, sizeof(Stats->Sorted[0]), SDLCompareFrameTimes);
+
+    // NOTE: Nearest rank, so every value printed is one that was measured.
+    uint32 P50 = Stats->Sorted[(50*Count + 99) / 100 - 1];
+    uint32 P90 = Stats->Sorted[(90*Count + 99) / 100 - 1];
+    uint32 P99 = Stats->Sorted[(99*Count + 99) / 100 - 1];
+    uint32 Max = Stats->Sorted[Count - 1];
+    printf("  %-8s p50 %6.02fms  p90 %6.02fms  p99 %6.02fms  max %6.02fms\n", Name,
+           (real64)P50 / 1000000.0, (real64)P90 / 1000000.0,
+           (real64)P99 / 1000000.0, (real64)Max / 1000000.0);
+}
+
+static void
+SDLReportFrameStats(sdl_frame_stats *Stats, sdl_frame_pacer *Pacer)
+{
+    uint32 Count = Stats->FrameCount;
+    if(Count > SDL_FRAME_STATS_COUNT)
+    {
+        Count = SDL_FRAME_STATS_COUNT;
+    }
+
+    if(Count)
+    {
+        uint32 MissedCount = 0;
+        for(uint32 FrameIndex = 0;
+            FrameIndex < Count;
+            ++FrameIndex)
+        {
+            Stats->Sorted[FrameIndex] = Stats->Frames[FrameIndex].FrameNanoseconds;
+            MissedCount += Stats->Frames[FrameIndex].Missed ? 1 : 0;
+        }
+
+        printf("Frame times over the last %u frames (%u missed, %u since startup):\n",
+               Count, MissedCount, Pacer->MissedFrameCount);
+        SDLPrintFrameTimePercentiles(Stats, "frame", Count);
+
+        char *PhaseNames[SDLFramePhase_Count] =
+        {
+            "input", "update", "audio", "sleep", "upload", "present",
+        };
+        for(uint32 Phase = 0;
+            Phase < SDLFramePhase_Count;
+            ++Phase)
+        {
+            for(uint32 FrameIndex = 0;
+                FrameIndex < Count;
+                ++FrameIndex)
+            {
+                Stats->Sorted[FrameIndex] = Stats->Frames[FrameIndex].PhaseNanoseconds[Phase];
+            }
+            SDLPrintFrameTimePercentiles(Stats, PhaseNames[Phase], Count);
+        }
+    }
+}
+
+static bool32
+SDLEndFrameStats(sdl_frame_stats *Stats, sdl_frame_pacer *Pacer, uint64 LastFrameEnd)
+{
+    // NOTE: Called after SDLEndFrame, with the frame end before this one.
+    sdl_frame_timing *Frame = &Stats->Frames[Stats->FrameCount % SDL_FRAME_STATS_COUNT];
+    Frame->FrameNanoseconds = (uint32)(Pacer->LastFrameEnd - LastFrameEnd);
+    Frame->Missed = Pacer->MissedThisFrame;
+    ++Stats->FrameCount;
+
+    bool32 ReportDue = false;
+#if HANDMADE_INTERNAL
+    ReportDue = ((Pacer->LastFrameEnd - Stats->LastReport) >
+                 SDL_FRAME_STATS_REPORT_SECONDS*1000000000ULL);
+#endif
+    bool32 Reported = (Stats->ReportRequested || ReportDue);
+    if(Reported)
+    {
+        SDLReportFrameStats(Stats, Pacer);
+        Stats->ReportRequested = false;
+        Stats->LastReport = Pacer->LastFrameEnd;
+    }
+
+    // NOTE: So the time spent reporting counts toward the next frame's input.
+    Stats->PhaseStart = Pacer->LastFrameEnd;
+
+    return(Reported);
+}
+
+#if HANDMADE_INTERNAL
+static u32
+SDLAddDebugNode(sdl_debug_state *State, u32 Parent, sdl_debug_open_block *Block)
+{
+    u32 Result = 0;
+    if(State->NodeCount < SDL_MAX_DEBUG_NODE_COUNT)
+    {
+        Result = State->NodeCount++;
+        sdl_debug_node *Node = State->Nodes + Result;
+        *Node = {};
+        Node->FileName = Block->FileName;
+        Node->BlockName = Block->BlockName;
+        Node->LineNumber = Block->LineNumber;
+
+        if(Parent)
+        {
+            Node->NextSibling = State->Nodes[Parent].FirstChild;
+            State->Nodes[Parent].FirstChild = Result;
+        }
+    }
+
+    return(Result);
+}
+
+static u32
+SDLGetDebugNode(sdl_debug_state *State, sdl_debug_thread *Thread, u32 Level)
+{
+    sdl_debug_open_block *Block = Thread->Stack + Level;
+    if(Block->NodeCollation != State->CollationIndex)
+    {
+        u32 Parent = Level ? SDLGetDebugNode(State, Thread, Level - 1) : Thread->RootNode;
+
+        u32 NodeIndex = 0;
+        if(Parent)
+        {
+            for(u32 Child = State->Nodes[Parent].FirstChild;
+                Child;
+                Child = State->Nodes[Child].NextSibling)
+            {
+                sdl_debug_node *Node = State->Nodes + Child;
+                if((Node->LineNumber == Block->LineNumber) &&
+                   (Node->FileName == Block->FileName) &&
+                   (Node->BlockName == Block->BlockName))
+                {
+                    NodeIndex = Child;
+                    break;
+                }
+            }
+
+            if(!NodeIndex)
+            {
+                NodeIndex = SDLAddDebugNode(State, Parent, Block);
+            }
+        }
+
+        Block->NodeIndex = NodeIndex;
+        Block->NodeCollation = State->CollationIndex;
+    }
+
+    return(Block->NodeIndex);
+}
+
+static void
+SDLCollateDebugEvents(sdl_debug_state *State, sdl_debug_thread *Thread,
+                      debug_event *Events, u32 EventCount)
+{
+    for(u32 EventIndex = 0;
+        EventIndex < EventCount;
+        ++EventIndex)
+    {
+        debug_event *Event = Events + EventIndex;
+        if(Event->Type == DebugEvent_BeginBlock)
+        {
+            if(Thread->Depth < SDL_MAX_DEBUG_BLOCK_DEPTH)
+            {
+                sdl_debug_open_block *Block = Thread->Stack + Thread->Depth++;
+                Block->Clock = Event->Clock;
+                Block->FileName = Event->FileName;
+                Block->BlockName = Event->BlockName;
+                Block->LineNumber = Event->LineNumber;
+                Block->NodeCollation = State->CollationIndex - 1;
+            }
+            else
+            {
+                ++Thread->SkippedDepth;
+            }
+        }
+        else if(Thread->SkippedDepth)
+        {
+            --Thread->SkippedDepth;
+        }
+        else
+        {
+            // NOTE: Ends the innermost open block from the same place. Blocks
+            // above it lost their end events, and an end with no matching
+            // begin lost its begin; either way there's nothing to time.
+            u32 Level = Thread->Depth;
+            while(Level &&
+                  !((Thread->Stack[Level - 1].LineNumber == Event->LineNumber) &&
+                    (Thread->Stack[Level - 1].FileName == Event->FileName) &&
+                    (Thread->Stack[Level - 1].BlockName == Event->BlockName)))
+            {
+                --Level;
+            }
+
+            if(Level)
+            {
+                --Level;
+                sdl_debug_node *Node = State->Nodes + SDLGetDebugNode(State, Thread, Level);
+                u64 Cycles = Event->Clock - Thread->Stack[Level].Clock;
+                ++Node->HitCount;
+                Node->TotalCycles += Cycles;
+
+                u32 Parent = Level ? SDLGetDebugNode(State, Thread, Level - 1) : Thread->RootNode;
+                State->Nodes[Parent].ChildCycles += Cycles;
+
+                Thread->Depth = Level;
+            }
+        }
+    }
+}
+
+static void
+SDLCollateDebugTable(sdl_debug_state *State, debug_table *Table, b32 Discard)
+{
+    /* NOTE: Called once a frame, on the main thread.
+
+       What gets collated is each thread's array from the frame before, not
+       the one swapped out just now, so that a thread that was partway
+       through writing an event at the swap has long since finished it.
+
+       Events carry pointers to block and file names in whichever module
+       recorded them, so the frames around a game code reload have to be
+       discarded rather than collated.
+    */
+    if(Discard)
+    {
+        State->DiscardCount = 2;
+    }
+
+    ++State->CollationIndex;
+    State->NodeCount = 1;
+    State->Nodes[0] = {};
+
+    u64 Clock = __rdtsc();
+    State->FrameCycles = State->PendingFrameCycles;
+    State->PendingFrameCycles = Clock - State->LastCollationClock;
+    State->LastCollationClock = Clock;
+
+    u32 ThreadCount = Table->ThreadCount;
+    if(ThreadCount > MAX_DEBUG_THREAD_COUNT)
+    {
+        ThreadCount = MAX_DEBUG_THREAD_COUNT;
+    }
+
+    for(u32 ThreadIndex = 0;
+        ThreadIndex < ThreadCount;
+        ++ThreadIndex)
+    {
+        debug_thread_events *ThreadEvents = Table->Threads + ThreadIndex;
+        sdl_debug_thread *Thread = State->Threads + ThreadIndex;
+
+        Thread->RootNode = 0;
+        Thread->EventCount = Thread->PendingEventCount;
+        Thread->DroppedEventCount = 0;
+        if(Thread->EventCount > MAX_DEBUG_EVENT_COUNT)
+        {
+            Thread->DroppedEventCount = Thread->EventCount - MAX_DEBUG_EVENT_COUNT;
+            Thread->EventCount = MAX_DEBUG_EVENT_COUNT;
+        }
+
+        if(State->DiscardCount)
+        {
+            Thread->Depth = 0;
+            Thread->SkippedDepth = 0;
+        }
+        else if(Thread->EventCount)
+        {
+            sdl_debug_open_block Root = {};
+            Thread->RootNode = SDLAddDebugNode(State, 0, &Root);
+            SDLCollateDebugEvents(State, Thread,
+                                  ThreadEvents->Events[Thread->PendingArrayIndex],
+                                  Thread->EventCount);
+        }
+
+        // NOTE: Only the collator changes which array is in use, so it can
+        // read that without racing the thread.
+        u32 ArrayIndex = (u32)(ThreadEvents->ArrayIndex_EventIndex >> 32);
+        u64 ArrayIndex_EventIndex =
+            AtomicExchangeU64(&ThreadEvents->ArrayIndex_EventIndex, (u64)(!ArrayIndex) << 32);
+        Thread->PendingArrayIndex = (u32)(ArrayIndex_EventIndex >> 32);
+        Thread->PendingEventCount = (u32)(ArrayIndex_EventIndex & 0xFFFFFFFF);
+    }
+
+    if(State->DiscardCount)
+    {
+        --State->DiscardCount;
+    }
+}
+
+static void
+SDLPrintDebugNode(sdl_debug_state *State, u32 NodeIndex, u32 Depth)
+{
+    for(u32 Child = State->Nodes[NodeIndex].FirstChild;
+        Child;
+        Child = State->Nodes[Child].NextSibling)
+    {
+        sdl_debug_node *Node = State->Nodes + Child;
+        u64 SelfCycles = Node->TotalCycles - Node->ChildCycles;
+        printf("  %*s%-*s %10.03fMcy %10.03fMcy self %5.01f%% %6uh  %s:%u\n",
+               2*Depth, "", 32 - 2*Depth, Node->BlockName,
+               (real64)Node->TotalCycles / 1000000.0,
+               (real64)SelfCycles / 1000000.0,
+               State->FrameCycles ? 100.0*(real64)Node->TotalCycles / (real64)State->FrameCycles : 0.0,
+               Node->HitCount, Node->FileName, Node->LineNumber);
+        SDLPrintDebugNode(State, Child, Depth + 1);
+    }
+}
+
+static void
+SDLPrintDebugBlocks(sdl_debug_state *State, debug_table *Table)
+{
+    printf("Timed blocks, one frame (%.03fMcy):\n", (real64)State->FrameCycles / 1000000.0);
+
+    u32 ThreadCount = Table->ThreadCount;
+    if(ThreadCount > MAX_DEBUG_THREAD_COUNT)
+    {
+        ThreadCount = MAX_DEBUG_THREAD_COUNT;
+    }
+
+    for(u32 ThreadIndex = 0;
+        ThreadIndex < ThreadCount;
+        ++ThreadIndex)
+    {
+        sdl_debug_thread *Thread = State->Threads + ThreadIndex;
+        if(Thread->RootNode)
+        {
+            printf("  Thread %u (%u events, %u dropped):\n", Table->Threads[ThreadIndex].ThreadID,
+                   Thread->EventCount, Thread->DroppedEventCount);
+            SDLPrintDebugNode(State, Thread->RootNode, 1);
+        }
+    }
+
+    if(State->NodeCount == SDL_MAX_DEBUG_NODE_COUNT)
+    {
+        printf("  (ran out of nodes; some blocks are missing)\n");
+    }
+}
+#endif
+
+static void
+HandleDebugArenaReport(game_memory *Memory)
+{
+#if HANDMADE_INTERNAL
+    printf("DEBUG ARENA HIGH-WATER MARKS:\n");
+    for(uint32 ArenaIndex = 0;
+        ArenaIndex < Memory->DebugArenaCount;
+        ++ArenaIndex)
+    {
+        debug_arena_info *Info = Memory->DebugArenas + ArenaIndex;
+        memory_index Size = *Info->Size;
+        memory_index MaxUsed = *Info->MaxUsed;
+        printf("  %-31s %12zu / %12zu bytes (%.01f%%), %zu in use\n",
+               Info->Name, MaxUsed, Size,
+               Size ? (100.0f*(real32)MaxUsed / (real32)Size) : 0.0f,
+               *Info->Used);
+    }
+
+    platform_memory_stats Stats;
+    Memory->PlatformAPI.GetMemoryStats(&Stats);
+    printf("DEBUG PLATFORM MEMORY: %lu allocations (%lu live), %lu live bytes, "
+           "%lu slab bytes, %lu large bytes\n",
+           Stats.AllocationCount, Stats.LiveAllocationCount, Stats.LiveBytes,
+           Stats.SlabBytes, Stats.LargeBytes);
+#endif
+}
+
+#if 0
+
+static void
+SDLDebugDrawVertical(sdl_offscreen_buffer *Backbuffer,
+                       int X, int Top, int Bottom, uint32 Color)
+{
+    if(Top <= 0)
+    {
+        Top = 0;
+    }
+
+    if(Bottom > Backbuffer->Height)
+    {
+        Bottom = Backbuffer->Height;
+    }
+
+    if((X >= 0) && (X < Backbuffer->Width))
+    {
+        uint8 *Pixel = ((uint8 *)Backbuffer->Memory +
+                        X*Backbuffer->BytesPerPixel +
+                        Top*Backbuffer->Pitch);
+        for(int Y = Top;
+            Y < Bottom;
+            ++Y)
+        {
+            *(uint32 *)Pixel = Color;
+            Pixel += Backbuffer->Pitch;
+        }
+    }
+}
+
+inline void
+SDLDrawSoundBufferMarker(sdl_offscreen_buffer *Backbuffer,
+                           sdl_sound_output *SoundOutput,
+                           real32 C, int PadX, int Top, int Bottom,
+                           uint32 Value, uint32 Color)
+{
+    real32 XReal32 = (C * (real32)Value);
+    int X = PadX + (int)XReal32;
+    SDLDebugDrawVertical(Backbuffer, X, Top, Bottom, Color);
+}
+
+static void
+SDLDebugSyncDisplay(sdl_offscreen_buffer *Backbuffer,
+                      int MarkerCount, sdl_debug_time_marker *Markers,
+                      int CurrentMarkerIndex,
+                      sdl_sound_output *SoundOutput, real32 TargetSecondsPerFrame)
+{
+    int PadX = 16;
+    int PadY = 16;
+
+    int LineHeight = 64;
+
+    real32 C = (real32)(Backbuffer->Width - 2*PadX) / (real32)SoundOutput->SecondaryBufferSize;
+    for(int MarkerIndex = 0;
+        MarkerIndex < MarkerCount;
+        ++MarkerIndex)
+    {
+        sdl_debug_time_marker *ThisMarker = &Markers[MarkerIndex];
+
+        uint32 WriteColor = 0x000000FF;
+        uint32 QueuedAudioColor = 0x00FF0000;
+        uint32 ExpectedFlipColor = 0x0000FF00;
+
+        int Top = PadY;
+        int Bottom = PadY + LineHeight;
+        if(MarkerIndex == CurrentMarkerIndex)
+        {
+            Top += LineHeight+PadY;
+            Bottom += LineHeight+PadY;
+
+            int FirstTop = Top;
+
+            SDLDrawSoundBufferMarker(Backbuffer, SoundOutput, C, MarkerIndex*30+PadX, Top, Bottom, ThisMarker->OutputByteCount, WriteColor);
+
+            Top += LineHeight+PadY;
+            Bottom += LineHeight+PadY;
+
+            SDLDrawSoundBufferMarker(Backbuffer, SoundOutput, C, MarkerIndex*30+PadX, Top, Bottom, ThisMarker->QueuedAudioBytes, QueuedAudioColor);
+
+            Top += LineHeight+PadY;
+            Bottom += LineHeight+PadY;
+
+            SDLDrawSoundBufferMarker(Backbuffer, SoundOutput, C, MarkerIndex*30+PadX, FirstTop, Bottom, ThisMarker->ExpectedBytesUntilFlip, ExpectedFlipColor);
+        }
+
+        SDLDrawSoundBufferMarker(Backbuffer, SoundOutput, C, MarkerIndex*30+PadX, Top, Bottom, ThisMarker->OutputByteCount, WriteColor);
+        SDLDrawSoundBufferMarker(Backbuffer, SoundOutput, C, MarkerIndex*30+PadX, Top, Bottom, ThisMarker->QueuedAudioBytes, QueuedAudioColor);
+        SDLDrawSoundBufferMarker(Backbuffer, SoundOutput, C, MarkerIndex*30+PadX, Top, Bottom, ThisMarker->ExpectedBytesUntilFlip, ExpectedFlipColor);
+    }
+}
+
+#endif
+
+struct platform_work_queue_entry
+{
+    platform_work_queue_callback *Callback;
+    void *Data;
+};
+
+struct platform_work_queue
+{
+    unsigned int volatile CompletionGoal;
+    unsigned int volatile CompletionCount;
+
+    unsigned int volatile NextEntryToWrite;
+    unsigned int volatile NextEntryToRead;
+    SDL_sem *SemaphoreHandle;
+
+    // NOTE: Async read completions are posted from the I/O workers, so
+    // writers serialize on this. Readers stay lock-free.
+    SDL_SpinLock AddLock;
+
+    platform_work_queue_entry Entries[256];
+};
+
+static void
+SDLReserveEntry(platform_work_queue *Queue)
+{
+    SDL_AtomicIncRef((SDL_atomic_t *)&Queue->CompletionGoal);
+}
+
+static void
+SDLPostEntry(platform_work_queue *Queue, platform_work_queue_callback *Callback, void *Data)
+{
+    // NOTE: The entry must already have been counted with SDLReserveEntry.
+    SDL_AtomicLock(&Queue->AddLock);
+    uint32 NewNextEntryToWrite = (Queue->NextEntryToWrite + 1) % ArrayCount(Queue->Entries);
+    Assert(NewNextEntryToWrite != Queue->NextEntryToRead);
+    platform_work_queue_entry *Entry = Queue->Entries + Queue->NextEntryToWrite;
+    Entry->Callback = Callback;
+    Entry->Data = Data;
+    SDL_CompilerBarrier();
+    Queue->NextEntryToWrite = NewNextEntryToWrite;
+    SDL_AtomicUnlock(&Queue->AddLock);
+    SDL_SemPost(Queue->SemaphoreHandle);
+}
+
+static void
+SDLAddEntry(platform_work_queue *Queue, platform_work_queue_callback *Callback, void *Data)
+{
+    SDLReserveEntry(Queue);
+    SDLPostEntry(Queue, Callback, Data);
+}
+
+static bool32
+SDLDoNextWorkQueueEntry(platform_work_queue *Queue)
+{
+    bool32 WeShouldSleep = false;
+
+    uint32 OriginalNextEntryToRead = Queue->NextEntryToRead;
+    uint32 NewNextEntryToRead = (OriginalNextEntryToRead + 1) % ArrayCount(Queue->Entries);
+    if(OriginalNextEntryToRead != Queue->NextEntryToWrite)
+    {
+        SDL_bool WasSet = SDL_AtomicCAS((SDL_atomic_t *)&Queue->NextEntryToRead,
+                                        OriginalNextEntryToRead,
+                                        NewNextEntryToRead);
+        if(WasSet)
+        {
+            platform_work_queue_entry Entry = Queue->Entries[OriginalNextEntryToRead];
+            TIMED_BLOCK(WorkQueueEntry);
+            Entry.Callback(Queue, Entry.Data);
+            SDL_AtomicIncRef((SDL_atomic_t *)&Queue->CompletionCount);
+        }
+    }
+    else
+    {
+        WeShouldSleep = true;
+    }
+
+    return(WeShouldSleep);
+}
+
+static bool32
+SDLIsQueueIdle(platform_work_queue *Queue)
+{
+    // NOTE: An entry, or an async read that will post one, counts toward
+    // CompletionGoal from when it's added and toward CompletionCount once it
+    // has run, so equal counts mean nothing on the queue is running or
+    // still to come. The count has to be read first: a goal read first can
+    // miss an entry added by one that then finishes before the count is read.
+    uint32 CompletionCount = Queue->CompletionCount;
+    CompletePreviousReadsBeforeFutureReads;
+    uint32 CompletionGoal = Queue->CompletionGoal;
+    CompletePreviousReadsBeforeFutureReads;
+
+    bool32 Result = (CompletionCount == CompletionGoal);
+    return(Result);
+}
+
+// NOTE: Defined with the async reads below. Reads done through io_uring only
+// complete when someone polls for them, so waiting on a queue has to.
+static void SDLPollAsyncReads(void);
+
+static void
+SDLCompleteAllWork(platform_work_queue *Queue)
+{
+    while(Queue->CompletionGoal != Queue->CompletionCount)
+    {
+        SDLPollAsyncReads();
+        SDLDoNextWorkQueueEntry(Queue);
+    }
+
+    Queue->CompletionGoal = 0;
+    Queue->CompletionCount = 0;
+}
+
+int
+ThreadProc(void *Parameter)
+{
+    platform_work_queue *Queue = (platform_work_queue *)Parameter;
+
+    for(;;)
+    {
+        if(SDLDoNextWorkQueueEntry(Queue))
+        {
+            SDL_SemWait(Queue->SemaphoreHandle);
+        }
+    }
+
+//    return(0);
+}
+
+static PLATFORM_WORK_QUEUE_CALLBACK(DoWorkerWork)
+{
+    printf("Thread %lu: %s\n", SDL_ThreadID(), (char *)Data);
+}
+
+static void
+SDLMakeQueue(platform_work_queue *Queue, uint32 ThreadCount)
+{
+    Queue->CompletionGoal = 0;
+    Queue->CompletionCount = 0;
+
+    Queue->NextEntryToWrite = 0;
+    Queue->NextEntryToRead = 0;
+
+    uint32 InitialCount = 0;
+    Queue->SemaphoreHandle = SDL_CreateSemaphore(InitialCount);
+
+    for(uint32 ThreadIndex = 0;
+        ThreadIndex < ThreadCount;
+        ++ThreadIndex)
+    {
+        SDL_Thread *ThreadHandle = SDL_CreateThread(ThreadProc, 0, Queue);
+        SDL_DetachThread(ThreadHandle);
+    }
+}
+
+struct sdl_platform_file_handle
+{
+    int SDLHandle;
+
+    // NOTE: The whole file, mapped by the first MapFileRange on it.
+    SDL_SpinLock MappingLock;
+    void * volatile Mapping;
+    u64 MappingSize;
+
+    // NOTE: Group is cleared when the group ends; the handle itself lives
+    // on until CloseFile puts it on the cache's free list.
+    struct sdl_platform_file_group *Group;
+    sdl_platform_file_handle *NextInGroup;
+    sdl_platform_file_handle *NextFree;
+};
+
+struct sdl_cached_file
+{
+    char *Name;
+    u64 Size;
+    u64 LastWriteTime;
+};
+
+// NOTE: One file type's files in the executable's directory, sorted by name
+// as glob's were. A listing is only rescanned once the directory's inotify
+// watch has seen a file of its type written, moved or removed. It can't be
+// rescanned while a group is open on it, so a Begin in the middle of another
+// group of the same type gets the listing the first one did.
+#define SDL_FILE_LISTING_ARENA_SIZE Kilobytes(256)
+struct sdl_file_listing
+{
+    char *Extension;
+    bool32 Stale;
+    uint32 OpenGroupCount;
+
+    uint32 FileCount;
+    sdl_cached_file *Files;
+    memory_arena Arena;
+};
+
+struct sdl_platform_file_group
+{
+    sdl_file_listing *Listing;
+    uint32 FileIndex;
+
+    // NOTE: Every handle opened from the group, so their mappings can go
+    // when it ends.
+    sdl_platform_file_handle *FirstHandle;
+
+    sdl_platform_file_group *NextFree;
+};
+
+// NOTE: Listings, groups and handles all come out of Arena. Groups are
+// recycled when they end, and handles when they're closed.
+#define SDL_FILE_CACHE_ARENA_SIZE Megabytes(2)
+struct sdl_file_cache
+{
+    SDL_SpinLock Lock;
+    memory_arena Arena;
+
+    int DirectoryHandle;
+    int WatchHandle;
+
+    sdl_file_listing Listings[PlatformFileType_Count];
+    sdl_platform_file_group *FirstFreeGroup;
+    sdl_platform_file_handle *FirstFreeHandle;
+};
+
+static sdl_file_cache GlobalFileCache;
+
+static void
+SDLInitFileCache(sdl_file_cache *Cache, sdl_state *State)
+{
+    char Directory[SDL_STATE_FILE_NAME_COUNT];
+    SDLBuildEXEPathFileName(State, ".", sizeof(Directory), Directory);
+
+    void *Memory = mmap(0, SDL_FILE_CACHE_ARENA_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    Cache->DirectoryHandle = open(Directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if((Memory != MAP_FAILED) && (Cache->DirectoryHandle != -1))
+    {
+        InitializeArena(&Cache->Arena, SDL_FILE_CACHE_ARENA_SIZE, Memory);
+
+        for(uint32 Type = 0;
+            Type < PlatformFileType_Count;
+            ++Type)
+        {
+            sdl_file_listing *Listing = Cache->Listings + Type;
+            switch(Type)
+            {
+                case PlatformFileType_AssetFile:
+                {
+                    Listing->Extension = ".hha";
+                } break;
+
+                case PlatformFileType_SavedGameFile:
+                {
+                    Listing->Extension = ".hhs";
+                } break;
+
+                InvalidDefaultCase;
+            }
+
+            Listing->Stale = true;
+            SubArena(&Listing->Arena, &Cache->Arena, SDL_FILE_LISTING_ARENA_SIZE);
+        }
+
+        // NOTE: Without the watch every Begin rescans, as it always used to.
+        Cache->WatchHandle = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if((Cache->WatchHandle != -1) &&
+           (inotify_add_watch(Cache->WatchHandle, Directory,
+                              IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE |
+                              IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF) == -1))
+        {
+            close(Cache->WatchHandle);
+            Cache->WatchHandle = -1;
+        }
+    }
+    else
+    {
+        // TODO: Diagnostic
+#if HANDMADE_INTERNAL
+        printf("Can't list files in %s; there will be none.\n", Directory);
+#endif
+        if(Memory != MAP_FAILED)
+        {
+            munmap(Memory, SDL_FILE_CACHE_ARENA_SIZE);
+        }
+        Cache->DirectoryHandle = -1;
+        Cache->WatchHandle = -1;
+    }
+}
+
+static bool32
+SDLFileHasExtension(char *Name, char *Extension)
+{
+    size_t NameLength = strlen(Name);
+    size_t ExtensionLength = strlen(Extension);
+    bool32 Result = ((NameLength > ExtensionLength) &&
+                     (strcmp(Name + NameLength - ExtensionLength, Extension) == 0));
+    return(Result);
+}
+
+static void
+SDLUpdateFileCache(sdl_file_cache *Cache)
+{
+    // NOTE: Cache->Lock must be held. Non-blocking, so with nothing queued
+    // this is one read that fails with EAGAIN.
+    if(Cache->WatchHandle != -1)
+    {
+        uint8 Events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        ssize_t BytesRead;
+        while((BytesRead = read(Cache->WatchHandle, Events, sizeof(Events))) > 0)
+        {
+            uint8 *At = Events;
+            while(At < (Events + BytesRead))
+            {
+                struct inotify_event *Event = (struct inotify_event *)At;
+                if(Event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+                {
+                    // NOTE: The directory itself went; there's nothing left
+                    // to watch, so go back to rescanning every time.
+                    close(Cache->WatchHandle);
+                    Cache->WatchHandle = -1;
+                    break;
+                }
+
+                for(uint32 Type = 0;
+                    Type < PlatformFileType_Count;
+                    ++Type)
+                {
+                    sdl_file_listing *Listing = Cache->Listings + Type;
+                    if((Event->mask & IN_Q_OVERFLOW) ||
+                       (Event->len && SDLFileHasExtension(Event->name, Listing->Extension)))
+                    {
+                        Listing->Stale = true;
+                    }
+                }
+                At += sizeof(struct inotify_event) + Event->len;
+            }
+
+            if(Cache->WatchHandle == -1)
+            {
+                break;
+            }
+        }
+    }
+
+    if(Cache->WatchHandle == -1)
+    {
+        for(uint32 Type = 0;
+            Type < PlatformFileType_Count;
+            ++Type)
+        {
+            Cache->Listings[Type].Stale = true;
+        }
+    }
+}
+
+static int
+SDLCompareCachedFiles(const void *A, const void *B)
+{
+    int Result = strcmp(((sdl_cached_file *)A)->Name, ((sdl_cached_file *)B)->Name);
+    return(Result);
+}
+
+static void
+SDLScanFileListing(sdl_file_cache *Cache, sdl_file_listing *Listing)
+{
+    // NOTE: Cache->Lock must be held. Files that don't fit in the listing's
+    // arena are left out.
+    Listing->Arena.Used = 0;
+    Listing->FileCount = 0;
+    Listing->Files = 0;
+    Listing->Stale = false;
+
+    int DirectoryHandle = dup(Cache->DirectoryHandle);
+    DIR *Directory = (DirectoryHandle != -1) ? fdopendir(DirectoryHandle) : 0;
+    if(Directory)
+    {
+        // NOTE: The dup shares its position with Cache->DirectoryHandle, so
+        // it has to go back to the start every time.
+        rewinddir(Directory);
+
+        uint32 MaxFileCount = 0;
+        struct dirent *Entry;
+        while((Entry = readdir(Directory)) != 0)
+        {
+            if(SDLFileHasExtension(Entry->d_name, Listing->Extension))
+            {
+                ++MaxFileCount;
+            }
+        }
+
+        memory_index MaxFilesSize = MaxFileCount*sizeof(sdl_cached_file);
+        if(MaxFilesSize > GetArenaSizeRemaining(&Listing->Arena, 8))
+        {
+            MaxFileCount = (uint32)(GetArenaSizeRemaining(&Listing->Arena, 8) / sizeof(sdl_cached_file));
+        }
+        Listing->Files = PushArray(&Listing->Arena, MaxFileCount, sdl_cached_file, 8);
+
+        rewinddir(Directory);
+        while((Listing->FileCount < MaxFileCount) &&
+              ((Entry = readdir(Directory)) != 0))
+        {
+            struct stat FileStatus;
+            if(SDLFileHasExtension(Entry->d_name, Listing->Extension) &&
+               (fstatat(Cache->DirectoryHandle, Entry->d_name, &FileStatus, 0) == 0) &&
+               S_ISREG(FileStatus.st_mode))
+            {
+                memory_index NameSize = strlen(Entry->d_name) + 1;
+                if(NameSize > GetArenaSizeRemaining(&Listing->Arena, 1))
+                {
+                    // TODO: Diagnostic
+#if HANDMADE_INTERNAL
+                    printf("Too many %s files to list them all.\n", Listing->Extension);
+#endif
+                    break;
+                }
+
+                sdl_cached_file *File = Listing->Files + Listing->FileCount++;
+                File->Name = (char *)PushSize(&Listing->Arena, NameSize, 1);
+                memcpy(File->Name, Entry->d_name, NameSize);
+                File->Size = FileStatus.st_size;
+                File->LastWriteTime = ((uint64)FileStatus.st_mtim.tv_sec*1000000000ULL +
+                                       (uint64)FileStatus.st_mtim.tv_nsec);
+            }
+        }
+
+        closedir(Directory);
+
+        qsort(Listing->Files, Listing->FileCount, sizeof(sdl_cached_file), SDLCompareCachedFiles);
+    }
+    else if(DirectoryHandle != -1)
+    {
+        close(DirectoryHandle);
+    }
+}
+
+static PLATFORM_GET_ALL_FILE_OF_TYPE_BEGIN(SDLGetAllFilesOfTypeBegin)
+{
+    platform_file_group Result = {};
+
+    sdl_file_cache *Cache = &GlobalFileCache;
+    Assert(Type < PlatformFileType_Count);
+    if(Cache->Arena.Base && (Type < PlatformFileType_Count))
+    {
+        SDL_AtomicLock(&Cache->Lock);
+
+        SDLUpdateFileCache(Cache);
+
+        sdl_file_listing *Listing = Cache->Listings + Type;
+        if(Listing->Stale && !Listing->OpenGroupCount)
+        {
+            SDLScanFileListing(Cache, Listing);
+        }
+
+        sdl_platform_file_group *SDLFileGroup = Cache->FirstFreeGroup;
+        if(SDLFileGroup)
+        {
+            Cache->FirstFreeGroup = SDLFileGroup->NextFree;
+        }
+        else if(GetArenaSizeRemaining(&Cache->Arena, 8) >= sizeof(sdl_platform_file_group))
+        {
+            SDLFileGroup = PushStruct(&Cache->Arena, sdl_platform_file_group, 8);
+        }
+
+        if(SDLFileGroup)
+        {
+            SDLFileGroup->Listing = Listing;
+            SDLFileGroup->FileIndex = 0;
+            SDLFileGroup->FirstHandle = 0;
+            SDLFileGroup->NextFree = 0;
+            ++Listing->OpenGroupCount;
+
+            Result.FileCount = Listing->FileCount;
+            Result.Platform = SDLFileGroup;
+        }
+
+        SDL_AtomicUnlock(&Cache->Lock);
+    }
+
+    return(Result);
+}
+
+static PLATFORM_GET_ALL_FILE_OF_TYPE_END(SDLGetAllFilesOfTypeEnd)
+{
+    sdl_platform_file_group *SDLFileGroup = (sdl_platform_file_group *)FileGroup->Platform;
+    if(SDLFileGroup)
+    {
+        // NOTE: The handles themselves stay open for reads until CloseFile;
+        // only pointers from MapFileRange end with the group.
+        for(sdl_platform_file_handle *Handle = SDLFileGroup->FirstHandle;
+            Handle;
+            Handle = Handle->NextInGroup)
+        {
+            if(Handle->Mapping)
+            {
+                munmap(Handle->Mapping, Handle->MappingSize);
+                Handle->Mapping = 0;
+                Handle->MappingSize = 0;
+            }
+            Handle->Group = 0;
+        }
+
+        sdl_file_cache *Cache = &GlobalFileCache;
+        SDL_AtomicLock(&Cache->Lock);
+        Assert(SDLFileGroup->Listing->OpenGroupCount);
+        --SDLFileGroup->Listing->OpenGroupCount;
+        SDLFileGroup->NextFree = Cache->FirstFreeGroup;
+        Cache->FirstFreeGroup = SDLFileGroup;
+        SDL_AtomicUnlock(&Cache->Lock);
+
+        FileGroup->Platform = 0;
+    }
+}
+
+static PLATFORM_OPEN_FILE(SDLOpenNextFile)
+{
+    sdl_platform_file_group *SDLFileGroup = (sdl_platform_file_group *)FileGroup->Platform;
+    platform_file_handle Result = {};
+
+    if(SDLFileGroup && (SDLFileGroup->FileIndex < SDLFileGroup->Listing->FileCount))
+    {
+        sdl_file_cache *Cache = &GlobalFileCache;
+        sdl_cached_file *File = SDLFileGroup->Listing->Files + SDLFileGroup->FileIndex++;
+        Result.Size = File->Size;
+        Result.LastWriteTime = File->LastWriteTime;
+
+        SDL_AtomicLock(&Cache->Lock);
+        sdl_platform_file_handle *SDLHandle = Cache->FirstFreeHandle;
+        if(SDLHandle)
+        {
+            Cache->FirstFreeHandle = SDLHandle->NextFree;
+        }
+        else if(GetArenaSizeRemaining(&Cache->Arena, 8) >= sizeof(sdl_platform_file_handle))
+        {
+            SDLHandle = PushStruct(&Cache->Arena, sdl_platform_file_handle, 8);
+        }
+        SDL_AtomicUnlock(&Cache->Lock);
+
+        Result.Platform = SDLHandle;
+        if(SDLHandle)
+        {
+            ZeroStruct(*SDLHandle);
+            SDLHandle->Group = SDLFileGroup;
+            SDLHandle->NextInGroup = SDLFileGroup->FirstHandle;
+            SDLFileGroup->FirstHandle = SDLHandle;
+
+            SDLHandle->SDLHandle = openat(Cache->DirectoryHandle, File->Name, O_RDONLY | O_CLOEXEC);
+            Result.NoErrors = (SDLHandle->SDLHandle != -1);
+        }
+        else
+        {
+            // TODO: Diagnostic
+#if HANDMADE_INTERNAL
+            printf("Out of file handles opening %s\n", File->Name);
+#endif
+        }
+    }
+
+    return(Result);
+}
+
+static PLATFORM_CLOSE_FILE(SDLCloseFile)
+{
+    sdl_platform_file_handle *SDLHandle = (sdl_platform_file_handle *)Handle->Platform;
+    if(SDLHandle)
+    {
+        sdl_platform_file_group *SDLFileGroup = SDLHandle->Group;
+        if(SDLFileGroup)
+        {
+            for(sdl_platform_file_handle **Link = &SDLFileGroup->FirstHandle;
+                *Link;
+                Link = &(*Link)->NextInGroup)
+            {
+                if(*Link == SDLHandle)
+                {
+                    *Link = SDLHandle->NextInGroup;
+                    break;
+                }
+            }
+        }
+
+        if(SDLHandle->Mapping)
+        {
+            munmap(SDLHandle->Mapping, SDLHandle->MappingSize);
+        }
+        if(SDLHandle->SDLHandle != -1)
+        {
+            close(SDLHandle->SDLHandle);
+        }
+
+        sdl_file_cache *Cache = &GlobalFileCache;
+        SDL_AtomicLock(&Cache->Lock);
+        SDLHandle->NextFree = Cache->FirstFreeHandle;
+        Cache->FirstFreeHandle = SDLHandle;
+        SDL_AtomicUnlock(&Cache->Lock);
+    }
+
+    Handle->Platform = 0;
+    Handle->NoErrors = false;
+}
+
+static PLATFORM_FILE_ERROR(SDLFileError)
+{
+#if HANDMADE_INTERNAL
+    printf("SDL FILE ERROR: %s\n", Message);
+#endif
+
+    Handle->NoErrors = false;
+}
+
+static PLATFORM_READ_DATA_FROM_FILE(SDLReadDataFromFile)
+{
+    if(PlatformNoFileErrors(Source))
+    {
+        sdl_platform_file_handle *Handle = (sdl_platform_file_handle *)Source->Platform;
+
+        if(SDLReadAt(Handle->SDLHandle, Offset, Size, Dest) != Size)
+        {
+            SDLFileError(Source, "Read file failed.");
+        }
+    }
+}
+
+static PLATFORM_READ_NEXT_FILE_WINDOW(SDLReadNextFileWindow)
+{
+    u64 Result = 0;
+
+    if(PlatformNoFileErrors(Stream->Source) &&
+       (Stream->Offset < Stream->OnePastLastOffset))
+    {
+        Result = Stream->OnePastLastOffset - Stream->Offset;
+        if(Result > Stream->WindowSize)
+        {
+            Result = Stream->WindowSize;
+        }
+
+        SDLReadDataFromFile(Stream->Source, Stream->Offset, Result, Stream->Window);
+        Stream->Offset += Result;
+
+        if(PlatformNoFileErrors(Stream->Source))
+        {
+            // NOTE: Gets the kernel reading the next window while the caller
+            // works through this one.
+            u64 NextSize = Stream->OnePastLastOffset - Stream->Offset;
+            if(NextSize > Stream->WindowSize)
+            {
+                NextSize = Stream->WindowSize;
+            }
+
+            if(NextSize)
+            {
+                sdl_platform_file_handle *Handle = (sdl_platform_file_handle *)Stream->Source->Platform;
+                posix_fadvise(Handle->SDLHandle, Stream->Offset, NextSize, POSIX_FADV_WILLNEED);
+            }
+        }
+        else
+        {
+            Result = 0;
+        }
+    }
+
+    return(Result);
+}
+
+static PLATFORM_MAP_FILE_RANGE(SDLMapFileRange)
+{
+    void *Result = 0;
+
+    if(PlatformNoFileErrors(Source))
+    {
+        sdl_platform_file_handle *Handle = (sdl_platform_file_handle *)Source->Platform;
+
+        // NOTE: Asset loads run on several threads at once; the lock makes
+        // sure only one of them maps the file.
+        if(!Handle->Mapping)
+        {
+            SDL_AtomicLock(&Handle->MappingLock);
+            if(!Handle->Mapping)
+            {
+                struct stat FileStatus;
+                if((fstat(Handle->SDLHandle, &FileStatus) == 0) && (FileStatus.st_size > 0))
+                {
+                    void *Mapping = mmap(0, FileStatus.st_size, PROT_READ, MAP_SHARED,
+                                         Handle->SDLHandle, 0);
+                    if(Mapping != MAP_FAILED)
+                    {
+                        Handle->MappingSize = FileStatus.st_size;
+                        CompletePreviousWritesBeforeFutureWrites;
+                        Handle->Mapping = Mapping;
+                    }
+                }
+            }
+            SDL_AtomicUnlock(&Handle->MappingLock);
+        }
+
+        uint8 *Mapping = (uint8 *)Handle->Mapping;
+        if(Mapping && (Offset <= Handle->MappingSize) && (Size <= (Handle->MappingSize - Offset)))
+        {
+            Result = Mapping + Offset;
+
+            int Advice = -1;
+            switch(Access)
+            {
+                case PlatformFileAccess_Normal:
+                {
+                } break;
+
+                case PlatformFileAccess_WillNeed:
+                {
+                    Advice = MADV_WILLNEED;
+                } break;
+
+                case PlatformFileAccess_Sequential:
+                {
+                    Advice = MADV_SEQUENTIAL;
+                } break;
+
+                case PlatformFileAccess_Random:
+                {
+                    Advice = MADV_RANDOM;
+                } break;
+
+                InvalidDefaultCase;
+            }
+
+            if((Advice != -1) && Size)
+            {
+                // NOTE: madvise wants a page-aligned start.
+                memory_index PageSize = sysconf(_SC_PAGESIZE);
+                memory_index First = Offset & ~(u64)(PageSize - 1);
+                madvise(Mapping + First, (Offset + Size) - First, Advice);
+            }
+        }
+        else
+        {
+            SDLFileError(Source, "Map file range failed.");
+        }
+    }
+
+    return(Result);
 }
 
-static void
-SDLEndRecordingInput(sdl_state *State)
+struct sdl_async_read
 {
-    close(State->RecordingHandle);
-    State->InputRecordingIndex = 0;
-}
+    platform_file_handle *Source;
+    u64 Offset;
 
-static void
-SDLBeginInputPlayBack(sdl_state *State, int InputPlayingIndex)
+    // NOTE: Segments before FirstSegment have been read, and the first one
+    // left is trimmed to what's left of it. Skipped ranges read into
+    // GlobalDiscardBuffer.
+    u32 FirstSegment;
+    u32 SegmentCount;
+    struct iovec Segments[PLATFORM_MAX_READ_SEGMENTS];
+
+    platform_work_queue *CompletionQueue;
+    platform_work_queue_callback *Callback;
+    void *Data;
+
+    sdl_async_read *NextFree;
+};
+
+// NOTE: With io_uring, a read is handed to the kernel as an IORING_OP_READ
+// and no thread of ours waits on it. Reads are queued as they come in and
+// submitted SDL_IO_RING_BATCH_SIZE at a time, or by SDLPollAsyncReads, which
+// the frame loop calls once a frame and SDLCompleteAllWork calls while it
+// waits. Polling also collects finished reads and posts their callbacks to
+// the queue they were asked for on. Without io_uring, reads are done by
+// IOQueue's threads instead.
+#define SDL_IO_RING_BATCH_SIZE 32
+#define SDL_IO_RING_MAX_READ_SIZE Gigabytes(1)
+struct sdl_io_ring
 {
-    sdl_replay_buffer *ReplayBuffer = SDLGetReplayBuffer(State, InputPlayingIndex);
-    if(ReplayBuffer->MemoryBlock)
+    int Handle;
+    SDL_SpinLock Lock;
+
+    uint32 *SQHead;
+    uint32 *SQTail;
+    uint32 SQMask;
+    uint32 *SQArray;
+    struct io_uring_sqe *SQEntries;
+    uint32 Unsubmitted;
+
+    uint32 *CQHead;
+    uint32 *CQTail;
+    uint32 CQMask;
+    struct io_uring_cqe *CQEntries;
+};
+
+// NOTE: On the thread path, reads are done by their own workers so that the
+// blocking pread never holds a thread from the high or low priority queues.
+static platform_work_queue *GlobalIOQueue;
+static sdl_io_ring GlobalIORing;
+static SDL_SpinLock GlobalAsyncReadLock;
+static sdl_async_read *GlobalFirstFreeAsyncRead;
+// NOTE: Fewer than IOQueue has entries, so that on the thread path the
+// reads in flight can never fill it.
+static sdl_async_read GlobalAsyncReads[128];
+// NOTE: Everyone's skips land here at once; nothing ever reads it back.
+static uint8 GlobalDiscardBuffer[PLATFORM_MAX_READ_SKIP];
+
+static bool32
+SDLInitIORing(sdl_io_ring *Ring, uint32 EntryCount)
+{
+    struct io_uring_params Params = {};
+    Ring->Handle = (int)syscall(__NR_io_uring_setup, EntryCount, &Params);
+
+    // NOTE: IORING_FEAT_RW_CUR_POS came in with IORING_OP_READ (5.6).
+    if((Ring->Handle != -1) &&
+       !(Params.features & IORING_FEAT_RW_CUR_POS))
     {
-        State->InputPlayingIndex = InputPlayingIndex;
+        close(Ring->Handle);
+        Ring->Handle = -1;
+    }
 
-        char FileName[SDL_STATE_FILE_NAME_COUNT];
-        SDLGetInputFileLocation(State, true, InputPlayingIndex, sizeof(FileName), FileName);
-        State->PlaybackHandle = open(FileName, O_RDONLY);
+    if(Ring->Handle != -1)
+    {
+        memory_index SQSize = Params.sq_off.array + Params.sq_entries*sizeof(uint32);
+        memory_index CQSize = Params.cq_off.cqes + Params.cq_entries*sizeof(struct io_uring_cqe);
+        if(Params.features & IORING_FEAT_SINGLE_MMAP)
+        {
+            SQSize = CQSize = (SQSize > CQSize) ? SQSize : CQSize;
+        }
 
-#if 0
-        lseek(State->PlaybackHandle, State->TotalSize, SEEK_SET);
-#endif
+        uint8 *SQ = (uint8 *)mmap(0, SQSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                  Ring->Handle, IORING_OFF_SQ_RING);
+        uint8 *CQ = SQ;
+        if(!(Params.features & IORING_FEAT_SINGLE_MMAP) && (SQ != MAP_FAILED))
+        {
+            CQ = (uint8 *)mmap(0, CQSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                               Ring->Handle, IORING_OFF_CQ_RING);
+        }
+        void *SQEntries = mmap(0, Params.sq_entries*sizeof(struct io_uring_sqe),
+                               PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                               Ring->Handle, IORING_OFF_SQES);
 
-        memcpy(State->GameMemoryBlock, ReplayBuffer->MemoryBlock, State->TotalSize);
+        if((SQ != MAP_FAILED) && (CQ != MAP_FAILED) && (SQEntries != MAP_FAILED))
+        {
+            Ring->SQHead = (uint32 *)(SQ + Params.sq_off.head);
+            Ring->SQTail = (uint32 *)(SQ + Params.sq_off.tail);
+            Ring->SQMask = *(uint32 *)(SQ + Params.sq_off.ring_mask);
+            Ring->SQArray = (uint32 *)(SQ + Params.sq_off.array);
+            Ring->SQEntries = (struct io_uring_sqe *)SQEntries;
+
+            Ring->CQHead = (uint32 *)(CQ + Params.cq_off.head);
+            Ring->CQTail = (uint32 *)(CQ + Params.cq_off.tail);
+            Ring->CQMask = *(uint32 *)(CQ + Params.cq_off.ring_mask);
+            Ring->CQEntries = (struct io_uring_cqe *)(CQ + Params.cq_off.cqes);
+        }
+        else
+        {
+            // NOTE: Closing the ring is enough; the mappings that did work
+            // are leaked, which only happens once, at startup.
+            close(Ring->Handle);
+            Ring->Handle = -1;
+        }
     }
+
+    bool32 Result = (Ring->Handle != -1);
+    return(Result);
 }
 
 static void
-SDLEndInputPlayBack(sdl_state *State)
+SDLInitAsyncReads(platform_work_queue *IOQueue)
 {
-    close(State->PlaybackHandle);
-    State->InputPlayingIndex = 0;
+    GlobalIOQueue = IOQueue;
+    for(uint32 ReadIndex = 0;
+        ReadIndex < ArrayCount(GlobalAsyncReads);
+        ++ReadIndex)
+    {
+        sdl_async_read *Read = GlobalAsyncReads + ReadIndex;
+        Read->NextFree = GlobalFirstFreeAsyncRead;
+        GlobalFirstFreeAsyncRead = Read;
+    }
+
+    // NOTE: HANDMADE_IO_URING=0 forces the thread path. The ring has a slot
+    // for every read that can be in flight, and the completion ring is
+    // twice that, so neither can overflow.
+    GlobalIORing.Handle = -1;
+    char *UseIORing = getenv("HANDMADE_IO_URING");
+    if(!UseIORing || (strcmp(UseIORing, "0") != 0))
+    {
+        SDLInitIORing(&GlobalIORing, ArrayCount(GlobalAsyncReads));
+    }
+
+#if HANDMADE_INTERNAL
+    printf("Async reads: %s\n", (GlobalIORing.Handle != -1) ? "io_uring" : "IOQueue threads");
+#endif
 }
 
 static void
-SDLRecordInput(sdl_state *State, game_input *NewInput)
+SDLFinishAsyncRead(sdl_async_read *Read)
+{
+    platform_work_queue *CompletionQueue = Read->CompletionQueue;
+    platform_work_queue_callback *Callback = Read->Callback;
+    void *CompletionData = Read->Data;
+
+    SDL_AtomicLock(&GlobalAsyncReadLock);
+    Read->NextFree = GlobalFirstFreeAsyncRead;
+    GlobalFirstFreeAsyncRead = Read;
+    SDL_AtomicUnlock(&GlobalAsyncReadLock);
+
+    SDLPostEntry(CompletionQueue, Callback, CompletionData);
+}
+
+static bool32
+SDLAdvanceAsyncRead(sdl_async_read *Read, u64 BytesRead)
+{
+    // NOTE: Moves past BytesRead and any empty segments after them, and
+    // returns whether there is anything left to read.
+    Read->Offset += BytesRead;
+    while(Read->FirstSegment < Read->SegmentCount)
+    {
+        struct iovec *Segment = Read->Segments + Read->FirstSegment;
+        if(BytesRead < Segment->iov_len)
+        {
+            Segment->iov_base = (uint8 *)Segment->iov_base + BytesRead;
+            Segment->iov_len -= BytesRead;
+            break;
+        }
+
+        BytesRead -= Segment->iov_len;
+        ++Read->FirstSegment;
+    }
+
+    bool32 Result = (Read->FirstSegment < Read->SegmentCount);
+    return(Result);
+}
+
+static PLATFORM_WORK_QUEUE_CALLBACK(SDLDoAsyncRead)
 {
-    ssize_t BytesWritten = write(State->RecordingHandle, NewInput, sizeof(*NewInput));
+    sdl_async_read *Read = (sdl_async_read *)Data;
+    sdl_platform_file_handle *Handle = (sdl_platform_file_handle *)Read->Source->Platform;
+
+    bool32 Remaining = SDLAdvanceAsyncRead(Read, 0);
+    while(Remaining && PlatformNoFileErrors(Read->Source))
+    {
+        ssize_t BytesRead = preadv(Handle->SDLHandle, Read->Segments + Read->FirstSegment,
+                                   Read->SegmentCount - Read->FirstSegment, Read->Offset);
+        if(BytesRead > 0)
+        {
+            Remaining = SDLAdvanceAsyncRead(Read, BytesRead);
+        }
+        else if(!((BytesRead == -1) && (errno == EINTR)))
+        {
+            // NOTE: 0 is the end of the file before the end of the read.
+            SDLFileError(Read->Source, "Read file failed.");
+        }
+    }
+
+    SDLFinishAsyncRead(Read);
 }
 
 static void
-SDLPlayBackInput(sdl_state *State, game_input *NewInput)
+SDLSubmitRingReads(sdl_io_ring *Ring)
 {
-    ssize_t BytesRead = read(State->PlaybackHandle, NewInput, sizeof(*NewInput));
-    if(BytesRead == 0)
+    // NOTE: Ring->Lock must be held. Whatever the kernel won't take now
+    // (EAGAIN, EBUSY) stays queued for the next poll.
+    while(Ring->Unsubmitted)
     {
-        // NOTE(casey): We've hit the end of the stream, go back to the beginning
-        int PlayingIndex = State->InputPlayingIndex;
-        SDLEndInputPlayBack(State);
-        SDLBeginInputPlayBack(State, PlayingIndex);
-        read(State->PlaybackHandle, NewInput, sizeof(*NewInput));
+        int Submitted = (int)syscall(__NR_io_uring_enter, Ring->Handle, Ring->Unsubmitted, 0, 0, 0, 0);
+        if(Submitted > 0)
+        {
+            Ring->Unsubmitted -= Submitted;
+        }
+        else if(!((Submitted == -1) && (errno == EINTR)))
+        {
+            break;
+        }
     }
 }
 
 static void
-SDLToggleFullscreen(SDL_Window *Window)
+SDLQueueRingRead(sdl_io_ring *Ring, sdl_async_read *Read)
 {
-    uint32 Flags = SDL_GetWindowFlags(Window);
-    if(Flags & SDL_WINDOW_FULLSCREEN_DESKTOP)
+    // NOTE: Ring->Lock must be held. There is never more than a batch
+    // unsubmitted and the kernel takes entries off the submission ring as
+    // they are submitted, so it can't be full. Reads bigger than one entry
+    // can take go in pieces, like short reads do. Only reads still spread
+    // over several segments need IORING_OP_READV.
+    sdl_platform_file_handle *Handle = (sdl_platform_file_handle *)Read->Source->Platform;
+
+    uint32 Tail = *Ring->SQTail;
+    Assert((Tail - __atomic_load_n(Ring->SQHead, __ATOMIC_ACQUIRE)) <= Ring->SQMask);
+    uint32 Index = Tail & Ring->SQMask;
+
+    struct io_uring_sqe *Entry = Ring->SQEntries + Index;
+    memset(Entry, 0, sizeof(*Entry));
+    struct iovec *Segment = Read->Segments + Read->FirstSegment;
+    uint32 SegmentsLeft = Read->SegmentCount - Read->FirstSegment;
+    Entry->fd = Handle->SDLHandle;
+    if(SegmentsLeft == 1)
     {
-        SDL_SetWindowFullscreen(Window, 0);
+        Entry->opcode = IORING_OP_READ;
+        Entry->addr = (u64)Segment->iov_base;
+        Entry->len = (u32)((Segment->iov_len < SDL_IO_RING_MAX_READ_SIZE) ?
+                           Segment->iov_len : SDL_IO_RING_MAX_READ_SIZE);
     }
     else
     {
-        SDL_SetWindowFullscreen(Window, SDL_WINDOW_FULLSCREEN_DESKTOP);
+        Entry->opcode = IORING_OP_READV;
+        Entry->addr = (u64)Segment;
+        Entry->len = SegmentsLeft;
+    }
+    Entry->off = Read->Offset;
+    Entry->user_data = (u64)Read;
+    Ring->SQArray[Index] = Index;
+
+    __atomic_store_n(Ring->SQTail, Tail + 1, __ATOMIC_RELEASE);
+    if(++Ring->Unsubmitted >= SDL_IO_RING_BATCH_SIZE)
+    {
+        SDLSubmitRingReads(Ring);
     }
 }
 
 static void
-SDLProcessPendingEvents(sdl_state *State, game_controller_input *KeyboardController)
+SDLPollAsyncReads(void)
 {
-    SDL_Event Event;
-    while(SDL_PollEvent(&Event))
+    // NOTE: Whoever gets the lock does the polling; anyone else would only
+    // find the same completions.
+    sdl_io_ring *Ring = &GlobalIORing;
+    if((Ring->Handle != -1) && SDL_AtomicTryLock(&Ring->Lock))
     {
-        switch(Event.type)
+        SDLSubmitRingReads(Ring);
+
+        uint32 Head = *Ring->CQHead;
+        uint32 Tail = __atomic_load_n(Ring->CQTail, __ATOMIC_ACQUIRE);
+        while(Head != Tail)
         {
-            case SDL_QUIT:
+            struct io_uring_cqe *Completion = Ring->CQEntries + (Head++ & Ring->CQMask);
+            sdl_async_read *Read = (sdl_async_read *)Completion->user_data;
+            int32 BytesRead = Completion->res;
+
+            bool32 Remaining = true;
+            if(BytesRead > 0)
             {
-                GlobalRunning = false;
-            } break;
+                Remaining = SDLAdvanceAsyncRead(Read, BytesRead);
+            }
+            else if((BytesRead != -EINTR) && (BytesRead != -EAGAIN))
+            {
+                // NOTE: 0 is the end of the file before the end of the read.
+                SDLFileError(Read->Source, "Read file failed.");
+                Remaining = false;
+            }
 
-            case SDL_KEYDOWN:
-            case SDL_KEYUP:
+            if(Remaining)
             {
-                SDL_Keycode KeyCode = Event.key.keysym.sym;
-                bool IsDown = (Event.key.state == SDL_PRESSED);
+                SDLQueueRingRead(Ring, Read);
+            }
+            else
+            {
+                SDLFinishAsyncRead(Read);
+            }
+        }
+        __atomic_store_n(Ring->CQHead, Head, __ATOMIC_RELEASE);
 
-                // NOTE: In the windows version, we used "if (IsDown != WasDown)"
-                // to detect key repeats. SDL has the 'repeat' value, though,
-                // which we'll use.
-                if (Event.key.repeat == 0)
-                {
-                    if(KeyCode == SDLK_w)
-                    {
-                        SDLProcessKeyboardEvent(&KeyboardController->MoveUp, IsDown);
-                    }
-                    else if(KeyCode == SDLK_a)
-                    {
-                        SDLProcessKeyboardEvent(&KeyboardController->MoveLeft, IsDown);
-                    }
-                    else if(KeyCode == SDLK_s)
-                    {
-                        SDLProcessKeyboardEvent(&KeyboardController->MoveDown, IsDown);
-                    }
-                    else if(KeyCode == SDLK_d)
-                    {
-                        SDLProcessKeyboardEvent(&KeyboardController->MoveRight, IsDown);
-                    }
-                    else if(KeyCode == SDLK_q)
-                    {
-                        SDLProcessKeyboardEvent(&KeyboardController->LeftShoulder, IsDown);
-                    }
-                    else if(KeyCode == SDLK_e)
-                    {
-                        SDLProcessKeyboardEvent(&KeyboardController->RightShoulder, IsDown);
-                    }
-                    else if(KeyCode == SDLK_UP)
-                    {
-                        SDLProcessKeyboardEvent(&KeyboardController->ActionUp, IsDown);
-                    }
-                    else if(KeyCode == SDLK_LEFT)
-                    {
-                        SDLProcessKeyboardEvent(&KeyboardController->ActionLeft, IsDown);
-                    }
-                    else if(KeyCode == SDLK_DOWN)
-                    {
-                        SDLProcessKeyboardEvent(&KeyboardController->ActionDown, IsDown);
-                    }
-                    else if(KeyCode == SDLK_RIGHT)
-                    {
-                        SDLProcessKeyboardEvent(&KeyboardController->ActionRight, IsDown);
-                    }
-                    else if(KeyCode == SDLK_ESCAPE)
-                    {
-                        SDLProcessKeyboardEvent(&KeyboardController->Back, IsDown);
-                    }
-                    else if(KeyCode == SDLK_SPACE)
-                    {
-                        SDLProcessKeyboardEvent(&KeyboardController->Start, IsDown);
-                    }
-#if HANDMADE_INTERNAL
-                    else if(KeyCode == SDLK_p)
-                    {
-                        if(IsDown)
-                        {
-                            GlobalPause = !GlobalPause;
-                        }
-                    }
-                    else if(KeyCode == SDLK_l)
-                    {
-                        if(IsDown)
-                        {
-                            if(State->InputPlayingIndex == 0)
-                            {
-                                if(State->InputRecordingIndex == 0)
-                                {
-                                    SDLBeginRecordingInput(State, 1);
-                                }
-                                else
-                                {
-                                    SDLEndRecordingInput(State);
-                                    SDLBeginInputPlayBack(State, 1);
-                                }
-                            }
-                            else
-                            {
-                                SDLEndInputPlayBack(State);
-                            }
-                        }
-                    }
-#endif
-                    if(IsDown)
-                    {
-                        bool AltKeyWasDown = (Event.key.keysym.mod & KMOD_ALT);
-                        if (KeyCode == SDLK_F4 && AltKeyWasDown)
-                        {
-                            GlobalRunning = false;
-                        }
-                        if((KeyCode == SDLK_RETURN) && AltKeyWasDown)
-                        {
-                            SDL_Window *Window = SDL_GetWindowFromID(Event.window.windowID);
-                            if(Window)
-                            {
-                                SDLToggleFullscreen(Window);
-                            }
-                        }
-                    }
-                }
+        SDLSubmitRingReads(Ring);
+        SDL_AtomicUnlock(&Ring->Lock);
+    }
+}
 
-            } break;
+static PLATFORM_READ_SEGMENTS_FROM_FILE_ASYNC(SDLReadSegmentsFromFileAsync)
+{
+    Assert(SegmentCount <= PLATFORM_MAX_READ_SEGMENTS);
 
-            case SDL_WINDOWEVENT:
-            {
-                switch(Event.window.event)
-                {
-                    case SDL_WINDOWEVENT_SIZE_CHANGED:
-                    {
-                        SDL_Window *Window = SDL_GetWindowFromID(Event.window.windowID);
-                        SDL_Renderer *Renderer = SDL_GetRenderer(Window);
-                        printf("SDL_WINDOWEVENT_SIZE_CHANGED (%d, %d)\n", Event.window.data1, Event.window.data2);
-                    } break;
+    // NOTE: Count the completion now, so CompleteAllWork on Queue can't
+    // return while the read is still in flight.
+    SDLReserveEntry(Queue);
 
-                    case SDL_WINDOWEVENT_FOCUS_GAINED:
-                    {
-                        printf("SDL_WINDOWEVENT_FOCUS_GAINED\n");
-                    } break;
+    SDL_AtomicLock(&GlobalAsyncReadLock);
+    sdl_async_read *Read = GlobalFirstFreeAsyncRead;
+    if(Read)
+    {
+        GlobalFirstFreeAsyncRead = Read->NextFree;
+    }
+    SDL_AtomicUnlock(&GlobalAsyncReadLock);
 
-                    case SDL_WINDOWEVENT_EXPOSED:
-                    {
-                        SDL_Window *Window = SDL_GetWindowFromID(Event.window.windowID);
-                        SDL_Renderer *Renderer = SDL_GetRenderer(Window);
-                        sdl_window_dimension Dimension = SDLGetWindowDimension(Window);
-                        SDLDisplayBufferInWindow(&GlobalBackbuffer, Renderer,
-                                                 Dimension.Width, Dimension.Height);
+    if(Read)
+    {
+        Read->Source = Source;
+        Read->Offset = Offset;
+        Read->FirstSegment = 0;
+        Read->SegmentCount = SegmentCount;
+        for(uint32 SegmentIndex = 0;
+            SegmentIndex < SegmentCount;
+            ++SegmentIndex)
+        {
+            platform_read_segment *Segment = Segments + SegmentIndex;
+            struct iovec *Dest = Read->Segments + SegmentIndex;
 
-                    } break;
+            Dest->iov_base = Segment->Dest;
+            Dest->iov_len = Segment->Size;
+            if(!Segment->Dest)
+            {
+                if(Segment->Size > sizeof(GlobalDiscardBuffer))
+                {
+                    SDLFileError(Source, "Read skip too large.");
                 }
-            } break;
+                Dest->iov_base = GlobalDiscardBuffer;
+            }
+        }
+        Read->CompletionQueue = Queue;
+        Read->Callback = Callback;
+        Read->Data = Data;
+
+        bool32 Remaining = SDLAdvanceAsyncRead(Read, 0);
+        if(GlobalIORing.Handle == -1)
+        {
+            SDLAddEntry(GlobalIOQueue, SDLDoAsyncRead, Read);
+        }
+        else if(!Remaining || !PlatformNoFileErrors(Source))
+        {
+            SDLFinishAsyncRead(Read);
+        }
+        else
+        {
+            SDL_AtomicLock(&GlobalIORing.Lock);
+            SDLQueueRingRead(&GlobalIORing, Read);
+            SDL_AtomicUnlock(&GlobalIORing.Lock);
+        }
+    }
+    else
+    {
+        // NOTE: Out of async read slots, so this one blocks the caller.
+        // TODO: Diagnostic
+        u64 SegmentOffset = Offset;
+        for(uint32 SegmentIndex = 0;
+            SegmentIndex < SegmentCount;
+            ++SegmentIndex)
+        {
+            platform_read_segment *Segment = Segments + SegmentIndex;
+            if(Segment->Dest)
+            {
+                SDLReadDataFromFile(Source, SegmentOffset, Segment->Size, Segment->Dest);
+            }
+            SegmentOffset += Segment->Size;
         }
+        SDLPostEntry(Queue, Callback, Data);
     }
 }
 
-inline uint64
-SDLGetWallClock(void)
+static PLATFORM_READ_DATA_FROM_FILE_ASYNC(SDLReadDataFromFileAsync)
 {
-    uint64 Result = SDL_GetPerformanceCounter();
-    return(Result);
+    platform_read_segment Segment = {Size, Dest};
+    SDLReadSegmentsFromFileAsync(Queue, Source, Offset, 1, &Segment, Callback, Data);
 }
 
-static real32
-SDLGetSecondsElapsed(uint64 Start, uint64 End)
+static void
+SDLGetGameCodeTempName(sdl_state *State, uint32 LoadIndex, int DestCount, char *Dest)
 {
-    real32 Result = ((real32)(End - Start) /
-                     (real32)GlobalPerfCountFrequency);
-    return(Result);
+    // NOTE: The pid keeps a replay runner and the game from sharing copies.
+    char Temp[64];
+    sprintf(Temp, "handmade_temp_%d_%u.so", (int)getpid(), LoadIndex);
+    SDLBuildEXEPathFileName(State, Temp, DestCount, Dest);
+}
+
+static PLATFORM_WORK_QUEUE_CALLBACK(SDLLoadGameCodeWork)
+{
+    sdl_game_code_loader *Loader = (sdl_game_code_loader *)Data;
+
+    char TempDLLName[SDL_STATE_FILE_NAME_COUNT];
+    SDLGetGameCodeTempName(Loader->State, Loader->LoadCount, sizeof(TempDLLName), TempDLLName);
+    Loader->Loaded = SDLLoadGameCode(Loader->SourceDLLName, TempDLLName);
+
+    CompletePreviousWritesBeforeFutureWrites;
+    Loader->Loading = false;
 }
 
 static void
-HandleDebugCycleCounters(game_memory *Memory)
+SDLBeginGameCodeLoad(sdl_game_code_loader *Loader, platform_work_queue *Queue)
 {
-#if HANDMADE_INTERNAL
-    printf("DEBUG CYCLE COUNTS:\n");
-    for(int CounterIndex = 0;
-        CounterIndex < ArrayCount(Memory->Counters);
-        ++CounterIndex)
+    Assert(!Loader->Started);
+
+    ++Loader->LoadCount;
+    Loader->Started = true;
+    Loader->Loading = true;
+    SDLAddEntry(Queue, SDLLoadGameCodeWork, Loader);
+}
+
+static bool32
+SDLFinishGameCodeLoad(sdl_game_code_loader *Loader, sdl_game_code *Game,
+                      platform_work_queue *HighPriorityQueue,
+                      platform_work_queue *LowPriorityQueue)
+{
+    // NOTE: Swaps in the library loaded in the background once it is ready.
+    // The old one keeps running if the new one didn't load; the next build
+    // gets another try.
+    bool32 Result = false;
+
+    if(Loader->Started && !Loader->Loading)
     {
-        debug_cycle_counter *Counter = Memory->Counters + CounterIndex;
+        CompletePreviousReadsBeforeFutureReads;
+        Loader->Started = false;
 
-        if(Counter->HitCount)
+        if(Loader->Loaded.IsValid)
         {
-            printf("  %d: %lucy %uh %lucy/h\n",
-                   CounterIndex,
-                   Counter->CycleCount,
-                   Counter->HitCount,
-                   Counter->CycleCount / Counter->HitCount);
-            Counter->HitCount = 0;
-            Counter->CycleCount = 0;
+            // NOTE: Nothing queued may still be running code of the old
+            // library when it goes.
+            uint64 DrainStartCounter = SDL_GetPerformanceCounter();
+            SDLCompleteAllWork(HighPriorityQueue);
+            SDLCompleteAllWork(LowPriorityQueue);
+            uint64 UnloadStartCounter = SDL_GetPerformanceCounter();
+            SDLUnloadGameCode(Game);
+            uint64 EndCounter = SDL_GetPerformanceCounter();
+
+            Loader->DrainCounter = UnloadStartCounter - DrainStartCounter;
+            Loader->UnloadCounter = EndCounter - UnloadStartCounter;
+
+            *Game = Loader->Loaded;
+            Result = true;
         }
-    }
+        else
+        {
+            // TODO: Diagnostic
+#if HANDMADE_INTERNAL
+            printf("Could not load the new %s, keeping the old one\n", Loader->SourceDLLName);
 #endif
+            SDLUnloadGameCode(&Loader->Loaded);
+        }
+    }
+
+    return(Result);
 }
 
-#if 0
+//
+// NOTE: Platform memory allocator
+//
+// Small requests are served from size-class slabs carved out of one big
+// reservation. Each thread keeps a short free list per class, so the common
+// allocate/free touches no lock and makes no syscall; the shared per-class
+// lists are only hit to refill or flush a thread's cache. Anything larger
+// than the biggest class still gets its own mapping.
+//
+// In internal builds, setting HANDMADE_GUARD_PAGES=1 sends every request down
+// the mapping path with an inaccessible page right after the block, so an
+// overrun faults on the spot.
+//
+
+#define SDL_SIZE_CLASS_COUNT 12
+#define SDL_SMALLEST_SIZE_CLASS 16
+#define SDL_LARGEST_SIZE_CLASS (SDL_SMALLEST_SIZE_CLASS << (SDL_SIZE_CLASS_COUNT - 1))
+#define SDL_SLAB_SIZE Kilobytes(256)
+#define SDL_SLAB_REGION_SIZE Gigabytes(4)
+#define SDL_THREAD_CACHE_MAX 64
+#define SDL_THREAD_CACHE_BATCH 32
+
+struct sdl_free_block
+{
+    sdl_free_block *Next;
+};
+
+struct sdl_size_class
+{
+    SDL_SpinLock Lock;
+    sdl_free_block *FirstFree;
+
+    uint8 *CarveAt;
+    uint8 *CarveEnd;
+};
+
+struct sdl_large_allocation_header
+{
+    void *Base;
+    memory_index MapSize;
+};
+
+struct sdl_allocator
+{
+    memory_index PageSize;
+    bool32 GuardPages;
+
+    uint8 *SlabRegion;
+    uint32 volatile NextSlab;
+    uint32 SlabCount;
+    uint8 SlabClass[SDL_SLAB_REGION_SIZE / SDL_SLAB_SIZE];
+
+    sdl_size_class Classes[SDL_SIZE_CLASS_COUNT];
+
+    u64 volatile AllocationCount;
+    u64 volatile DeallocationCount;
+    u64 volatile LiveBytes;
+    u64 volatile SlabBytes;
+    u64 volatile LargeBytes;
+};
+
+struct sdl_thread_cache
+{
+    sdl_free_block *FirstFree;
+    uint32 Count;
+};
+
+static sdl_allocator GlobalAllocator;
+static thread_local sdl_thread_cache GlobalThreadCaches[SDL_SIZE_CLASS_COUNT];
 
 static void
-SDLDebugDrawVertical(sdl_offscreen_buffer *Backbuffer,
-                       int X, int Top, int Bottom, uint32 Color)
+SDLInitAllocator(sdl_allocator *Allocator)
 {
-    if(Top <= 0)
+    Allocator->PageSize = sysconf(_SC_PAGESIZE);
+
+#if HANDMADE_INTERNAL
+    char *GuardPages = getenv("HANDMADE_GUARD_PAGES");
+    Allocator->GuardPages = (GuardPages && (GuardPages[0] == '1'));
+#endif
+
+    // NOTE: Only address space; pages are committed as slabs get used.
+    void *Region = mmap(0, SDL_SLAB_REGION_SIZE,
+                        PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                        -1, 0);
+    if(Region != MAP_FAILED)
     {
-        Top = 0;
+        Allocator->SlabRegion = (uint8 *)Region;
+        Allocator->SlabCount = SDL_SLAB_REGION_SIZE / SDL_SLAB_SIZE;
     }
-
-    if(Bottom > Backbuffer->Height)
+    else
     {
-        Bottom = Backbuffer->Height;
+        // NOTE: Every allocation will take the mapping path.
+        // TODO: Diagnostic
     }
+}
 
-    if((X >= 0) && (X < Backbuffer->Width))
+inline uint32
+SDLGetSizeClass(memory_index Size)
+{
+    uint32 ClassIndex = 0;
+    memory_index ClassSize = SDL_SMALLEST_SIZE_CLASS;
+    while(ClassSize < Size)
     {
-        uint8 *Pixel = ((uint8 *)Backbuffer->Memory +
-                        X*Backbuffer->BytesPerPixel +
-                        Top*Backbuffer->Pitch);
-        for(int Y = Top;
-            Y < Bottom;
-            ++Y)
-        {
-            *(uint32 *)Pixel = Color;
-            Pixel += Backbuffer->Pitch;
-        }
+        ClassSize <<= 1;
+        ++ClassIndex;
     }
+
+    return(ClassIndex);
 }
 
-inline void
-SDLDrawSoundBufferMarker(sdl_offscreen_buffer *Backbuffer,
-                           sdl_sound_output *SoundOutput,
-                           real32 C, int PadX, int Top, int Bottom,
-                           uint32 Value, uint32 Color)
+inline memory_index
+SDLGetSizeClassSize(uint32 ClassIndex)
 {
-    real32 XReal32 = (C * (real32)Value);
-    int X = PadX + (int)XReal32;
-    SDLDebugDrawVertical(Backbuffer, X, Top, Bottom, Color);
+    memory_index Result = ((memory_index)SDL_SMALLEST_SIZE_CLASS << ClassIndex);
+    return(Result);
 }
 
 static void
-SDLDebugSyncDisplay(sdl_offscreen_buffer *Backbuffer,
-                      int MarkerCount, sdl_debug_time_marker *Markers,
-                      int CurrentMarkerIndex,
-                      sdl_sound_output *SoundOutput, real32 TargetSecondsPerFrame)
+SDLRefillThreadCache(sdl_allocator *Allocator, uint32 ClassIndex, sdl_thread_cache *Cache)
 {
-    int PadX = 16;
-    int PadY = 16;
-
-    int LineHeight = 64;
+    sdl_size_class *Class = Allocator->Classes + ClassIndex;
+    memory_index ClassSize = SDLGetSizeClassSize(ClassIndex);
 
-    real32 C = (real32)(Backbuffer->Width - 2*PadX) / (real32)SoundOutput->SecondaryBufferSize;
-    for(int MarkerIndex = 0;
-        MarkerIndex < MarkerCount;
-        ++MarkerIndex)
+    SDL_AtomicLock(&Class->Lock);
+    while(Class->FirstFree && (Cache->Count < SDL_THREAD_CACHE_BATCH))
     {
-        sdl_debug_time_marker *ThisMarker = &Markers[MarkerIndex];
+        sdl_free_block *Block = Class->FirstFree;
+        Class->FirstFree = Block->Next;
 
-        uint32 WriteColor = 0x000000FF;
-        uint32 QueuedAudioColor = 0x00FF0000;
-        uint32 ExpectedFlipColor = 0x0000FF00;
+        Block->Next = Cache->FirstFree;
+        Cache->FirstFree = Block;
+        ++Cache->Count;
+    }
 
-        int Top = PadY;
-        int Bottom = PadY + LineHeight;
-        if(MarkerIndex == CurrentMarkerIndex)
+    while(Cache->Count < SDL_THREAD_CACHE_BATCH)
+    {
+        if(Class->CarveAt == Class->CarveEnd)
         {
-            Top += LineHeight+PadY;
-            Bottom += LineHeight+PadY;
-
-            int FirstTop = Top;
+            uint32 SlabIndex = SDL_AtomicAdd((SDL_atomic_t *)&Allocator->NextSlab, 1);
+            if(SlabIndex >= Allocator->SlabCount)
+            {
+                break;
+            }
 
-            SDLDrawSoundBufferMarker(Backbuffer, SoundOutput, C, MarkerIndex*30+PadX, Top, Bottom, ThisMarker->OutputByteCount, WriteColor);
+            Allocator->SlabClass[SlabIndex] = (uint8)ClassIndex;
+            Class->CarveAt = Allocator->SlabRegion + (memory_index)SlabIndex*SDL_SLAB_SIZE;
+            Class->CarveEnd = Class->CarveAt + SDL_SLAB_SIZE;
+            AtomicAddU64(&Allocator->SlabBytes, SDL_SLAB_SIZE);
+        }
 
-            Top += LineHeight+PadY;
-            Bottom += LineHeight+PadY;
+        sdl_free_block *Block = (sdl_free_block *)Class->CarveAt;
+        Class->CarveAt += ClassSize;
 
-            SDLDrawSoundBufferMarker(Backbuffer, SoundOutput, C, MarkerIndex*30+PadX, Top, Bottom, ThisMarker->QueuedAudioBytes, QueuedAudioColor);
+        Block->Next = Cache->FirstFree;
+        Cache->FirstFree = Block;
+        ++Cache->Count;
+    }
+    SDL_AtomicUnlock(&Class->Lock);
+}
 
-            Top += LineHeight+PadY;
-            Bottom += LineHeight+PadY;
+static void
+SDLFlushThreadCache(sdl_allocator *Allocator, uint32 ClassIndex, sdl_thread_cache *Cache)
+{
+    sdl_size_class *Class = Allocator->Classes + ClassIndex;
 
-            SDLDrawSoundBufferMarker(Backbuffer, SoundOutput, C, MarkerIndex*30+PadX, FirstTop, Bottom, ThisMarker->ExpectedBytesUntilFlip, ExpectedFlipColor);
-        }
+    SDL_AtomicLock(&Class->Lock);
+    while(Cache->Count > (SDL_THREAD_CACHE_MAX - SDL_THREAD_CACHE_BATCH))
+    {
+        sdl_free_block *Block = Cache->FirstFree;
+        Cache->FirstFree = Block->Next;
+        --Cache->Count;
 
-        SDLDrawSoundBufferMarker(Backbuffer, SoundOutput, C, MarkerIndex*30+PadX, Top, Bottom, ThisMarker->OutputByteCount, WriteColor);
-        SDLDrawSoundBufferMarker(Backbuffer, SoundOutput, C, MarkerIndex*30+PadX, Top, Bottom, ThisMarker->QueuedAudioBytes, QueuedAudioColor);
-        SDLDrawSoundBufferMarker(Backbuffer, SoundOutput, C, MarkerIndex*30+PadX, Top, Bottom, ThisMarker->ExpectedBytesUntilFlip, ExpectedFlipColor);
+        Block->Next = Class->FirstFree;
+        Class->FirstFree = Block;
     }
+    SDL_AtomicUnlock(&Class->Lock);
 }
 
-#endif
-
-struct platform_work_queue_entry
+static void *
+SDLAllocateLarge(sdl_allocator *Allocator, memory_index Size)
 {
-    platform_work_queue_callback *Callback;
-    void *Data;
-};
+    void *Result = 0;
 
-struct platform_work_queue
-{
-    unsigned int volatile CompletionGoal;
-    unsigned int volatile CompletionCount;
+    memory_index HeaderSize = sizeof(sdl_large_allocation_header);
+    memory_index PageSize = Allocator->PageSize;
+    memory_index MapSize = Size + HeaderSize;
+    if(Allocator->GuardPages)
+    {
+        MapSize = AlignPow2(Align16(Size) + HeaderSize, PageSize) + PageSize;
+    }
 
-    unsigned int volatile NextEntryToWrite;
-    unsigned int volatile NextEntryToRead;
-    SDL_sem *SemaphoreHandle;
+    void *Base = mmap(0, MapSize, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(Base != MAP_FAILED)
+    {
+        uint8 *Block = (uint8 *)Base + HeaderSize;
+        if(Allocator->GuardPages)
+        {
+            uint8 *GuardPage = (uint8 *)Base + MapSize - PageSize;
+            mprotect(GuardPage, PageSize, PROT_NONE);
+            Block = GuardPage - Align16(Size);
+        }
 
-    platform_work_queue_entry Entries[256];
-};
+        sdl_large_allocation_header *Header = (sdl_large_allocation_header *)Block - 1;
+        Header->Base = Base;
+        Header->MapSize = MapSize;
 
-static void
-SDLAddEntry(platform_work_queue *Queue, platform_work_queue_callback *Callback, void *Data)
-{
-    // TODO(casey): Switch to InterlockedCompareExchange eventually
-    // so that any thread can add?
-    uint32 NewNextEntryToWrite = (Queue->NextEntryToWrite + 1) % ArrayCount(Queue->Entries);
-    Assert(NewNextEntryToWrite != Queue->NextEntryToRead);
-    platform_work_queue_entry *Entry = Queue->Entries + Queue->NextEntryToWrite;
-    Entry->Callback = Callback;
-    Entry->Data = Data;
-    ++Queue->CompletionGoal;
-    SDL_CompilerBarrier();
-    Queue->NextEntryToWrite = NewNextEntryToWrite;
-    SDL_SemPost(Queue->SemaphoreHandle);
+        AtomicAddU64(&Allocator->LargeBytes, MapSize);
+        AtomicAddU64(&Allocator->LiveBytes, MapSize);
+
+        Result = Block;
+    }
+
+    return(Result);
 }
 
-static bool32
-SDLDoNextWorkQueueEntry(platform_work_queue *Queue)
+PLATFORM_ALLOCATE_MEMORY(SDLAllocateMemory)
 {
-    bool32 WeShouldSleep = false;
+    sdl_allocator *Allocator = &GlobalAllocator;
+    void *Result = 0;
 
-    uint32 OriginalNextEntryToRead = Queue->NextEntryToRead;
-    uint32 NewNextEntryToRead = (OriginalNextEntryToRead + 1) % ArrayCount(Queue->Entries);
-    if(OriginalNextEntryToRead != Queue->NextEntryToWrite)
+    if((Size <= SDL_LARGEST_SIZE_CLASS) && !Allocator->GuardPages)
     {
-        SDL_bool WasSet = SDL_AtomicCAS((SDL_atomic_t *)&Queue->NextEntryToRead,
-                                        OriginalNextEntryToRead,
-                                        NewNextEntryToRead);
-        if(WasSet)
+        uint32 ClassIndex = SDLGetSizeClass(Size);
+        memory_index ClassSize = SDLGetSizeClassSize(ClassIndex);
+        sdl_thread_cache *Cache = GlobalThreadCaches + ClassIndex;
+        if(!Cache->FirstFree)
         {
-            platform_work_queue_entry Entry = Queue->Entries[OriginalNextEntryToRead];
-            Entry.Callback(Queue, Entry.Data);
-            SDL_AtomicIncRef((SDL_atomic_t *)&Queue->CompletionCount);
+            SDLRefillThreadCache(Allocator, ClassIndex, Cache);
+        }
+
+        sdl_free_block *Block = Cache->FirstFree;
+        if(Block)
+        {
+            Cache->FirstFree = Block->Next;
+            --Cache->Count;
+
+            // NOTE: Callers expect cleared memory, like a fresh mapping.
+            memset(Block, 0, ClassSize);
+            AtomicAddU64(&Allocator->LiveBytes, ClassSize);
+
+            Result = Block;
         }
     }
-    else
+
+    if(!Result)
     {
-        WeShouldSleep = true;
+        Result = SDLAllocateLarge(Allocator, Size);
     }
 
-    return(WeShouldSleep);
-}
-
-static void
-SDLCompleteAllWork(platform_work_queue *Queue)
-{
-    while(Queue->CompletionGoal != Queue->CompletionCount)
+    if(Result)
     {
-        SDLDoNextWorkQueueEntry(Queue);
+        AtomicAddU64(&Allocator->AllocationCount, 1);
     }
 
-    Queue->CompletionGoal = 0;
-    Queue->CompletionCount = 0;
+    return(Result);
 }
 
-int
-ThreadProc(void *Parameter)
+PLATFORM_DEALLOCATE_MEMORY(SDLDeallocateMemory)
 {
-    platform_work_queue *Queue = (platform_work_queue *)Parameter;
-
-    for(;;)
+    sdl_allocator *Allocator = &GlobalAllocator;
+    if(Memory)
     {
-        if(SDLDoNextWorkQueueEntry(Queue))
+        uint8 *Block = (uint8 *)Memory;
+        // NOTE: Without a slab region, every block came from the mapping path.
+        if(Allocator->SlabRegion &&
+           (Block >= Allocator->SlabRegion) &&
+           (Block < (Allocator->SlabRegion + SDL_SLAB_REGION_SIZE)))
         {
-            SDL_SemWait(Queue->SemaphoreHandle);
+            // NOTE: A slab only ever holds one class, so small blocks need
+            // no header - the slab they live in says how big they are.
+            uint32 ClassIndex = Allocator->SlabClass[(Block - Allocator->SlabRegion) / SDL_SLAB_SIZE];
+            sdl_thread_cache *Cache = GlobalThreadCaches + ClassIndex;
+
+            sdl_free_block *FreeBlock = (sdl_free_block *)Block;
+            FreeBlock->Next = Cache->FirstFree;
+            Cache->FirstFree = FreeBlock;
+            ++Cache->Count;
+
+            if(Cache->Count > SDL_THREAD_CACHE_MAX)
+            {
+                SDLFlushThreadCache(Allocator, ClassIndex, Cache);
+            }
+
+            AtomicAddU64(&Allocator->LiveBytes, -(u64)SDLGetSizeClassSize(ClassIndex));
         }
-    }
+        else
+        {
+            sdl_large_allocation_header *Header = (sdl_large_allocation_header *)Memory - 1;
+            memory_index MapSize = Header->MapSize;
 
-//    return(0);
+            AtomicAddU64(&Allocator->LargeBytes, -(u64)MapSize);
+            AtomicAddU64(&Allocator->LiveBytes, -(u64)MapSize);
+            munmap(Header->Base, MapSize);
+        }
+
+        AtomicAddU64(&Allocator->DeallocationCount, 1);
+    }
 }
 
-static PLATFORM_WORK_QUEUE_CALLBACK(DoWorkerWork)
+static PLATFORM_GET_MEMORY_STATS(SDLGetMemoryStats)
 {
-    printf("Thread %lu: %s\n", SDL_ThreadID(), (char *)Data);
+    sdl_allocator *Allocator = &GlobalAllocator;
+
+    Stats->AllocationCount = Allocator->AllocationCount;
+    Stats->DeallocationCount = Allocator->DeallocationCount;
+    Stats->LiveAllocationCount = Stats->AllocationCount - Stats->DeallocationCount;
+    Stats->LiveBytes = Allocator->LiveBytes;
+    Stats->SlabBytes = Allocator->SlabBytes;
+    Stats->LargeBytes = Allocator->LargeBytes;
 }
 
-static void
-SDLMakeQueue(platform_work_queue *Queue, uint32 ThreadCount)
-{
-    Queue->CompletionGoal = 0;
-    Queue->CompletionCount = 0;
+// NOTE: Saves are written one at a time, in the order they were made, by
+// SaveWriteQueue's one thread.
+static platform_work_queue *GlobalSaveWriteQueue;
+static uint32 volatile GlobalPendingSaveCount;
 
-    Queue->NextEntryToWrite = 0;
-    Queue->NextEntryToRead = 0;
+struct sdl_save_output
+{
+    int Handle;
+    bool32 Failed;
+    uint64 BytesWritten;
 
-    uint32 InitialCount = 0;
-    Queue->SemaphoreHandle = SDL_CreateSemaphore(InitialCount);
+    memory_index Used;
+    memory_index Size;
+    uint8 *Buffer;
+};
 
-    for(uint32 ThreadIndex = 0;
-        ThreadIndex < ThreadCount;
-        ++ThreadIndex)
+static void
+SDLFlushSaveOutput(sdl_save_output *Output)
+{
+    uint8 *At = Output->Buffer;
+    while(!Output->Failed && (At < (Output->Buffer + Output->Used)))
     {
-        SDL_Thread *ThreadHandle = SDL_CreateThread(ThreadProc, 0, Queue);
-        SDL_DetachThread(ThreadHandle);
+        ssize_t BytesWritten = write(Output->Handle, At, (Output->Buffer + Output->Used) - At);
+        if(BytesWritten > 0)
+        {
+            At += BytesWritten;
+            Output->BytesWritten += BytesWritten;
+        }
+        else if(errno != EINTR)
+        {
+            Output->Failed = true;
+        }
     }
+
+    Output->Used = 0;
 }
 
-struct sdl_platform_file_handle
+static void
+SDLWriteSaveOutput(sdl_save_output *Output, memory_index Size, void *Source)
 {
-    int SDLHandle;
-};
+    if((Output->Used + Size) > Output->Size)
+    {
+        SDLFlushSaveOutput(Output);
+    }
 
-struct sdl_platform_file_group
-{
-    uint32 FileIndex;
-    glob_t GlobData;
-};
+    Assert(Size <= Output->Size);
+    memcpy(Output->Buffer + Output->Used, Source, Size);
+    Output->Used += Size;
+}
 
-static PLATFORM_GET_ALL_FILE_OF_TYPE_BEGIN(SDLGetAllFilesOfTypeBegin)
+static PLATFORM_WORK_QUEUE_CALLBACK(SDLWriteSavedGameWork)
 {
-    platform_file_group Result = {};
-
-    // TODO(casey): If we want, someday, make an actual arena
-    sdl_platform_file_group *SDLFileGroup = (sdl_platform_file_group *)calloc(
-        1, sizeof(sdl_platform_file_group));
-    Result.Platform = SDLFileGroup;
+    sdl_saved_game_write *Save = (sdl_saved_game_write *)Data;
+    int DirectoryHandle = GlobalFileCache.DirectoryHandle;
+    uint64 StartCounter = SDL_GetPerformanceCounter();
+
+    char TempFileName[SDL_STATE_FILE_NAME_COUNT + 8];
+    snprintf(TempFileName, sizeof(TempFileName), "%s.tmp", Save->FileName);
+
+    sdl_save_output Output = {};
+    Output.Handle = openat(DirectoryHandle, TempFileName, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                           S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    Output.Size = Megabytes(1);
+    Output.Buffer = (uint8 *)SDLAllocateMemory(Output.Size + SDL_SAVED_GAME_BLOCK_SIZE);
+    uint8 *Compressed = Output.Buffer + Output.Size;
+    Output.Failed = ((Output.Handle == -1) || !Output.Buffer);
+
+    sdl_saved_game_header Header = {};
+    Header.MagicValue = SDL_SAVED_GAME_MAGIC_VALUE;
+    Header.Version = SDL_SAVED_GAME_VERSION;
+    Header.RegionCount = Save->RegionCount;
+    Header.TotalSize = Save->TotalSize;
+    if(!Output.Failed)
+    {
+        SDLWriteSaveOutput(&Output, sizeof(Header), &Header);
+        for(uint32 RegionIndex = 0;
+            RegionIndex < Save->RegionCount;
+            ++RegionIndex)
+        {
+            SDLWriteSaveOutput(&Output, sizeof(uint64), Save->RegionSizes + RegionIndex);
+        }
+    }
 
-    char *WildCard = "*.*";
-    switch(Type)
+    for(uint64 Offset = 0;
+        !Output.Failed && (Offset < Save->TotalSize);
+        Offset += SDL_SAVED_GAME_BLOCK_SIZE)
     {
-        case PlatformFileType_AssetFile:
+        uint32 RawSize = SDL_SAVED_GAME_BLOCK_SIZE;
+        if(RawSize > (Save->TotalSize - Offset))
         {
-            WildCard = "*.hha";
-        } break;
+            RawSize = (uint32)(Save->TotalSize - Offset);
+        }
 
-        case PlatformFileType_SavedGameFile:
+        sdl_saved_game_block Block = {};
+        Block.DataSize = RawSize;
+        uint8 *BlockData = Save->Snapshot + Offset;
+        memory_index CompressedSize = CompressLZ(RawSize, BlockData, RawSize - 1, Compressed);
+        if(CompressedSize)
         {
-            WildCard = "*.hhs";
-        } break;
+            Block.Flags |= SDLSavedGameBlock_Compressed;
+            Block.DataSize = (uint32)CompressedSize;
+            BlockData = Compressed;
+        }
 
-        InvalidDefaultCase;
+        SDLWriteSaveOutput(&Output, sizeof(Block), &Block);
+        SDLWriteSaveOutput(&Output, Block.DataSize, BlockData);
     }
 
-    glob(WildCard, 0, 0, &SDLFileGroup->GlobData);
-    Result.FileCount = SDLFileGroup->GlobData.gl_pathc;
+    bool32 Completed = false;
+    if(!Output.Failed)
+    {
+        SDLFlushSaveOutput(&Output);
 
-    return(Result);
-}
+        // NOTE: The data has to be on disk before the rename is, or a crash
+        // could leave the new name on an empty file.
+        Completed = (!Output.Failed && (fdatasync(Output.Handle) == 0));
+    }
 
-static PLATFORM_GET_ALL_FILE_OF_TYPE_END(SDLGetAllFilesOfTypeEnd)
-{
-    sdl_platform_file_group *SDLFileGroup = (sdl_platform_file_group *)FileGroup->Platform;
-    if(SDLFileGroup)
+    if(Output.Handle != -1)
     {
-        globfree(&SDLFileGroup->GlobData);
+        close(Output.Handle);
+        if(Completed)
+        {
+            Completed = (renameat(DirectoryHandle, TempFileName, DirectoryHandle, Save->FileName) == 0);
+            fsync(DirectoryHandle);
+        }
+
+        if(!Completed)
+        {
+            unlinkat(DirectoryHandle, TempFileName, 0);
+        }
+    }
 
-        free(SDLFileGroup);
+    uint64 EndCounter = SDL_GetPerformanceCounter();
+#if HANDMADE_INTERNAL
+    if(Completed)
+    {
+        printf("Saved %s: %lu bytes of %lu in %.02fms\n",
+               Save->FileName, Output.BytesWritten, Save->TotalSize,
+               1000.0f*(real32)(EndCounter - StartCounter) / (real32)GlobalPerfCountFrequency);
     }
+    else
+    {
+        // TODO: Diagnostic
+        printf("Could not save %s\n", Save->FileName);
+    }
+#endif
+
+    SDLDeallocateMemory(Output.Buffer);
+    SDLDeallocateMemory(Save);
+    AtomicAddU32(&GlobalPendingSaveCount, (uint32)-1);
 }
 
-static PLATFORM_OPEN_FILE(SDLOpenNextFile)
+static PLATFORM_SAVE_GAME(SDLSaveGame)
 {
-    sdl_platform_file_group *SDLFileGroup = (sdl_platform_file_group *)FileGroup->Platform;
-    platform_file_handle Result = {};
+    b32 Result = false;
 
-    if(SDLFileGroup->FileIndex < SDLFileGroup->GlobData.gl_pathc)
+    uint64 TotalSize = 0;
+    for(uint32 RegionIndex = 0;
+        RegionIndex < RegionCount;
+        ++RegionIndex)
     {
-        // TODO(casey): If we want, someday, make an actual arena
-        sdl_platform_file_handle *SDLHandle = (sdl_platform_file_handle *)malloc(
-            sizeof(sdl_platform_file_handle));
-        Result.Platform = SDLHandle;
+        TotalSize += Regions[RegionIndex].Size;
+    }
 
-        if(SDLHandle)
+    // NOTE: Only a save that got counted as pending uncounts itself when it
+    // can't be queued after all.
+    if(GlobalSaveWriteQueue && GlobalFileCache.Arena.Base)
+    {
+        if(AtomicAddU32(&GlobalPendingSaveCount, 1) < SDL_MAX_PENDING_SAVES)
         {
-            char *FileName = SDLFileGroup->GlobData.gl_pathv[SDLFileGroup->FileIndex++];
-            SDLHandle->SDLHandle = open(FileName, O_RDONLY);
-            Result.NoErrors = (SDLHandle->SDLHandle != -1);
+            memory_index SizesSize = RegionCount*sizeof(uint64);
+            sdl_saved_game_write *Save = (sdl_saved_game_write *)SDLAllocateMemory(
+                sizeof(sdl_saved_game_write) + SizesSize + TotalSize);
+            if(Save)
+            {
+                snprintf(Save->FileName, sizeof(Save->FileName), "%s.hhs", Name);
+                Save->RegionCount = RegionCount;
+                Save->TotalSize = TotalSize;
+                Save->RegionSizes = (uint64 *)(Save + 1);
+                Save->Snapshot = (uint8 *)Save->RegionSizes + SizesSize;
+
+                uint8 *Dest = Save->Snapshot;
+                for(uint32 RegionIndex = 0;
+                    RegionIndex < RegionCount;
+                    ++RegionIndex)
+                {
+                    platform_save_region *Region = Regions + RegionIndex;
+                    Save->RegionSizes[RegionIndex] = Region->Size;
+                    memcpy(Dest, Region->Memory, Region->Size);
+                    Dest += Region->Size;
+                }
+
+                SDLAddEntry(GlobalSaveWriteQueue, SDLWriteSavedGameWork, Save);
+                Result = true;
+            }
+        }
+
+        if(!Result)
+        {
+            // TODO: Diagnostic
+            AtomicAddU32(&GlobalPendingSaveCount, (uint32)-1);
         }
     }
 
     return(Result);
 }
 
-static PLATFORM_FILE_ERROR(SDLFileError)
+static void
+SDLFinishSavedGameWrites(void)
 {
-#if HANDMADE_INTERNAL
-    printf("SDL FILE ERROR: %s\n", Message);
-#endif
-
-    Handle->NoErrors = false;
+    // NOTE: Waits, rather than helping out with CompleteAllWork, so the saves
+    // still go one at a time and in the order they were made.
+    while(GlobalPendingSaveCount)
+    {
+        SDL_Delay(1);
+    }
 }
 
-static PLATFORM_READ_DATA_FROM_FILE(SDLReadDataFromFile)
+static PLATFORM_LOAD_GAME(SDLLoadGame)
 {
+    // NOTE: Everything is decoded into scratch memory first, so a damaged
+    // file can't leave the regions half loaded.
+    b32 Result = false;
+
+    uint64 TotalSize = 0;
+    for(uint32 RegionIndex = 0;
+        RegionIndex < RegionCount;
+        ++RegionIndex)
+    {
+        TotalSize += Regions[RegionIndex].Size;
+    }
+
+    uint8 *File = 0;
+    uint8 *Scratch = 0;
+    uint64 FileSize = Source->Size;
     if(PlatformNoFileErrors(Source))
+    {
+        File = (uint8 *)SDLAllocateMemory(FileSize);
+        Scratch = (uint8 *)SDLAllocateMemory(TotalSize + 1);
+    }
+
+    if(File && Scratch)
     {
         sdl_platform_file_handle *Handle = (sdl_platform_file_handle *)Source->Platform;
+        uint8 *End = File + SDLReadAt(Handle->SDLHandle, 0, FileSize, File);
+        uint8 *At = File;
+
+        sdl_saved_game_header Header;
+        bool32 Valid = ((memory_index)(End - At) >= (sizeof(Header) + RegionCount*sizeof(uint64)));
+        if(Valid)
+        {
+            memcpy(&Header, At, sizeof(Header));
+            At += sizeof(Header);
+            Valid = ((Header.MagicValue == SDL_SAVED_GAME_MAGIC_VALUE) &&
+                     (Header.Version == SDL_SAVED_GAME_VERSION) &&
+                     (Header.RegionCount == RegionCount) &&
+                     (Header.TotalSize == TotalSize));
+        }
 
-        uint32 FileSize32 = SafeTruncateUInt64(Size);
+        for(uint32 RegionIndex = 0;
+            Valid && (RegionIndex < RegionCount);
+            ++RegionIndex)
+        {
+            uint64 RegionSize;
+            memcpy(&RegionSize, At, sizeof(RegionSize));
+            At += sizeof(RegionSize);
+            Valid = (RegionSize == Regions[RegionIndex].Size);
+        }
 
-        uint8 *DestLocation = (uint8*)Dest;
-        while (FileSize32)
+        for(uint64 Offset = 0;
+            Valid && (Offset < TotalSize);
+            Offset += SDL_SAVED_GAME_BLOCK_SIZE)
         {
-            ssize_t BytesRead = pread(Handle->SDLHandle, DestLocation, FileSize32, Offset);
-            if (BytesRead != -1)
+            uint32 RawSize = SDL_SAVED_GAME_BLOCK_SIZE;
+            if(RawSize > (TotalSize - Offset))
             {
-                // NOTE(casey): File read succeeded!
-                FileSize32 -= BytesRead;
-                DestLocation += BytesRead;
+                RawSize = (uint32)(TotalSize - Offset);
             }
-            else
+
+            sdl_saved_game_block Block;
+            Valid = ((memory_index)(End - At) >= sizeof(Block));
+            if(Valid)
             {
-                SDLFileError(Source, "Read file failed.");
-                break;
+                memcpy(&Block, At, sizeof(Block));
+                At += sizeof(Block);
+                Valid = (Block.DataSize <= (memory_index)(End - At));
+            }
+
+            if(Valid)
+            {
+                if(Block.Flags & SDLSavedGameBlock_Compressed)
+                {
+                    Valid = (DecompressLZ(Block.DataSize, At, RawSize, Scratch + Offset) == RawSize);
+                }
+                else
+                {
+                    Valid = (Block.DataSize == RawSize);
+                    if(Valid)
+                    {
+                        memcpy(Scratch + Offset, At, RawSize);
+                    }
+                }
+                At += Block.DataSize;
+            }
+        }
+
+        if(Valid)
+        {
+            uint8 *From = Scratch;
+            for(uint32 RegionIndex = 0;
+                RegionIndex < RegionCount;
+                ++RegionIndex)
+            {
+                platform_save_region *Region = Regions + RegionIndex;
+                memcpy(Region->Memory, From, Region->Size);
+                From += Region->Size;
             }
+            Result = true;
+        }
+        else
+        {
+            // TODO: Diagnostic
+#if HANDMADE_INTERNAL
+            printf("Saved game is damaged or from another version\n");
+#endif
         }
     }
-}
 
-/*
+    SDLDeallocateMemory(File);
+    SDLDeallocateMemory(Scratch);
 
-static PLATFORM_FILE_ERROR(SDLCloseFile)
-{
-    close(FileHandle);
+    return(Result);
 }
 
-*/
-
-PLATFORM_ALLOCATE_MEMORY(SDLAllocateMemory)
+static bool32
+SDLInitGameMemory(sdl_state *State, game_memory *GameMemory)
 {
-    memory_index TotalSize = Size + sizeof(memory_index);
+    // NOTE: Everything about game memory but its work queues, which the
+    // caller sets up - shared by the game loop and the replay runner.
+#if HANDMADE_INTERNAL
+    // TODO: This will fail gently on 32-bit at the moment, but we should probably fix it.
+    void *BaseAddress = (void *)Terabytes(2);
+#else
+    void *BaseAddress = 0;
+#endif
+
+    GameMemory->PermanentStorageSize = Megabytes(256);
+    GameMemory->TransientStorageSize = Megabytes(256);
+    GameMemory->CacheStorageSize = Megabytes(768);
+    GameMemory->PlatformAPI.AddEntry = SDLAddEntry;
+    GameMemory->PlatformAPI.CompleteAllWork = SDLCompleteAllWork;
+
+    GameMemory->PlatformAPI.GetAllFilesOfTypeBegin = SDLGetAllFilesOfTypeBegin;
+    GameMemory->PlatformAPI.GetAllFilesOfTypeEnd = SDLGetAllFilesOfTypeEnd;
+    GameMemory->PlatformAPI.OpenNextFile = SDLOpenNextFile;
+    GameMemory->PlatformAPI.CloseFile = SDLCloseFile;
+    GameMemory->PlatformAPI.ReadDataFromFile = SDLReadDataFromFile;
+    GameMemory->PlatformAPI.ReadDataFromFileAsync = SDLReadDataFromFileAsync;
+    GameMemory->PlatformAPI.ReadSegmentsFromFileAsync = SDLReadSegmentsFromFileAsync;
+    GameMemory->PlatformAPI.MapFileRange = SDLMapFileRange;
+    GameMemory->PlatformAPI.ReadNextFileWindow = SDLReadNextFileWindow;
+    GameMemory->PlatformAPI.FileError = SDLFileError;
+
+    GameMemory->PlatformAPI.SaveGame = SDLSaveGame;
+    GameMemory->PlatformAPI.LoadGame = SDLLoadGame;
+
+    GameMemory->PlatformAPI.AllocateMemory = SDLAllocateMemory;
+    GameMemory->PlatformAPI.DeallocateMemory = SDLDeallocateMemory;
+    GameMemory->PlatformAPI.GetMemoryStats = SDLGetMemoryStats;
+
+#if HANDMADE_INTERNAL
+    // NOTE: Zeroed pages, only touched for the threads that record events.
+    if(!GlobalDebugTable)
+    {
+        sdl_memory_mapping DebugTableMapping = SDLMapMemory(0, sizeof(debug_table), SDLHugePages_None);
+        GlobalDebugTable = (debug_table *)DebugTableMapping.Base;
+    }
+    GameMemory->DebugTable = GlobalDebugTable;
+#endif
+
+    GameMemory->PlatformAPI.DEBUGFreeFileMemory = DEBUGPlatformFreeFileMemory;
+    GameMemory->PlatformAPI.DEBUGReadEntireFile = DEBUGPlatformReadEntireFile;
+    GameMemory->PlatformAPI.DEBUGWriteEntireFile = DEBUGPlatformWriteEntireFile;
+
+    // TODO(casey): Handle various memory footprints (USING
+    // SYSTEM METRICS)
+
+    // NOTE: Laid out permanent, game transient, cache, so that the part
+    // looped input recording has to save and restore is one contiguous run
+    // at the start of the block.
+    State->ReplayableSize = GameMemory->PermanentStorageSize + GameMemory->TransientStorageSize;
+    State->TotalSize = State->ReplayableSize + GameMemory->CacheStorageSize;
+    State->GameMemory = GameMemory;
+    State->GameMemoryMapping = SDLMapMemory(BaseAddress, State->TotalSize, GlobalHugePageMode);
+    State->GameMemoryBlock = State->GameMemoryMapping.Base;
+    GameMemory->PermanentStorage = State->GameMemoryBlock;
+    GameMemory->TransientStorage = ((uint8 *)GameMemory->PermanentStorage +
+                                    GameMemory->PermanentStorageSize);
+    GameMemory->CacheStorage = ((uint8 *)GameMemory->TransientStorage +
+                                GameMemory->TransientStorageSize);
+    if(State->GameMemoryBlock)
+    {
+        SDLInitCopyOnWriteSnapshots(State);
+    }
+    SDLReportPageUsage(State);
 
-    memory_index *Result = (memory_index *)mmap(0, TotalSize,
-        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    *Result++ = TotalSize;
+    for(int ReplayIndex = 1;
+        ReplayIndex < ArrayCount(State->ReplayBuffers);
+        ++ReplayIndex)
+    {
+        sdl_replay_buffer *ReplayBuffer = &State->ReplayBuffers[ReplayIndex];
+        ReplayBuffer->SnapshotHandle = -1;
+
+        SDLGetInputFileLocation(State, "state", ReplayIndex,
+                                sizeof(ReplayBuffer->FileName), ReplayBuffer->FileName);
+    }
 
+    bool32 Result = (GameMemory->PermanentStorage && GameMemory->TransientStorage && GameMemory->CacheStorage);
     return(Result);
 }
 
-PLATFORM_DEALLOCATE_MEMORY(SDLDeallocateMemory)
+static uint64
+SDLHashMemory(uint64 Hash, memory_index Size, void *Memory)
 {
-    if(Memory)
+    // NOTE: Only has to tell frames apart, not resist anyone.
+    uint8 *At = (uint8 *)Memory;
+    while(Size >= sizeof(uint64))
+    {
+        uint64 Word;
+        memcpy(&Word, At, sizeof(Word));
+        Hash = (Hash ^ Word)*0x9E3779B97F4A7C15ULL;
+        Hash ^= (Hash >> 29);
+        At += sizeof(Word);
+        Size -= sizeof(Word);
+    }
+
+    while(Size--)
     {
-        memory_index *TotalMemory = ((memory_index *)Memory) - 1;
-        memory_index Size = *TotalMemory;
+        Hash = (Hash ^ *At++)*0x9E3779B97F4A7C15ULL;
+    }
+
+    return(Hash);
+}
+
+static int
+SDLRunReplay(sdl_state *State, game_memory *GameMemory, char *GameCodeDLLFullPath,
+             int SlotIndex, int PassCount)
+{
+    // NOTE: Plays the loop recorded in a slot with no window and no audio
+    // device, as fast as the game can go, printing a hash of every frame's
+    // image and sound and how long the game took over it. The same
+    // recording should hash the same on every run and every build that
+    // isn't meant to change the output; with PassCount above one, later
+    // passes are checked against the first in-process.
+    //
+    // Work queued by the game is finished at the end of every frame, so
+    // what one frame started is always done by the next. A frame can still
+    // come out differently if an asset the game asked for earlier in the
+    // same frame happens to land before it is drawn.
+    int Result = 1;
+
+    sdl_offscreen_buffer Backbuffer = {};
+    Backbuffer.Width = 1920;
+    Backbuffer.Height = 1080;
+    Backbuffer.BytesPerPixel = 4;
+    Backbuffer.Pitch = Align16(Backbuffer.Width*Backbuffer.BytesPerPixel);
+    Backbuffer.Mapping = SDLMapMemory(0, Backbuffer.Pitch*Backbuffer.Height, GlobalHugePageMode);
+    Backbuffer.Memory = Backbuffer.Mapping.Base;
+
+    int SamplesPerSecond = 48000;
+    u32 MaxPossibleOverrun = 8;
+    int16 *Samples = (int16 *)calloc(SamplesPerSecond + MaxPossibleOverrun, 2*sizeof(int16));
+
+    bool32 GameMemoryIsValid = SDLInitGameMemory(State, GameMemory);
+    if((SlotIndex > 0) && (SlotIndex < ArrayCount(State->ReplayBuffers)) &&
+       GameMemoryIsValid && Backbuffer.Memory && Samples)
+    {
+        char TempGameCodeDLLFullPath[SDL_STATE_FILE_NAME_COUNT];
+        SDLGetGameCodeTempName(State, 0, sizeof(TempGameCodeDLLFullPath), TempGameCodeDLLFullPath);
+        sdl_game_code Game = SDLLoadGameCode(GameCodeDLLFullPath, TempGameCodeDLLFullPath);
+        SDLBeginInputPlayBack(State, SlotIndex);
+
+        sdl_input_player *Player = &State->InputPlayer;
+        uint32 FrameCount = Player->FrameCount;
+        uint64 *FrameHashes = (uint64 *)SDLAllocateMemory(2*(FrameCount + 1)*sizeof(uint64));
+        if(Game.IsValid && State->InputPlayingIndex && FrameHashes)
+        {
+            game_offscreen_buffer Buffer = {};
+            // NOTE: Bottom-up, like the game loop hands it over.
+            Buffer.Memory = ((uint8 *)Backbuffer.Memory +
+                             (Backbuffer.Height - 1)*Backbuffer.Pitch);
+            Buffer.Width = Backbuffer.Width;
+            Buffer.Height = Backbuffer.Height;
+            Buffer.Pitch = -Backbuffer.Pitch;
+
+            uint32 MismatchCount = 0;
+            uint64 TotalUpdateCounter = 0;
+            uint64 TotalSoundCounter = 0;
+            uint64 MaxFrameCounter = 0;
+            uint64 StartCounter = SDL_GetPerformanceCounter();
+
+            printf("# frame image_hash sound_hash update_ms sound_ms\n");
+            for(int PassIndex = 0;
+                PassIndex < PassCount;
+                ++PassIndex)
+            {
+                if(PassIndex > 0)
+                {
+                    SDLSeekPlayBack(State, 0, &Game, &Buffer, SamplesPerSecond, Samples);
+                }
+
+                for(uint32 FrameIndex = 0;
+                    FrameIndex < FrameCount;
+                    ++FrameIndex)
+                {
+                    game_input Input = {};
+                    SDLPlayBackInput(State, &Input, &Game, &Buffer, SamplesPerSecond, Samples);
+
+                    uint64 FrameStartCounter = SDL_GetPerformanceCounter();
+                    if(Game.UpdateAndRender)
+                    {
+                        Game.UpdateAndRender(GameMemory, &Input, &Buffer);
+                    }
+                    uint64 UpdateEndCounter = SDL_GetPerformanceCounter();
+
+                    // NOTE: A fixed frame's worth of samples rather than
+                    // whatever the audio device happens to want.
+                    game_sound_output_buffer SoundBuffer = {};
+                    SoundBuffer.SamplesPerSecond = SamplesPerSecond;
+                    SoundBuffer.SampleCount = Align8((int)((real32)SamplesPerSecond*
+                                                           Input.dtForFrame*(real32)Input.SimStepCount));
+                    if(SoundBuffer.SampleCount > SamplesPerSecond)
+                    {
+                        SoundBuffer.SampleCount = SamplesPerSecond;
+                    }
+                    SoundBuffer.Samples = Samples;
+                    if(Game.GetSoundSamples)
+                    {
+                        Game.GetSoundSamples(GameMemory, &SoundBuffer);
+                    }
+                    uint64 SoundEndCounter = SDL_GetPerformanceCounter();
+
+                    GameMemory->PlatformAPI.CompleteAllWork(GameMemory->HighPriorityQueue);
+                    GameMemory->PlatformAPI.CompleteAllWork(GameMemory->LowPriorityQueue);
+
+                    uint64 ImageHash = 0;
+                    for(int Y = 0;
+                        Y < Backbuffer.Height;
+                        ++Y)
+                    {
+                        ImageHash = SDLHashMemory(ImageHash, Backbuffer.Width*Backbuffer.BytesPerPixel,
+                                                  (uint8 *)Backbuffer.Memory + Y*Backbuffer.Pitch);
+                    }
+                    uint64 SoundHash = SDLHashMemory(0, SoundBuffer.SampleCount*2*sizeof(int16), Samples);
+
+                    uint64 UpdateCounter = UpdateEndCounter - FrameStartCounter;
+                    uint64 SoundCounter = SoundEndCounter - UpdateEndCounter;
+                    TotalUpdateCounter += UpdateCounter;
+                    TotalSoundCounter += SoundCounter;
+                    if(MaxFrameCounter < (UpdateCounter + SoundCounter))
+                    {
+                        MaxFrameCounter = UpdateCounter + SoundCounter;
+                    }
+
+                    uint64 *FrameHash = FrameHashes + 2*FrameIndex;
+                    if(PassIndex == 0)
+                    {
+                        FrameHash[0] = ImageHash;
+                        FrameHash[1] = SoundHash;
+                        printf("%u %016lx %016lx %.03f %.03f\n", FrameIndex, ImageHash, SoundHash,
+                               1000.0f*(real32)UpdateCounter / (real32)GlobalPerfCountFrequency,
+                               1000.0f*(real32)SoundCounter / (real32)GlobalPerfCountFrequency);
+                    }
+                    else if((FrameHash[0] != ImageHash) || (FrameHash[1] != SoundHash))
+                    {
+                        printf("# pass %d frame %u differs: %016lx %016lx\n",
+                               PassIndex, FrameIndex, ImageHash, SoundHash);
+                        ++MismatchCount;
+                    }
+                }
+            }
+
+            uint64 EndCounter = SDL_GetPerformanceCounter();
+            uint32 TotalFrameCount = FrameCount*PassCount;
+            real32 TotalMS = 1000.0f*(real32)(EndCounter - StartCounter) / (real32)GlobalPerfCountFrequency;
+            real32 DivFrames = TotalFrameCount ? (1.0f / (real32)TotalFrameCount) : 0.0f;
+            printf("# %u frames in %.02fms (%.01f frames/s): update %.03fms, sound %.03fms on average, "
+                   "slowest frame %.03fms\n",
+                   TotalFrameCount, TotalMS, TotalMS ? (1000.0f*(real32)TotalFrameCount / TotalMS) : 0.0f,
+                   DivFrames*1000.0f*(real32)TotalUpdateCounter / (real32)GlobalPerfCountFrequency,
+                   DivFrames*1000.0f*(real32)TotalSoundCounter / (real32)GlobalPerfCountFrequency,
+                   1000.0f*(real32)MaxFrameCounter / (real32)GlobalPerfCountFrequency);
+            if(PassCount > 1)
+            {
+                printf("# %u frames differed from the first pass\n", MismatchCount);
+            }
+
+            Result = (MismatchCount == 0) ? 0 : 2;
+        }
+        else
+        {
+            // TODO: Diagnostic
+            fprintf(stderr, "Could not play back loop %d with %s\n", SlotIndex, GameCodeDLLFullPath);
+        }
 
-        munmap(TotalMemory, Size);
+        SDLDeallocateMemory(FrameHashes);
+        if(State->InputPlayingIndex)
+        {
+            SDLEndInputPlayBack(State);
+        }
+        SDLUnloadGameCode(&Game);
     }
+    else
+    {
+        // TODO: Diagnostic
+        fprintf(stderr, "Could not set up loop %d for replay\n", SlotIndex);
+    }
+
+    SDLFinishReplayStateWrites(State);
+    free(Samples);
+    SDLUnmapMemory(&Backbuffer.Mapping);
+
+    return(Result);
 }
 
 int
@@ -1121,12 +6158,34 @@ main(int argc, char *argv[])
 {
     sdl_state SDLState = {};
 
+    // NOTE: Startup is timed phase by phase, so that anything that creeps
+    // into it shows up.
+    uint64 StartupCounter = SDL_GetPerformanceCounter();
+
+    SDLInitAllocator(&GlobalAllocator);
+
+    // NOTE: Before any thread is created, so the counter covers the workers.
+    SDLState.TLBMissCounter = SDLOpenTLBMissCounter();
+
     platform_work_queue HighPriorityQueue = {};
     SDLMakeQueue(&HighPriorityQueue, 6);
 
     platform_work_queue LowPriorityQueue = {};
     SDLMakeQueue(&LowPriorityQueue, 2);
 
+    platform_work_queue IOQueue = {};
+    SDLMakeQueue(&IOQueue, 2);
+    SDLInitAsyncReads(&IOQueue);
+
+    platform_work_queue ReplayWriteQueue = {};
+    SDLMakeQueue(&ReplayWriteQueue, 1);
+
+    platform_work_queue SaveWriteQueue = {};
+    SDLMakeQueue(&SaveWriteQueue, 1);
+    GlobalSaveWriteQueue = &SaveWriteQueue;
+
+    uint64 ThreadsCounter = SDL_GetPerformanceCounter();
+
 #if 0
     SDLAddEntry(&Queue, DoWorkerWork, (void *)"String A0");
     SDLAddEntry(&Queue, DoWorkerWork, (void *)"String A1");
@@ -1154,18 +6213,40 @@ main(int argc, char *argv[])
 #endif
 
     GlobalPerfCountFrequency = SDL_GetPerformanceFrequency();
+    GlobalHugePageMode = SDLGetHugePageModeFromEnvironment();
 
     SDLGetEXEFileName(&SDLState);
+    SDLInitFileCache(&GlobalFileCache, &SDLState);
 
     char SourceGameCodeDLLFullPath[SDL_STATE_FILE_NAME_COUNT];
     SDLBuildEXEPathFileName(&SDLState, "handmade.so",
                               sizeof(SourceGameCodeDLLFullPath), SourceGameCodeDLLFullPath);
 
+    if((argc >= 3) && (strcmp(argv[1], "--replay") == 0))
+    {
+        // NOTE: handmadehero --replay <loop slot> [pass count] plays a
+        // recorded loop headless; see SDLRunReplay.
+        game_memory GameMemory = {};
+        GameMemory.HighPriorityQueue = &HighPriorityQueue;
+        GameMemory.LowPriorityQueue = &LowPriorityQueue;
+        SDLState.ReplayWriteQueue = &ReplayWriteQueue;
+        SDLState.InputWriteQueue = &IOQueue;
+
+        int PassCount = (argc >= 4) ? atoi(argv[3]) : 1;
+        if(PassCount < 1)
+        {
+            PassCount = 1;
+        }
+        return(SDLRunReplay(&SDLState, &GameMemory, SourceGameCodeDLLFullPath, atoi(argv[2]), PassCount));
+    }
+
     SDL_Init(SDL_INIT_VIDEO | SDL_INIT_GAMECONTROLLER | SDL_INIT_HAPTIC | SDL_INIT_AUDIO);
 
     // Initialise our Game Controllers:
     SDLOpenGameControllers();
 
+    uint64 SDLInitCounter = SDL_GetPerformanceCounter();
+
 #if HANDMADE_INTERNAL
     DEBUGGlobalShowCursor = true;
 #endif
@@ -1186,27 +6267,54 @@ main(int argc, char *argv[])
     {
         SDL_ShowCursor(DEBUGGlobalShowCursor ? SDL_ENABLE : SDL_DISABLE);
 
+        int MonitorRefreshHz = 60;
+        int DisplayIndex = SDL_GetWindowDisplayIndex(Window);
+        SDL_DisplayMode Mode = {};
+        int DisplayModeResult = SDL_GetDesktopDisplayMode(DisplayIndex, &Mode);
+        if(DisplayModeResult == 0 && Mode.refresh_rate > 1)
+        {
+            MonitorRefreshHz = Mode.refresh_rate;
+        }
+        real32 GameUpdateHz = (real32)(MonitorRefreshHz / 2.0f);
+
+        // NOTE: With a fixed timestep the simulation rate no longer depends
+        // on the frame rate, so frames can go at the display's full rate.
+        real32 SimulationHz = SDLGetSimulationHzFromEnvironment();
+        if(SimulationHz > 0.0f)
+        {
+            GameUpdateHz = (real32)MonitorRefreshHz;
+        }
+        real32 TargetSecondsPerFrame = 1.0f / (real32)GameUpdateHz;
+
+        // NOTE: Vsync only when it is what paces the frames; on top of the
+        // timer it would add a wait for the next flip to every frame.
+        sdl_pacing_mode PacingMode = SDLGetPacingMode(MonitorRefreshHz, GameUpdateHz);
+
         // Create a "Renderer" for our window.
         SDL_Renderer *Renderer = SDL_CreateRenderer(Window,
                                                     -1,
-                                                    SDL_RENDERER_PRESENTVSYNC);
+                                                    (PacingMode == SDLPacing_VSync) ?
+                                                    SDL_RENDERER_PRESENTVSYNC : 0);
         if (Renderer)
         {
             //SDLResizeTexture(&GlobalBackbuffer, Renderer, 960, 540);
             SDLResizeTexture(&GlobalBackbuffer, Renderer, 1920, 1080);
 
-            sdl_sound_output SoundOutput = {};
-
-            int MonitorRefreshHz = 60;
-            int DisplayIndex = SDL_GetWindowDisplayIndex(Window);
-            SDL_DisplayMode Mode = {};
-            int DisplayModeResult = SDL_GetDesktopDisplayMode(DisplayIndex, &Mode);
-            if(DisplayModeResult == 0 && Mode.refresh_rate > 1)
+            SDL_RendererInfo RendererInfo = {};
+            if((PacingMode == SDLPacing_VSync) &&
+               ((SDL_GetRendererInfo(Renderer, &RendererInfo) != 0) ||
+                !(RendererInfo.flags & SDL_RENDERER_PRESENTVSYNC)))
             {
-                MonitorRefreshHz = Mode.refresh_rate;
+                // TODO: Diagnostic
+#if HANDMADE_INTERNAL
+                printf("No vsync from the renderer, pacing frames by timer\n");
+#endif
+                PacingMode = SDLPacing_Timer;
             }
-            real32 GameUpdateHz = (real32)(MonitorRefreshHz / 2.0f);
-            real32 TargetSecondsPerFrame = 1.0f / (real32)GameUpdateHz;
+
+            uint64 WindowCounter = SDL_GetPerformanceCounter();
+
+            sdl_sound_output SoundOutput = {};
 
             // TODO(casey): Make this like sixty seconds?
             SoundOutput.SamplesPerSecond = 48000;
@@ -1219,6 +6327,8 @@ main(int argc, char *argv[])
             SDLClearBuffer(&SoundOutput);
             SDL_PauseAudio(0);
 
+            uint64 AudioCounter = SDL_GetPerformanceCounter();
+
             GlobalRunning = true;
 
 #if 0
@@ -1247,86 +6357,33 @@ main(int argc, char *argv[])
             u32 MaxPossibleOverrun = 8;
             int16 *Samples = (int16 *)calloc(SoundOutput.SamplesPerSecond + MaxPossibleOverrun, SoundOutput.BytesPerSample);
 
-#if HANDMADE_INTERNAL
-            // TODO: This will fail gently on 32-bit at the moment, but we should probably fix it.
-            void *BaseAddress = (void *)Terabytes(2);
-#else
-            void *BaseAddress = 0;
-#endif
-
             game_memory GameMemory = {};
-            GameMemory.PermanentStorageSize = Megabytes(256);
-            GameMemory.TransientStorageSize = Gigabytes(1);
             GameMemory.HighPriorityQueue = &HighPriorityQueue;
             GameMemory.LowPriorityQueue = &LowPriorityQueue;
-            GameMemory.PlatformAPI.AddEntry = SDLAddEntry;
-            GameMemory.PlatformAPI.CompleteAllWork = SDLCompleteAllWork;
-
-            GameMemory.PlatformAPI.GetAllFilesOfTypeBegin = SDLGetAllFilesOfTypeBegin;
-            GameMemory.PlatformAPI.GetAllFilesOfTypeEnd = SDLGetAllFilesOfTypeEnd;
-            GameMemory.PlatformAPI.OpenNextFile = SDLOpenNextFile;
-            GameMemory.PlatformAPI.ReadDataFromFile = SDLReadDataFromFile;
-            GameMemory.PlatformAPI.FileError = SDLFileError;
-
-            GameMemory.PlatformAPI.AllocateMemory = SDLAllocateMemory;
-            GameMemory.PlatformAPI.DeallocateMemory = SDLDeallocateMemory;
-
-            GameMemory.PlatformAPI.DEBUGFreeFileMemory = DEBUGPlatformFreeFileMemory;
-            GameMemory.PlatformAPI.DEBUGReadEntireFile = DEBUGPlatformReadEntireFile;
-            GameMemory.PlatformAPI.DEBUGWriteEntireFile = DEBUGPlatformWriteEntireFile;
-
-            // TODO(casey): Handle various memory footprints (USING
-            // SYSTEM METRICS)
-
-            // TODO(casey): TransientStorage needs to be broken up
-            // into game transient and cache transient, and only the
-            // former need be saved for state playback.
-            SDLState.TotalSize = GameMemory.PermanentStorageSize + GameMemory.TransientStorageSize;
-            SDLState.GameMemoryBlock = mmap(BaseAddress, (size_t)SDLState.TotalSize,
-                                               PROT_READ | PROT_WRITE,
-                                               MAP_ANON | MAP_PRIVATE,
-                                               -1, 0);
-            GameMemory.PermanentStorage = SDLState.GameMemoryBlock;
-            GameMemory.TransientStorage = ((uint8 *)GameMemory.PermanentStorage +
-                                           GameMemory.PermanentStorageSize);
-
-            for(int ReplayIndex = 1;
-                ReplayIndex < ArrayCount(SDLState.ReplayBuffers);
-                ++ReplayIndex)
-            {
-                sdl_replay_buffer *ReplayBuffer = &SDLState.ReplayBuffers[ReplayIndex];
-
-                SDLGetInputFileLocation(&SDLState, false, ReplayIndex,
-                                          sizeof(ReplayBuffer->FileName), ReplayBuffer->FileName);
-
-                ReplayBuffer->FileHandle =
-                    open(ReplayBuffer->FileName,
-                         O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-
-                ftruncate(ReplayBuffer->FileHandle, SDLState.TotalSize);
-
-                ReplayBuffer->MemoryBlock = mmap(0, (size_t)SDLState.TotalSize,
-                                                 PROT_READ | PROT_WRITE,
-                                                 MAP_PRIVATE,
-                                                 ReplayBuffer->FileHandle, 0);
-                if(ReplayBuffer->MemoryBlock)
-                {
-                }
-                else
-                {
-                    // TODO(casey): Diagnostic
-                }
-            }
+            SDLState.ReplayWriteQueue = &ReplayWriteQueue;
+            SDLState.InputWriteQueue = &IOQueue;
+            bool32 GameMemoryIsValid = SDLInitGameMemory(&SDLState, &GameMemory);
 
-            if(Samples && GameMemory.PermanentStorage && GameMemory.TransientStorage)
+            uint64 GameMemoryCounter = SDL_GetPerformanceCounter();
+
+            if(Samples && GameMemoryIsValid)
             {
                 game_input Input[2] = {};
                 game_input *NewInput = &Input[0];
                 game_input *OldInput = &Input[1];
 
-                uint64 LastCounter = SDLGetWallClock();
                 uint64 FlipWallClock = SDLGetWallClock();
 
+                sdl_frame_pacer FramePacer = {};
+                SDLInitFramePacer(&FramePacer, PacingMode, GameUpdateHz);
+
+                sdl_frame_stats *FrameStats = &GlobalFrameStats;
+                FrameStats->PhaseStart = FramePacer.LastFrameEnd;
+                FrameStats->LastReport = FramePacer.LastFrameEnd;
+
+                sdl_fixed_timestep FixedTimestep = {};
+                SDLInitFixedTimestep(&FixedTimestep, SimulationHz, &FramePacer);
+
                 int DebugTimeMarkerIndex = 0;
                 sdl_debug_time_marker DebugTimeMarkers[30] = {0};
 
@@ -1334,25 +6391,56 @@ main(int argc, char *argv[])
                 real32 AudioLatencySeconds = 0;
                 bool32 SoundIsValid = false;
 
-                sdl_game_code Game = SDLLoadGameCode(SourceGameCodeDLLFullPath);
+                // NOTE: Watching before loading, so a build that lands in
+                // between isn't missed.
+                sdl_game_code_watch GameCodeWatch = {};
+                SDLInitGameCodeWatch(&GameCodeWatch, SourceGameCodeDLLFullPath);
+
+                sdl_game_code_loader GameCodeLoader = {};
+                GameCodeLoader.State = &SDLState;
+                GameCodeLoader.SourceDLLName = SourceGameCodeDLLFullPath;
+                char TempGameCodeDLLFullPath[SDL_STATE_FILE_NAME_COUNT];
+                SDLGetGameCodeTempName(&SDLState, GameCodeLoader.LoadCount,
+                                       sizeof(TempGameCodeDLLFullPath), TempGameCodeDLLFullPath);
+                sdl_game_code Game = SDLLoadGameCode(SourceGameCodeDLLFullPath, TempGameCodeDLLFullPath);
+                bool32 GameCodeWanted = false;
+
+                uint64 GameCodeCounter = SDL_GetPerformanceCounter();
+#if HANDMADE_INTERNAL
+                printf("Startup: threads %.02fms, SDL %.02fms, window %.02fms, audio %.02fms, "
+                       "game memory %.02fms, game code %.02fms (%.02fms total)\n",
+                       1000.0f*SDLGetSecondsElapsed(StartupCounter, ThreadsCounter),
+                       1000.0f*SDLGetSecondsElapsed(ThreadsCounter, SDLInitCounter),
+                       1000.0f*SDLGetSecondsElapsed(SDLInitCounter, WindowCounter),
+                       1000.0f*SDLGetSecondsElapsed(WindowCounter, AudioCounter),
+                       1000.0f*SDLGetSecondsElapsed(AudioCounter, GameMemoryCounter),
+                       1000.0f*SDLGetSecondsElapsed(GameMemoryCounter, GameCodeCounter),
+                       1000.0f*SDLGetSecondsElapsed(StartupCounter, GameCodeCounter));
+#endif
 
-                uint64 LastCycleCount = _rdtsc();
                 while(GlobalRunning)
                 {
-                    NewInput->dtForFrame = TargetSecondsPerFrame;
+                    SDLAdvanceFixedTimestep(&FixedTimestep, &FramePacer, NewInput,
+                                            TargetSecondsPerFrame);
 
-                    NewInput->ExecutableReloaded = false;
-                    time_t NewDLLWriteTime = SDLGetLastWriteTime(SourceGameCodeDLLFullPath);
-                    if(NewDLLWriteTime != Game.DLLLastWriteTime)
+                    // NOTE: A build that lands while the last one is still
+                    // loading is loaded after it.
+                    if(SDLGameCodeChanged(&GameCodeWatch, SourceGameCodeDLLFullPath))
                     {
-                        SDLCompleteAllWork(&HighPriorityQueue);
-                        SDLCompleteAllWork(&LowPriorityQueue);
+                        GameCodeWanted = true;
+                    }
 
-                        SDLUnloadGameCode(&Game);
-                        Game = SDLLoadGameCode(SourceGameCodeDLLFullPath);
-                        NewInput->ExecutableReloaded = true;
+                    if(GameCodeWanted && !GameCodeLoader.Started)
+                    {
+                        GameCodeWanted = false;
+                        SDLBeginGameCodeLoad(&GameCodeLoader, &IOQueue);
                     }
 
+                    bool32 GameCodeReloaded =
+                        SDLFinishGameCodeLoad(&GameCodeLoader, &Game,
+                                              &HighPriorityQueue, &LowPriorityQueue);
+                    NewInput->ExecutableReloaded = GameCodeReloaded;
+
                     // TODO(casey): Zeroing macro
                     // TODO(casey): We can't zero everything because the up/down state will
                     // be wrong!!!
@@ -1518,15 +6606,38 @@ main(int argc, char *argv[])
 
                         if(SDLState.InputPlayingIndex)
                         {
-                            SDLPlayBackInput(&SDLState, NewInput);
+                            SDLPlayBackInput(&SDLState, NewInput, &Game, &Buffer,
+                                             SoundOutput.SamplesPerSecond, Samples);
                         }
 
+                        SDLMarkFramePhase(FrameStats, SDLFramePhase_Input);
+
                         if(Game.UpdateAndRender)
                         {
+                            TIMED_BLOCK(GameUpdateAndRender);
+                            uint64 UpdateStartCounter = SDL_GetPerformanceCounter();
                             Game.UpdateAndRender(&GameMemory, NewInput, &Buffer);
-                            HandleDebugCycleCounters(&GameMemory);
+
+#if HANDMADE_INTERNAL
+                            if(GameCodeReloaded)
+                            {
+                                uint64 UpdateEndCounter = SDL_GetPerformanceCounter();
+                                printf("Game code reload: load %.02fms (on IOQueue), drain %.02fms, "
+                                       "unload %.02fms, first frame %.02fms\n",
+                                       1000.0f*SDLGetSecondsElapsed(0, Game.LoadCounter),
+                                       1000.0f*SDLGetSecondsElapsed(0, GameCodeLoader.DrainCounter),
+                                       1000.0f*SDLGetSecondsElapsed(0, GameCodeLoader.UnloadCounter),
+                                       1000.0f*SDLGetSecondsElapsed(UpdateStartCounter, UpdateEndCounter));
+                            }
+#endif
                         }
 
+                        // NOTE: Sends off the reads asked for this frame and
+                        // hands back the ones that have finished.
+                        SDLPollAsyncReads();
+
+                        SDLMarkFramePhase(FrameStats, SDLFramePhase_Update);
+
                         uint64 AudioWallClock = SDLGetWallClock();
                         real32 FromBeginToAudioSeconds = SDLGetSecondsElapsed(FlipWallClock, AudioWallClock);
 
@@ -1562,6 +6673,7 @@ main(int argc, char *argv[])
                         SoundBuffer.Samples = Samples;
                         if(Game.GetSoundSamples)
                         {
+                            TIMED_BLOCK(GameGetSoundSamples);
                             Game.GetSoundSamples(&GameMemory, &SoundBuffer);
                         }
 
@@ -1586,42 +6698,11 @@ main(int argc, char *argv[])
 #endif
                         SDLFillSoundBuffer(&SoundOutput, BytesToWrite, &SoundBuffer);
 
-                        uint64 WorkCounter = SDLGetWallClock();
-                        real32 WorkSecondsElapsed = SDLGetSecondsElapsed(LastCounter, WorkCounter);
-
-                        // TODO(casey): NOT TESTED YET!  PROBABLY BUGGY!!!!!
-                        real32 SecondsElapsedForFrame = WorkSecondsElapsed;
-                        if(SecondsElapsedForFrame < TargetSecondsPerFrame)
-                        {
-                            uint32 SleepMS = (uint32)(1000.0f * (TargetSecondsPerFrame -
-                                                               SecondsElapsedForFrame));
-                            if(SleepMS > 0)
-                            {
-                                SDL_Delay(SleepMS);
-                            }
-
-                            real32 TestSecondsElapsedForFrame = SDLGetSecondsElapsed(LastCounter,
-                                                                                       SDLGetWallClock());
-                            if(TestSecondsElapsedForFrame < TargetSecondsPerFrame)
-                            {
-                                // TODO(casey): LOG MISSED SLEEP HERE
-                            }
+                        SDLMarkFramePhase(FrameStats, SDLFramePhase_Audio);
 
-                            while(SecondsElapsedForFrame < TargetSecondsPerFrame)
-                            {
-                                SecondsElapsedForFrame = SDLGetSecondsElapsed(LastCounter,
-                                                                                SDLGetWallClock());
-                            }
-                        }
-                        else
-                        {
-                            // TODO(casey): MISSED FRAME RATE!
-                            // TODO(casey): Logging
-                        }
+                        SDLWaitForFrameDeadline(&FramePacer);
 
-                        uint64 EndCounter = SDLGetWallClock();
-                        real32 MSPerFrame = 1000.0f*SDLGetSecondsElapsed(LastCounter, EndCounter);
-                        LastCounter = EndCounter;
+                        SDLMarkFramePhase(FrameStats, SDLFramePhase_Sleep);
 
 #if 0
                         // TODO(casey): Note, current is wrong on the zero'th index
@@ -1631,26 +6712,33 @@ main(int argc, char *argv[])
 
                         sdl_window_dimension Dimension = SDLGetWindowDimension(Window);
                         SDLDisplayBufferInWindow(&GlobalBackbuffer, Renderer,
-                                                   Dimension.Width, Dimension.Height);
+                                                   Dimension.Width, Dimension.Height,
+                                                   FrameStats);
 
                         FlipWallClock = SDLGetWallClock();
+                        uint64 LastFrameEnd = FramePacer.LastFrameEnd;
+                        SDLEndFrame(&FramePacer);
+                        bool32 FrameStatsReported =
+                            SDLEndFrameStats(FrameStats, &FramePacer, LastFrameEnd);
+
+#if HANDMADE_INTERNAL
+                        if(GlobalDebugTable)
+                        {
+                            SDLCollateDebugTable(&GlobalDebugState, GlobalDebugTable, GameCodeReloaded);
+                        }
+                        if(FrameStatsReported && GlobalDebugTable)
+                        {
+                            SDLPrintDebugBlocks(&GlobalDebugState, GlobalDebugTable);
+                        }
+#else
+                        (void)FrameStatsReported;
+#endif
 
                         game_input *Temp = NewInput;
                         NewInput = OldInput;
                         OldInput = Temp;
                         // TODO(casey): Should I clear these here?
 
-#if 1
-                        uint64 EndCycleCount = __rdtsc();
-                        uint64 CyclesElapsed = EndCycleCount - LastCycleCount;
-                        LastCycleCount = EndCycleCount;
-
-                        real64 FPS = 0.0f;
-                        real64 MCPF = ((real64)CyclesElapsed / (1000.0f * 1000.0f));
-
-                        printf("%.02fms/f,  %.02ff/s,  %.02fmc/f\n", MSPerFrame, FPS, MCPF);
-#endif
-
 #if HANDMADE_INTERNAL
                         ++DebugTimeMarkerIndex;
                         if(DebugTimeMarkerIndex == ArrayCount(DebugTimeMarkers))
@@ -1660,6 +6748,27 @@ main(int argc, char *argv[])
 #endif
                     }
                 }
+
+                // NOTE: Let the input and any loop snapshot still being
+                // written reach the disk, so the two match.
+                if(SDLState.InputRecordingIndex)
+                {
+                    SDLEndRecordingInput(&SDLState);
+                }
+                SDLFinishReplayStateWrites(&SDLState);
+                SDLFinishSavedGameWrites();
+
+                HandleDebugArenaReport(&GameMemory);
+                SDLReportPageUsage(&SDLState);
+
+                // NOTE: Unloading deletes the temp copies.
+                while(GameCodeLoader.Started &&
+                      !SDLFinishGameCodeLoad(&GameCodeLoader, &Game,
+                                             &HighPriorityQueue, &LowPriorityQueue))
+                {
+                    SDL_Delay(1);
+                }
+                SDLUnloadGameCode(&Game);
             }
             else
             {
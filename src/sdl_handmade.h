@@ -2,10 +2,29 @@
 
 #include <SDL.h>
 
+enum sdl_huge_page_mode
+{
+    SDLHugePages_None,
+    SDLHugePages_Transparent,
+    SDLHugePages_Explicit2MB,
+    SDLHugePages_Explicit1GB,
+};
+
+struct sdl_memory_mapping
+{
+    void *Base;
+    memory_index Size;
+
+    // NOTE: What we actually got, which may be less than what was asked for.
+    sdl_huge_page_mode HugePages;
+    memory_index PageSize;
+};
+
 struct sdl_offscreen_buffer
 {
     // NOTE(casey): Pixels are alwasy 32-bits wide, Memory Order BB GG RR XX
     SDL_Texture *Texture;
+    sdl_memory_mapping Mapping;
     void *Memory;
     int Width;
     int Height;
@@ -38,38 +57,533 @@ struct sdl_debug_time_marker
     uint32_t ExpectedBytesUntilFlip;
 };
 
+// NOTE: With vsync pacing, SDL_RenderPresent blocks until the flip and that
+// is what sets the frame rate; the pacer only watches for missed frames.
+// With timer pacing, frames end on absolute deadlines FrameNanoseconds apart,
+// so a late wake on one frame doesn't push back every frame after it. The
+// pacer sleeps (clock_nanosleep, TIMER_ABSTIME) until SpinMargin before the
+// deadline and spins out the rest. SpinMargin follows how late the sleeps
+// actually wake: it jumps up to twice any wake-up that was later than it
+// would have allowed for and decays slowly back down otherwise.
+#define SDL_PACER_MIN_SPIN_NANOSECONDS 50000
+#define SDL_PACER_MAX_SPIN_NANOSECONDS 4000000
+enum sdl_pacing_mode
+{
+    SDLPacing_Timer,
+    SDLPacing_VSync,
+};
+
+struct sdl_frame_pacer
+{
+    sdl_pacing_mode Mode;
+    uint64 FrameNanoseconds;
+    uint64 NextDeadline;
+    uint64 SpinMargin;
+
+    uint64 LastFrameEnd;
+    bool32 MissedThisFrame;
+    uint32 FrameIndex;
+    uint32 MissedFrameCount;
+};
+
+// NOTE: With HANDMADE_SIMULATION_HZ set, the simulation steps at that fixed
+// rate and frames render at the display rate, taking as many steps as the
+// time since the last frame covers. Frame intervals within SnapNanoseconds
+// of the frame period count as exactly one period, so vsync jitter doesn't
+// make the step count alternate. A frame never takes more than
+// SDL_MAX_SIM_STEPS_PER_FRAME steps; time beyond that is dropped, so a slow
+// frame can't make the next one slower still.
+#define SDL_MAX_SIM_STEPS_PER_FRAME 4
+struct sdl_fixed_timestep
+{
+    bool32 Enabled;
+    uint64 StepNanoseconds;
+    uint64 FrameNanoseconds;
+    uint64 SnapNanoseconds;
+
+    uint64 LastFrameEnd;
+    uint64 Accumulated;
+    uint64 DroppedNanoseconds;
+};
+
+// NOTE: How long each part of the last SDL_FRAME_STATS_COUNT frames took,
+// kept in memory and only summarized (percentiles per phase plus missed
+// frames) when asked for or every SDL_FRAME_STATS_REPORT_SECONDS, so the
+// reporting doesn't land in the frames it measures. With vsync pacing the
+// wait for the flip shows up under Present rather than Sleep.
+#define SDL_FRAME_STATS_COUNT 512
+#define SDL_FRAME_STATS_REPORT_SECONDS 10
+enum sdl_frame_phase
+{
+    SDLFramePhase_Input,
+    SDLFramePhase_Update,
+    SDLFramePhase_Audio,
+    SDLFramePhase_Sleep,
+    SDLFramePhase_Upload,
+    SDLFramePhase_Present,
+
+    SDLFramePhase_Count,
+};
+
+struct sdl_frame_timing
+{
+    uint32 PhaseNanoseconds[SDLFramePhase_Count];
+    uint32 FrameNanoseconds;
+    bool32 Missed;
+};
+
+struct sdl_frame_stats
+{
+    uint64 PhaseStart;
+    uint64 LastReport;
+    bool32 ReportRequested;
+
+    uint32 FrameCount;
+    sdl_frame_timing Frames[SDL_FRAME_STATS_COUNT];
+
+    uint32 Sorted[SDL_FRAME_STATS_COUNT];
+};
+
+#if HANDMADE_INTERNAL
+// NOTE: TIMED_BLOCK events collated into one tree per thread per frame. A
+// node is a block at one place in the hierarchy: the same block reached
+// through two different parents is two nodes. Node 0 is where blocks go
+// once the frame's nodes have run out. Each thread's stack of open blocks
+// carries over from frame to frame, so a block is counted in the frame it
+// ends in.
+#define SDL_MAX_DEBUG_NODE_COUNT 4096
+#define SDL_MAX_DEBUG_BLOCK_DEPTH 64
+struct sdl_debug_node
+{
+    char *FileName;
+    char *BlockName;
+    u32 LineNumber;
+    u32 HitCount;
+    u64 TotalCycles;
+    u64 ChildCycles;
+
+    u32 FirstChild;
+    u32 NextSibling;
+};
+
+struct sdl_debug_open_block
+{
+    u64 Clock;
+    char *FileName;
+    char *BlockName;
+    u32 LineNumber;
+
+    // NOTE: Only valid when NodeCollation is the current collation.
+    u32 NodeIndex;
+    u32 NodeCollation;
+};
+
+struct sdl_debug_thread
+{
+    u32 Depth;
+    u32 SkippedDepth;
+    sdl_debug_open_block Stack[SDL_MAX_DEBUG_BLOCK_DEPTH];
+
+    // NOTE: The array that was swapped out last frame, collated this frame.
+    u32 PendingArrayIndex;
+    u32 PendingEventCount;
+
+    u32 RootNode;
+    u32 EventCount;
+    u32 DroppedEventCount;
+};
+
+struct sdl_debug_state
+{
+    u32 CollationIndex;
+    u32 DiscardCount;
+
+    u64 LastCollationClock;
+    u64 PendingFrameCycles;
+    u64 FrameCycles;
+
+    u32 NodeCount;
+    sdl_debug_node Nodes[SDL_MAX_DEBUG_NODE_COUNT];
+
+    sdl_debug_thread Threads[MAX_DEBUG_THREAD_COUNT];
+};
+#endif
+
+#define SDL_STATE_FILE_NAME_COUNT 4096
+
 struct sdl_game_code
 {
     void* GameCodeDLL;
-    time_t DLLLastWriteTime;
+    uint64 DLLLastWriteTime;
+
+    // NOTE: The copy of the library that is actually loaded, deleted again
+    // on unload.
+    char TempDLLName[SDL_STATE_FILE_NAME_COUNT];
 
     // IMPORTANT(casey): Either of the callbacks can be 0!  You must
     // check before calling.
     game_update_and_render *UpdateAndRender;
     game_get_sound_samples *GetSoundSamples;
+    game_get_api_version *GetAPIVersion;
 
     bool IsValid;
+    uint64 LoadCounter;
+};
+
+// NOTE: Every entry point the platform layer looks up in the game library.
+// A missing Required one makes the library invalid.
+struct sdl_game_code_symbol
+{
+    char *Name;
+    memory_index Offset;
+    bool32 Required;
+};
+
+// NOTE: A new library is copied and loaded on IOQueue while the old one keeps
+// running, and only swapped in, between frames, once it has loaded and
+// checked out.
+struct sdl_game_code_loader
+{
+    struct sdl_state *State;
+    char *SourceDLLName;
+    uint32 LoadCount;
+
+    bool32 Started;
+    bool32 volatile Loading;
+    sdl_game_code Loaded;
+
+    uint64 DrainCounter;
+    uint64 UnloadCounter;
+};
+
+// NOTE: How the game loop notices a new handmade.so: an inotify watch on its
+// directory, drained without blocking once a frame, or a stat of the library
+// every frame if inotify isn't available (Handle is -1).
+#define SDL_GAME_CODE_SETTLE_MS 50
+struct sdl_game_code_watch
+{
+    int Handle;
+    char *FileName;
+
+    bool32 Changed;
+    uint64 LastEventCounter;
+    uint64 LastWriteTime;
+};
+
+enum sdl_dirty_page_tracking
+{
+    SDLDirtyTracking_None,
+    SDLDirtyTracking_WriteProtect,
+    SDLDirtyTracking_SoftDirty,
+};
+
+struct sdl_page_run
+{
+    uint32 FirstPage;
+    uint32 OnePastLastPage;
+};
+
+// NOTE: Finds the pages of a mapping written since the last reset, either
+// with asynchronous userfaultfd write-protection read back through
+// PAGEMAP_SCAN (Linux 6.7+), or with the kernel's soft-dirty bits.
+struct sdl_dirty_page_tracker
+{
+    sdl_dirty_page_tracking Mode;
+
+    uint8 *Base;
+    memory_index Size;
+    memory_index PageSize;
+    uint32 PageCount;
+
+    int PagemapHandle;
+    int ClearRefsHandle;
+    int UserfaultHandle;
+
+    void *Scratch;
+    memory_index ScratchSize;
+
+    uint32 MaxDirtyRunCount;
+    uint32 DirtyRunCount;
+    sdl_page_run *DirtyRuns;
+};
+
+// NOTE: On-disk loop snapshot (loop_edit_N_state.hmi). The replayable game
+// memory is cut into blocks of SDL_REPLAY_STATE_PAGES_PER_BLOCK pages; each
+// block with anything in it is stored as a sdl_replay_state_block followed by
+// its non-zero pages, LZ compressed unless that didn't make them smaller.
+// All-zero pages and blocks aren't stored at all. A block with BlockIndex
+// SDL_REPLAY_STATE_END ends the file, so a truncated file is detectable.
+#define SDL_REPLAY_STATE_CODE(a, b, c, d) (((uint32)(a) << 0) | ((uint32)(b) << 8) | ((uint32)(c) << 16) | ((uint32)(d) << 24))
+#define SDL_REPLAY_STATE_MAGIC_VALUE SDL_REPLAY_STATE_CODE('h','m','r','s')
+#define SDL_REPLAY_STATE_VERSION 1
+#define SDL_REPLAY_STATE_PAGE_SIZE 4096
+#define SDL_REPLAY_STATE_PAGES_PER_BLOCK 16
+#define SDL_REPLAY_STATE_BLOCK_SIZE (SDL_REPLAY_STATE_PAGE_SIZE*SDL_REPLAY_STATE_PAGES_PER_BLOCK)
+#define SDL_REPLAY_STATE_END 0xFFFFFFFF
+
+struct sdl_replay_state_header
+{
+    uint32 MagicValue;
+    uint32 Version;
+    uint64 ReplayableSize;
+};
+
+enum sdl_replay_state_block_flag
+{
+    SDLReplayStateBlock_Compressed = 0x1,
+};
+
+struct sdl_replay_state_block
+{
+    uint32 BlockIndex;
+    uint16 PageMask;
+    uint16 Flags;
+    uint32 DataSize;
+};
+
+// NOTE: Saved game (<name>.hhs). After the header come RegionCount uint64
+// region sizes, then the regions' bytes back to back, TotalSize in all, cut
+// into SDL_SAVED_GAME_BLOCK_SIZE blocks. Each block is a
+// sdl_saved_game_block and its data, LZ compressed unless that didn't make
+// it smaller. Only the last block is short, so a truncated file is
+// detectable.
+#define SDL_SAVED_GAME_MAGIC_VALUE SDL_REPLAY_STATE_CODE('h','h','s','g')
+#define SDL_SAVED_GAME_VERSION 1
+#define SDL_SAVED_GAME_BLOCK_SIZE Kilobytes(64)
+#define SDL_MAX_PENDING_SAVES 4
+
+struct sdl_saved_game_header
+{
+    uint32 MagicValue;
+    uint32 Version;
+    uint32 RegionCount;
+    uint32 Reserved;
+    uint64 TotalSize;
+};
+
+enum sdl_saved_game_block_flag
+{
+    SDLSavedGameBlock_Compressed = 0x1,
+};
+
+struct sdl_saved_game_block
+{
+    uint32 Flags;
+    uint32 DataSize;
+};
+
+// NOTE: One queued save: the snapshot of the regions, copied on the frame
+// loop, and where it goes.
+struct sdl_saved_game_write
+{
+    char FileName[SDL_STATE_FILE_NAME_COUNT];
+    uint32 RegionCount;
+    uint64 TotalSize;
+    uint64 *RegionSizes;
+    uint8 *Snapshot;
+};
+
+// NOTE: Recorded input (loop_edit_N_input.hmi). After the header, each
+// frame's game_input is stored as a delta against the frame before it (the
+// first against all zeroes), taken a 32-bit word at a time: a varint count
+// of changed words, then per changed word a varint of how many unchanged
+// words to skip to it and a varint of the new word XOR the old one. A frame
+// where nothing changed is a single zero byte.
+#define SDL_INPUT_STREAM_MAGIC_VALUE SDL_REPLAY_STATE_CODE('h','m','i','s')
+#define SDL_INPUT_STREAM_VERSION 1
+#define SDL_INPUT_STREAM_WORD_COUNT (sizeof(game_input) / sizeof(uint32))
+#define SDL_MAX_ENCODED_INPUT_SIZE (5 + 10*SDL_INPUT_STREAM_WORD_COUNT)
+
+struct sdl_input_stream_header
+{
+    uint32 MagicValue;
+    uint32 Version;
+    uint32 InputSize;
+    uint32 FrameCount;
+};
+
+// NOTE: Recording appends encoded frames to one chunk of a ring; a full
+// chunk is handed to InputWriteQueue and written at its own file offset, so
+// the frame loop itself never makes a system call.
+#define SDL_INPUT_CHUNK_SIZE Kilobytes(32)
+#define SDL_INPUT_CHUNK_COUNT 8
+struct sdl_input_chunk
+{
+    struct sdl_input_recorder *Recorder;
+    uint64 FileOffset;
+    uint32 Used;
+    bool32 volatile Pending;
+    uint8 *Data;
+};
+
+// NOTE: Keyframes (loop_edit_N_keys.hmi) let playback reach any frame of a
+// loop without running it all from the start. After the file header, about
+// every SDL_KEYFRAME_INTERVAL frames of recording there is a
+// sdl_keyframe_header followed by every page of replayable memory that
+// differs from the keyframe before it (or from the loop snapshot, for the
+// first), stored as blocks exactly like the state file's - except that
+// PageMask means "stored", so zero pages are stored too - and ended by an
+// SDL_REPLAY_STATE_END block. The state at a keyframe is the snapshot with
+// every keyframe up to and including it laid over it in order.
+//
+// A keyframe that is due waits for a frame where the game's work queues are
+// already idle, and only drains them itself once it has waited
+// SDL_MAX_KEYFRAME_WAIT frames.
+//
+// A recording stops taking keyframes after SDL_MAX_KEYFRAME_COUNT of them,
+// or once the file reaches SDL_MAX_KEYFRAME_FILE_SIZE; seeks past the last
+// one run the game from there.
+#define SDL_KEYFRAME_MAGIC_VALUE SDL_REPLAY_STATE_CODE('h','m','i','k')
+#define SDL_KEYFRAME_VERSION 2
+#define SDL_KEYFRAME_INTERVAL 120
+#define SDL_MAX_KEYFRAME_WAIT 30
+#define SDL_MAX_KEYFRAME_COUNT 256
+#define SDL_MAX_KEYFRAME_FILE_SIZE Gigabytes(1)
+
+struct sdl_keyframe_file_header
+{
+    uint32 MagicValue;
+    uint32 Version;
+    uint32 InputSize;
+    uint32 Reserved;
+    uint64 ReplayableSize;
+};
+
+struct sdl_keyframe_header
+{
+    // NOTE: The state just before frame FrameIndex runs. InputOffset is
+    // where that frame starts in the input stream, and LastInput is the
+    // frame before it, which its delta is against. DataSize is the size of
+    // the blocks that follow, the end block included.
+    uint32 FrameIndex;
+    uint32 PageCount;
+    uint64 InputOffset;
+    uint64 DataSize;
+    game_input LastInput;
+};
+
+// NOTE: The changed pages are copied into the recorder's shadow of
+// replayable memory on the frame loop, and compressed and written from there
+// on ReplayWriteQueue. Runs are in state file pages.
+struct sdl_keyframe_capture
+{
+    struct sdl_state *State;
+    sdl_keyframe_header Header;
+
+    uint32 RunCount;
+    uint32 MaxRunCount;
+    sdl_page_run *Runs;
+};
+
+struct sdl_input_recorder
+{
+    int Handle;
+    bool32 volatile WriteFailed;
+    uint32 FrameCount;
+    uint64 FileOffset;
+
+    uint32 ChunkIndex;
+    sdl_input_chunk Chunks[SDL_INPUT_CHUNK_COUNT];
+
+    game_input LastInput;
+
+    int KeyframeHandle;
+    uint32 NextKeyframeFrame;
+    bool32 volatile KeyframePending;
+    sdl_keyframe_capture Keyframe;
+
+    // NOTE: What replayable memory held at the last keyframe, for the pages
+    // any keyframe has stored so far; KeyframeShadowPages has a bit for each
+    // of those. Once a keyframe fails to write, the ones after it would have
+    // nothing to build on, so there are no more.
+    memory_index KeyframeShadowSize;
+    uint8 *KeyframeShadow;
+    uint8 *KeyframeShadowPages;
+    uint32 KeyframeCount;
+    uint64 volatile KeyframeFileSize;
+    bool32 volatile KeyframeWriteFailed;
+};
+
+struct sdl_input_player
+{
+    uint8 *Base;
+    memory_index Size;
+
+    uint8 *FirstFrame;
+    uint8 *At;
+
+    game_input LastInput;
+
+    uint32 FrameIndex;
+    uint32 FrameCount;
+
+    // NOTE: Playback goes back to LoopStartFrame at the end of the stream.
+    // A seek is requested from the event loop and done before the next
+    // frame, since it has to run the game.
+    uint32 LoopStartFrame;
+    bool32 SeekRequested;
+    uint32 SeekFrame;
+
+    uint8 *KeyframeBase;
+    memory_index KeyframeSize;
+    uint32 KeyframeCount;
+    uint8 **Keyframes;
+    uint8 *Scratch;
 };
 
-#define SDL_STATE_FILE_NAME_COUNT 4096
 struct sdl_replay_buffer
 {
-    int FileHandle;
     void* MemoryMap;
     char FileName[SDL_STATE_FILE_NAME_COUNT];
     void *MemoryBlock;
+
+    // NOTE: With copy-on-write snapshots, the memfd holding this slot's
+    // snapshot, or -1.
+    int SnapshotHandle;
+    bool32 HasSnapshot;
+
+    // NOTE: The snapshot is written to FileName in the background. It must
+    // not change while WriteQueued; WriteCancelled makes the writer stop.
+    struct sdl_state *State;
+    bool32 WriteQueued;
+    bool32 volatile WriteCancelled;
 };
 
 struct sdl_state
 {
     uint64_t TotalSize;
+    uint64_t ReplayableSize;
     void *GameMemoryBlock;
+    game_memory *GameMemory;
+    sdl_memory_mapping GameMemoryMapping;
+
+    int TLBMissCounter;
     sdl_replay_buffer ReplayBuffers[4];
 
-    int RecordingHandle;
+    // NOTE: The replay buffer that matched the game memory block when dirty
+    // tracking was last reset, or 0. Only that buffer can be brought up to
+    // date (or restored from) by copying just the dirty pages.
+    sdl_dirty_page_tracker DirtyPageTracker;
+    int SyncedReplayIndex;
+
+    // NOTE: With copy-on-write snapshots the replayable part of game memory
+    // is a memfd mapping. Until the first snapshot it is a shared mapping of
+    // GameMemoryHandle; after that it is a private mapping of the snapshot
+    // of slot MappedSnapshotIndex, and only the pages the game has written
+    // since are private copies.
+    bool32 CopyOnWriteSnapshots;
+    int GameMemoryHandle;
+    int MappedSnapshotIndex;
+    uint32 MaxChangedRunCount;
+    sdl_page_run *ChangedRuns;
+
+    platform_work_queue *ReplayWriteQueue;
+    platform_work_queue *InputWriteQueue;
+
+    sdl_input_recorder InputRecorder;
     int InputRecordingIndex;
 
-    int PlaybackHandle;
+    sdl_input_player InputPlayer;
     int InputPlayingIndex;
 
     char EXEFileName[SDL_STATE_FILE_NAME_COUNT];
@@ -0,0 +1,619 @@
+/* NOTE: Packs loose art and sound into an .hha asset pack (see
+   handmade_file_formats.h).
+
+     test_asset_builder <output.hha> <manifest>
+
+   The manifest has one asset per line:
+
+     <type id> bitmap <file.bmp> [align=<x>,<y>] [<tag id>=<value> ...]
+     <type id> sound <file.wav> [<tag id>=<value> ...]
+     <type id> data <file> [<tag id>=<value> ...]
+
+   Blank lines and lines starting with # are skipped. Relative file names are
+   relative to the working directory. Bitmaps must be uncompressed 24 or
+   32-bit BMPs, sounds 16-bit PCM WAVs. Assets keep their manifest order
+   within a type.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "handmade_platform.h"
+#include "handmade_file_formats.h"
+
+#pragma pack(push, 1)
+struct bitmap_header
+{
+    u16 FileType;
+    u32 FileSize;
+    u16 Reserved1;
+    u16 Reserved2;
+    u32 BitmapOffset;
+    u32 Size;
+    s32 Width;
+    s32 Height;
+    u16 Planes;
+    u16 BitsPerPixel;
+    u32 Compression;
+    u32 SizeOfBitmap;
+    s32 HorzResolution;
+    s32 VertResolution;
+    u32 ColorsUsed;
+    u32 ColorsImportant;
+
+    u32 RedMask;
+    u32 GreenMask;
+    u32 BlueMask;
+};
+
+struct riff_chunk
+{
+    u32 ID;
+    u32 Size;
+};
+
+struct wave_fmt
+{
+    u16 wFormatTag;
+    u16 nChannels;
+    u32 nSamplesPerSec;
+    u32 nAvgBytesPerSec;
+    u16 nBlockAlign;
+    u16 wBitsPerSample;
+};
+#pragma pack(pop)
+
+#define RIFF_CODE(a, b, c, d) HHA_CODE(a, b, c, d)
+
+struct entire_file
+{
+    u64 ContentsSize;
+    void *Contents;
+};
+
+struct asset_source
+{
+    u32 TypeID;
+    u32 Kind;
+    char *FileName;
+    r32 AlignPercentage[2];
+
+    u32 FirstTagIndex;
+    u32 OnePastLastTagIndex;
+};
+
+struct asset_builder
+{
+    u32 TagCount;
+    u32 MaxTagCount;
+    hha_tag *Tags;
+
+    u32 SourceCount;
+    u32 MaxSourceCount;
+    asset_source *Sources;
+};
+
+static entire_file
+ReadEntireFile(char *FileName)
+{
+    entire_file Result = {};
+
+    FILE *In = fopen(FileName, "rb");
+    if(In)
+    {
+        fseeko(In, 0, SEEK_END);
+        Result.ContentsSize = ftello(In);
+        fseeko(In, 0, SEEK_SET);
+
+        Result.Contents = malloc(Result.ContentsSize ? Result.ContentsSize : 1);
+        if(Result.Contents &&
+           (fread(Result.Contents, 1, Result.ContentsSize, In) != Result.ContentsSize))
+        {
+            free(Result.Contents);
+            Result.Contents = 0;
+            Result.ContentsSize = 0;
+        }
+
+        fclose(In);
+    }
+
+    if(!Result.Contents)
+    {
+        fprintf(stderr, "ERROR: Unable to read %s.\n", FileName);
+    }
+
+    return(Result);
+}
+
+static u32
+ShiftForMask(u32 Mask)
+{
+    u32 Result = 0;
+    if(Mask)
+    {
+        while(!(Mask & 1))
+        {
+            Mask >>= 1;
+            ++Result;
+        }
+    }
+    return(Result);
+}
+
+static void *
+LoadBMP(char *FileName, hha_bitmap *Bitmap, u64 *DataSize)
+{
+    // NOTE: Converted to BB GG RR AA, bottom row first, which is what the
+    // pack stores.
+    u32 *Result = 0;
+
+    // NOTE: The file header is 14 bytes and the info header says how big it
+    // is itself: 40 bytes for the plain BITMAPINFOHEADER most tools write,
+    // more for the later versions. With BI_BITFIELDS and a 40-byte header,
+    // the three masks follow it, right where the later headers have them.
+    entire_file File = ReadEntireFile(FileName);
+    bitmap_header *Header = (bitmap_header *)File.Contents;
+    u64 FileHeaderSize = 14;
+    u64 InfoHeaderSize = 0;
+    if(File.Contents && (File.ContentsSize >= (FileHeaderSize + sizeof(Header->Size))))
+    {
+        InfoHeaderSize = Header->Size;
+    }
+    u64 HeaderSize = FileHeaderSize + InfoHeaderSize;
+    if(File.Contents && (InfoHeaderSize >= 40) &&
+       (File.ContentsSize >= HeaderSize) &&
+       ((Header->Compression != 3) || (File.ContentsSize >= sizeof(bitmap_header))) &&
+       (Header->FileType == 0x4D42) &&
+       ((Header->BitsPerPixel == 24) || (Header->BitsPerPixel == 32)) &&
+       ((Header->Compression == 0) || ((Header->Compression == 3) && (Header->BitsPerPixel == 32))))
+    {
+        u32 Width = (Header->Width < 0) ? -Header->Width : Header->Width;
+        u32 Height = (Header->Height < 0) ? -Header->Height : Header->Height;
+        b32 TopDown = (Header->Height < 0);
+
+        u32 BytesPerPixel = Header->BitsPerPixel / 8;
+        u64 SourcePitch = Align4((u64)Width*BytesPerPixel);
+        if((Header->BitmapOffset + SourcePitch*Height) <= File.ContentsSize)
+        {
+            u32 RedMask = 0x00FF0000;
+            u32 GreenMask = 0x0000FF00;
+            u32 BlueMask = 0x000000FF;
+            u32 AlphaMask = 0;
+            if(Header->Compression == 3)
+            {
+                RedMask = Header->RedMask;
+                GreenMask = Header->GreenMask;
+                BlueMask = Header->BlueMask;
+                AlphaMask = ~(RedMask | GreenMask | BlueMask);
+            }
+
+            u32 RedShift = ShiftForMask(RedMask);
+            u32 GreenShift = ShiftForMask(GreenMask);
+            u32 BlueShift = ShiftForMask(BlueMask);
+            u32 AlphaShift = ShiftForMask(AlphaMask);
+
+            *DataSize = (u64)Width*Height*sizeof(u32);
+            Result = (u32 *)malloc(*DataSize ? *DataSize : 1);
+            if(Result)
+            {
+                u32 *Dest = Result;
+                for(u32 Y = 0;
+                    Y < Height;
+                    ++Y)
+                {
+                    u32 SourceY = TopDown ? (Height - 1 - Y) : Y;
+                    u8 *Source = ((u8 *)File.Contents + Header->BitmapOffset +
+                                  SourceY*SourcePitch);
+                    for(u32 X = 0;
+                        X < Width;
+                        ++X)
+                    {
+                        u32 C = 0;
+                        for(u32 ByteIndex = 0;
+                            ByteIndex < BytesPerPixel;
+                            ++ByteIndex)
+                        {
+                            C |= (u32)Source[ByteIndex] << (8*ByteIndex);
+                        }
+                        Source += BytesPerPixel;
+
+                        u32 R = (C & RedMask) >> RedShift;
+                        u32 G = (C & GreenMask) >> GreenShift;
+                        u32 B = (C & BlueMask) >> BlueShift;
+                        u32 A = AlphaMask ? ((C & AlphaMask) >> AlphaShift) : 0xFF;
+                        *Dest++ = ((A & 0xFF) << 24) | ((R & 0xFF) << 16) | ((G & 0xFF) << 8) | (B & 0xFF);
+                    }
+                }
+
+                Bitmap->Dim[0] = Width;
+                Bitmap->Dim[1] = Height;
+            }
+        }
+    }
+
+    if(File.Contents && !Result)
+    {
+        fprintf(stderr, "ERROR: %s is not an uncompressed 24 or 32-bit BMP.\n", FileName);
+    }
+
+    free(File.Contents);
+    return(Result);
+}
+
+static void *
+LoadWAV(char *FileName, hha_sound *Sound, u64 *DataSize)
+{
+    void *Result = 0;
+
+    entire_file File = ReadEntireFile(FileName);
+    u8 *At = (u8 *)File.Contents;
+    u8 *End = At + File.ContentsSize;
+    if(File.Contents && (File.ContentsSize >= 12) &&
+       (((riff_chunk *)At)->ID == RIFF_CODE('R','I','F','F')) &&
+       (*(u32 *)(At + 8) == RIFF_CODE('W','A','V','E')))
+    {
+        wave_fmt *Format = 0;
+        u8 *SampleData = 0;
+        u32 SampleDataSize = 0;
+
+        At += 12;
+        while((At + sizeof(riff_chunk)) <= End)
+        {
+            riff_chunk *Chunk = (riff_chunk *)At;
+            u8 *ChunkData = At + sizeof(riff_chunk);
+            if(Chunk->Size > (u64)(End - ChunkData))
+            {
+                break;
+            }
+
+            if((Chunk->ID == RIFF_CODE('f','m','t',' ')) && (Chunk->Size >= sizeof(wave_fmt)))
+            {
+                Format = (wave_fmt *)ChunkData;
+            }
+            else if(Chunk->ID == RIFF_CODE('d','a','t','a'))
+            {
+                SampleData = ChunkData;
+                SampleDataSize = Chunk->Size;
+            }
+
+            At = ChunkData + ((Chunk->Size + 1) & ~1);
+        }
+
+        if(Format && SampleData &&
+           (Format->wFormatTag == 1) &&
+           (Format->wBitsPerSample == 16) &&
+           Format->nChannels)
+        {
+            Sound->ChannelCount = Format->nChannels;
+            Sound->SampleCount = SampleDataSize / (Format->nChannels*sizeof(s16));
+            *DataSize = (u64)Sound->SampleCount*Sound->ChannelCount*sizeof(s16);
+
+            Result = malloc(*DataSize ? *DataSize : 1);
+            if(Result)
+            {
+                memcpy(Result, SampleData, *DataSize);
+            }
+        }
+    }
+
+    if(File.Contents && !Result)
+    {
+        fprintf(stderr, "ERROR: %s is not a 16-bit PCM WAV.\n", FileName);
+    }
+
+    free(File.Contents);
+    return(Result);
+}
+
+static char *
+NextWord(char **At)
+{
+    char *Result = 0;
+
+    char *Scan = *At;
+    while((*Scan == ' ') || (*Scan == '\t') || (*Scan == '\r') || (*Scan == '\n'))
+    {
+        ++Scan;
+    }
+
+    if(*Scan)
+    {
+        Result = Scan;
+        while(*Scan && !((*Scan == ' ') || (*Scan == '\t') || (*Scan == '\r') || (*Scan == '\n')))
+        {
+            ++Scan;
+        }
+
+        if(*Scan)
+        {
+            *Scan++ = 0;
+        }
+    }
+
+    *At = Scan;
+    return(Result);
+}
+
+static b32
+AddTag(asset_builder *Builder, u32 ID, r32 Value)
+{
+    b32 Result = (ID < HHA_TAG_ID_COUNT);
+    if(Result)
+    {
+        if(Builder->TagCount == Builder->MaxTagCount)
+        {
+            Builder->MaxTagCount = Builder->MaxTagCount ? 2*Builder->MaxTagCount : 256;
+            Builder->Tags = (hha_tag *)realloc(Builder->Tags, Builder->MaxTagCount*sizeof(hha_tag));
+        }
+
+        hha_tag *Tag = Builder->Tags + Builder->TagCount++;
+        Tag->ID = ID;
+        Tag->Value = Value;
+    }
+
+    return(Result);
+}
+
+static b32
+ParseManifest(asset_builder *Builder, char *ManifestFileName)
+{
+    b32 Result = true;
+
+    FILE *In = fopen(ManifestFileName, "r");
+    if(In)
+    {
+        char Line[4096];
+        u32 LineNumber = 0;
+        while(Result && fgets(Line, sizeof(Line), In))
+        {
+            ++LineNumber;
+
+            char *At = Line;
+            char *TypeWord = NextWord(&At);
+            if(!TypeWord || (TypeWord[0] == '#'))
+            {
+                continue;
+            }
+
+            char *KindWord = NextWord(&At);
+            char *FileWord = NextWord(&At);
+
+            asset_source Source = {};
+            Source.TypeID = (u32)atoi(TypeWord);
+            Source.AlignPercentage[0] = 0.5f;
+            Source.AlignPercentage[1] = 0.5f;
+            if(KindWord && (strcmp(KindWord, "bitmap") == 0))
+            {
+                Source.Kind = HHAAsset_Bitmap;
+            }
+            else if(KindWord && (strcmp(KindWord, "sound") == 0))
+            {
+                Source.Kind = HHAAsset_Sound;
+            }
+            else if(KindWord && (strcmp(KindWord, "data") == 0))
+            {
+                Source.Kind = HHAAsset_Data;
+            }
+
+            if(!Source.Kind || !FileWord || !Source.TypeID || (Source.TypeID >= HHA_TYPE_ID_COUNT))
+            {
+                fprintf(stderr, "ERROR: %s(%u): expected <type id 1-%u> <bitmap|sound|data> <file>\n",
+                        ManifestFileName, LineNumber, HHA_TYPE_ID_COUNT - 1);
+                Result = false;
+                break;
+            }
+
+            Source.FileName = strdup(FileWord);
+            Source.FirstTagIndex = Builder->TagCount;
+
+            char *Word;
+            while(Result && (Word = NextWord(&At)))
+            {
+                char *Equals = strchr(Word, '=');
+                if(Equals && (strncmp(Word, "align=", 6) == 0))
+                {
+                    Result = (sscanf(Equals + 1, "%f,%f", &Source.AlignPercentage[0],
+                                     &Source.AlignPercentage[1]) == 2);
+                }
+                else if(Equals)
+                {
+                    Result = AddTag(Builder, (u32)atoi(Word), (r32)atof(Equals + 1));
+                }
+                else
+                {
+                    Result = false;
+                }
+
+                if(!Result)
+                {
+                    fprintf(stderr, "ERROR: %s(%u): bad option \"%s\" (tag ids go up to %u)\n",
+                            ManifestFileName, LineNumber, Word, HHA_TAG_ID_COUNT - 1);
+                }
+            }
+            Source.OnePastLastTagIndex = Builder->TagCount;
+
+            if(Builder->SourceCount == Builder->MaxSourceCount)
+            {
+                Builder->MaxSourceCount = Builder->MaxSourceCount ? 2*Builder->MaxSourceCount : 256;
+                Builder->Sources = (asset_source *)realloc(Builder->Sources,
+                                                           Builder->MaxSourceCount*sizeof(asset_source));
+            }
+            Builder->Sources[Builder->SourceCount++] = Source;
+        }
+
+        fclose(In);
+    }
+    else
+    {
+        fprintf(stderr, "ERROR: Unable to open manifest %s.\n", ManifestFileName);
+        Result = false;
+    }
+
+    return(Result);
+}
+
+static b32
+WriteHHA(asset_builder *Builder, char *OutFileName)
+{
+    b32 Result = false;
+
+    // NOTE: Assets are grouped by type, keeping manifest order within a
+    // type, with the null asset first.
+    u32 AssetCount = Builder->SourceCount + 1;
+    u32 *Order = (u32 *)malloc(AssetCount*sizeof(u32));
+    hha_asset *Assets = (hha_asset *)calloc(AssetCount, sizeof(hha_asset));
+    hha_asset_type *AssetTypes = (hha_asset_type *)calloc(HHA_TYPE_ID_COUNT, sizeof(hha_asset_type));
+
+    u32 AssetTypeCount = 0;
+    u32 AssetIndex = 1;
+    for(u32 TypeID = 1;
+        TypeID < HHA_TYPE_ID_COUNT;
+        ++TypeID)
+    {
+        hha_asset_type *Type = AssetTypes + AssetTypeCount;
+        Type->TypeID = TypeID;
+        Type->FirstAssetIndex = AssetIndex;
+        for(u32 SourceIndex = 0;
+            SourceIndex < Builder->SourceCount;
+            ++SourceIndex)
+        {
+            if(Builder->Sources[SourceIndex].TypeID == TypeID)
+            {
+                Order[AssetIndex++] = SourceIndex;
+            }
+        }
+        Type->OnePastLastAssetIndex = AssetIndex;
+
+        if(Type->OnePastLastAssetIndex > Type->FirstAssetIndex)
+        {
+            ++AssetTypeCount;
+        }
+    }
+
+    hha_header Header = {};
+    Header.MagicValue = HHA_MAGIC_VALUE;
+    Header.Version = HHA_VERSION;
+    Header.TagCount = Builder->TagCount;
+    Header.AssetTypeCount = AssetTypeCount;
+    Header.AssetCount = AssetCount;
+
+    u64 TagArraySize = Header.TagCount*sizeof(hha_tag);
+    u64 AssetTypeArraySize = Header.AssetTypeCount*sizeof(hha_asset_type);
+    u64 AssetArraySize = Header.AssetCount*sizeof(hha_asset);
+
+    Header.Tags = sizeof(Header);
+    Header.AssetTypes = Header.Tags + TagArraySize;
+    Header.Assets = Header.AssetTypes + AssetTypeArraySize;
+
+    FILE *Out = fopen(OutFileName, "wb");
+    if(Out && Order && Assets && AssetTypes)
+    {
+        Result = true;
+
+        // NOTE: Payloads first, after where the index will go, so the
+        // assets' offsets are known by the time the index is written.
+        u64 At = Header.Assets + AssetArraySize;
+        for(AssetIndex = 1;
+            Result && (AssetIndex < AssetCount);
+            ++AssetIndex)
+        {
+            asset_source *Source = Builder->Sources + Order[AssetIndex];
+            hha_asset *Dest = Assets + AssetIndex;
+            Dest->FirstTagIndex = Source->FirstTagIndex;
+            Dest->OnePastLastTagIndex = Source->OnePastLastTagIndex;
+            Dest->Kind = Source->Kind;
+
+            void *Data = 0;
+            switch(Source->Kind)
+            {
+                case HHAAsset_Bitmap:
+                {
+                    Dest->Bitmap.AlignPercentage[0] = Source->AlignPercentage[0];
+                    Dest->Bitmap.AlignPercentage[1] = Source->AlignPercentage[1];
+                    Data = LoadBMP(Source->FileName, &Dest->Bitmap, &Dest->DataSize);
+                } break;
+
+                case HHAAsset_Sound:
+                {
+                    Data = LoadWAV(Source->FileName, &Dest->Sound, &Dest->DataSize);
+                } break;
+
+                case HHAAsset_Data:
+                {
+                    entire_file File = ReadEntireFile(Source->FileName);
+                    Data = File.Contents;
+                    Dest->DataSize = File.ContentsSize;
+                } break;
+
+                InvalidDefaultCase;
+            }
+
+            At = AlignPow2(At, (u64)HHA_DATA_ALIGNMENT);
+            Dest->DataOffset = At;
+
+            Result = (Data &&
+                      (fseeko(Out, At, SEEK_SET) == 0) &&
+                      (fwrite(Data, 1, Dest->DataSize, Out) == Dest->DataSize));
+            At += Dest->DataSize;
+
+            free(Data);
+        }
+
+        Result = (Result &&
+                  (fseeko(Out, 0, SEEK_SET) == 0) &&
+                  (fwrite(&Header, sizeof(Header), 1, Out) == 1) &&
+                  (fwrite(Builder->Tags, 1, TagArraySize, Out) == TagArraySize) &&
+                  (fwrite(AssetTypes, 1, AssetTypeArraySize, Out) == AssetTypeArraySize) &&
+                  (fwrite(Assets, 1, AssetArraySize, Out) == AssetArraySize));
+
+        if(fclose(Out) != 0)
+        {
+            Result = false;
+        }
+
+        if(Result)
+        {
+            printf("%s: %u assets of %u types, %u tags, %llu bytes\n",
+                   OutFileName, AssetCount - 1, AssetTypeCount, Header.TagCount,
+                   (unsigned long long)At);
+        }
+        else
+        {
+            fprintf(stderr, "ERROR: Unable to write %s.\n", OutFileName);
+            remove(OutFileName);
+        }
+    }
+    else
+    {
+        fprintf(stderr, "ERROR: Unable to open %s.\n", OutFileName);
+    }
+
+    free(AssetTypes);
+    free(Assets);
+    free(Order);
+
+    return(Result);
+}
+
+int
+main(int ArgCount, char **Args)
+{
+    int Result = 1;
+
+    if(ArgCount == 3)
+    {
+        asset_builder Builder = {};
+        if(ParseManifest(&Builder, Args[2]) &&
+           WriteHHA(&Builder, Args[1]))
+        {
+            Result = 0;
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Usage: %s <output.hha> <manifest>\n", Args[0]);
+    }
+
+    return(Result);
+}
@@ -0,0 +1,177 @@
+/* NOTE: Checks that AllocateGameAssets only takes in .hha packs whose index
+   is what handmade_file_formats.h says it is, using packs built in memory
+   and a platform that reads from them.
+
+     test_asset_index
+
+   Prints what failed and returns non-zero if anything did.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "handmade_platform.h"
+#include "handmade_memory.h"
+#include "handmade_file_formats.h"
+#include "handmade_asset.h"
+
+#if HANDMADE_INTERNAL
+debug_table *GlobalDebugTable;
+#endif
+
+struct test_pack
+{
+    u64 Size;
+    u8 Contents[4096];
+};
+
+static test_pack *OpenPack;
+static u32 FileErrorCount;
+static u32 FailureCount;
+
+static PLATFORM_GET_ALL_FILE_OF_TYPE_BEGIN(TestGetAllFilesOfTypeBegin)
+{
+    platform_file_group Result = {};
+    Result.FileCount = 1;
+    return(Result);
+}
+
+static PLATFORM_GET_ALL_FILE_OF_TYPE_END(TestGetAllFilesOfTypeEnd)
+{
+}
+
+static PLATFORM_OPEN_FILE(TestOpenNextFile)
+{
+    platform_file_handle Result = {};
+    Result.NoErrors = true;
+    Result.Platform = OpenPack;
+    Result.Size = OpenPack->Size;
+    return(Result);
+}
+
+static PLATFORM_CLOSE_FILE(TestCloseFile)
+{
+    Handle->Platform = 0;
+    Handle->NoErrors = false;
+}
+
+static PLATFORM_FILE_ERROR(TestFileError)
+{
+    ++FileErrorCount;
+    Handle->NoErrors = false;
+}
+
+static PLATFORM_READ_DATA_FROM_FILE(TestReadDataFromFile)
+{
+    test_pack *Pack = (test_pack *)Source->Platform;
+    if(PlatformNoFileErrors(Source) && Pack &&
+       (Offset <= Pack->Size) && (Size <= (Pack->Size - Offset)))
+    {
+        memcpy(Dest, Pack->Contents + Offset, Size);
+    }
+    else
+    {
+        Source->NoErrors = false;
+    }
+}
+
+static void
+Check(b32 Condition, char const *What)
+{
+    if(!Condition)
+    {
+        printf("FAILED: %s\n", What);
+        ++FailureCount;
+    }
+}
+
+static void
+MakePack(test_pack *Pack, u32 AssetTypeCount, hha_asset_type *AssetTypes, u32 AssetCount)
+{
+    // NOTE: One tag, the types, then AssetCount empty assets, the first of
+    // them the null asset.
+    memset(Pack, 0, sizeof(*Pack));
+
+    hha_header Header = {};
+    Header.MagicValue = HHA_MAGIC_VALUE;
+    Header.Version = HHA_VERSION;
+    Header.TagCount = 1;
+    Header.AssetTypeCount = AssetTypeCount;
+    Header.AssetCount = AssetCount;
+    Header.Tags = sizeof(hha_header);
+    Header.AssetTypes = Header.Tags + Header.TagCount*sizeof(hha_tag);
+    Header.Assets = Header.AssetTypes + AssetTypeCount*sizeof(hha_asset_type);
+
+    Pack->Size = Header.Assets + AssetCount*sizeof(hha_asset);
+    Assert(Pack->Size <= sizeof(Pack->Contents));
+    memcpy(Pack->Contents, &Header, sizeof(Header));
+    memcpy(Pack->Contents + Header.AssetTypes, AssetTypes, AssetTypeCount*sizeof(hha_asset_type));
+}
+
+static u32
+LoadPackAssetCount(test_pack *Pack)
+{
+    // NOTE: The asset count AllocateGameAssets ends up with, null asset
+    // included, so 1 means the pack was turned away.
+    platform_api Platform = {};
+    Platform.GetAllFilesOfTypeBegin = TestGetAllFilesOfTypeBegin;
+    Platform.GetAllFilesOfTypeEnd = TestGetAllFilesOfTypeEnd;
+    Platform.OpenNextFile = TestOpenNextFile;
+    Platform.CloseFile = TestCloseFile;
+    Platform.ReadDataFromFile = TestReadDataFromFile;
+    Platform.FileError = TestFileError;
+
+    static u8 ArenaMemory[Megabytes(1)];
+    memory_arena Arena;
+    InitializeArena(&Arena, sizeof(ArenaMemory), ArenaMemory);
+
+    OpenPack = Pack;
+    FileErrorCount = 0;
+    game_assets *Assets = AllocateGameAssets(&Arena, Kilobytes(64), &Platform, 0);
+
+    u32 Result = Assets->AssetCount;
+    return(Result);
+}
+
+int
+main(int ArgCount, char **Args)
+{
+    static test_pack Pack;
+
+    hha_asset_type Good[] = {{1, 1, 3}, {4, 3, 6}};
+    MakePack(&Pack, ArrayCount(Good), Good, 6);
+    Check(LoadPackAssetCount(&Pack) == 6, "a pack with sorted, disjoint type ranges loads");
+    Check(FileErrorCount == 0, "a good pack reports no error");
+
+    hha_asset_type Overlapping[] = {{1, 1, 5}, {4, 2, 6}};
+    MakePack(&Pack, ArrayCount(Overlapping), Overlapping, 6);
+    Check(LoadPackAssetCount(&Pack) == 1, "a pack with overlapping type ranges is turned away");
+    Check(FileErrorCount == 1, "a pack with overlapping type ranges reports an error");
+
+    hha_asset_type SameType[] = {{2, 1, 4}, {2, 1, 4}};
+    MakePack(&Pack, ArrayCount(SameType), SameType, 4);
+    Check(LoadPackAssetCount(&Pack) == 1, "a pack listing a TypeID twice is turned away");
+
+    hha_asset_type Unsorted[] = {{4, 1, 3}, {1, 3, 6}};
+    MakePack(&Pack, ArrayCount(Unsorted), Unsorted, 6);
+    Check(LoadPackAssetCount(&Pack) == 1, "a pack with types out of TypeID order is turned away");
+
+    MakePack(&Pack, ArrayCount(Good), Good, 6);
+    ((hha_header *)Pack.Contents)->AssetTypeCount = 0x10000000;
+    Check(LoadPackAssetCount(&Pack) == 1, "a pack with more asset types than it has room for is turned away");
+
+    MakePack(&Pack, ArrayCount(Good), Good, 6);
+    ((hha_header *)Pack.Contents)->TagCount = 0x10000000;
+    Check(LoadPackAssetCount(&Pack) == 1, "a pack with more tags than it has room for is turned away");
+
+    MakePack(&Pack, ArrayCount(Good), Good, 6);
+    Pack.Size -= sizeof(hha_asset);
+    Check(LoadPackAssetCount(&Pack) == 1, "a pack cut off inside its assets is turned away");
+
+    if(!FailureCount)
+    {
+        printf("test_asset_index: all passed\n");
+    }
+
+    return(FailureCount ? 1 : 0);
+}
@@ -0,0 +1,129 @@
+/* NOTE: Checks the asset prefetch scheduler's deadlines against a platform
+   whose reads complete only when the test says so.
+
+     test_asset_prefetch
+
+   Prints what failed and returns non-zero if anything did.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "handmade_platform.h"
+#include "handmade_memory.h"
+#include "handmade_file_formats.h"
+#include "handmade_asset.h"
+
+#if HANDMADE_INTERNAL
+debug_table *GlobalDebugTable;
+#endif
+
+struct test_pending_read
+{
+    platform_work_queue_callback *Callback;
+    void *Data;
+};
+
+static u32 PendingReadCount;
+static test_pending_read PendingReads[MAX_PREFETCH_READS];
+static u32 FailureCount;
+
+static PLATFORM_GET_ALL_FILE_OF_TYPE_BEGIN(TestGetAllFilesOfTypeBegin)
+{
+    platform_file_group Result = {};
+    return(Result);
+}
+
+static PLATFORM_GET_ALL_FILE_OF_TYPE_END(TestGetAllFilesOfTypeEnd)
+{
+}
+
+static PLATFORM_READ_SEGMENTS_FROM_FILE_ASYNC(TestReadSegmentsFromFileAsync)
+{
+    Assert(PendingReadCount < ArrayCount(PendingReads));
+    test_pending_read *Read = PendingReads + PendingReadCount++;
+    Read->Callback = Callback;
+    Read->Data = Data;
+}
+
+static void
+CompletePendingReads(void)
+{
+    for(u32 ReadIndex = 0;
+        ReadIndex < PendingReadCount;
+        ++ReadIndex)
+    {
+        PendingReads[ReadIndex].Callback(0, PendingReads[ReadIndex].Data);
+    }
+    PendingReadCount = 0;
+}
+
+static void
+Check(b32 Condition, char const *What)
+{
+    if(!Condition)
+    {
+        printf("FAILED: %s\n", What);
+        ++FailureCount;
+    }
+}
+
+int
+main(int ArgCount, char **Args)
+{
+    platform_api Platform = {};
+    Platform.GetAllFilesOfTypeBegin = TestGetAllFilesOfTypeBegin;
+    Platform.GetAllFilesOfTypeEnd = TestGetAllFilesOfTypeEnd;
+    Platform.ReadSegmentsFromFileAsync = TestReadSegmentsFromFileAsync;
+
+    static u8 ArenaMemory[Megabytes(4)];
+    memory_arena Arena;
+    InitializeArena(&Arena, sizeof(ArenaMemory), ArenaMemory);
+    game_assets *Assets = AllocateGameAssets(&Arena, Megabytes(1), &Platform, 0);
+
+    // NOTE: Three assets far apart in one pack, so each gets a read of its own.
+    asset_file File = {};
+    File.Handle.NoErrors = true;
+    asset TestAssets[4] = {};
+    for(u32 AssetIndex = 1;
+        AssetIndex < ArrayCount(TestAssets);
+        ++AssetIndex)
+    {
+        TestAssets[AssetIndex].File = &File;
+        TestAssets[AssetIndex].HHA.DataOffset = AssetIndex*Megabytes(1);
+        TestAssets[AssetIndex].HHA.DataSize = Kilobytes(4);
+    }
+    Assets->Assets = TestAssets;
+    Assets->AssetCount = ArrayCount(TestAssets);
+
+    // NOTE: Wanted this frame, and in before the frame after it starts.
+    PrefetchAsset(Assets, 1, 0, 0);
+    RunAssetPrefetch(Assets);
+    Check(PendingReadCount == 1, "a request for this frame is read this frame");
+    CompletePendingReads();
+    Check(Assets->OnTimeLoadCount == 1, "a load landing in the frame it was needed by is on time");
+    Check(Assets->LateLoadCount == 0, "a load landing in the frame it was needed by is not late");
+
+    // NOTE: Wanted this frame, but only in once the next frame has run.
+    PrefetchAsset(Assets, 2, 0, 0);
+    RunAssetPrefetch(Assets);
+    RunAssetPrefetch(Assets);
+    CompletePendingReads();
+    Check(Assets->LateLoadCount == 1, "a load landing a frame after it was needed is late");
+
+    // NOTE: Wanted two frames out; nothing has passed by the next run.
+    PrefetchAsset(Assets, 3, 0, 2);
+    RunAssetPrefetch(Assets);
+    RunAssetPrefetch(Assets);
+    Check(Assets->PrefetchCancelCount == 0, "a request isn't dropped before its deadline");
+    CompletePendingReads();
+    Check(Assets->OnTimeLoadCount == 2, "a load landing before its deadline is on time");
+    Check(TestAssets[3].State == AssetState_Loaded, "a prefetched asset ends up loaded");
+
+    if(!FailureCount)
+    {
+        printf("test_asset_prefetch: all passed\n");
+    }
+
+    return(FailureCount ? 1 : 0);
+}
@@ -0,0 +1,185 @@
+/* NOTE: Checks test_asset_builder's BMP loading against files written out
+   byte by byte, the way the usual tools lay them out.
+
+     test_bmp_loader
+
+   Writes test_bmp_loader.bmp in the working directory and deletes it when
+   done. Prints what failed and returns non-zero if anything did.
+*/
+
+#define main AssetBuilderMain
+#include "test_asset_builder.cpp"
+#undef main
+
+static u32 FailureCount;
+
+static void
+Check(b32 Condition, char const *What)
+{
+    if(!Condition)
+    {
+        printf("FAILED: %s\n", What);
+        ++FailureCount;
+    }
+}
+
+static u8 *
+PutU16(u8 *At, u16 Value)
+{
+    *At++ = (u8)Value;
+    *At++ = (u8)(Value >> 8);
+    return(At);
+}
+
+static u8 *
+PutU32(u8 *At, u32 Value)
+{
+    At = PutU16(At, (u16)Value);
+    At = PutU16(At, (u16)(Value >> 16));
+    return(At);
+}
+
+static u64
+MakeBMP(u8 *Dest, u32 Width, u32 Height, u32 BitsPerPixel, u32 Compression, u32 *Masks,
+        u32 PixelSize, u8 *Pixels)
+{
+    // NOTE: A 14-byte file header and a 40-byte BITMAPINFOHEADER, then the
+    // masks if there are any, then the pixels, bottom row first.
+    u32 MaskSize = Masks ? 3*sizeof(u32) : 0;
+    u32 BitmapOffset = 14 + 40 + MaskSize;
+    u32 FileSize = BitmapOffset + PixelSize;
+
+    u8 *At = Dest;
+    At = PutU16(At, 0x4D42);
+    At = PutU32(At, FileSize);
+    At = PutU32(At, 0);
+    At = PutU32(At, BitmapOffset);
+
+    At = PutU32(At, 40);
+    At = PutU32(At, Width);
+    At = PutU32(At, Height);
+    At = PutU16(At, 1);
+    At = PutU16(At, (u16)BitsPerPixel);
+    At = PutU32(At, Compression);
+    At = PutU32(At, PixelSize);
+    At = PutU32(At, 2835);
+    At = PutU32(At, 2835);
+    At = PutU32(At, 0);
+    At = PutU32(At, 0);
+
+    for(u32 MaskIndex = 0;
+        Masks && (MaskIndex < 3);
+        ++MaskIndex)
+    {
+        At = PutU32(At, Masks[MaskIndex]);
+    }
+
+    memcpy(At, Pixels, PixelSize);
+    At += PixelSize;
+
+    return(At - Dest);
+}
+
+static b32
+WriteTestFile(char *FileName, u8 *Contents, u64 Size)
+{
+    b32 Result = false;
+
+    FILE *Out = fopen(FileName, "wb");
+    if(Out)
+    {
+        Result = (fwrite(Contents, 1, Size, Out) == Size);
+        fclose(Out);
+    }
+
+    return(Result);
+}
+
+int
+main(int ArgCount, char **Args)
+{
+    char *FileName = (char *)"test_bmp_loader.bmp";
+    u8 Contents[256];
+
+    // NOTE: One padded 24-bit texel: the whole file is shorter than
+    // bitmap_header, masks and all.
+    u8 Pixel24[] = {0x01, 0x02, 0x03, 0x00};
+    u64 Size = MakeBMP(Contents, 1, 1, 24, 0, 0, sizeof(Pixel24), Pixel24);
+    Check(Size < sizeof(bitmap_header), "the 1x1 file is shorter than bitmap_header");
+    Check(WriteTestFile(FileName, Contents, Size), "the 1x1 file was written");
+    {
+        hha_bitmap Bitmap = {};
+        u64 DataSize = 0;
+        u32 *Texels = (u32 *)LoadBMP(FileName, &Bitmap, &DataSize);
+        Check(Texels != 0, "a 1x1 24-bit BMP with a 54-byte header loads");
+        if(Texels)
+        {
+            Check((Bitmap.Dim[0] == 1) && (Bitmap.Dim[1] == 1), "it is 1x1");
+            Check(Texels[0] == 0xFF030201, "its texel comes out opaque, blue first");
+        }
+        free(Texels);
+    }
+
+    // NOTE: 24-bit rows are padded to 4 bytes: blue, green / red, white.
+    u8 Pixels24[] =
+    {
+        0xFF, 0x00, 0x00,  0x00, 0xFF, 0x00,  0x00, 0x00,
+        0x00, 0x00, 0xFF,  0xFF, 0xFF, 0xFF,  0x00, 0x00,
+    };
+    Size = MakeBMP(Contents, 2, 2, 24, 0, 0, sizeof(Pixels24), Pixels24);
+    Check(Size == (54 + sizeof(Pixels24)), "the 24-bit file has a 54-byte header");
+    Check(WriteTestFile(FileName, Contents, Size), "the 24-bit file was written");
+    {
+        hha_bitmap Bitmap = {};
+        u64 DataSize = 0;
+        u32 *Texels = (u32 *)LoadBMP(FileName, &Bitmap, &DataSize);
+        Check(Texels != 0, "a 2x2 24-bit BMP with a 54-byte header loads");
+        if(Texels)
+        {
+            Check((Bitmap.Dim[0] == 2) && (Bitmap.Dim[1] == 2), "it is 2x2");
+            Check(DataSize == 4*sizeof(u32), "it is 4 texels");
+            Check((Texels[0] == 0xFF0000FF) && (Texels[1] == 0xFF00FF00) &&
+                  (Texels[2] == 0xFFFF0000) && (Texels[3] == 0xFFFFFFFF),
+                  "its texels come out BB GG RR AA, bottom row first");
+        }
+        free(Texels);
+    }
+
+    // NOTE: Cut off inside the info header.
+    Check(WriteTestFile(FileName, Contents, 50), "the cut off file was written");
+    {
+        hha_bitmap Bitmap = {};
+        u64 DataSize = 0;
+        void *Texels = LoadBMP(FileName, &Bitmap, &DataSize);
+        Check(Texels == 0, "a BMP cut off inside its header doesn't load");
+        free(Texels);
+    }
+
+    // NOTE: BI_BITFIELDS with a 40-byte header, so the masks follow it.
+    u32 Masks[] = {0x000000FF, 0x0000FF00, 0x00FF0000};
+    u32 Pixels32[] = {0x80000001, 0x80000200, 0x80030000, 0x80040506};
+    Size = MakeBMP(Contents, 2, 2, 32, 3, Masks, sizeof(Pixels32), (u8 *)Pixels32);
+    Check(WriteTestFile(FileName, Contents, Size), "the 32-bit file was written");
+    {
+        hha_bitmap Bitmap = {};
+        u64 DataSize = 0;
+        u32 *Texels = (u32 *)LoadBMP(FileName, &Bitmap, &DataSize);
+        Check(Texels != 0, "a 32-bit BI_BITFIELDS BMP with a 40-byte info header loads");
+        if(Texels)
+        {
+            Check((Texels[0] == 0x80010000) && (Texels[1] == 0x80000200) &&
+                  (Texels[2] == 0x80000003) && (Texels[3] == 0x80060504),
+                  "its masks are the ones after the header");
+        }
+        free(Texels);
+    }
+
+    remove(FileName);
+
+    if(!FailureCount)
+    {
+        printf("test_bmp_loader: all passed\n");
+    }
+
+    return(FailureCount ? 1 : 0);
+}
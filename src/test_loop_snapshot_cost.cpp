@@ -0,0 +1,119 @@
+/* NOTE: Times copy-on-write loop snapshots against a plain copy of the same
+   memory, for replayable game memory of the given size.
+
+     test_loop_snapshot_cost [megabytes]
+
+   Defaults to 256MB. Touches all of it, takes the first snapshot, writes
+   4096 scattered pages and times the restore, then writes them again and
+   times a re-snapshot of the same slot. Builds the SDL platform layer, so
+   it needs the SDL headers and library, and enough RAM for the memory plus
+   the copy (the copy is skipped above 1GB).
+*/
+
+#define main SDLMain
+#include "sdl_handmade.cpp"
+#undef main
+
+static real64
+GetMillisecondsSince(uint64 StartCounter)
+{
+    real64 Result = (1000.0*(real64)(SDL_GetPerformanceCounter() - StartCounter) /
+                     (real64)GlobalPerfCountFrequency);
+    return(Result);
+}
+
+static void
+WriteScatteredPages(sdl_state *State, uint32 Stride, uint8 Value)
+{
+    uint8 *Memory = (uint8 *)State->GameMemoryBlock;
+    uint64 PageCount = State->ReplayableSize / 4096;
+    for(uint32 PageIndex = 0;
+        PageIndex < 4096;
+        ++PageIndex)
+    {
+        Memory[(((uint64)PageIndex*Stride) % PageCount)*4096] = Value;
+    }
+}
+
+int
+main(int ArgCount, char **Args)
+{
+    GlobalPerfCountFrequency = SDL_GetPerformanceFrequency();
+
+    uint64 SizeInMegabytes = (ArgCount > 1) ? strtoull(Args[1], 0, 10) : 256;
+    if(!SizeInMegabytes)
+    {
+        printf("usage: test_loop_snapshot_cost [megabytes]\n");
+        return(1);
+    }
+
+    // NOTE: The part of SDLInitGameMemory that loop snapshots care about,
+    // at the size asked for. No work queues, so there is nothing to drain.
+    static game_memory GameMemory = {};
+    static sdl_state State = {};
+    State.ReplayableSize = Megabytes(SizeInMegabytes);
+    State.TotalSize = State.ReplayableSize;
+    State.GameMemory = &GameMemory;
+    State.GameMemoryMapping = SDLMapMemory((void *)Terabytes(2), State.TotalSize, GlobalHugePageMode);
+    State.GameMemoryBlock = State.GameMemoryMapping.Base;
+    for(int ReplayIndex = 1;
+        ReplayIndex < ArrayCount(State.ReplayBuffers);
+        ++ReplayIndex)
+    {
+        State.ReplayBuffers[ReplayIndex].SnapshotHandle = -1;
+    }
+
+    if(!State.GameMemoryBlock)
+    {
+        printf("Could not map %luMB of game memory\n", SizeInMegabytes);
+        return(1);
+    }
+
+    SDLInitCopyOnWriteSnapshots(&State);
+    if(!State.CopyOnWriteSnapshots)
+    {
+        printf("Copy-on-write snapshots are unavailable here\n");
+        return(1);
+    }
+
+    memset(State.GameMemoryBlock, 7, State.ReplayableSize);
+
+    memory_index BytesCopied = 0;
+    uint64 StartCounter = SDL_GetPerformanceCounter();
+    bool32 Snapshotted = SDLTakeSnapshot(&State, 1, &BytesCopied);
+    real64 FirstSnapshotMS = GetMillisecondsSince(StartCounter);
+
+    WriteScatteredPages(&State, 7919, 1);
+    StartCounter = SDL_GetPerformanceCounter();
+    SDLRestoreSnapshot(&State, 1);
+    real64 RestoreMS = GetMillisecondsSince(StartCounter);
+
+    WriteScatteredPages(&State, 104729, 2);
+    StartCounter = SDL_GetPerformanceCounter();
+    Snapshotted = SDLTakeSnapshot(&State, 1, &BytesCopied) && Snapshotted;
+    real64 ResnapshotMS = GetMillisecondsSince(StartCounter);
+
+    printf("%luMB: first snapshot %.02fms, restore %.02fms, re-snapshot %.02fms (%lu bytes)",
+           SizeInMegabytes, FirstSnapshotMS, RestoreMS, ResnapshotMS, (uint64)BytesCopied);
+
+    if(State.ReplayableSize <= Gigabytes(1))
+    {
+        uint8 *Copy = (uint8 *)malloc(State.ReplayableSize);
+        if(Copy)
+        {
+            memset(Copy, 1, State.ReplayableSize);
+            StartCounter = SDL_GetPerformanceCounter();
+            memcpy(Copy, State.GameMemoryBlock, State.ReplayableSize);
+            printf(", memcpy %.02fms", GetMillisecondsSince(StartCounter));
+            free(Copy);
+        }
+    }
+    printf("\n");
+
+    if(!Snapshotted)
+    {
+        printf("A snapshot failed\n");
+    }
+
+    return(Snapshotted ? 0 : 1);
+}
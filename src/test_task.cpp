@@ -0,0 +1,186 @@
+/* NOTE: Checks that tasks run, suspend on reads and hand their frames back,
+   on a work queue and file reads that only move when the test says so.
+
+     test_task
+
+   Prints what failed and returns non-zero if anything did.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "handmade_platform.h"
+#include "handmade_memory.h"
+#include "handmade_task.h"
+
+#if HANDMADE_INTERNAL
+debug_table *GlobalDebugTable;
+#endif
+
+struct test_entry
+{
+    platform_work_queue_callback *Callback;
+    void *Data;
+};
+
+struct test_pending_read
+{
+    platform_work_queue *Queue;
+    u64 Offset;
+    u64 Size;
+    void *Dest;
+    test_entry Completion;
+};
+
+static u32 EntryCount;
+static test_entry Entries[16];
+static u32 PendingReadCount;
+static test_pending_read PendingReads[16];
+static u8 FileContents[64];
+static u32 FailureCount;
+
+static void
+TestAddEntry(platform_work_queue *Queue, platform_work_queue_callback *Callback, void *Data)
+{
+    Assert(EntryCount < ArrayCount(Entries));
+    test_entry *Entry = Entries + EntryCount++;
+    Entry->Callback = Callback;
+    Entry->Data = Data;
+}
+
+static PLATFORM_READ_DATA_FROM_FILE_ASYNC(TestReadDataFromFileAsync)
+{
+    Assert(PendingReadCount < ArrayCount(PendingReads));
+    test_pending_read *Read = PendingReads + PendingReadCount++;
+    Read->Queue = Queue;
+    Read->Offset = Offset;
+    Read->Size = Size;
+    Read->Dest = Dest;
+    Read->Completion.Callback = Callback;
+    Read->Completion.Data = Data;
+}
+
+static void
+RunQueuedWork(void)
+{
+    // NOTE: In the order it was added, including whatever the work adds.
+    for(u32 EntryIndex = 0;
+        EntryIndex < EntryCount;
+        ++EntryIndex)
+    {
+        Entries[EntryIndex].Callback(0, Entries[EntryIndex].Data);
+    }
+    EntryCount = 0;
+}
+
+static void
+CompletePendingReads(void)
+{
+    for(u32 ReadIndex = 0;
+        ReadIndex < PendingReadCount;
+        ++ReadIndex)
+    {
+        test_pending_read *Read = PendingReads + ReadIndex;
+        memcpy(Read->Dest, FileContents + Read->Offset, Read->Size);
+        TestAddEntry(Read->Queue, Read->Completion.Callback, Read->Completion.Data);
+    }
+    PendingReadCount = 0;
+}
+
+static void
+Check(b32 Condition, char const *What)
+{
+    if(!Condition)
+    {
+        printf("FAILED: %s\n", What);
+        ++FailureCount;
+    }
+}
+
+struct test_task_result
+{
+    b32 ChildRan;
+    b32 ReadOK;
+    u32 Value;
+    b32 Done;
+};
+
+static task
+ReadValueTask(task_context *Context, platform_file_handle *File, test_task_result *Result)
+{
+    Result->ReadOK = co_await TaskReadDataFromFile(Context, File, 8, sizeof(Result->Value), &Result->Value);
+}
+
+static task
+ParentTask(task_context *Context, platform_file_handle *File, test_task_result *Result)
+{
+    Result->ChildRan = co_await ReadValueTask(Context, File, Result);
+    Result->Done = true;
+}
+
+int
+main(int ArgCount, char **Args)
+{
+    platform_api Platform = {};
+    Platform.AddEntry = TestAddEntry;
+    Platform.ReadDataFromFileAsync = TestReadDataFromFileAsync;
+
+    u32 Value = 0x12345678;
+    memcpy(FileContents + 8, &Value, sizeof(Value));
+    platform_file_handle File = {};
+    File.NoErrors = true;
+    File.Size = sizeof(FileContents);
+
+    static u8 FrameMemory[4*Kilobytes(4)];
+    task_frame_arena FrameArena;
+    InitializeTaskFrameArena(&FrameArena, sizeof(FrameMemory), FrameMemory, Kilobytes(4));
+
+    task_context Context = {};
+    Context.Platform = &Platform;
+    Context.FrameArena = &FrameArena;
+
+    // NOTE: A parent awaiting a child that awaits a read.
+    test_task_result Result = {};
+    Check(StartTask(&Context, ParentTask(&Context, &File, &Result)), "a task with room for its frame starts");
+    Check(!Result.Done && (EntryCount == 1), "a started task waits for its queue");
+
+    RunQueuedWork();
+    Check(PendingReadCount == 1, "the child's read is handed to the platform");
+    Check((EntryCount == 0) && !Result.Done, "the worker is given back while the read is in flight");
+    Check(FrameArena.BlocksInUse == 2, "the parent and child each have a frame while suspended");
+
+    CompletePendingReads();
+    RunQueuedWork();
+    Check(Result.ChildRan && Result.ReadOK, "the child ran and its read succeeded");
+    Check(Result.Value == 0x12345678, "the child read the right bytes");
+    Check(Result.Done, "the parent continued once the child was done");
+    Check(FrameArena.BlocksInUse == 0, "every frame comes back once the tasks are done");
+    Check(FrameArena.MaxBlocksInUse == 2, "no more than two frames were ever in use");
+
+    // NOTE: One block, taken by the first task, so nothing else gets a frame.
+    static u8 OneFrameMemory[Kilobytes(4)];
+    task_frame_arena OneFrameArena;
+    InitializeTaskFrameArena(&OneFrameArena, sizeof(OneFrameMemory), OneFrameMemory, Kilobytes(4));
+    Context.FrameArena = &OneFrameArena;
+
+    test_task_result FirstResult = {};
+    test_task_result SecondResult = {};
+    task First = ParentTask(&Context, &File, &FirstResult);
+    task Second = ParentTask(&Context, &File, &SecondResult);
+    Check((First.Handle != 0) && (Second.Handle == 0), "a full frame arena gives an empty task");
+    Check(!StartTask(&Context, Second), "an empty task doesn't start");
+
+    Check(StartTask(&Context, First), "the task holding the only frame starts");
+    RunQueuedWork();
+    Check(!FirstResult.ChildRan && FirstResult.Done, "awaiting a child with no frame returns false at once");
+    Check(PendingReadCount == 0, "a child with no frame never reads");
+    Check(!SecondResult.Done, "an empty task never runs");
+    Check(OneFrameArena.BlocksInUse == 0, "the only frame comes back");
+
+    if(!FailureCount)
+    {
+        printf("test_task: all passed\n");
+    }
+
+    return(FailureCount ? 1 : 0);
+}
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cstdint>
 #include <string>
 #include <windows.h>
@@ -78,7 +79,30 @@ static void Win32LoadXInput()
 #define DIRECT_SOUND_CREATE(name) HRESULT WINAPI name([[maybe_unused]] LPCGUID pcGuidDevice, [[maybe_unused]] LPDIRECTSOUND* ppDS, [[maybe_unused]] LPUNKNOWN pUnkOuter)
 typedef DIRECT_SOUND_CREATE(direct_sound_create);
 
+// NOTE: Per-phase times for the last WIN32_FRAME_STATS_COUNT frames, kept in memory and only
+// summarized as percentiles once the ring has gone all the way round, so the reporting
+// doesn't land in the frames it measures.
+#define WIN32_FRAME_STATS_COUNT 512
+enum win32_frame_phase {
+    Win32FramePhase_Input,
+    Win32FramePhase_Update,
+    Win32FramePhase_Audio,
+    Win32FramePhase_Present,
+
+    Win32FramePhase_Count,
+};
+
+struct win32_frame_stats {
+    int64_t perf_counter_frequency;
+    int64_t phase_start;
+    uint32_t frame_count;
+    uint32_t phase_microseconds[Win32FramePhase_Count][WIN32_FRAME_STATS_COUNT];
+    uint32_t frame_microseconds[WIN32_FRAME_STATS_COUNT];
+    uint32_t sorted[WIN32_FRAME_STATS_COUNT];
+};
+
 static bool GlobalRunning;
+static win32_frame_stats GlobalFrameStats;
 static win32_offscreen_buffer GlobalBackBuffer;
 static LPDIRECTSOUNDBUFFER GlobalSecondaryBuffer = { };
 
@@ -490,6 +514,65 @@ static void Win32FillSoundBuffer(win32_sound_output* sound_output, DWORD byte_to
     }
 }
 
+static uint32_t Win32GetMicrosecondsElapsed(const win32_frame_stats* stats, int64_t start, int64_t end)
+{
+    return static_cast<uint32_t>((end - start) * 1000000 / stats->perf_counter_frequency);
+}
+
+static void Win32MarkFramePhase(win32_frame_stats* stats, win32_frame_phase phase)
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+
+    uint32_t frame_index = stats->frame_count % WIN32_FRAME_STATS_COUNT;
+    stats->phase_microseconds[phase][frame_index] =
+        Win32GetMicrosecondsElapsed(stats, stats->phase_start, now.QuadPart);
+    stats->phase_start = now.QuadPart;
+}
+
+static void Win32OutputFrameTimePercentiles(win32_frame_stats* stats, const char* name, const uint32_t* times)
+{
+    std::copy(times, times + WIN32_FRAME_STATS_COUNT, stats->sorted);
+    std::sort(stats->sorted, stats->sorted + WIN32_FRAME_STATS_COUNT);
+
+    // NOTE: Nearest rank, so every value printed is one that was measured.
+    uint32_t p50 = stats->sorted[(50 * WIN32_FRAME_STATS_COUNT + 99) / 100 - 1];
+    uint32_t p90 = stats->sorted[(90 * WIN32_FRAME_STATS_COUNT + 99) / 100 - 1];
+    uint32_t p99 = stats->sorted[(99 * WIN32_FRAME_STATS_COUNT + 99) / 100 - 1];
+    uint32_t max = stats->sorted[WIN32_FRAME_STATS_COUNT - 1];
+
+    char buffer[256];
+    wsprintfA(buffer, "  %s: p50 %uus, p90 %uus, p99 %uus, max %uus\n", name, p50, p90, p99, max);
+    OutputDebugStringA(buffer);
+}
+
+static void Win32EndFrameStats(win32_frame_stats* stats, int64_t last_counter, int64_t end_counter)
+{
+    stats->frame_microseconds[stats->frame_count % WIN32_FRAME_STATS_COUNT] =
+        Win32GetMicrosecondsElapsed(stats, last_counter, end_counter);
+    ++stats->frame_count;
+
+    if ((stats->frame_count % WIN32_FRAME_STATS_COUNT) == 0)
+    {
+        const char* phase_names[Win32FramePhase_Count] = { "input", "update", "audio", "present" };
+
+        char buffer[256];
+        wsprintfA(buffer, "Frame times over the last %u frames:\n", WIN32_FRAME_STATS_COUNT);
+        OutputDebugStringA(buffer);
+        Win32OutputFrameTimePercentiles(stats, "frame", stats->frame_microseconds);
+        for (int phase = 0; phase < Win32FramePhase_Count; ++phase)
+        {
+            Win32OutputFrameTimePercentiles(stats, phase_names[phase], stats->phase_microseconds[phase]);
+        }
+
+        QueryPerformanceCounter(reinterpret_cast<LARGE_INTEGER*>(&stats->phase_start));
+    }
+    else
+    {
+        stats->phase_start = end_counter;
+    }
+}
+
 int CALLBACK WinMain(HINSTANCE hInstance,
     [[maybe_unused]] HINSTANCE hPrevInstance,
     [[maybe_unused]] LPSTR lpCmdLine,
@@ -562,7 +645,10 @@ int CALLBACK WinMain(HINSTANCE hInstance,
 
             LARGE_INTEGER last_counter;
             QueryPerformanceCounter(&last_counter);
-            DWORD64 last_cycle_count = __rdtsc();
+
+            win32_frame_stats* frame_stats = &GlobalFrameStats;
+            frame_stats->perf_counter_frequency = perf_counter_frequency;
+            frame_stats->phase_start = last_counter.QuadPart;
 
             while (GlobalRunning)
             {
@@ -622,6 +708,8 @@ int CALLBACK WinMain(HINSTANCE hInstance,
                     }
                 }
 
+                Win32MarkFramePhase(frame_stats, Win32FramePhase_Input);
+
                 DWORD byte_to_lock = 0;
                 DWORD target_cursor = 0;
                 DWORD bytes_to_write = 0;
@@ -664,33 +752,25 @@ int CALLBACK WinMain(HINSTANCE hInstance,
                 Buffer.pitch = GlobalBackBuffer.Pitch;
                 GameUpdateAndRender(&Buffer, xOffset, yOffset, &sound_buffer, sound_output.tone_hz);
 
+                Win32MarkFramePhase(frame_stats, Win32FramePhase_Update);
+
                 if (sound_is_valid)
                 {
                     Win32FillSoundBuffer(&sound_output, byte_to_lock, bytes_to_write, &sound_buffer);
                 }
 
+                Win32MarkFramePhase(frame_stats, Win32FramePhase_Audio);
+
                 win32_window_dimensions dimensions = Win32GetWindowDimensions(windowHandle);
                 Win32DisplayBufferInWindow(GlobalBackBuffer, deviceContext, dimensions.Width, dimensions.Height);
 
-                uint64_t end_cycle_count = __rdtsc();
+                Win32MarkFramePhase(frame_stats, Win32FramePhase_Present);
 
                 LARGE_INTEGER end_counter;
                 QueryPerformanceCounter(&end_counter);
-
-                uint64_t cycles_elapsed = end_cycle_count - last_cycle_count;
-                int64_t counter_elapsed = end_counter.QuadPart - last_counter.QuadPart;
-                auto ms_per_frame = static_cast<float>(counter_elapsed) * 1000.0f / static_cast<
-                    float>(perf_counter_frequency);
-                float fps = 1000 / ms_per_frame;
-                auto mega_cycles_per_frame = static_cast<float>(cycles_elapsed) / (1000.0f *
-                    1000.0f);
-                char buffer[256];
-                wsprintf(buffer, "ms/frame: %f (FPS: %f, Mega Cycles: %f)\n", ms_per_frame, fps,
-                         mega_cycles_per_frame);
-                OutputDebugStringA(buffer);
+                Win32EndFrameStats(frame_stats, last_counter.QuadPart, end_counter.QuadPart);
 
                 last_counter = end_counter;
-                last_cycle_count = end_cycle_count;
             }
         }
         else